@@ -1043,6 +1043,99 @@ void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
     qemu_spin_unlock(&env_tlb(env)->c.lock);
 }
 
+#ifdef XBOX
+/* Returns the page @te maps, if that is host RAM overlapping the range */
+static bool tlb_entry_maps_host_range(const CPUTLBEntry *te, uintptr_t start,
+                                      uintptr_t length, target_ulong *page)
+{
+    target_ulong addr = te->addr_read;
+
+    if (addr == -1) {
+        addr = te->addr_write;
+    }
+    if (addr == -1) {
+        addr = te->addr_code;
+    }
+    if (addr == -1 || (addr & TLB_MMIO)) {
+        return false;
+    }
+
+    *page = addr & TARGET_PAGE_MASK;
+    uintptr_t host = *page + te->addend;
+    return host < start + length && start < host + TARGET_PAGE_SIZE;
+}
+
+/* Called with tlb_c.lock held */
+static void tlb_flush_host_range_locked(CPUArchState *env, int midx,
+                                        uintptr_t start, uintptr_t length)
+{
+    CPUTLBDesc *d = &env_tlb(env)->d[midx];
+    CPUTLBDescFast *f = &env_tlb(env)->f[midx];
+    unsigned int n = tlb_n_entries(f);
+    target_ulong page;
+
+    /*
+     * There's no reverse map from host to guest virtual pages, so find the
+     * pages through the entries mapping them, victim TLB included.
+     */
+    for (unsigned int i = 0; i < n + CPU_VTLB_SIZE; i++) {
+        CPUTLBEntry *te = i < n ? &f->table[i] : &d->vtable[i - n];
+        if (!tlb_entry_maps_host_range(te, start, length, &page)) {
+            continue;
+        }
+        bool large = (page & d->large_page_mask) == d->large_page_addr;
+        tlb_flush_page_locked(env, midx, page);
+        if (large) {
+            /* That flushed the whole mmu_idx and may have resized the table */
+            return;
+        }
+    }
+}
+
+static void tlb_flush_host_range_async_0(CPUState *cpu, uintptr_t start,
+                                         uintptr_t length)
+{
+    CPUArchState *env = cpu->env_ptr;
+    int mmu_idx;
+
+    assert_cpu_is_self(cpu);
+
+    qemu_spin_lock(&env_tlb(env)->c.lock);
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        tlb_flush_host_range_locked(env, mmu_idx, start, length);
+    }
+    qemu_spin_unlock(&env_tlb(env)->c.lock);
+}
+
+typedef struct {
+    uintptr_t start;
+    uintptr_t length;
+} TLBFlushHostRangeData;
+
+static void tlb_flush_host_range_async_1(CPUState *cpu, run_on_cpu_data data)
+{
+    TLBFlushHostRangeData *d = data.host_ptr;
+
+    tlb_flush_host_range_async_0(cpu, d->start, d->length);
+    g_free(d);
+}
+
+void tlb_flush_host_range(CPUState *cpu, void *host, size_t length)
+{
+    if (qemu_cpu_is_self(cpu)) {
+        tlb_flush_host_range_async_0(cpu, (uintptr_t)host, length);
+    } else {
+        TLBFlushHostRangeData *d = g_new(TLBFlushHostRangeData, 1);
+
+        /* Allocate a structure, freed by the worker.  */
+        d->start = (uintptr_t)host;
+        d->length = length;
+        async_run_on_cpu(cpu, tlb_flush_host_range_async_1,
+                         RUN_ON_CPU_HOST_PTR(d));
+    }
+}
+#endif
+
 /* Called with tlb_c.lock held */
 static inline void tlb_set_dirty1_locked(CPUTLBEntry *tlb_entry,
                                          target_ulong vaddr)
@@ -993,3 +993,17 @@ SRST
   ``info virtio-queue-element`` *path* *queue* [*index*]
     Display element of a given virtio queue
 ERST
+
+    {
+        .name       = "nv2a-profile",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show NV2A PGRAPH timing for the last frame as JSON",
+        .cmd_info_hrt = qmp_x_query_nv2a_profile,
+    },
+
+SRST
+  ``info nv2a-profile``
+    Show where the NV2A PGRAPH puller spent its time over the last frame, as
+    JSON. Turn timing on first with ``nv2a-profile on``.
+ERST
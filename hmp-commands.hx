@@ -633,6 +633,19 @@ SRST
   whether profiling is on or off.
 ERST
 
+    {
+        .name       = "nv2a-profile",
+        .args_type  = "enable:b",
+        .params     = "on|off",
+        .help       = "turn NV2A PGRAPH timing on or off",
+        .cmd        = hmp_nv2a_profile,
+    },
+
+SRST
+``nv2a-profile on|off``
+  Turn NV2A PGRAPH timing on or off. See ``info nv2a-profile``.
+ERST
+
     {
         .name       = "system_reset",
         .args_type  = "",
@@ -0,0 +1,250 @@
+/*
+ * MCPX APU decoded ADPCM block cache
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+#include "qemu/xxhash.h"
+#include "cpu.h"
+#include "exec/ramlist.h"
+#include "hw/xbox/nv2a/lru.h"
+#include "adpcm.h"
+#include "adpcm_cache.h"
+
+/* About 5 seconds of mono audio at 48 kHz */
+#define ADPCM_CACHE_ENTRIES 4096
+
+/*
+ * A guest page backing at least one cached block. Its generation is bumped
+ * whenever the page was written, which makes the blocks on it stale.
+ */
+typedef struct ADPCMCachePage {
+    hwaddr addr;
+    uint32_t gen;
+    unsigned int refs;
+} ADPCMCachePage;
+
+typedef struct ADPCMCacheKey {
+    hwaddr addr;
+    uint32_t size;
+    uint32_t channels;
+} ADPCMCacheKey;
+
+typedef struct ADPCMCacheEntry {
+    LruNode node;
+    ADPCMCacheKey key;
+    /* A block may straddle two pages */
+    ADPCMCachePage *pages[2];
+    uint32_t gens[2];
+    /* Lookups copying or decoding outside the lock, which pin the entry */
+    unsigned int users;
+    bool decoded;
+    int num_samples;
+    int16_t samples[ADPCM_CACHE_MAX_SAMPLES];
+} ADPCMCacheEntry;
+
+struct ADPCMCache {
+    QemuMutex lock;
+    MemoryRegion *ram;
+    uint8_t *ram_ptr;
+    GHashTable *pages;
+    ADPCMCacheEntry *entries;
+    Lru lru;
+};
+
+static ADPCMCachePage *adpcm_cache_page_get(ADPCMCache *cache, hwaddr addr)
+{
+    ADPCMCachePage *page = g_hash_table_lookup(cache->pages, &addr);
+
+    if (!page) {
+        page = g_new0(ADPCMCachePage, 1);
+        page->addr = addr;
+        /* Whatever was written before doesn't matter, the block is read next */
+        memory_region_test_and_clear_dirty(cache->ram, addr, TARGET_PAGE_SIZE,
+                                           DIRTY_MEMORY_MCPX);
+        g_hash_table_insert(cache->pages, &page->addr, page);
+    }
+    page->refs++;
+
+    return page;
+}
+
+static void adpcm_cache_page_put(ADPCMCache *cache, ADPCMCachePage *page)
+{
+    assert(page->refs > 0);
+    if (--page->refs == 0) {
+        g_hash_table_remove(cache->pages, &page->addr);
+    }
+}
+
+static void adpcm_cache_entry_init(Lru *lru, LruNode *node, void *key)
+{
+    ADPCMCache *cache = container_of(lru, ADPCMCache, lru);
+    ADPCMCacheEntry *entry = container_of(node, ADPCMCacheEntry, node);
+    ADPCMCacheKey *k = key;
+
+    entry->key = *k;
+    entry->pages[0] =
+        adpcm_cache_page_get(cache, k->addr & TARGET_PAGE_MASK);
+    hwaddr last = (k->addr + k->size - 1) & TARGET_PAGE_MASK;
+    entry->pages[1] = last != entry->pages[0]->addr ?
+                      adpcm_cache_page_get(cache, last) : NULL;
+    entry->decoded = false;
+}
+
+static bool adpcm_cache_entry_pre_evict(Lru *lru, LruNode *node)
+{
+    ADPCMCacheEntry *entry = container_of(node, ADPCMCacheEntry, node);
+    return entry->users == 0;
+}
+
+static void adpcm_cache_entry_post_evict(Lru *lru, LruNode *node)
+{
+    ADPCMCache *cache = container_of(lru, ADPCMCache, lru);
+    ADPCMCacheEntry *entry = container_of(node, ADPCMCacheEntry, node);
+
+    for (int i = 0; i < ARRAY_SIZE(entry->pages); i++) {
+        if (entry->pages[i]) {
+            adpcm_cache_page_put(cache, entry->pages[i]);
+            entry->pages[i] = NULL;
+        }
+    }
+}
+
+static bool adpcm_cache_entry_compare(Lru *lru, LruNode *node, void *key)
+{
+    ADPCMCacheEntry *entry = container_of(node, ADPCMCacheEntry, node);
+    return memcmp(&entry->key, key, sizeof(ADPCMCacheKey));
+}
+
+static bool adpcm_cache_entry_is_current(ADPCMCacheEntry *entry)
+{
+    if (!entry->decoded) {
+        return false;
+    }
+    for (int i = 0; i < ARRAY_SIZE(entry->pages); i++) {
+        if (entry->pages[i] && entry->pages[i]->gen != entry->gens[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+ADPCMCache *adpcm_cache_new(MemoryRegion *ram)
+{
+    ADPCMCache *cache = g_new0(ADPCMCache, 1);
+
+    qemu_mutex_init(&cache->lock);
+    cache->ram = ram;
+    cache->ram_ptr = memory_region_get_ram_ptr(ram);
+    cache->pages = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL,
+                                         g_free);
+
+    lru_init(&cache->lru);
+    cache->entries = g_new0(ADPCMCacheEntry, ADPCM_CACHE_ENTRIES);
+    for (int i = 0; i < ADPCM_CACHE_ENTRIES; i++) {
+        lru_add_free(&cache->lru, &cache->entries[i].node);
+    }
+    cache->lru.init_node = adpcm_cache_entry_init;
+    cache->lru.compare_nodes = adpcm_cache_entry_compare;
+    cache->lru.pre_node_evict = adpcm_cache_entry_pre_evict;
+    cache->lru.post_node_evict = adpcm_cache_entry_post_evict;
+
+    return cache;
+}
+
+void adpcm_cache_free(ADPCMCache *cache)
+{
+    adpcm_cache_flush(cache);
+    assert(g_hash_table_size(cache->pages) == 0);
+    g_hash_table_destroy(cache->pages);
+    g_free(cache->entries);
+    qemu_mutex_destroy(&cache->lock);
+    g_free(cache);
+}
+
+void adpcm_cache_flush(ADPCMCache *cache)
+{
+    qemu_mutex_lock(&cache->lock);
+    lru_flush(&cache->lru);
+    qemu_mutex_unlock(&cache->lock);
+}
+
+void adpcm_cache_sync(ADPCMCache *cache)
+{
+    GHashTableIter iter;
+    ADPCMCachePage *page;
+
+    qemu_mutex_lock(&cache->lock);
+    g_hash_table_iter_init(&iter, cache->pages);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&page)) {
+        if (memory_region_test_and_clear_dirty(cache->ram, page->addr,
+                                               TARGET_PAGE_SIZE,
+                                               DIRTY_MEMORY_MCPX)) {
+            page->gen++;
+        }
+    }
+    qemu_mutex_unlock(&cache->lock);
+}
+
+void adpcm_cache_decode(ADPCMCache *cache, hwaddr addr, size_t size,
+                        unsigned int channels, int16_t *out)
+{
+    ADPCMCacheKey key = {
+        .addr = addr,
+        .size = size,
+        .channels = channels,
+    };
+    uint64_t hash = qemu_xxhash4(addr, (uint64_t)size << 32 | channels);
+
+    assert(size <= ADPCM_CACHE_MAX_BLOCK_SIZE);
+    assert(addr + size <= memory_region_size(cache->ram));
+
+    qemu_mutex_lock(&cache->lock);
+    LruNode *node = lru_lookup(&cache->lru, hash, &key);
+    ADPCMCacheEntry *entry = container_of(node, ADPCMCacheEntry, node);
+    bool current = adpcm_cache_entry_is_current(entry);
+    uint32_t gens[2] = { 0, 0 };
+    if (!current) {
+        /* Take the generations before reading, so later writes invalidate */
+        for (int i = 0; i < ARRAY_SIZE(entry->pages); i++) {
+            if (entry->pages[i]) {
+                gens[i] = entry->pages[i]->gen;
+            }
+        }
+    }
+    entry->users++;
+    qemu_mutex_unlock(&cache->lock);
+
+    int num_samples = entry->num_samples;
+    if (current) {
+        memcpy(out, entry->samples, num_samples * channels * sizeof(int16_t));
+    } else {
+        num_samples = adpcm_decode_block(out, &cache->ram_ptr[addr], size,
+                                         channels);
+    }
+
+    qemu_mutex_lock(&cache->lock);
+    /* Only publish while nobody else may be copying the samples */
+    if (!current && entry->users == 1) {
+        memcpy(entry->samples, out, num_samples * channels * sizeof(int16_t));
+        memcpy(entry->gens, gens, sizeof(gens));
+        entry->num_samples = num_samples;
+        entry->decoded = true;
+    }
+    entry->users--;
+    qemu_mutex_unlock(&cache->lock);
+}
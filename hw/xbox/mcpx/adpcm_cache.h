@@ -0,0 +1,61 @@
+/*
+ * MCPX APU decoded ADPCM block cache
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HW_XBOX_MCPX_ADPCM_CACHE_H
+#define HW_XBOX_MCPX_ADPCM_CACHE_H
+
+#include "exec/memory.h"
+
+/* Largest block the voice processor decodes, 65 samples of 2 channels */
+#define ADPCM_CACHE_MAX_BLOCK_SIZE (36 * 2)
+#define ADPCM_CACHE_MAX_SAMPLES (65 * 2)
+
+typedef struct ADPCMCache ADPCMCache;
+
+/*
+ * Blocks are decoded straight from guest RAM in @ram, which must have
+ * DIRTY_MEMORY_MCPX logging enabled so that writes to a cached block are
+ * seen by adpcm_cache_sync.
+ */
+ADPCMCache *adpcm_cache_new(MemoryRegion *ram);
+void adpcm_cache_free(ADPCMCache *cache);
+
+/* Drops every decoded block, for when RAM changes without being logged */
+void adpcm_cache_flush(ADPCMCache *cache);
+
+/*
+ * Marks blocks on pages written since the last call as stale, they're
+ * decoded again the next time they're used. Called once per frame.
+ */
+void adpcm_cache_sync(ADPCMCache *cache);
+
+/**
+ * adpcm_cache_decode:
+ * @cache: the cache
+ * @addr: RAM offset of the block, the whole block must lie in RAM
+ * @size: block size in bytes, at most ADPCM_CACHE_MAX_BLOCK_SIZE
+ * @channels: number of interleaved channels in the block
+ * @out: destination for up to ADPCM_CACHE_MAX_SAMPLES decoded samples
+ *
+ * Copies the decoded block to @out, decoding it only if it isn't cached
+ * or its memory was written since. Safe to call from several threads, the
+ * cache lock is only held for the lookup, not while decoding or copying.
+ */
+void adpcm_cache_decode(ADPCMCache *cache, hwaddr addr, size_t size,
+                        unsigned int channels, int16_t *out);
+
+#endif
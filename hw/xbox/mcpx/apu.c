@@ -41,8 +41,11 @@
 #include "apu_regs.h"
 #include "apu_debug.h"
 #include "adpcm.h"
+#include "adpcm_cache.h"
 #include "svf.h"
 #include "fpconv.h"
+#include "pcm.h"
+#include "mix.h"
 
 #define GET_MASK(v, mask) (((v) & (mask)) >> ctz32(mask))
 
@@ -78,13 +81,50 @@ typedef struct MCPXAPUVPSSLData {
     int ssl_seg;
 } MCPXAPUVPSSLData;
 
+/*
+ * Copy of a voice's descriptor, taken once per frame while the voice is
+ * processed. Only words that were changed are written back to guest memory.
+ */
+typedef struct MCPXAPUVoiceDesc {
+    uint16_t v;
+    hwaddr addr;
+    uint32_t regs[NV_PAVS_SIZE / 4];
+    uint32_t dirty; // Bit per word of regs
+} MCPXAPUVoiceDesc;
+
 typedef struct MCPXAPUVoiceFilter {
     uint16_t voice;
+    MCPXAPUVoiceDesc *desc; // Voice being processed, for the resampler
     float resample_buf[NUM_SAMPLES_PER_FRAME * 2];
     SRC_STATE *resampler;
     sv_filter svf[2];
 } MCPXAPUVoiceFilter;
 
+/* Active voices are handed out to the voice pool this many at a time */
+#define MCPX_VP_POOL_CHUNK_VOICES 8
+#define MCPX_VP_POOL_MAX_VOICES (3 * MCPX_HW_MAX_VOICES)
+#define MCPX_VP_POOL_MAX_CHUNKS \
+    (MCPX_VP_POOL_MAX_VOICES / MCPX_VP_POOL_CHUNK_VOICES)
+
+typedef struct MCPXAPUVoicePool {
+    QemuMutex lock;
+    QemuCond work_cond;
+    QemuCond done_cond;
+    QemuThread *threads;
+    int num_threads;
+    bool shutdown;
+    bool dispatch; // Workers may take chunks of the current frame
+
+    /* Active voices queued by the list walk, in voice list order */
+    uint16_t voices[MCPX_VP_POOL_MAX_VOICES];
+    bool pending[MCPX_VP_POOL_MAX_VOICES]; // Locked since, left to the APU
+    int num_voices;
+    int num_chunks;
+    int next_chunk;
+    int chunks_done;
+    float mixbins[MCPX_VP_POOL_MAX_CHUNKS][NUM_MIXBINS][NUM_SAMPLES_PER_FRAME];
+} MCPXAPUVoicePool;
+
 typedef struct MCPXAPUState {
     PCIDevice dev;
     bool exiting;
@@ -118,6 +158,8 @@ typedef struct MCPXAPUState {
         float sample_buf[NUM_SAMPLES_PER_FRAME][2];
         uint64_t voice_locked[4];
         QemuSpin voice_spinlocks[MCPX_HW_MAX_VOICES];
+        MCPXAPUVoicePool pool;
+        ADPCMCache *adpcm_cache;
     } vp;
 
     /* Global Processor */
@@ -149,6 +191,14 @@ typedef struct MCPXAPUState {
     int16_t apu_fifo_output[256][2]; // 1 EP frame (0x400 bytes), 8 buffered
 } MCPXAPUState;
 
+static const struct {
+    hwaddr top, current, next;
+} voice_list_regs[] = {
+    {NV_PAPU_TVL2D, NV_PAPU_CVL2D, NV_PAPU_NVL2D}, //2D
+    {NV_PAPU_TVL3D, NV_PAPU_CVL3D, NV_PAPU_NVL3D}, //3D
+    {NV_PAPU_TVLMP, NV_PAPU_CVLMP, NV_PAPU_NVLMP}, //MP
+};
+
 static MCPXAPUState *g_state; // Used via debug handlers
 static struct McpxApuDebug g_dbg, g_dbg_cache;
 static int g_dbg_voice_monitor = -1;
@@ -156,7 +206,6 @@ static uint64_t g_dbg_muted_voices[4];
 static const int16_t ep_silence[256][2] = { 0 };
 
 static float clampf(float v, float min, float max);
-static float attenuate(uint16_t vol);
 
 static void mcpx_debug_begin_frame(void);
 static void mcpx_debug_end_frame(void);
@@ -165,10 +214,18 @@ static uint32_t voice_get_mask(MCPXAPUState *d, uint16_t voice_handle,
                                hwaddr offset, uint32_t mask);
 static void voice_set_mask(MCPXAPUState *d, uint16_t voice_handle,
                            hwaddr offset, uint32_t mask, uint32_t val);
+static void voice_desc_load(MCPXAPUState *d, MCPXAPUVoiceDesc *vd,
+                            uint16_t v);
+static void voice_desc_store(MCPXAPUState *d, MCPXAPUVoiceDesc *vd);
+static uint32_t voice_desc_get_mask(MCPXAPUVoiceDesc *vd, hwaddr offset,
+                                    uint32_t mask);
+static void voice_desc_set_mask(MCPXAPUVoiceDesc *vd, hwaddr offset,
+                                uint32_t mask, uint32_t val);
 static uint64_t mcpx_apu_read(void *opaque, hwaddr addr, unsigned int size);
 static void mcpx_apu_write(void *opaque, hwaddr addr, uint64_t val,
                            unsigned int size);
 static void voice_off(MCPXAPUState *d, uint16_t v);
+static void voice_desc_off(MCPXAPUState *d, MCPXAPUVoiceDesc *vd);
 static void voice_lock(MCPXAPUState *d, uint16_t v, bool lock);
 static bool is_voice_locked(MCPXAPUState *d, uint16_t v);
 static void fe_method(MCPXAPUState *d, uint32_t method, uint32_t argument);
@@ -198,24 +255,42 @@ static void gp_write(void *opaque, hwaddr addr, uint64_t val,
 static uint64_t ep_read(void *opaque, hwaddr addr, unsigned int size);
 static void ep_write(void *opaque, hwaddr addr, uint64_t val,
                      unsigned int size);
-static float voice_step_envelope(MCPXAPUState *d, uint16_t v,
+static float voice_step_envelope(MCPXAPUState *d, MCPXAPUVoiceDesc *vd,
                                  uint32_t reg_0, uint32_t reg_a,
                                  uint32_t rr_reg, uint32_t rr_mask,
                                  uint32_t lvl_reg, uint32_t lvl_mask,
                                  uint32_t count_mask, uint32_t cur_mask);
 static hwaddr get_data_ptr(hwaddr sge_base, unsigned int max_sge,
                            uint32_t addr);
+static const uint8_t *voice_fetch(MCPXAPUState *d, bool stream, hwaddr base,
+                                  uint32_t linear_addr, uint8_t *buf,
+                                  size_t len);
+static void voice_decode_adpcm_block(MCPXAPUState *d, bool stream,
+                                     hwaddr base, uint32_t linear_addr,
+                                     size_t block_size, unsigned int channels,
+                                     int16_t *out);
 static void set_notify_status(MCPXAPUState *d, uint32_t v, int notifier,
                               int status);
 static long voice_resample_callback(void *cb_data, float **data);
-static int voice_resample(MCPXAPUState *d, uint16_t v, float samples[][2],
-                          int requested_num, float rate);
+static int voice_resample(MCPXAPUState *d, MCPXAPUVoiceDesc *vd,
+                          float samples[][2], int requested_num, float rate);
 static void voice_reset_filters(MCPXAPUState *d, uint16_t v);
 static void voice_process(MCPXAPUState *d,
                           float mixbins[NUM_MIXBINS][NUM_SAMPLES_PER_FRAME],
-                          uint16_t v);
-static int voice_get_samples(MCPXAPUState *d, uint32_t v, float samples[][2],
-                             int num_samples_requested);
+                          MCPXAPUVoiceDesc *vd);
+static int voice_get_samples(MCPXAPUState *d, MCPXAPUVoiceDesc *vd,
+                             float samples[][2], int num_samples_requested);
+static void voice_wait_and_process(
+    MCPXAPUState *d, float mixbins[NUM_MIXBINS][NUM_SAMPLES_PER_FRAME],
+    uint16_t v);
+static void voice_process_chunk(MCPXAPUState *d, int chunk);
+static void voice_pool_work(MCPXAPUState *d);
+static void *voice_pool_thread(void *arg);
+static void voice_pool_init(MCPXAPUState *d);
+static void voice_pool_destroy(MCPXAPUState *d);
+static bool voice_pool_run(MCPXAPUState *d,
+                           float mixbins[NUM_MIXBINS][NUM_SAMPLES_PER_FRAME],
+                           hwaddr current, hwaddr next);
 static void se_frame(MCPXAPUState *d);
 static void update_irq(MCPXAPUState *d);
 static void sleep_ns(int64_t ns);
@@ -329,12 +404,6 @@ static float clampf(float v, float min, float max)
     }
 }
 
-static float attenuate(uint16_t vol)
-{
-    vol &= 0xFFF;
-    return (vol == 0xFFF) ? 0.0 : powf(10.0f, vol/(64.0 * -20.0f));
-}
-
 static uint32_t voice_get_mask(MCPXAPUState *d, uint16_t voice_handle,
                                hwaddr offset, uint32_t mask)
 {
@@ -348,9 +417,59 @@ static void voice_set_mask(MCPXAPUState *d, uint16_t voice_handle,
 {
     hwaddr voice = d->regs[NV_PAPU_VPVADDR]
                     + voice_handle * NV_PAVS_SIZE;
+
+    /* Don't land in the middle of the voice being processed */
+    assert(voice_handle < MCPX_HW_MAX_VOICES);
+    qemu_spin_lock(&d->vp.voice_spinlocks[voice_handle]);
     uint32_t v = ldl_le_phys(&address_space_memory, voice + offset) & ~mask;
     stl_le_phys(&address_space_memory, voice + offset,
                 v | ((val << ctz32(mask)) & mask));
+    qemu_spin_unlock(&d->vp.voice_spinlocks[voice_handle]);
+}
+
+static void voice_desc_load(MCPXAPUState *d, MCPXAPUVoiceDesc *vd, uint16_t v)
+{
+    vd->v = v;
+    vd->addr = d->regs[NV_PAPU_VPVADDR] + v * NV_PAVS_SIZE;
+    vd->dirty = 0;
+    address_space_read(&address_space_memory, vd->addr,
+                       MEMTXATTRS_UNSPECIFIED, vd->regs, sizeof(vd->regs));
+    for (int i = 0; i < ARRAY_SIZE(vd->regs); i++) {
+        vd->regs[i] = le32_to_cpu(vd->regs[i]);
+    }
+}
+
+static void voice_desc_store(MCPXAPUState *d, MCPXAPUVoiceDesc *vd)
+{
+    while (vd->dirty) {
+        /* Write each run of changed words in one go */
+        int first = ctz32(vd->dirty);
+        int n = cto32(vd->dirty >> first);
+        uint32_t buf[ARRAY_SIZE(vd->regs)];
+        for (int i = 0; i < n; i++) {
+            buf[i] = cpu_to_le32(vd->regs[first + i]);
+        }
+        address_space_write(&address_space_memory, vd->addr + first * 4,
+                            MEMTXATTRS_UNSPECIFIED, buf, n * 4);
+        vd->dirty &= ~(MAKE_64BIT_MASK(first, n));
+    }
+}
+
+static uint32_t voice_desc_get_mask(MCPXAPUVoiceDesc *vd, hwaddr offset,
+                                    uint32_t mask)
+{
+    return (vd->regs[offset / 4] & mask) >> ctz32(mask);
+}
+
+static void voice_desc_set_mask(MCPXAPUVoiceDesc *vd, hwaddr offset,
+                                uint32_t mask, uint32_t val)
+{
+    uint32_t old = vd->regs[offset / 4];
+    uint32_t new = (old & ~mask) | ((val << ctz32(mask)) & mask);
+    if (new != old) {
+        vd->regs[offset / 4] = new;
+        vd->dirty |= 1u << (offset / 4);
+    }
 }
 
 static void update_irq(MCPXAPUState *d)
@@ -435,11 +554,25 @@ static const MemoryRegionOps mcpx_apu_mmio_ops = {
 
 static void voice_off(MCPXAPUState *d, uint16_t v)
 {
-    voice_set_mask(d, v, NV_PAVS_VOICE_PAR_STATE,
-                   NV_PAVS_VOICE_PAR_STATE_ACTIVE_VOICE, 0);
+    MCPXAPUVoiceDesc vd;
 
-    bool stream = voice_get_mask(d, v, NV_PAVS_VOICE_CFG_FMT,
-                                 NV_PAVS_VOICE_CFG_FMT_DATA_TYPE);
+    assert(v < MCPX_HW_MAX_VOICES);
+    qemu_spin_lock(&d->vp.voice_spinlocks[v]);
+    voice_desc_load(d, &vd, v);
+    voice_desc_off(d, &vd);
+    voice_desc_store(d, &vd);
+    qemu_spin_unlock(&d->vp.voice_spinlocks[v]);
+}
+
+static void voice_desc_off(MCPXAPUState *d, MCPXAPUVoiceDesc *vd)
+{
+    uint16_t v = vd->v;
+
+    voice_desc_set_mask(vd, NV_PAVS_VOICE_PAR_STATE,
+                        NV_PAVS_VOICE_PAR_STATE_ACTIVE_VOICE, 0);
+
+    bool stream = voice_desc_get_mask(vd, NV_PAVS_VOICE_CFG_FMT,
+                                      NV_PAVS_VOICE_CFG_FMT_DATA_TYPE);
     int notifier = MCPX_HW_NOTIFIER_SSLA_DONE;
     if (stream) {
         assert(v < MCPX_HW_MAX_VOICES);
@@ -1324,37 +1457,114 @@ static hwaddr get_data_ptr(hwaddr sge_base, unsigned int max_sge, uint32_t addr)
     return prd_address + addr % TARGET_PAGE_SIZE;
 }
 
-static float voice_step_envelope(MCPXAPUState *d, uint16_t v, uint32_t reg_0,
-                           uint32_t reg_a, uint32_t rr_reg, uint32_t rr_mask,
-                           uint32_t lvl_reg, uint32_t lvl_mask,
-                           uint32_t count_mask, uint32_t cur_mask)
+/*
+ * Fetches @len bytes of voice data at @linear_addr. Stream segments are
+ * physically contiguous from @base, buffer voices are scattered over the
+ * pages of the SGE table at @base, which is looked up once per page.
+ *
+ * Returns a pointer straight into guest RAM when the data is contiguous
+ * there, otherwise the data is copied into @buf and @buf is returned.
+ */
+static const uint8_t *voice_fetch(MCPXAPUState *d, bool stream, hwaddr base,
+                                  uint32_t linear_addr, uint8_t *buf,
+                                  size_t len)
+{
+    hwaddr ram_size = memory_region_size(d->ram);
+    size_t done = 0;
+
+    while (done < len) {
+        hwaddr addr;
+        size_t run;
+        uint32_t offset = linear_addr + done;
+        if (stream) {
+            addr = base + offset;
+            run = len - done;
+        } else {
+            addr = get_data_ptr(base, 0xFFFFFFFF, offset);
+            run = MIN(len - done, TARGET_PAGE_SIZE - offset % TARGET_PAGE_SIZE);
+        }
+
+        bool in_ram = addr < ram_size && run <= ram_size - addr;
+        if (in_ram && run == len) {
+            return &d->ram_ptr[addr];
+        }
+        if (in_ram) {
+            memcpy(&buf[done], &d->ram_ptr[addr], run);
+        } else {
+            address_space_read(&address_space_memory, addr,
+                               MEMTXATTRS_UNSPECIFIED, &buf[done], run);
+        }
+        done += run;
+    }
+
+    return buf;
+}
+
+/*
+ * Decodes the ADPCM block at @linear_addr into @out. Blocks that lie
+ * contiguously in RAM go through the decoded block cache.
+ */
+static void voice_decode_adpcm_block(MCPXAPUState *d, bool stream,
+                                     hwaddr base, uint32_t linear_addr,
+                                     size_t block_size, unsigned int channels,
+                                     int16_t *out)
+{
+    hwaddr ram_size = memory_region_size(d->ram);
+    hwaddr addr = HWADDR_MAX;
+
+    if (stream) {
+        addr = base + linear_addr;
+    } else if (linear_addr % TARGET_PAGE_SIZE + block_size <=
+               TARGET_PAGE_SIZE) {
+        addr = get_data_ptr(base, 0xFFFFFFFF, linear_addr);
+    }
+
+    if (addr < ram_size && block_size <= ram_size - addr) {
+        adpcm_cache_decode(d->vp.adpcm_cache, addr, block_size, channels,
+                           out);
+        return;
+    }
+
+    uint8_t buf[ADPCM_CACHE_MAX_BLOCK_SIZE];
+    assert(block_size <= sizeof(buf));
+    const uint8_t *block =
+        voice_fetch(d, stream, base, linear_addr, buf, block_size);
+    adpcm_decode_block(out, block, block_size, channels);
+}
+
+static float voice_step_envelope(MCPXAPUState *d, MCPXAPUVoiceDesc *vd,
+                                 uint32_t reg_0, uint32_t reg_a,
+                                 uint32_t rr_reg, uint32_t rr_mask,
+                                 uint32_t lvl_reg, uint32_t lvl_mask,
+                                 uint32_t count_mask, uint32_t cur_mask)
 {
-    uint8_t cur = voice_get_mask(d, v, NV_PAVS_VOICE_PAR_STATE, cur_mask);
+    uint8_t cur = voice_desc_get_mask(vd, NV_PAVS_VOICE_PAR_STATE, cur_mask);
     switch (cur) {
     case NV_PAVS_VOICE_PAR_STATE_EFCUR_OFF:
-        voice_set_mask(d, v, NV_PAVS_VOICE_CUR_ECNT, count_mask, 0);
-        voice_set_mask(d, v, lvl_reg, lvl_mask, 0xFF);
+        voice_desc_set_mask(vd, NV_PAVS_VOICE_CUR_ECNT, count_mask, 0);
+        voice_desc_set_mask(vd, lvl_reg, lvl_mask, 0xFF);
         return 1.0f;
     case NV_PAVS_VOICE_PAR_STATE_EFCUR_DELAY: {
         uint16_t count =
-            voice_get_mask(d, v, NV_PAVS_VOICE_CUR_ECNT, count_mask);
-        voice_set_mask(d, v, lvl_reg, lvl_mask, 0x00); // FIXME: Confirm this?
+            voice_desc_get_mask(vd, NV_PAVS_VOICE_CUR_ECNT, count_mask);
+        // FIXME: Confirm this?
+        voice_desc_set_mask(vd, lvl_reg, lvl_mask, 0x00);
 
         if (count == 0) {
             cur++;
-            voice_set_mask(d, v, NV_PAVS_VOICE_PAR_STATE, cur_mask, cur);
+            voice_desc_set_mask(vd, NV_PAVS_VOICE_PAR_STATE, cur_mask, cur);
             count = 0;
         } else {
             count--;
         }
-        voice_set_mask(d, v, NV_PAVS_VOICE_CUR_ECNT, count_mask, count);
+        voice_desc_set_mask(vd, NV_PAVS_VOICE_CUR_ECNT, count_mask, count);
         return 0.0f;
     }
     case NV_PAVS_VOICE_PAR_STATE_EFCUR_ATTACK: {
         uint16_t count =
-            voice_get_mask(d, v, NV_PAVS_VOICE_CUR_ECNT, count_mask);
-        uint16_t attack_rate =
-            voice_get_mask(d, v, reg_0, NV_PAVS_VOICE_CFG_ENV0_EA_ATTACKRATE);
+            voice_desc_get_mask(vd, NV_PAVS_VOICE_CUR_ECNT, count_mask);
+        uint16_t attack_rate = voice_desc_get_mask(
+            vd, reg_0, NV_PAVS_VOICE_CFG_ENV0_EA_ATTACKRATE);
 
         float value;
         if (attack_rate == 0) {
@@ -1370,45 +1580,45 @@ static float voice_step_envelope(MCPXAPUState *d, uint16_t v, uint32_t reg_0,
                 value = 255.0f;
             }
         }
-        voice_set_mask(d, v, lvl_reg, lvl_mask, value);
+        voice_desc_set_mask(vd, lvl_reg, lvl_mask, value);
         // FIXME: Comparison could also be the other way around?! Test please.
         if (count == (attack_rate * 16)) {
             cur++;
-            voice_set_mask(d, v, NV_PAVS_VOICE_PAR_STATE, cur_mask, cur);
-            uint16_t hold_time =
-                voice_get_mask(d, v, reg_a, NV_PAVS_VOICE_CFG_ENVA_EA_HOLDTIME);
+            voice_desc_set_mask(vd, NV_PAVS_VOICE_PAR_STATE, cur_mask, cur);
+            uint16_t hold_time = voice_desc_get_mask(
+                vd, reg_a, NV_PAVS_VOICE_CFG_ENVA_EA_HOLDTIME);
             count = hold_time * 16; // FIXME: Skip next phase if count is 0?
                                     // [other instances too]
         } else {
             count++;
         }
-        voice_set_mask(d, v, NV_PAVS_VOICE_CUR_ECNT, count_mask, count);
+        voice_desc_set_mask(vd, NV_PAVS_VOICE_CUR_ECNT, count_mask, count);
         return value / 255.0f;
     }
     case NV_PAVS_VOICE_PAR_STATE_EFCUR_HOLD: {
         uint16_t count =
-            voice_get_mask(d, v, NV_PAVS_VOICE_CUR_ECNT, count_mask);
-        voice_set_mask(d, v, lvl_reg, lvl_mask, 0xFF);
+            voice_desc_get_mask(vd, NV_PAVS_VOICE_CUR_ECNT, count_mask);
+        voice_desc_set_mask(vd, lvl_reg, lvl_mask, 0xFF);
 
         if (count == 0) {
             cur++;
-            voice_set_mask(d, v, NV_PAVS_VOICE_PAR_STATE, cur_mask, cur);
-            uint16_t decay_rate = voice_get_mask(
-                d, v, reg_a, NV_PAVS_VOICE_CFG_ENVA_EA_DECAYRATE);
+            voice_desc_set_mask(vd, NV_PAVS_VOICE_PAR_STATE, cur_mask, cur);
+            uint16_t decay_rate = voice_desc_get_mask(
+                vd, reg_a, NV_PAVS_VOICE_CFG_ENVA_EA_DECAYRATE);
             count = decay_rate * 16;
         } else {
             count--;
         }
-        voice_set_mask(d, v, NV_PAVS_VOICE_CUR_ECNT, count_mask, count);
+        voice_desc_set_mask(vd, NV_PAVS_VOICE_CUR_ECNT, count_mask, count);
         return 1.0f;
     }
     case NV_PAVS_VOICE_PAR_STATE_EFCUR_DECAY: {
         uint16_t count =
-            voice_get_mask(d, v, NV_PAVS_VOICE_CUR_ECNT, count_mask);
+            voice_desc_get_mask(vd, NV_PAVS_VOICE_CUR_ECNT, count_mask);
         uint16_t decay_rate =
-            voice_get_mask(d, v, reg_a, NV_PAVS_VOICE_CFG_ENVA_EA_DECAYRATE);
-        uint8_t sustain_level =
-            voice_get_mask(d, v, reg_a, NV_PAVS_VOICE_CFG_ENVA_EA_SUSTAINLEVEL);
+            voice_desc_get_mask(vd, reg_a, NV_PAVS_VOICE_CFG_ENVA_EA_DECAYRATE);
+        uint8_t sustain_level = voice_desc_get_mask(
+            vd, reg_a, NV_PAVS_VOICE_CFG_ENVA_EA_SUSTAINLEVEL);
 
         // FIXME: Decay should return a value no less than sustain
         float value;
@@ -1423,27 +1633,27 @@ static float voice_step_envelope(MCPXAPUState *d, uint16_t v, uint32_t reg_0,
         if (value <= (sustain_level + 0.2f) || (value > 255.0f)) {
             // FIXME: Should we still update lvl?
             cur++;
-            voice_set_mask(d, v, NV_PAVS_VOICE_PAR_STATE, cur_mask, cur);
+            voice_desc_set_mask(vd, NV_PAVS_VOICE_PAR_STATE, cur_mask, cur);
         } else {
             count--;
-            voice_set_mask(d, v, NV_PAVS_VOICE_CUR_ECNT, count_mask, count);
-            voice_set_mask(d, v, lvl_reg, lvl_mask, value);
+            voice_desc_set_mask(vd, NV_PAVS_VOICE_CUR_ECNT, count_mask, count);
+            voice_desc_set_mask(vd, lvl_reg, lvl_mask, value);
         }
         return value / 255.0f;
     }
     case NV_PAVS_VOICE_PAR_STATE_EFCUR_SUSTAIN: {
-        uint8_t sustain_level =
-            voice_get_mask(d, v, reg_a, NV_PAVS_VOICE_CFG_ENVA_EA_SUSTAINLEVEL);
-        voice_set_mask(
-            d, v, NV_PAVS_VOICE_CUR_ECNT, count_mask,
+        uint8_t sustain_level = voice_desc_get_mask(
+            vd, reg_a, NV_PAVS_VOICE_CFG_ENVA_EA_SUSTAINLEVEL);
+        voice_desc_set_mask(
+            vd, NV_PAVS_VOICE_CUR_ECNT, count_mask,
             0x00); // FIXME: is this only set to 0 once or forced to zero?
-        voice_set_mask(d, v, lvl_reg, lvl_mask, sustain_level);
+        voice_desc_set_mask(vd, lvl_reg, lvl_mask, sustain_level);
         return sustain_level / 255.0f;
     }
     case NV_PAVS_VOICE_PAR_STATE_EFCUR_RELEASE: {
         uint16_t count =
-            voice_get_mask(d, v, NV_PAVS_VOICE_CUR_ECNT, count_mask);
-        uint16_t release_rate = voice_get_mask(d, v, rr_reg, rr_mask);
+            voice_desc_get_mask(vd, NV_PAVS_VOICE_CUR_ECNT, count_mask);
+        uint16_t release_rate = voice_desc_get_mask(vd, rr_reg, rr_mask);
 
         if (release_rate == 0) {
             count = 0;
@@ -1451,7 +1661,7 @@ static float voice_step_envelope(MCPXAPUState *d, uint16_t v, uint32_t reg_0,
 
         float value = 0;
         if (count == 0) {
-            voice_set_mask(d, v, NV_PAVS_VOICE_PAR_STATE, cur_mask, ++cur);
+            voice_desc_set_mask(vd, NV_PAVS_VOICE_PAR_STATE, cur_mask, ++cur);
         } else {
             // FIXME: Appears to be an exponential but unsure about actual
             // curve; performing standard decay of current level to T60 over the
@@ -1462,17 +1672,17 @@ static float voice_step_envelope(MCPXAPUState *d, uint16_t v, uint32_t reg_0,
             // permit simpler attenuation more efficiently and update level on
             // each round.
             float pos = clampf(1 - count / (release_rate * 16.0), 0, 1);
-            uint8_t lvl = voice_get_mask(d, v, lvl_reg, lvl_mask);
+            uint8_t lvl = voice_desc_get_mask(vd, lvl_reg, lvl_mask);
             value = powf(M_E, -6.91*pos)*lvl;
             count--; // FIXME: Should release count ascend or descend?
-            voice_set_mask(d, v, NV_PAVS_VOICE_CUR_ECNT, count_mask, count);
+            voice_desc_set_mask(vd, NV_PAVS_VOICE_CUR_ECNT, count_mask, count);
         }
 
         return value / 255.0f;
     }
     case NV_PAVS_VOICE_PAR_STATE_EFCUR_FORCE_RELEASE:
         if (count_mask == NV_PAVS_VOICE_CUR_ECNT_EACOUNT) {
-            voice_off(d, v);
+            voice_desc_off(d, vd);
         }
         return 0.0f;
     default:
@@ -1500,7 +1710,7 @@ static void set_notify_status(MCPXAPUState *d, uint32_t v, int notifier,
 
     qatomic_or(&d->regs[NV_PAPU_ISTS],
               NV_PAPU_ISTS_FEVINTSTS | NV_PAPU_ISTS_FENINTSTS);
-    d->set_irq = true;
+    qatomic_set(&d->set_irq, true);
 }
 
 static long voice_resample_callback(void *cb_data, float **data)
@@ -1509,16 +1719,18 @@ static long voice_resample_callback(void *cb_data, float **data)
     uint16_t v = filter->voice;
     assert(v < MCPX_HW_MAX_VOICES);
     MCPXAPUState *d = container_of(filter, MCPXAPUState, vp.filters[v]);
+    MCPXAPUVoiceDesc *vd = filter->desc;
+    assert(vd && vd->v == v);
 
     int sample_count = 0;
     while (sample_count < NUM_SAMPLES_PER_FRAME) {
-        int active = voice_get_mask(d, v, NV_PAVS_VOICE_PAR_STATE,
-                                    NV_PAVS_VOICE_PAR_STATE_ACTIVE_VOICE);
+        int active = voice_desc_get_mask(vd, NV_PAVS_VOICE_PAR_STATE,
+                                         NV_PAVS_VOICE_PAR_STATE_ACTIVE_VOICE);
         if (!active) {
             break;
         }
         int count = voice_get_samples(
-            d, v, (float(*)[2]) & filter->resample_buf[2 * sample_count],
+            d, vd, (float(*)[2]) & filter->resample_buf[2 * sample_count],
             NUM_SAMPLES_PER_FRAME - sample_count);
         if (count < 0) {
             break;
@@ -1537,9 +1749,10 @@ static long voice_resample_callback(void *cb_data, float **data)
     return sample_count;
 }
 
-static int voice_resample(MCPXAPUState *d, uint16_t v, float samples[][2],
-                          int requested_num, float rate)
+static int voice_resample(MCPXAPUState *d, MCPXAPUVoiceDesc *vd,
+                          float samples[][2], int requested_num, float rate)
 {
+    uint16_t v = vd->v;
     assert(v < MCPX_HW_MAX_VOICES);
     MCPXAPUVoiceFilter *filter = &d->vp.filters[v];
 
@@ -1561,8 +1774,10 @@ static int voice_resample(MCPXAPUState *d, uint16_t v, float samples[][2],
         }
     }
 
+    filter->desc = vd;
     int count = src_callback_read(filter->resampler, rate, requested_num,
                                   (float *)samples);
+    filter->desc = NULL;
     if (count == -1) {
         DPRINTF("resample error\n");
     }
@@ -1587,14 +1802,15 @@ static void voice_reset_filters(MCPXAPUState *d, uint16_t v)
 
 static void voice_process(MCPXAPUState *d,
                           float mixbins[NUM_MIXBINS][NUM_SAMPLES_PER_FRAME],
-                          uint16_t v)
+                          MCPXAPUVoiceDesc *vd)
 {
+    uint16_t v = vd->v;
     assert(v < MCPX_HW_MAX_VOICES);
-    bool stereo = voice_get_mask(d, v, NV_PAVS_VOICE_CFG_FMT,
-                                 NV_PAVS_VOICE_CFG_FMT_STEREO);
+    bool stereo = voice_desc_get_mask(vd, NV_PAVS_VOICE_CFG_FMT,
+                                      NV_PAVS_VOICE_CFG_FMT_STEREO);
     unsigned int channels = stereo ? 2 : 1;
-    bool paused = voice_get_mask(d, v, NV_PAVS_VOICE_PAR_STATE,
-                                 NV_PAVS_VOICE_PAR_STATE_PAUSED);
+    bool paused = voice_desc_get_mask(vd, NV_PAVS_VOICE_PAR_STATE,
+                                      NV_PAVS_VOICE_PAR_STATE_PAUSED);
 
     struct McpxApuDebugVoice *dbg = &g_dbg.vp.v[v];
     dbg->active = true;
@@ -1606,21 +1822,21 @@ static void voice_process(MCPXAPUState *d,
     }
 
     float ef_value = voice_step_envelope(
-        d, v, NV_PAVS_VOICE_CFG_ENV1, NV_PAVS_VOICE_CFG_ENVF,
+        d, vd, NV_PAVS_VOICE_CFG_ENV1, NV_PAVS_VOICE_CFG_ENVF,
         NV_PAVS_VOICE_CFG_MISC, NV_PAVS_VOICE_CFG_MISC_EF_RELEASERATE,
         NV_PAVS_VOICE_PAR_NEXT, NV_PAVS_VOICE_PAR_NEXT_EFLVL,
         NV_PAVS_VOICE_CUR_ECNT_EFCOUNT, NV_PAVS_VOICE_PAR_STATE_EFCUR);
     assert(ef_value >= 0.0f);
     assert(ef_value <= 1.0f);
-    int16_t p = voice_get_mask(d, v, NV_PAVS_VOICE_TAR_PITCH_LINK,
-                               NV_PAVS_VOICE_TAR_PITCH_LINK_PITCH);
-    int8_t ps = voice_get_mask(d, v, NV_PAVS_VOICE_CFG_ENV0,
-                               NV_PAVS_VOICE_CFG_ENV0_EF_PITCHSCALE);
+    int16_t p = voice_desc_get_mask(vd, NV_PAVS_VOICE_TAR_PITCH_LINK,
+                                    NV_PAVS_VOICE_TAR_PITCH_LINK_PITCH);
+    int8_t ps = voice_desc_get_mask(vd, NV_PAVS_VOICE_CFG_ENV0,
+                                    NV_PAVS_VOICE_CFG_ENV0_EF_PITCHSCALE);
     float rate = 1.0 / powf(2.0f, (p + ps * 32 * ef_value) / 4096.0f);
     dbg->rate = rate;
 
     float ea_value = voice_step_envelope(
-        d, v, NV_PAVS_VOICE_CFG_ENV0, NV_PAVS_VOICE_CFG_ENVA,
+        d, vd, NV_PAVS_VOICE_CFG_ENV0, NV_PAVS_VOICE_CFG_ENVA,
         NV_PAVS_VOICE_TAR_LFO_ENV, NV_PAVS_VOICE_TAR_LFO_ENV_EA_RELEASERATE,
         NV_PAVS_VOICE_PAR_OFFSET, NV_PAVS_VOICE_PAR_OFFSET_EALVL,
         NV_PAVS_VOICE_CUR_ECNT_EACOUNT, NV_PAVS_VOICE_PAR_STATE_EACUR);
@@ -1629,12 +1845,12 @@ static void voice_process(MCPXAPUState *d,
 
     float samples[NUM_SAMPLES_PER_FRAME][2] = { 0 };
     for (int sample_count = 0; sample_count < NUM_SAMPLES_PER_FRAME;) {
-        int active = voice_get_mask(d, v, NV_PAVS_VOICE_PAR_STATE,
-                                    NV_PAVS_VOICE_PAR_STATE_ACTIVE_VOICE);
+        int active = voice_desc_get_mask(vd, NV_PAVS_VOICE_PAR_STATE,
+                                         NV_PAVS_VOICE_PAR_STATE_ACTIVE_VOICE);
         if (!active) {
             return;
         }
-        int count = voice_resample(d, v, &samples[sample_count],
+        int count = voice_resample(d, vd, &samples[sample_count],
                                    NUM_SAMPLES_PER_FRAME - sample_count, rate);
         if (count < 0) {
             break;
@@ -1642,29 +1858,29 @@ static void voice_process(MCPXAPUState *d,
         sample_count += count;
     }
 
-    int active = voice_get_mask(d, v, NV_PAVS_VOICE_PAR_STATE,
-                                NV_PAVS_VOICE_PAR_STATE_ACTIVE_VOICE);
+    int active = voice_desc_get_mask(vd, NV_PAVS_VOICE_PAR_STATE,
+                                     NV_PAVS_VOICE_PAR_STATE_ACTIVE_VOICE);
     if (!active) {
         return;
     }
 
     int bin[8];
-    bin[0] = voice_get_mask(d, v, NV_PAVS_VOICE_CFG_VBIN,
-                            NV_PAVS_VOICE_CFG_VBIN_V0BIN);
-    bin[1] = voice_get_mask(d, v, NV_PAVS_VOICE_CFG_VBIN,
-                            NV_PAVS_VOICE_CFG_VBIN_V1BIN);
-    bin[2] = voice_get_mask(d, v, NV_PAVS_VOICE_CFG_VBIN,
-                            NV_PAVS_VOICE_CFG_VBIN_V2BIN);
-    bin[3] = voice_get_mask(d, v, NV_PAVS_VOICE_CFG_VBIN,
-                            NV_PAVS_VOICE_CFG_VBIN_V3BIN);
-    bin[4] = voice_get_mask(d, v, NV_PAVS_VOICE_CFG_VBIN,
-                            NV_PAVS_VOICE_CFG_VBIN_V4BIN);
-    bin[5] = voice_get_mask(d, v, NV_PAVS_VOICE_CFG_VBIN,
-                            NV_PAVS_VOICE_CFG_VBIN_V5BIN);
-    bin[6] = voice_get_mask(d, v, NV_PAVS_VOICE_CFG_FMT,
-                            NV_PAVS_VOICE_CFG_FMT_V6BIN);
-    bin[7] = voice_get_mask(d, v, NV_PAVS_VOICE_CFG_FMT,
-                            NV_PAVS_VOICE_CFG_FMT_V7BIN);
+    bin[0] = voice_desc_get_mask(vd, NV_PAVS_VOICE_CFG_VBIN,
+                                 NV_PAVS_VOICE_CFG_VBIN_V0BIN);
+    bin[1] = voice_desc_get_mask(vd, NV_PAVS_VOICE_CFG_VBIN,
+                                 NV_PAVS_VOICE_CFG_VBIN_V1BIN);
+    bin[2] = voice_desc_get_mask(vd, NV_PAVS_VOICE_CFG_VBIN,
+                                 NV_PAVS_VOICE_CFG_VBIN_V2BIN);
+    bin[3] = voice_desc_get_mask(vd, NV_PAVS_VOICE_CFG_VBIN,
+                                 NV_PAVS_VOICE_CFG_VBIN_V3BIN);
+    bin[4] = voice_desc_get_mask(vd, NV_PAVS_VOICE_CFG_VBIN,
+                                 NV_PAVS_VOICE_CFG_VBIN_V4BIN);
+    bin[5] = voice_desc_get_mask(vd, NV_PAVS_VOICE_CFG_VBIN,
+                                 NV_PAVS_VOICE_CFG_VBIN_V5BIN);
+    bin[6] = voice_desc_get_mask(vd, NV_PAVS_VOICE_CFG_FMT,
+                                 NV_PAVS_VOICE_CFG_FMT_V6BIN);
+    bin[7] = voice_desc_get_mask(vd, NV_PAVS_VOICE_CFG_FMT,
+                                 NV_PAVS_VOICE_CFG_FMT_V7BIN);
 
     if (v < 64) {
         bin[0] = d->vp.hrtf_submix[0];
@@ -1674,31 +1890,31 @@ static void voice_process(MCPXAPUState *d,
     }
 
     uint16_t vol[8];
-    vol[0] = voice_get_mask(d, v, NV_PAVS_VOICE_TAR_VOLA,
-                            NV_PAVS_VOICE_TAR_VOLA_VOLUME0);
-    vol[1] = voice_get_mask(d, v, NV_PAVS_VOICE_TAR_VOLA,
-                            NV_PAVS_VOICE_TAR_VOLA_VOLUME1);
-    vol[2] = voice_get_mask(d, v, NV_PAVS_VOICE_TAR_VOLB,
-                            NV_PAVS_VOICE_TAR_VOLB_VOLUME2);
-    vol[3] = voice_get_mask(d, v, NV_PAVS_VOICE_TAR_VOLB,
-                            NV_PAVS_VOICE_TAR_VOLB_VOLUME3);
-    vol[4] = voice_get_mask(d, v, NV_PAVS_VOICE_TAR_VOLC,
-                            NV_PAVS_VOICE_TAR_VOLC_VOLUME4);
-    vol[5] = voice_get_mask(d, v, NV_PAVS_VOICE_TAR_VOLC,
-                            NV_PAVS_VOICE_TAR_VOLC_VOLUME5);
-
-    vol[6] = voice_get_mask(d, v, NV_PAVS_VOICE_TAR_VOLC,
-                            NV_PAVS_VOICE_TAR_VOLC_VOLUME6_B11_8) << 8;
-    vol[6] |= voice_get_mask(d, v, NV_PAVS_VOICE_TAR_VOLB,
-                             NV_PAVS_VOICE_TAR_VOLB_VOLUME6_B7_4) << 4;
-    vol[6] |= voice_get_mask(d, v, NV_PAVS_VOICE_TAR_VOLA,
-                             NV_PAVS_VOICE_TAR_VOLA_VOLUME6_B3_0);
-    vol[7] = voice_get_mask(d, v, NV_PAVS_VOICE_TAR_VOLC,
-                            NV_PAVS_VOICE_TAR_VOLC_VOLUME7_B11_8) << 8;
-    vol[7] |= voice_get_mask(d, v, NV_PAVS_VOICE_TAR_VOLB,
-                             NV_PAVS_VOICE_TAR_VOLB_VOLUME7_B7_4) << 4;
-    vol[7] |= voice_get_mask(d, v, NV_PAVS_VOICE_TAR_VOLA,
-                             NV_PAVS_VOICE_TAR_VOLA_VOLUME7_B3_0);
+    vol[0] = voice_desc_get_mask(vd, NV_PAVS_VOICE_TAR_VOLA,
+                                 NV_PAVS_VOICE_TAR_VOLA_VOLUME0);
+    vol[1] = voice_desc_get_mask(vd, NV_PAVS_VOICE_TAR_VOLA,
+                                 NV_PAVS_VOICE_TAR_VOLA_VOLUME1);
+    vol[2] = voice_desc_get_mask(vd, NV_PAVS_VOICE_TAR_VOLB,
+                                 NV_PAVS_VOICE_TAR_VOLB_VOLUME2);
+    vol[3] = voice_desc_get_mask(vd, NV_PAVS_VOICE_TAR_VOLB,
+                                 NV_PAVS_VOICE_TAR_VOLB_VOLUME3);
+    vol[4] = voice_desc_get_mask(vd, NV_PAVS_VOICE_TAR_VOLC,
+                                 NV_PAVS_VOICE_TAR_VOLC_VOLUME4);
+    vol[5] = voice_desc_get_mask(vd, NV_PAVS_VOICE_TAR_VOLC,
+                                 NV_PAVS_VOICE_TAR_VOLC_VOLUME5);
+
+    vol[6] = voice_desc_get_mask(vd, NV_PAVS_VOICE_TAR_VOLC,
+                                 NV_PAVS_VOICE_TAR_VOLC_VOLUME6_B11_8) << 8;
+    vol[6] |= voice_desc_get_mask(vd, NV_PAVS_VOICE_TAR_VOLB,
+                                  NV_PAVS_VOICE_TAR_VOLB_VOLUME6_B7_4) << 4;
+    vol[6] |= voice_desc_get_mask(vd, NV_PAVS_VOICE_TAR_VOLA,
+                                  NV_PAVS_VOICE_TAR_VOLA_VOLUME6_B3_0);
+    vol[7] = voice_desc_get_mask(vd, NV_PAVS_VOICE_TAR_VOLC,
+                                 NV_PAVS_VOICE_TAR_VOLC_VOLUME7_B11_8) << 8;
+    vol[7] |= voice_desc_get_mask(vd, NV_PAVS_VOICE_TAR_VOLB,
+                                  NV_PAVS_VOICE_TAR_VOLB_VOLUME7_B7_4) << 4;
+    vol[7] |= voice_desc_get_mask(vd, NV_PAVS_VOICE_TAR_VOLA,
+                                  NV_PAVS_VOICE_TAR_VOLA_VOLUME7_B3_0);
 
     // FIXME: If phase negations means to flip the signal upside down
     //        we should modify volume of bin6 and bin7 here.
@@ -1712,8 +1928,8 @@ static void voice_process(MCPXAPUState *d,
         return;
     }
 
-    int fmode = voice_get_mask(d, v, NV_PAVS_VOICE_CFG_MISC,
-                               NV_PAVS_VOICE_CFG_MISC_FMODE);
+    int fmode = voice_desc_get_mask(vd, NV_PAVS_VOICE_CFG_MISC,
+                                    NV_PAVS_VOICE_CFG_MISC_FMODE);
 
     // FIXME: Move to function
     bool lpf = false;
@@ -1724,24 +1940,30 @@ static void voice_process(MCPXAPUState *d,
         /* 0:Bypass 1:DLS2 2:ParaEQ 3(Mono):DLS2+ParaEQ 3(Stereo):Bypass */
         lpf = stereo ? (fmode == 1) : (fmode & 1);
     }
+
+    /* The mixing kernels work on one channel at a time */
+    float planar[2][NUM_SAMPLES_PER_FRAME];
+    for (int i = 0; i < NUM_SAMPLES_PER_FRAME; i++) {
+        planar[0][i] = samples[i][0];
+        planar[1][i] = samples[i][1];
+    }
+
     if (lpf) {
         for (int ch = 0; ch < 2; ch++) {
             // FIXME: Cutoff modulation via NV_PAVS_VOICE_CFG_ENV1_EF_FCSCALE
-            int16_t fc = voice_get_mask(
-                d, v, NV_PAVS_VOICE_TAR_FCA + (ch % channels) * 4,
+            int16_t fc = voice_desc_get_mask(
+                vd, NV_PAVS_VOICE_TAR_FCA + (ch % channels) * 4,
                 NV_PAVS_VOICE_TAR_FCA_FC0);
             float fc_f = clampf(pow(2, fc / 4096.0), 0.003906f, 1.0f);
-            uint16_t q = voice_get_mask(
-                d, v, NV_PAVS_VOICE_TAR_FCA + (ch % channels) * 4,
+            uint16_t q = voice_desc_get_mask(
+                vd, NV_PAVS_VOICE_TAR_FCA + (ch % channels) * 4,
                 NV_PAVS_VOICE_TAR_FCA_FC1);
             float q_f = clampf(q / (1.0 * 0x8000), 0.079407f, 1.0f);
-            sv_filter *filter = &d->vp.filters[v].svf[ch];
-            setup_svf(filter, fc_f, q_f, F_LP);
-            for (int i = 0; i < NUM_SAMPLES_PER_FRAME; i++) {
-                samples[i][ch] = run_svf(filter, samples[i][ch]);
-                samples[i][ch] = fmin(fmax(samples[i][ch], -1.0), 1.0);
-            }
+            setup_svf(&d->vp.filters[v].svf[ch], fc_f, q_f, F_LP);
         }
+        mix_svf_lp(&d->vp.filters[v].svf[0], &d->vp.filters[v].svf[1],
+                   planar[0], planar[1], NUM_SAMPLES_PER_FRAME);
+        mix_clamp(&planar[0][0], -1.0f, 1.0f, 2 * NUM_SAMPLES_PER_FRAME);
     }
 
     // FIXME: ParaEQ
@@ -1756,10 +1978,9 @@ static void voice_process(MCPXAPUState *d,
         } else {
             hr = 1 << d->vp.submix_headroom[bin[b]];
         }
-        g *= attenuate(vol[b])/hr;
-        for (int i = 0; i < NUM_SAMPLES_PER_FRAME; i++) {
-            mixbins[bin[b]][i] += g*samples[i][b % channels];
-        }
+        g *= mix_attenuate(vol[b])/hr;
+        mix_accumulate(mixbins[bin[b]], planar[b % channels], g,
+                       NUM_SAMPLES_PER_FRAME);
     }
 
     if (d->mon == MCPX_APU_DEBUG_MON_VP) {
@@ -1770,52 +1991,54 @@ static void voice_process(MCPXAPUState *d,
         float g = 0.0f;
         for (int b = 0; b < 8; b++) {
             float hr = 1 << d->vp.submix_headroom[bin[b]];
-            g = fmax(g, attenuate(vol[b]) / hr);
+            g = fmax(g, mix_attenuate(vol[b]) / hr);
         }
         g *= ea_value;
         for (int i = 0; i < NUM_SAMPLES_PER_FRAME; i++) {
-            d->vp.sample_buf[i][0] += g*samples[i][0];
-            d->vp.sample_buf[i][1] += g*samples[i][1];
+            d->vp.sample_buf[i][0] += g*planar[0][i];
+            d->vp.sample_buf[i][1] += g*planar[1][i];
         }
     }
 }
 
-static int voice_get_samples(MCPXAPUState *d, uint32_t v, float samples[][2],
-                       int num_samples_requested)
+static int voice_get_samples(MCPXAPUState *d, MCPXAPUVoiceDesc *vd,
+                             float samples[][2], int num_samples_requested)
 {
+    uint32_t v = vd->v;
     assert(v < MCPX_HW_MAX_VOICES);
-    bool stereo = voice_get_mask(d, v, NV_PAVS_VOICE_CFG_FMT,
-                                 NV_PAVS_VOICE_CFG_FMT_STEREO);
+    bool stereo = voice_desc_get_mask(vd, NV_PAVS_VOICE_CFG_FMT,
+                                      NV_PAVS_VOICE_CFG_FMT_STEREO);
     unsigned int channels = stereo ? 2 : 1;
-    unsigned int sample_size = voice_get_mask(
-        d, v, NV_PAVS_VOICE_CFG_FMT, NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE);
+    unsigned int sample_size = voice_desc_get_mask(
+        vd, NV_PAVS_VOICE_CFG_FMT, NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE);
     unsigned int container_sizes[4] = { 1, 2, 0, 4 }; /* B8, B16, ADPCM, B32 */
-    unsigned int container_size_index = voice_get_mask(
-        d, v, NV_PAVS_VOICE_CFG_FMT, NV_PAVS_VOICE_CFG_FMT_CONTAINER_SIZE);
+    unsigned int container_size_index = voice_desc_get_mask(
+        vd, NV_PAVS_VOICE_CFG_FMT, NV_PAVS_VOICE_CFG_FMT_CONTAINER_SIZE);
     unsigned int container_size = container_sizes[container_size_index];
-    bool stream = voice_get_mask(d, v, NV_PAVS_VOICE_CFG_FMT,
-                                 NV_PAVS_VOICE_CFG_FMT_DATA_TYPE);
-    bool paused = voice_get_mask(d, v, NV_PAVS_VOICE_PAR_STATE,
-                                 NV_PAVS_VOICE_PAR_STATE_PAUSED);
-    bool loop =
-        voice_get_mask(d, v, NV_PAVS_VOICE_CFG_FMT, NV_PAVS_VOICE_CFG_FMT_LOOP);
-    uint32_t ebo = voice_get_mask(d, v, NV_PAVS_VOICE_PAR_NEXT,
-                                  NV_PAVS_VOICE_PAR_NEXT_EBO);
-    uint32_t cbo = voice_get_mask(d, v, NV_PAVS_VOICE_PAR_OFFSET,
-                                  NV_PAVS_VOICE_PAR_OFFSET_CBO);
-    uint32_t lbo = voice_get_mask(d, v, NV_PAVS_VOICE_CUR_PSH_SAMPLE,
-                                  NV_PAVS_VOICE_CUR_PSH_SAMPLE_LBO);
-    uint32_t ba = voice_get_mask(d, v, NV_PAVS_VOICE_CUR_PSL_START,
-                                 NV_PAVS_VOICE_CUR_PSL_START_BA);
+    bool stream = voice_desc_get_mask(vd, NV_PAVS_VOICE_CFG_FMT,
+                                      NV_PAVS_VOICE_CFG_FMT_DATA_TYPE);
+    bool paused = voice_desc_get_mask(vd, NV_PAVS_VOICE_PAR_STATE,
+                                      NV_PAVS_VOICE_PAR_STATE_PAUSED);
+    bool loop = voice_desc_get_mask(vd, NV_PAVS_VOICE_CFG_FMT,
+                                    NV_PAVS_VOICE_CFG_FMT_LOOP);
+    uint32_t ebo = voice_desc_get_mask(vd, NV_PAVS_VOICE_PAR_NEXT,
+                                       NV_PAVS_VOICE_PAR_NEXT_EBO);
+    uint32_t cbo = voice_desc_get_mask(vd, NV_PAVS_VOICE_PAR_OFFSET,
+                                       NV_PAVS_VOICE_PAR_OFFSET_CBO);
+    uint32_t lbo = voice_desc_get_mask(vd, NV_PAVS_VOICE_CUR_PSH_SAMPLE,
+                                       NV_PAVS_VOICE_CUR_PSH_SAMPLE_LBO);
+    uint32_t ba = voice_desc_get_mask(vd, NV_PAVS_VOICE_CUR_PSL_START,
+                                      NV_PAVS_VOICE_CUR_PSL_START_BA);
     unsigned int samples_per_block =
-        1 + voice_get_mask(d, v, NV_PAVS_VOICE_CFG_FMT,
-                           NV_PAVS_VOICE_CFG_FMT_SAMPLES_PER_BLOCK);
-    bool persist = voice_get_mask(d, v, NV_PAVS_VOICE_CFG_FMT,
-                                  NV_PAVS_VOICE_CFG_FMT_PERSIST);
-    bool multipass = voice_get_mask(d, v, NV_PAVS_VOICE_CFG_FMT,
-                                    NV_PAVS_VOICE_CFG_FMT_MULTIPASS);
-    bool linked = voice_get_mask(d, v, NV_PAVS_VOICE_CFG_FMT,
-                                 NV_PAVS_VOICE_CFG_FMT_LINKED); /* FIXME? */
+        1 + voice_desc_get_mask(vd, NV_PAVS_VOICE_CFG_FMT,
+                                NV_PAVS_VOICE_CFG_FMT_SAMPLES_PER_BLOCK);
+    bool persist = voice_desc_get_mask(vd, NV_PAVS_VOICE_CFG_FMT,
+                                       NV_PAVS_VOICE_CFG_FMT_PERSIST);
+    bool multipass = voice_desc_get_mask(vd, NV_PAVS_VOICE_CFG_FMT,
+                                         NV_PAVS_VOICE_CFG_FMT_MULTIPASS);
+    /* FIXME? */
+    bool linked = voice_desc_get_mask(vd, NV_PAVS_VOICE_CFG_FMT,
+                                      NV_PAVS_VOICE_CFG_FMT_LINKED);
 
     int ssl_index = 0;
     int ssl_seg = 0;
@@ -1830,8 +2053,8 @@ static int voice_get_samples(MCPXAPUState *d, uint32_t v, float samples[][2],
     size_t block_size;
 
     int adpcm_block_index = -1;
-    uint32_t adpcm_block[36*2/4];
-    int16_t adpcm_decoded[65*2]; // FIXME: Move out of here
+    int16_t adpcm_decoded[ADPCM_CACHE_MAX_SAMPLES];
+    uint8_t pcm_buf[NUM_SAMPLES_PER_FRAME * 4 * 32]; // Largest block is 128B
 
     // FIXME: Only update if necessary
     struct McpxApuDebugVoice *dbg = &g_dbg.vp.v[v];
@@ -1851,8 +2074,8 @@ static int voice_get_samples(MCPXAPUState *d, uint32_t v, float samples[][2],
     // This is probably cleared when the first sample is played
     // FIXME: How will this behave if CBO > EBO on first play?
     // FIXME: How will this behave if paused?
-    voice_set_mask(d, v, NV_PAVS_VOICE_PAR_STATE,
-                   NV_PAVS_VOICE_PAR_STATE_NEW_VOICE, 0);
+    voice_desc_set_mask(vd, NV_PAVS_VOICE_PAR_STATE,
+                        NV_PAVS_VOICE_PAR_STATE_NEW_VOICE, 0);
 
     if (paused) {
         return -1;
@@ -1862,13 +2085,13 @@ static int voice_get_samples(MCPXAPUState *d, uint32_t v, float samples[][2],
         if (!persist) {
             // FIXME: Confirm. Unsure if this should wait until end of SSL or
             // terminate immediately. Definitely not before end of envelope.
-            int eacur = voice_get_mask(d, v, NV_PAVS_VOICE_PAR_STATE,
-                                       NV_PAVS_VOICE_PAR_STATE_EACUR);
+            int eacur = voice_desc_get_mask(vd, NV_PAVS_VOICE_PAR_STATE,
+                                            NV_PAVS_VOICE_PAR_STATE_EACUR);
             if (eacur < NV_PAVS_VOICE_PAR_STATE_EFCUR_RELEASE) {
                 DPRINTF("Voice %d envelope not in release state (%d) and "
                         "persist is not set. Ending stream now!\n",
                         v, eacur);
-                voice_off(d, v);
+                voice_desc_off(d, vd);
                 return -1;
             }
         }
@@ -1884,12 +2107,12 @@ static int voice_get_samples(MCPXAPUState *d, uint32_t v, float samples[][2],
         // Check to see if the stream has ended
         if (count == 0) {
             DPRINTF("Stream has ended\n");
-            voice_set_mask(d, v, NV_PAVS_VOICE_PAR_OFFSET,
-                           NV_PAVS_VOICE_PAR_OFFSET_CBO, 0);
+            voice_desc_set_mask(vd, NV_PAVS_VOICE_PAR_OFFSET,
+                                NV_PAVS_VOICE_PAR_OFFSET_CBO, 0);
             d->vp.ssl[v].ssl_seg = 0;
             if (!persist) {
                 d->vp.ssl[v].ssl_index = 0;
-                voice_off(d, v);
+                voice_desc_off(d, vd);
             } else {
                 set_notify_status(
                     d, v, MCPX_HW_NOTIFIER_SSLA_DONE + d->vp.ssl[v].ssl_index,
@@ -1956,87 +2179,55 @@ static int voice_get_samples(MCPXAPUState *d, uint32_t v, float samples[][2],
 
     block_size *= samples_per_block;
 
-    // FIXME: Restructure this loop
+    hwaddr fetch_base = stream ? segment_offset : d->regs[NV_PAPU_VPSGEADDR];
+    unsigned int sample_bytes =
+        sample_size == NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_U8  ? 1 :
+        sample_size == NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_S16 ? 2 :
+                                                               4;
+
+    /* Convert as many samples at once as the block or buffer allows */
     int sample_count = 0;
-    for (; (sample_count < num_samples_requested) && (cbo <= ebo);
-         sample_count++, cbo++) {
+    while ((sample_count < num_samples_requested) && (cbo <= ebo)) {
+        int n = MIN(num_samples_requested - sample_count, ebo - cbo + 1);
+
         if (adpcm) {
             unsigned int block_index = cbo / ADPCM_SAMPLES_PER_BLOCK;
             unsigned int block_position = cbo % ADPCM_SAMPLES_PER_BLOCK;
             if (adpcm_block_index != block_index) {
                 uint32_t linear_addr = block_index * block_size;
                 if (stream) {
-                    hwaddr addr = segment_offset + linear_addr;
                     int max_seg_byte = (seg_len >> 6) * block_size;
                     assert(linear_addr + block_size <= max_seg_byte);
-                    memcpy(adpcm_block, &d->ram_ptr[addr],
-                           block_size); // FIXME: Use idiomatic DMA function
                 } else {
                     linear_addr += ba;
-                    for (unsigned int word_index = 0;
-                         word_index < (9 * samples_per_block); word_index++) {
-                        hwaddr addr = get_data_ptr(d->regs[NV_PAPU_VPSGEADDR],
-                                                   0xFFFFFFFF, linear_addr);
-                        adpcm_block[word_index] =
-                            ldl_le_phys(&address_space_memory, addr);
-                        linear_addr += 4;
-                    }
                 }
-                adpcm_decode_block(adpcm_decoded, (uint8_t *)adpcm_block,
-                                   block_size, channels);
+                voice_decode_adpcm_block(d, stream, fetch_base, linear_addr,
+                                         block_size, channels,
+                                         adpcm_decoded);
                 adpcm_block_index = block_index;
             }
 
-            samples[sample_count][0] =
-                int16_to_float(adpcm_decoded[block_position * channels]);
-            if (stereo) {
-                samples[sample_count][1] = int16_to_float(
-                    adpcm_decoded[block_position * channels + 1]);
-            }
+            n = MIN(n, ADPCM_SAMPLES_PER_BLOCK - block_position);
+            pcm_s16_to_float(&samples[sample_count],
+                             &adpcm_decoded[block_position * channels], n,
+                             stereo);
         } else {
-            // FIXME: Handle reading accross pages?!
-
-            hwaddr addr;
-            if (stream) {
-                addr = segment_offset + cbo * block_size;
-            } else {
-                uint32_t linear_addr = ba + cbo * block_size;
-                addr = get_data_ptr(d->regs[NV_PAPU_VPSGEADDR], 0xFFFFFFFF,
-                                    linear_addr);
-            }
-
-            for (unsigned int channel = 0; channel < channels; channel++) {
-                uint32_t ival;
-                float fval;
-                switch (sample_size) {
-                case NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_U8:
-                    ival = ldub_phys(&address_space_memory, addr);
-                    fval = uint8_to_float(ival & 0xff);
-                    break;
-                case NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_S16:
-                    ival = lduw_le_phys(&address_space_memory, addr);
-                    fval = int16_to_float(ival & 0xffff);
-                    break;
-                case NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_S24:
-                    ival = ldl_le_phys(&address_space_memory, addr);
-                    fval = int24_to_float(ival);
-                    break;
-                case NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_S32:
-                    ival = ldl_le_phys(&address_space_memory, addr);
-                    fval = int32_to_float(ival);
-                    break;
-                default:
-                    assert(false);
-                    break;
-                }
-                samples[sample_count][channel] = fval;
-                addr += container_size;
+            uint32_t linear_addr = cbo * block_size;
+            if (!stream) {
+                linear_addr += ba;
             }
+            /* Only the bytes the samples are loaded from */
+            size_t len = (n - 1) * block_size +
+                         (channels - 1) * container_size + sample_bytes;
+            assert(len <= sizeof(pcm_buf));
+            const uint8_t *src = voice_fetch(d, stream, fetch_base,
+                                             linear_addr, pcm_buf, len);
+            pcm_to_float(&samples[sample_count], src, n, block_size,
+                         sample_size, container_size, stereo);
         }
 
-        if (!stereo) {
-            samples[sample_count][1] = samples[sample_count][0];
-        }
+        sample_count += n;
+        cbo += n;
     }
 
     if (cbo >= ebo) {
@@ -2058,17 +2249,218 @@ static int voice_get_samples(MCPXAPUState *d, uint32_t v, float samples[][2],
                 cbo = lbo;
             } else {
                 cbo = ebo;
-                voice_off(d, v);
+                voice_desc_off(d, vd);
                 DPRINTF("end of buffer!\n");
             }
         }
     }
 
-    voice_set_mask(d, v, NV_PAVS_VOICE_PAR_OFFSET,
-                   NV_PAVS_VOICE_PAR_OFFSET_CBO, cbo);
+    voice_desc_set_mask(vd, NV_PAVS_VOICE_PAR_OFFSET,
+                        NV_PAVS_VOICE_PAR_OFFSET_CBO, cbo);
     return sample_count;
 }
 
+/* Called on the APU thread, which may stall here on the guest */
+static void voice_wait_and_process(
+    MCPXAPUState *d, float mixbins[NUM_MIXBINS][NUM_SAMPLES_PER_FRAME],
+    uint16_t v)
+{
+    qemu_spin_lock(&d->vp.voice_spinlocks[v]);
+    while (is_voice_locked(d, v)) {
+        /* Stall until voice is available */
+        qemu_spin_unlock(&d->vp.voice_spinlocks[v]);
+        qemu_cond_wait(&d->cond, &d->lock);
+        qemu_spin_lock(&d->vp.voice_spinlocks[v]);
+    }
+    MCPXAPUVoiceDesc vd;
+    voice_desc_load(d, &vd, v);
+    voice_process(d, mixbins, &vd);
+    voice_desc_store(d, &vd);
+    qemu_spin_unlock(&d->vp.voice_spinlocks[v]);
+}
+
+static void voice_process_chunk(MCPXAPUState *d, int chunk)
+{
+    MCPXAPUVoicePool *pool = &d->vp.pool;
+    int start = chunk * MCPX_VP_POOL_CHUNK_VOICES;
+    int end = MIN(start + MCPX_VP_POOL_CHUNK_VOICES, pool->num_voices);
+
+    memset(pool->mixbins[chunk], 0, sizeof(pool->mixbins[chunk]));
+
+    for (int i = start; i < end; i++) {
+        uint16_t v = pool->voices[i];
+        qemu_spin_lock(&d->vp.voice_spinlocks[v]);
+        /* Only the APU thread may stall on a locked voice, leave it to it */
+        pool->pending[i] = is_voice_locked(d, v);
+        if (!pool->pending[i]) {
+            MCPXAPUVoiceDesc vd;
+            voice_desc_load(d, &vd, v);
+            voice_process(d, pool->mixbins[chunk], &vd);
+            voice_desc_store(d, &vd);
+        }
+        qemu_spin_unlock(&d->vp.voice_spinlocks[v]);
+    }
+}
+
+/* Called with the pool lock held, dropped while each chunk is processed */
+static void voice_pool_work(MCPXAPUState *d)
+{
+    MCPXAPUVoicePool *pool = &d->vp.pool;
+
+    while (pool->next_chunk < pool->num_chunks) {
+        int chunk = pool->next_chunk++;
+        qemu_mutex_unlock(&pool->lock);
+
+        voice_process_chunk(d, chunk);
+
+        qemu_mutex_lock(&pool->lock);
+        if (++pool->chunks_done == pool->num_chunks) {
+            qemu_cond_signal(&pool->done_cond);
+        }
+    }
+}
+
+static void *voice_pool_thread(void *arg)
+{
+    MCPXAPUState *d = arg;
+    MCPXAPUVoicePool *pool = &d->vp.pool;
+
+    rcu_register_thread();
+
+    qemu_mutex_lock(&pool->lock);
+    while (true) {
+        while (!pool->shutdown &&
+               !(pool->dispatch && pool->next_chunk < pool->num_chunks)) {
+            qemu_cond_wait(&pool->work_cond, &pool->lock);
+        }
+        if (pool->shutdown) {
+            break;
+        }
+        voice_pool_work(d);
+    }
+    qemu_mutex_unlock(&pool->lock);
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void voice_pool_init(MCPXAPUState *d)
+{
+    MCPXAPUVoicePool *pool = &d->vp.pool;
+
+    qemu_mutex_init(&pool->lock);
+    qemu_cond_init(&pool->work_cond);
+    qemu_cond_init(&pool->done_cond);
+    pool->shutdown = false;
+    pool->dispatch = false;
+    pool->num_voices = 0;
+    pool->num_chunks = 0;
+    pool->next_chunk = 0;
+    pool->chunks_done = 0;
+
+    /*
+     * The APU thread works on chunks too. Leave room for the vCPU, PFIFO
+     * and texture prefetch threads.
+     */
+    int num_threads = MAX(0, MIN(3, (int)g_get_num_processors() / 2 - 1));
+    pool->num_threads = num_threads;
+    pool->threads = g_new(QemuThread, num_threads);
+    for (int i = 0; i < num_threads; i++) {
+        qemu_thread_create(&pool->threads[i], "mcpx.voice_pool",
+                           voice_pool_thread, d, QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void voice_pool_destroy(MCPXAPUState *d)
+{
+    MCPXAPUVoicePool *pool = &d->vp.pool;
+
+    qemu_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    qemu_cond_broadcast(&pool->work_cond);
+    qemu_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->num_threads; i++) {
+        qemu_thread_join(&pool->threads[i]);
+    }
+    g_free(pool->threads);
+    pool->threads = NULL;
+    pool->num_threads = 0;
+}
+
+/*
+ * Renders the voices queued in the pool and adds them into @mixbins, leaving
+ * the pool empty. Each chunk of voices mixes into its own buffer and the
+ * buffers are summed in chunk order, so the result doesn't depend on which
+ * thread got which chunk. The @current and @next list registers point at the
+ * last queued voice meanwhile, or at a voice locked since it was queued while
+ * stalling on it, and are put back afterwards. Returns whether it stalled.
+ */
+static bool voice_pool_run(MCPXAPUState *d,
+                           float mixbins[NUM_MIXBINS][NUM_SAMPLES_PER_FRAME],
+                           hwaddr current, hwaddr next)
+{
+    MCPXAPUVoicePool *pool = &d->vp.pool;
+    int num_chunks = DIV_ROUND_UP(pool->num_voices, MCPX_VP_POOL_CHUNK_VOICES);
+
+    if (num_chunks == 0) {
+        return false;
+    }
+
+    uint32_t walk_current = d->regs[current];
+    uint32_t walk_next = d->regs[next];
+    uint16_t last = pool->voices[pool->num_voices - 1];
+    d->regs[current] = last;
+    d->regs[next] = voice_get_mask(d, last, NV_PAVS_VOICE_TAR_PITCH_LINK,
+                                   NV_PAVS_VOICE_TAR_PITCH_LINK_NEXT_VOICE_HANDLE);
+
+    qemu_mutex_lock(&pool->lock);
+    pool->num_chunks = num_chunks;
+    pool->next_chunk = 0;
+    pool->chunks_done = 0;
+    /* The VP monitor sums every voice into the one shared sample_buf */
+    pool->dispatch = pool->num_threads > 0 && num_chunks > 1 &&
+                     d->mon != MCPX_APU_DEBUG_MON_VP;
+    if (pool->dispatch) {
+        qemu_cond_broadcast(&pool->work_cond);
+    }
+    voice_pool_work(d);
+    while (pool->chunks_done < num_chunks) {
+        qemu_cond_wait(&pool->done_cond, &pool->lock);
+    }
+    pool->dispatch = false;
+    qemu_mutex_unlock(&pool->lock);
+
+    bool stalled = false;
+    for (int i = 0; i < pool->num_voices; i++) {
+        if (!pool->pending[i]) {
+            continue;
+        }
+
+        uint16_t v = pool->voices[i];
+        stalled = true;
+        d->regs[current] = v;
+        d->regs[next] = voice_get_mask(d, v, NV_PAVS_VOICE_TAR_PITCH_LINK,
+                               NV_PAVS_VOICE_TAR_PITCH_LINK_NEXT_VOICE_HANDLE);
+        voice_wait_and_process(d, pool->mixbins[i / MCPX_VP_POOL_CHUNK_VOICES],
+                               v);
+    }
+
+    for (int chunk = 0; chunk < num_chunks; chunk++) {
+        for (int mixbin = 0; mixbin < NUM_MIXBINS; mixbin++) {
+            for (int sample = 0; sample < NUM_SAMPLES_PER_FRAME; sample++) {
+                mixbins[mixbin][sample] +=
+                    pool->mixbins[chunk][mixbin][sample];
+            }
+        }
+    }
+
+    pool->num_voices = 0;
+    d->regs[current] = walk_current;
+    d->regs[next] = walk_next;
+    return stalled;
+}
+
 static void se_frame(MCPXAPUState *d)
 {
     mcpx_apu_update_dsp_preference(d);
@@ -2110,6 +2502,9 @@ static void se_frame(MCPXAPUState *d)
     float mixbins[NUM_MIXBINS][NUM_SAMPLES_PER_FRAME] = { 0 };
 
     memset(d->vp.sample_buf, 0, sizeof(d->vp.sample_buf));
+    d->vp.pool.num_voices = 0;
+    bool serial = false;
+    adpcm_cache_sync(d->vp.adpcm_cache);
 
     /* Process all voices, mixing each into the affected MIXBINs */
     for (int list = 0; list < 3; list++) {
@@ -2129,24 +2524,35 @@ static void se_frame(MCPXAPUState *d)
             }
 
             uint16_t v = d->regs[current];
+            bool active = voice_get_mask(d, v, NV_PAVS_VOICE_PAR_STATE,
+                                         NV_PAVS_VOICE_PAR_STATE_ACTIVE_VOICE);
+            if (active && !serial && is_voice_locked(d, v)) {
+                /*
+                 * Render what was queued before stalling on this voice. The
+                 * guest may relink voices meanwhile, so from here on links
+                 * are followed in step with processing.
+                 */
+                voice_pool_run(d, mixbins, current, next);
+                serial = true;
+                active = voice_get_mask(d, v, NV_PAVS_VOICE_PAR_STATE,
+                                        NV_PAVS_VOICE_PAR_STATE_ACTIVE_VOICE);
+            }
+
             d->regs[next] = voice_get_mask(d, v, NV_PAVS_VOICE_TAR_PITCH_LINK,
                                NV_PAVS_VOICE_TAR_PITCH_LINK_NEXT_VOICE_HANDLE);
-            if (!voice_get_mask(d, v, NV_PAVS_VOICE_PAR_STATE,
-                                NV_PAVS_VOICE_PAR_STATE_ACTIVE_VOICE)) {
+            if (!active) {
                 fe_method(d, SE2FE_IDLE_VOICE, v);
+            } else if (serial) {
+                voice_wait_and_process(d, mixbins, v);
             } else {
-                qemu_spin_lock(&d->vp.voice_spinlocks[v]);
-                while (is_voice_locked(d, v)) {
-                    /* Stall until voice is available */
-                    qemu_spin_unlock(&d->vp.voice_spinlocks[v]);
-                    qemu_cond_wait(&d->cond, &d->lock);
-                    qemu_spin_lock(&d->vp.voice_spinlocks[v]);
-                }
-                voice_process(d, mixbins, v);
-                qemu_spin_unlock(&d->vp.voice_spinlocks[v]);
+                /* Rendered by the voice pool before the walk leaves it */
+                d->vp.pool.voices[d->vp.pool.num_voices++] = v;
             }
             d->regs[current] = d->regs[next];
         }
+
+        /* A stall here may have let the guest relink, go on in step */
+        serial |= voice_pool_run(d, mixbins, current, next);
     }
 
     if (d->mon == MCPX_APU_DEBUG_MON_VP) {
@@ -2165,13 +2571,11 @@ static void se_frame(MCPXAPUState *d)
     }
 
     /* Write VP results to the GP DSP MIXBUF */
-    for (int mixbin = 0; mixbin < NUM_MIXBINS; mixbin++) {
-        uint32_t base = GP_DSP_MIXBUF_BASE + mixbin * NUM_SAMPLES_PER_FRAME;
-        for (int sample = 0; sample < NUM_SAMPLES_PER_FRAME; sample++) {
-            dsp_write_memory(d->gp.dsp, 'X', base + sample,
-                             float_to_24b(mixbins[mixbin][sample]));
-        }
-    }
+    QEMU_BUILD_BUG_ON(GP_DSP_MIXBUF_BASE != DSP_MIXBUFFER_BASE);
+    QEMU_BUILD_BUG_ON(NUM_MIXBINS * NUM_SAMPLES_PER_FRAME !=
+                      DSP_MIXBUFFER_SIZE);
+    mix_float_to_24b(d->gp.dsp->core.mixbuffer, &mixbins[0][0],
+                     NUM_MIXBINS * NUM_SAMPLES_PER_FRAME);
 
     bool ep_enabled = (d->ep.regs[NV_PAPU_EPRST] & NV_PAPU_GPRST_GPRST) &&
                       (d->ep.regs[NV_PAPU_EPRST] & NV_PAPU_GPRST_GPDSPRST);
@@ -2323,6 +2727,8 @@ static void mcpx_apu_exitfn(PCIDevice *dev)
     d->exiting = true;
     qemu_cond_broadcast(&d->cond);
     qemu_thread_join(&d->apu_thread);
+    voice_pool_destroy(d);
+    adpcm_cache_free(d->vp.adpcm_cache);
 }
 
 static void mcpx_apu_reset(MCPXAPUState *d)
@@ -2378,6 +2784,8 @@ static int mcpx_apu_pre_load(void *opaque)
 static int mcpx_apu_post_load(void *opaque, int version_id)
 {
     MCPXAPUState *d = opaque;
+    /* RAM was loaded behind dirty tracking's back */
+    adpcm_cache_flush(d->vp.adpcm_cache);
     qemu_cond_signal(&d->cond);
     qemu_mutex_unlock(&d->lock);
     return 0;
@@ -2585,6 +2993,8 @@ void mcpx_apu_init(PCIBus *bus, int devfn, MemoryRegion *ram)
 
     d->ram = ram;
     d->ram_ptr = memory_region_get_ram_ptr(d->ram);
+    memory_region_set_log(d->ram, true, DIRTY_MEMORY_MCPX);
+    d->vp.adpcm_cache = adpcm_cache_new(d->ram);
 
     d->gp.dsp = dsp_init(d, gp_scratch_rw, gp_fifo_rw);
     for (int i = 0; i < DSP_PRAM_SIZE; i++) {
@@ -2655,6 +3065,7 @@ void mcpx_apu_init(PCIBus *bus, int devfn, MemoryRegion *ram)
      */
     mcpx_apu_update_dsp_preference(d);
 
+    voice_pool_init(d);
     qemu_thread_create(&d->apu_thread, "mcpx.apu_thread", mcpx_apu_frame_thread,
                        d, QEMU_THREAD_JOINABLE);
 }
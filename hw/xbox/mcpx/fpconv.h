@@ -21,27 +21,27 @@
 #ifndef FLOATCONV_H
 #define FLOATCONV_H
 
-static float uint8_to_float(uint8_t value)
+static inline float uint8_to_float(uint8_t value)
 {
     return ((int)value - 0x80) / (1.0 * 0x80);
 }
 
-static float int16_to_float(int16_t value)
+static inline float int16_to_float(int16_t value)
 {
     return value / (1.0 * 0x8000);
 }
 
-static float int32_to_float(int32_t value)
+static inline float int32_to_float(int32_t value)
 {
     return value / (1.0 * 0x80000000);
 }
 
-static float int24_to_float(int32_t value)
+static inline float int24_to_float(int32_t value)
 {
     return int32_to_float((uint32_t)value << 8);
 }
 
-static uint32_t float_to_24b(float value)
+static inline uint32_t float_to_24b(float value)
 {
     double scaled_value = value * (8.0 * 0x100000);
     int int24;
@@ -0,0 +1,361 @@
+/*
+ * MCPX APU mixing kernels
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "fpconv.h"
+#include "mix.h"
+
+float mix_attenuation_table[0x1000];
+
+static void __attribute__((constructor)) mix_init_attenuation_table(void)
+{
+    for (int vol = 0; vol < 0xFFF; vol++) {
+        mix_attenuation_table[vol] = powf(10.0f, vol / (64.0 * -20.0f));
+    }
+    mix_attenuation_table[0xFFF] = 0.0f;
+}
+
+typedef struct MixKernels {
+    void (*accumulate)(float *dst, const float *src, float gain, int count);
+    void (*clamp)(float *buf, float min, float max, int count);
+    void (*svf_lp)(sv_filter *left_filter, sv_filter *right_filter,
+                   float *left, float *right, int count);
+    void (*float_to_24b)(uint32_t *dst, const float *src, int count);
+} MixKernels;
+
+static void mix_accumulate_int(float *dst, const float *src, float gain,
+                               int count)
+{
+    for (int i = 0; i < count; i++) {
+        dst[i] += gain * src[i];
+    }
+}
+
+static void mix_clamp_int(float *buf, float min, float max, int count)
+{
+    for (int i = 0; i < count; i++) {
+        buf[i] = fminf(fmaxf(buf[i], min), max);
+    }
+}
+
+static void mix_svf_lp_int(sv_filter *left_filter, sv_filter *right_filter,
+                           float *left, float *right, int count)
+{
+    for (int i = 0; i < count; i++) {
+        left[i] = run_svf(left_filter, left[i]);
+    }
+    for (int i = 0; i < count; i++) {
+        right[i] = run_svf(right_filter, right[i]);
+    }
+}
+
+static void mix_float_to_24b_int(uint32_t *dst, const float *src, int count)
+{
+    for (int i = 0; i < count; i++) {
+        dst[i] = float_to_24b(src[i]);
+    }
+}
+
+static const MixKernels mix_kernels_int = {
+    .accumulate = mix_accumulate_int,
+    .clamp = mix_clamp_int,
+    .svf_lp = mix_svf_lp_int,
+    .float_to_24b = mix_float_to_24b_int,
+};
+
+#if defined(CONFIG_AVX2_OPT) || defined(__SSE2__)
+/* Do not use push_options pragmas unnecessarily, because clang
+ * does not support them.
+ */
+#if defined(CONFIG_AVX2_OPT)
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#endif
+#include <emmintrin.h>
+
+static void mix_accumulate_sse2(float *dst, const float *src, float gain,
+                                int count)
+{
+    __m128 g = _mm_set1_ps(gain);
+    int i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        __m128 s = _mm_mul_ps(g, _mm_loadu_ps(&src[i]));
+        _mm_storeu_ps(&dst[i], _mm_add_ps(_mm_loadu_ps(&dst[i]), s));
+    }
+    mix_accumulate_int(&dst[i], &src[i], gain, count - i);
+}
+
+static void mix_clamp_sse2(float *buf, float min, float max, int count)
+{
+    __m128 lo = _mm_set1_ps(min);
+    __m128 hi = _mm_set1_ps(max);
+    int i = 0;
+
+    /* maxps returns its second operand for NaN, like fmaxf */
+    for (; i + 4 <= count; i += 4) {
+        __m128 v = _mm_max_ps(_mm_loadu_ps(&buf[i]), lo);
+        _mm_storeu_ps(&buf[i], _mm_min_ps(v, hi));
+    }
+    mix_clamp_int(&buf[i], min, max, count - i);
+}
+
+/* Both channels go through the filter together, in the low two lanes */
+static void mix_svf_lp_sse2(sv_filter *left_filter, sv_filter *right_filter,
+                            float *left, float *right, int count)
+{
+    __m128 f = _mm_setr_ps(left_filter->f, right_filter->f, 0, 0);
+    __m128 q = _mm_setr_ps(left_filter->q, right_filter->q, 0, 0);
+    __m128 qnrm = _mm_setr_ps(left_filter->qnrm, right_filter->qnrm, 0, 0);
+    __m128 h = _mm_setr_ps(left_filter->h, right_filter->h, 0, 0);
+    __m128 b = _mm_setr_ps(left_filter->b, right_filter->b, 0, 0);
+    __m128 l = _mm_setr_ps(left_filter->l, right_filter->l, 0, 0);
+    __m128 shape = _mm_set1_ps(0.001f);
+    float out[4];
+
+    for (int i = 0; i < count; i++) {
+        __m128 in = _mm_mul_ps(qnrm, _mm_setr_ps(left[i], right[i], 0, 0));
+        b = _mm_sub_ps(b, _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(b, b), b), shape));
+        h = _mm_sub_ps(_mm_sub_ps(in, l), _mm_mul_ps(q, b));
+        b = _mm_add_ps(b, _mm_mul_ps(f, h));
+        l = _mm_add_ps(l, _mm_mul_ps(f, b));
+        _mm_storeu_ps(out, l);
+        left[i] = out[0];
+        right[i] = out[1];
+    }
+
+    sv_filter *filters[2] = { left_filter, right_filter };
+    float hs[4], bs[4], ls[4];
+    _mm_storeu_ps(hs, h);
+    _mm_storeu_ps(bs, b);
+    _mm_storeu_ps(ls, l);
+    for (int ch = 0; ch < 2; ch++) {
+        filters[ch]->h = hs[ch];
+        filters[ch]->b = bs[ch];
+        filters[ch]->l = ls[ch];
+        filters[ch]->n = ls[ch] + hs[ch];
+        filters[ch]->p = ls[ch] - hs[ch];
+    }
+}
+
+static void mix_float_to_24b_sse2(uint32_t *dst, const float *src, int count)
+{
+    __m128 scale = _mm_set1_ps(8.0f * 0x100000);
+    __m128 hi = _mm_set1_ps(1.0f * 0x7fffff);
+    __m128 lo = _mm_set1_ps(-8.0f * 0x100000);
+    __m128i hi_i = _mm_set1_epi32(0x7fffff);
+    __m128i lo_i = _mm_set1_epi32(-1 - 0x7fffff);
+    __m128i mask = _mm_set1_epi32(0xffffff);
+    int i = 0;
+
+    /*
+     * Scaling by 2^23 is exact in float as well as double, and cvtps2dq
+     * rounds to nearest even like lrint. The ordered compares leave NaN
+     * to the conversion, as float_to_24b does.
+     */
+    for (; i + 4 <= count; i += 4) {
+        __m128 v = _mm_mul_ps(_mm_loadu_ps(&src[i]), scale);
+        __m128i r = _mm_cvtps_epi32(v);
+        __m128i over = _mm_castps_si128(_mm_cmpge_ps(v, hi));
+        __m128i under = _mm_castps_si128(_mm_cmple_ps(v, lo));
+        r = _mm_or_si128(_mm_andnot_si128(over, r), _mm_and_si128(over, hi_i));
+        r = _mm_or_si128(_mm_andnot_si128(under, r),
+                         _mm_and_si128(under, lo_i));
+        _mm_storeu_si128((__m128i *)&dst[i], _mm_and_si128(r, mask));
+    }
+    mix_float_to_24b_int(&dst[i], &src[i], count - i);
+}
+
+static const MixKernels mix_kernels_sse2 = {
+    .accumulate = mix_accumulate_sse2,
+    .clamp = mix_clamp_sse2,
+    .svf_lp = mix_svf_lp_sse2,
+    .float_to_24b = mix_float_to_24b_sse2,
+};
+#if defined(CONFIG_AVX2_OPT)
+#pragma GCC pop_options
+#endif
+
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+static void mix_accumulate_avx2(float *dst, const float *src, float gain,
+                                int count)
+{
+    __m256 g = _mm256_set1_ps(gain);
+    int i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m256 s = _mm256_mul_ps(g, _mm256_loadu_ps(&src[i]));
+        _mm256_storeu_ps(&dst[i], _mm256_add_ps(_mm256_loadu_ps(&dst[i]), s));
+    }
+    mix_accumulate_sse2(&dst[i], &src[i], gain, count - i);
+}
+
+static void mix_clamp_avx2(float *buf, float min, float max, int count)
+{
+    __m256 lo = _mm256_set1_ps(min);
+    __m256 hi = _mm256_set1_ps(max);
+    int i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m256 v = _mm256_max_ps(_mm256_loadu_ps(&buf[i]), lo);
+        _mm256_storeu_ps(&buf[i], _mm256_min_ps(v, hi));
+    }
+    mix_clamp_sse2(&buf[i], min, max, count - i);
+}
+
+static void mix_float_to_24b_avx2(uint32_t *dst, const float *src, int count)
+{
+    __m256 scale = _mm256_set1_ps(8.0f * 0x100000);
+    __m256 hi = _mm256_set1_ps(1.0f * 0x7fffff);
+    __m256 lo = _mm256_set1_ps(-8.0f * 0x100000);
+    __m256i hi_i = _mm256_set1_epi32(0x7fffff);
+    __m256i lo_i = _mm256_set1_epi32(-1 - 0x7fffff);
+    __m256i mask = _mm256_set1_epi32(0xffffff);
+    int i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m256 v = _mm256_mul_ps(_mm256_loadu_ps(&src[i]), scale);
+        __m256i r = _mm256_cvtps_epi32(v);
+        __m256i over = _mm256_castps_si256(_mm256_cmp_ps(v, hi, _CMP_GE_OQ));
+        __m256i under = _mm256_castps_si256(_mm256_cmp_ps(v, lo, _CMP_LE_OQ));
+        r = _mm256_blendv_epi8(r, hi_i, over);
+        r = _mm256_blendv_epi8(r, lo_i, under);
+        _mm256_storeu_si256((__m256i *)&dst[i], _mm256_and_si256(r, mask));
+    }
+    mix_float_to_24b_sse2(&dst[i], &src[i], count - i);
+}
+
+/* The filter is recursive over time, so it can't use more than two lanes */
+static const MixKernels mix_kernels_avx2 = {
+    .accumulate = mix_accumulate_avx2,
+    .clamp = mix_clamp_avx2,
+    .svf_lp = mix_svf_lp_sse2,
+    .float_to_24b = mix_float_to_24b_avx2,
+};
+
+#pragma GCC pop_options
+#endif /* CONFIG_AVX2_OPT */
+
+/* Note that for mix_test_next_accel, the most preferred ISA must have the
+ * least significant bit.
+ */
+#define CACHE_AVX2    1
+#define CACHE_SSE2    2
+
+#if defined(CONFIG_AVX2_OPT)
+# define INIT_CACHE 0
+# define INIT_KERNELS (&mix_kernels_int)
+#else
+# define INIT_CACHE CACHE_SSE2
+# define INIT_KERNELS (&mix_kernels_sse2)
+#endif
+
+static unsigned cpuid_cache = INIT_CACHE;
+static const MixKernels *mix_kernels = INIT_KERNELS;
+
+static void init_accel(unsigned cache)
+{
+    const MixKernels *kernels = &mix_kernels_int;
+    if (cache & CACHE_SSE2) {
+        kernels = &mix_kernels_sse2;
+    }
+#ifdef CONFIG_AVX2_OPT
+    if (cache & CACHE_AVX2) {
+        kernels = &mix_kernels_avx2;
+    }
+#endif
+    mix_kernels = kernels;
+}
+
+#ifdef CONFIG_AVX2_OPT
+#include "qemu/cpuid.h"
+
+static void __attribute__((constructor)) init_cpuid_cache(void)
+{
+    unsigned max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+    unsigned cache = 0;
+
+    if (max >= 1) {
+        __cpuid(1, a, b, c, d);
+        if (d & bit_SSE2) {
+            cache |= CACHE_SSE2;
+        }
+
+        /* We must check that AVX is not just available, but usable.  */
+        if ((c & bit_OSXSAVE) && (c & bit_AVX) && max >= 7) {
+            int bv;
+            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+            __cpuid_count(7, 0, a, b, c, d);
+            if ((bv & 0x6) == 0x6 && (b & bit_AVX2)) {
+                cache |= CACHE_AVX2;
+            }
+        }
+    }
+    cpuid_cache = cache;
+    init_accel(cache);
+}
+#endif /* CONFIG_AVX2_OPT */
+
+bool mix_test_next_accel(void)
+{
+    /* If no bits set, we just tested the portable kernels, and there
+       are no more acceleration options to test.  */
+    if (cpuid_cache == 0) {
+        return false;
+    }
+    /* Disable the accelerator we used before and select a new one.  */
+    cpuid_cache &= cpuid_cache - 1;
+    init_accel(cpuid_cache);
+    return true;
+}
+
+#else
+static const MixKernels *mix_kernels = &mix_kernels_int;
+
+bool mix_test_next_accel(void)
+{
+    return false;
+}
+#endif
+
+void mix_accumulate(float *dst, const float *src, float gain, int count)
+{
+    mix_kernels->accumulate(dst, src, gain, count);
+}
+
+void mix_clamp(float *buf, float min, float max, int count)
+{
+    mix_kernels->clamp(buf, min, max, count);
+}
+
+void mix_svf_lp(sv_filter *left_filter, sv_filter *right_filter,
+                float *left, float *right, int count)
+{
+    assert(left_filter->op == &left_filter->l);
+    assert(right_filter->op == &right_filter->l);
+    mix_kernels->svf_lp(left_filter, right_filter, left, right, count);
+}
+
+void mix_float_to_24b(uint32_t *dst, const float *src, int count)
+{
+    mix_kernels->float_to_24b(dst, src, count);
+}
@@ -0,0 +1,59 @@
+/*
+ * MCPX APU mixing kernels
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HW_XBOX_MCPX_MIX_H
+#define HW_XBOX_MCPX_MIX_H
+
+#include "svf.h"
+
+/*
+ * Vector kernels for the voice processor's inner loops, with SSE2 and AVX2
+ * versions picked at startup and a portable fallback. Buffers are planar,
+ * one channel or mixbin each, and need no particular alignment.
+ */
+
+/* dst[i] += gain * src[i] */
+void mix_accumulate(float *dst, const float *src, float gain, int count);
+
+/* Clamps every sample of buf to [min, max], NaN becomes min */
+void mix_clamp(float *buf, float min, float max, int count);
+
+/*
+ * Runs a pair of low pass filters set up with setup_svf(..., F_LP) over
+ * the left and right channels, in place. Same as run_svf on each sample.
+ */
+void mix_svf_lp(sv_filter *left_filter, sv_filter *right_filter,
+                float *left, float *right, int count);
+
+/* float_to_24b from fpconv.h for every sample */
+void mix_float_to_24b(uint32_t *dst, const float *src, int count);
+
+/* Volume attenuation, 0 is full volume and 0xFFF silence */
+extern float mix_attenuation_table[0x1000];
+
+static inline float mix_attenuate(uint16_t vol)
+{
+    return mix_attenuation_table[vol & 0xFFF];
+}
+
+/*
+ * For testing: drops the fastest kernels in use and falls back to the next
+ * ones, returning false once only the portable kernels are left.
+ */
+bool mix_test_next_accel(void);
+
+#endif
@@ -0,0 +1,90 @@
+/*
+ * MCPX APU sample format conversion
+ *
+ * Copyright (c) 2020-2021 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "apu_regs.h"
+#include "pcm.h"
+
+/*
+ * Scaling by a power of two is exact, so these match the divisions done in
+ * fpconv.h bit for bit. Each format gets its own loop with a fixed load so
+ * the compiler can vectorise it.
+ */
+#define U8_SCALE (1.0f / 0x80)
+#define S16_SCALE (1.0f / 0x8000)
+#define S32_SCALE (1.0f / 0x80000000u)
+
+#define PCM_CONVERT(out, src, count, stride, container_size, stereo, expr) \
+    do {                                                                 \
+        if (stereo) {                                                    \
+            for (int i = 0; i < (count); i++) {                          \
+                const uint8_t *p = (src) + i * (stride);                 \
+                (out)[i][0] = (expr);                                    \
+                p += (container_size);                                   \
+                (out)[i][1] = (expr);                                    \
+            }                                                            \
+        } else {                                                         \
+            for (int i = 0; i < (count); i++) {                          \
+                const uint8_t *p = (src) + i * (stride);                 \
+                (out)[i][0] = (out)[i][1] = (expr);                      \
+            }                                                            \
+        }                                                                \
+    } while (0)
+
+void pcm_to_float(float out[][2], const uint8_t *src, int count,
+                  size_t stride, unsigned int sample_size,
+                  unsigned int container_size, bool stereo)
+{
+    switch (sample_size) {
+    case NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_U8:
+        PCM_CONVERT(out, src, count, stride, container_size, stereo,
+                    ((int)*p - 0x80) * U8_SCALE);
+        break;
+    case NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_S16:
+        PCM_CONVERT(out, src, count, stride, container_size, stereo,
+                    (int16_t)lduw_le_p(p) * S16_SCALE);
+        break;
+    case NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_S24:
+        PCM_CONVERT(out, src, count, stride, container_size, stereo,
+                    (int32_t)(ldl_le_p(p) << 8) * S32_SCALE);
+        break;
+    case NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_S32:
+        PCM_CONVERT(out, src, count, stride, container_size, stereo,
+                    (int32_t)ldl_le_p(p) * S32_SCALE);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+void pcm_s16_to_float(float out[][2], const int16_t *src, int count,
+                      bool stereo)
+{
+    if (stereo) {
+        for (int i = 0; i < count; i++) {
+            out[i][0] = src[2 * i] * S16_SCALE;
+            out[i][1] = src[2 * i + 1] * S16_SCALE;
+        }
+    } else {
+        for (int i = 0; i < count; i++) {
+            out[i][0] = out[i][1] = src[i] * S16_SCALE;
+        }
+    }
+}
@@ -0,0 +1,49 @@
+/*
+ * MCPX APU sample format conversion
+ *
+ * Copyright (c) 2020-2021 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HW_XBOX_MCPX_PCM_H
+#define HW_XBOX_MCPX_PCM_H
+
+/**
+ * pcm_to_float:
+ * @out: destination for @count stereo frames
+ * @src: little endian sample data as stored in guest memory
+ * @count: number of frames to convert
+ * @stride: bytes from one frame to the next
+ * @sample_size: one of NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_*
+ * @container_size: bytes from one channel of a frame to the next
+ * @stereo: frames have a second channel, otherwise the first is duplicated
+ *
+ * Gives the same results as converting every sample with fpconv.h.
+ */
+void pcm_to_float(float out[][2], const uint8_t *src, int count,
+                  size_t stride, unsigned int sample_size,
+                  unsigned int container_size, bool stereo);
+
+/**
+ * pcm_s16_to_float:
+ * @out: destination for @count stereo frames
+ * @src: interleaved host endian samples, such as decoded ADPCM
+ * @count: number of frames to convert
+ * @stereo: @src has two channels per frame, otherwise one
+ */
+void pcm_s16_to_float(float out[][2], const int16_t *src, int count,
+                      bool stereo);
+
+#endif
@@ -0,0 +1,626 @@
+/*
+ * QEMU Geforce NV2A push buffer capture and replay
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A capture starts at a flip with the device state and all of VRAM and
+ * RAMIN, then for every frame holds the method runs PGRAPH executed, in method
+ * queue encoding, and the memory that changed by the frame's end. Replaying
+ * one keeps the guest stopped and feeds the runs back to the puller, acting as
+ * the guest's interrupt handler where PGRAPH would wait on it, which makes a
+ * repeatable benchmark of everything from the puller down.
+ *
+ * Files are only ever read in host byte order, as xemu writes them.
+ *
+ * Replay builds the whole machine but never runs the guest, so it boots
+ * without ROM images, started with -nv2a_replay <file>. It needs a GL context;
+ * Xvfb with a software driver is enough. scripts/xemu-nv2a-capture.py writes
+ * synthetic captures, which set up PGRAPH through register chunks instead of
+ * a saved state, and checks a replay's output against its capture. CI replays
+ * one that way.
+ */
+
+#include "nv2a_int.h"
+#include "io/channel-buffer.h"
+#include "migration/qemu-file.h"
+#include "sysemu/sysemu.h"
+
+#define NV2A_CAPTURE_MAGIC "XNV2ACAP"
+#define NV2A_CAPTURE_VERSION 1
+
+/* Method runs are written out once this many words are buffered */
+#define NV2A_CAPTURE_METHODS_FLUSH (256 * KiB)
+
+enum NV2ACaptureChunkType {
+    NV2A_CAPTURE_STATE = 1, /* vmstate_nv2a_capture, addr is its version */
+    NV2A_CAPTURE_VRAM,      /* VRAM bytes from addr */
+    NV2A_CAPTURE_RAMIN,     /* RAMIN bytes from addr */
+    NV2A_CAPTURE_METHODS,   /* Executed method runs */
+    NV2A_CAPTURE_FRAME,     /* End of a frame, right after its FLIP_STALL */
+    NV2A_CAPTURE_PGRAPH_REGS, /* (offset, value) pairs, stored as is */
+};
+
+typedef struct NV2ACaptureHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_frames;
+    uint64_t vram_size;
+    uint64_t ramin_size;
+} NV2ACaptureHeader;
+
+typedef struct NV2ACaptureChunk {
+    uint32_t type;
+    uint32_t size; /* Payload bytes following, padded to 8 bytes */
+    uint64_t addr;
+} NV2ACaptureChunk;
+
+#define NV2A_CAPTURE_CHUNK_LEN(size) \
+    (sizeof(NV2ACaptureChunk) + ROUND_UP((size_t)(size), 8))
+
+static struct {
+    /* Handed over from nv2a_capture_start to the puller at the next flip */
+    char *pending_path;
+    unsigned int pending_frames;
+    bool active;
+
+    FILE *file;
+    char *path;
+    NV2ACaptureHeader header;
+    unsigned int num_frames;
+    unsigned int frames_left;
+    uint8_t *vram_shadow;
+    uint8_t *ramin_shadow;
+    GArray *methods;
+} capture;
+
+static struct {
+    GMappedFile *file;
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+    bool armed;
+
+    /* Position in the current METHODS chunk */
+    const uint32_t *run;
+    const uint32_t *run_end;
+
+    unsigned int frame;
+    unsigned int frame_runs;
+    uint64_t frame_words;
+    int64_t frame_start;
+    int64_t total_time;
+} replay;
+
+bool nv2a_capture_start(const char *path, unsigned int num_frames)
+{
+    if (nv2a_capture_active() || nv2a_replay_active() || num_frames == 0) {
+        return false;
+    }
+
+    capture.pending_frames = num_frames;
+    qatomic_set(&capture.active, true);
+    qatomic_store_release(&capture.pending_path, g_strdup(path));
+    return true;
+}
+
+bool nv2a_capture_active(void)
+{
+    return qatomic_read(&capture.active);
+}
+
+static bool nv2a_capture_write(const void *data, size_t size)
+{
+    return size == 0 || fwrite(data, size, 1, capture.file) == 1;
+}
+
+static bool nv2a_capture_write_chunk(uint32_t type, uint64_t addr,
+                                     const void *data, size_t size)
+{
+    static const uint8_t padding[8];
+    NV2ACaptureChunk chunk = {
+        .type = type,
+        .size = size,
+        .addr = addr,
+    };
+
+    assert(size <= UINT32_MAX);
+    return nv2a_capture_write(&chunk, sizeof(chunk)) &&
+           nv2a_capture_write(data, size) &&
+           nv2a_capture_write(padding, ROUND_UP(size, 8) - size);
+}
+
+static bool nv2a_capture_flush_methods(void)
+{
+    bool ok = nv2a_capture_write_chunk(
+        NV2A_CAPTURE_METHODS, 0, capture.methods->data,
+        capture.methods->len * sizeof(uint32_t));
+    g_array_set_size(capture.methods, 0);
+    return ok;
+}
+
+/* Write out, and take into the shadow copy, each run of changed pages */
+static bool nv2a_capture_write_delta(uint32_t type, const uint8_t *mem,
+                                     uint8_t *shadow, size_t size)
+{
+    size_t page = TARGET_PAGE_SIZE;
+
+    for (size_t addr = 0; addr < size;) {
+        if (!memcmp(mem + addr, shadow + addr, page)) {
+            addr += page;
+            continue;
+        }
+
+        size_t end = addr + page;
+        while (end < size && end - addr < 1 * GiB &&
+               memcmp(mem + end, shadow + end, page)) {
+            end += page;
+        }
+
+        memcpy(shadow + addr, mem + addr, end - addr);
+        if (!nv2a_capture_write_chunk(type, addr, shadow + addr,
+                                      end - addr)) {
+            return false;
+        }
+        addr = end;
+    }
+
+    return true;
+}
+
+static bool nv2a_capture_write_deltas(NV2AState *d)
+{
+    return nv2a_capture_write_delta(NV2A_CAPTURE_VRAM, d->vram_ptr,
+                                    capture.vram_shadow,
+                                    memory_region_size(d->vram)) &&
+           nv2a_capture_write_delta(NV2A_CAPTURE_RAMIN, d->ramin_ptr,
+                                    capture.ramin_shadow,
+                                    memory_region_size(&d->ramin));
+}
+
+static bool nv2a_capture_write_state(NV2AState *d)
+{
+    QIOChannelBuffer *bioc = qio_channel_buffer_new(64 * KiB);
+    QEMUFile *f = qemu_file_new_output(QIO_CHANNEL(bioc));
+
+    int ret = vmstate_save_state(f, &vmstate_nv2a_capture, d, NULL);
+    qemu_fflush(f);
+    bool ok = ret == 0 && !qemu_file_get_error(f) &&
+              nv2a_capture_write_chunk(NV2A_CAPTURE_STATE,
+                                       vmstate_nv2a_capture.version_id,
+                                       bioc->data, bioc->usage);
+
+    qemu_fclose(f);
+    object_unref(OBJECT(bioc));
+    return ok;
+}
+
+static void nv2a_capture_finish(bool ok)
+{
+    if (ok) {
+        /* The header is final once it has the frame count */
+        capture.header.num_frames = capture.num_frames;
+        ok = !fseek(capture.file, 0, SEEK_SET) &&
+             nv2a_capture_write(&capture.header, sizeof(capture.header));
+    }
+    ok = !fclose(capture.file) && ok;
+
+    if (ok) {
+        info_report("nv2a: captured %u frames to %s", capture.num_frames,
+                    capture.path);
+    } else {
+        error_report("nv2a: failed to write capture %s: %s", capture.path,
+                     strerror(errno));
+    }
+
+    capture.file = NULL;
+    g_free(capture.path);
+    g_free(capture.vram_shadow);
+    g_free(capture.ramin_shadow);
+    g_array_free(capture.methods, true);
+    qatomic_set(&capture.active, false);
+}
+
+static void nv2a_capture_begin(NV2AState *d, char *path)
+{
+    size_t vram_size = memory_region_size(d->vram);
+    size_t ramin_size = memory_region_size(&d->ramin);
+
+    capture.path = path;
+    capture.file = qemu_fopen(path, "wb");
+    if (!capture.file) {
+        error_report("nv2a: could not create capture %s: %s", path,
+                     strerror(errno));
+        g_free(path);
+        qatomic_set(&capture.active, false);
+        return;
+    }
+
+    capture.num_frames = capture.pending_frames;
+    capture.frames_left = capture.num_frames;
+    capture.vram_shadow = g_memdup2(d->vram_ptr, vram_size);
+    capture.ramin_shadow = g_memdup2(d->ramin_ptr, ramin_size);
+    capture.methods = g_array_new(false, false, sizeof(uint32_t));
+
+    capture.header = (NV2ACaptureHeader) {
+        .version = NV2A_CAPTURE_VERSION,
+        .vram_size = vram_size,
+        .ramin_size = ramin_size,
+    };
+    memcpy(capture.header.magic, NV2A_CAPTURE_MAGIC,
+           sizeof(capture.header.magic));
+    bool ok = nv2a_capture_write(&capture.header, sizeof(capture.header)) &&
+              nv2a_capture_write_state(d) &&
+              nv2a_capture_write_chunk(NV2A_CAPTURE_VRAM, 0,
+                                       capture.vram_shadow, vram_size) &&
+              nv2a_capture_write_chunk(NV2A_CAPTURE_RAMIN, 0,
+                                       capture.ramin_shadow, ramin_size);
+    if (!ok) {
+        nv2a_capture_finish(false);
+    }
+}
+
+/* Called by the puller for each run it executed, with the pgraph lock held */
+void nv2a_capture_methods(uint32_t header, const uint32_t *parameters,
+                          size_t count)
+{
+    if (!capture.file) {
+        return;
+    }
+
+    g_array_append_val(capture.methods, header);
+    g_array_append_vals(capture.methods, parameters, count);
+    if (capture.methods->len >= NV2A_CAPTURE_METHODS_FLUSH &&
+        !nv2a_capture_flush_methods()) {
+        nv2a_capture_finish(false);
+    }
+}
+
+/* Called by the puller after a FLIP_STALL, with the pgraph lock held */
+void nv2a_capture_frame(NV2AState *d)
+{
+    if (!capture.file) {
+        char *path = qatomic_xchg(&capture.pending_path, NULL);
+        if (path) {
+            nv2a_capture_begin(d, path);
+        }
+        return;
+    }
+
+    if (!nv2a_capture_flush_methods() ||
+        !nv2a_capture_write_chunk(NV2A_CAPTURE_FRAME, 0, NULL, 0)) {
+        nv2a_capture_finish(false);
+        return;
+    }
+
+    /*
+     * Memory the guest wrote while this frame was pending is only picked up
+     * here, so the next frame replays on top of it.
+     */
+    if (--capture.frames_left == 0) {
+        nv2a_capture_finish(true);
+    } else if (!nv2a_capture_write_deltas(d)) {
+        nv2a_capture_finish(false);
+    }
+}
+
+void nv2a_replay_init(const char *path)
+{
+    GError *err = NULL;
+
+    replay.file = g_mapped_file_new(path, false, &err);
+    if (!replay.file) {
+        error_report("nv2a: could not open capture %s: %s", path,
+                     err->message);
+        exit(1);
+    }
+
+    replay.data = (const uint8_t *)g_mapped_file_get_contents(replay.file);
+    replay.size = g_mapped_file_get_length(replay.file);
+
+    const NV2ACaptureHeader *header = (const NV2ACaptureHeader *)replay.data;
+    if (replay.size < sizeof(*header) ||
+        memcmp(header->magic, NV2A_CAPTURE_MAGIC, sizeof(header->magic)) ||
+        header->version != NV2A_CAPTURE_VERSION) {
+        error_report("nv2a: %s is not a version %d capture", path,
+                     NV2A_CAPTURE_VERSION);
+        exit(1);
+    }
+
+    /* The guest stays stopped; its state comes from the capture */
+    autostart = 0;
+}
+
+bool nv2a_replay_active(void)
+{
+    return replay.file != NULL;
+}
+
+/* Called with the pfifo and pgraph locks held */
+void nv2a_replay_reset(NV2AState *d)
+{
+    if (!replay.file) {
+        return;
+    }
+
+    const NV2ACaptureHeader *header = (const NV2ACaptureHeader *)replay.data;
+    if (header->vram_size != memory_region_size(d->vram) ||
+        header->ramin_size != memory_region_size(&d->ramin)) {
+        error_report("nv2a: capture was made with %" PRIu64 " MiB of RAM",
+                     header->vram_size / MiB);
+        exit(1);
+    }
+
+    replay.pos = sizeof(*header);
+    replay.run = replay.run_end = NULL;
+    replay.frame = 0;
+    replay.total_time = 0;
+    replay.armed = true;
+}
+
+static void nv2a_replay_finish(const char *error)
+{
+    if (error) {
+        error_report("nv2a: replay stopped at frame %u: %s", replay.frame,
+                     error);
+    } else if (replay.frame) {
+        printf("{\"frames\": %u, \"time_us\": %" PRId64
+               ", \"avg_time_us\": %" PRId64 "}\n",
+               replay.frame, replay.total_time,
+               replay.total_time / replay.frame);
+        fflush(stdout);
+    }
+
+    replay.armed = false;
+    qemu_system_shutdown_request(SHUTDOWN_CAUSE_HOST_UI);
+}
+
+static bool nv2a_replay_load_state(NV2AState *d, const uint8_t *data,
+                                   size_t size, int version_id)
+{
+    QIOChannelBuffer *bioc = qio_channel_buffer_new(size);
+    memcpy(bioc->data, data, size);
+    bioc->usage = size;
+    QEMUFile *f = qemu_file_new_input(QIO_CHANNEL(bioc));
+
+    qemu_mutex_lock(&d->pgraph.lock);
+    int ret = vmstate_load_state(f, &vmstate_nv2a_capture, d, version_id);
+    pfifo_queue_reset(d);
+    qatomic_set(&d->pgraph.flush_pending, true);
+    qemu_mutex_unlock(&d->pgraph.lock);
+
+    qemu_fclose(f);
+    object_unref(OBJECT(bioc));
+    return ret == 0;
+}
+
+/* Only written by synthetic captures, in place of a saved state */
+static bool nv2a_replay_store_pgraph_regs(NV2AState *d, const uint32_t *pairs,
+                                          size_t count)
+{
+    PGRAPHState *pg = &d->pgraph;
+    bool ok = true;
+
+    qemu_mutex_lock(&pg->lock);
+    for (size_t i = 0; i < count; i++) {
+        uint32_t addr = pairs[i * 2];
+        if (addr >= ARRAY_SIZE(pg->regs)) {
+            ok = false;
+            break;
+        }
+        pg->regs[addr] = pairs[i * 2 + 1];
+    }
+    qemu_mutex_unlock(&pg->lock);
+
+    return ok;
+}
+
+static void nv2a_replay_frame_start(void)
+{
+    replay.frame_runs = 0;
+    replay.frame_words = 0;
+    replay.frame_start = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+}
+
+/*
+ * Apply chunks up to the next method runs or frame end. Returns false at the
+ * end of the capture or once it has proven bad.
+ */
+static bool nv2a_replay_advance(NV2AState *d)
+{
+    while (replay.pos < replay.size) {
+        const NV2ACaptureChunk *chunk =
+            (const NV2ACaptureChunk *)(replay.data + replay.pos);
+        const uint8_t *payload = (const uint8_t *)(chunk + 1);
+
+        if (replay.size - replay.pos < sizeof(*chunk) ||
+            replay.size - replay.pos < NV2A_CAPTURE_CHUNK_LEN(chunk->size)) {
+            nv2a_replay_finish("truncated chunk");
+            return false;
+        }
+
+        switch (chunk->type) {
+        case NV2A_CAPTURE_STATE:
+            if (!nv2a_replay_load_state(d, payload, chunk->size,
+                                        chunk->addr)) {
+                nv2a_replay_finish("bad device state");
+                return false;
+            }
+            break;
+        case NV2A_CAPTURE_VRAM:
+            if (chunk->addr + chunk->size > memory_region_size(d->vram)) {
+                nv2a_replay_finish("VRAM chunk out of range");
+                return false;
+            }
+            memcpy(d->vram_ptr + chunk->addr, payload, chunk->size);
+            memory_region_set_dirty(d->vram, chunk->addr, chunk->size);
+            break;
+        case NV2A_CAPTURE_RAMIN:
+            if (chunk->addr + chunk->size > memory_region_size(&d->ramin)) {
+                nv2a_replay_finish("RAMIN chunk out of range");
+                return false;
+            }
+            memcpy(d->ramin_ptr + chunk->addr, payload, chunk->size);
+            break;
+        case NV2A_CAPTURE_PGRAPH_REGS:
+            if (chunk->size % (2 * sizeof(uint32_t)) ||
+                !nv2a_replay_store_pgraph_regs(
+                    d, (const uint32_t *)payload,
+                    chunk->size / (2 * sizeof(uint32_t)))) {
+                nv2a_replay_finish("bad PGRAPH register chunk");
+                return false;
+            }
+            break;
+        case NV2A_CAPTURE_METHODS:
+            replay.run = (const uint32_t *)payload;
+            replay.run_end = replay.run + chunk->size / sizeof(uint32_t);
+            replay.pos += NV2A_CAPTURE_CHUNK_LEN(chunk->size);
+            return true;
+        case NV2A_CAPTURE_FRAME:
+            /* Left in place until the frame has drained */
+            return true;
+        default:
+            nv2a_replay_finish("unknown chunk");
+            return false;
+        }
+
+        replay.pos += NV2A_CAPTURE_CHUNK_LEN(chunk->size);
+    }
+
+    nv2a_replay_finish(NULL);
+    return false;
+}
+
+/*
+ * Called by the pusher in place of decoding push buffers, with the pfifo lock
+ * held. Returns the next method run and its length in words, or NULL at the
+ * end of a frame or of the capture.
+ */
+const uint32_t *nv2a_replay_next_run(NV2AState *d, size_t *len)
+{
+    if (!replay.armed) {
+        return NULL;
+    }
+
+    while (replay.run == replay.run_end) {
+        if (!nv2a_replay_advance(d) || replay.run == replay.run_end) {
+            return NULL;
+        }
+    }
+
+    uint32_t header = replay.run[0];
+    uint32_t method = header & 0x1ffc;
+    size_t count = (header >> 18) & 0x7ff;
+
+    /* Bound objects are carried with their instance and channel */
+    *len = method == NV_SET_OBJECT ? 3 : 1 + count;
+    if (*len > (size_t)(replay.run_end - replay.run)) {
+        nv2a_replay_finish("truncated method run");
+        return NULL;
+    }
+
+    return replay.run;
+}
+
+void nv2a_replay_consume(size_t len)
+{
+    if (replay.frame_runs == 0) {
+        nv2a_replay_frame_start();
+    }
+    replay.frame_runs++;
+    replay.frame_words += len;
+    replay.run += len;
+}
+
+bool nv2a_replay_at_frame_end(void)
+{
+    if (!replay.armed || replay.run != replay.run_end ||
+        replay.pos >= replay.size) {
+        return false;
+    }
+
+    const NV2ACaptureChunk *chunk =
+        (const NV2ACaptureChunk *)(replay.data + replay.pos);
+    return chunk->type == NV2A_CAPTURE_FRAME;
+}
+
+/*
+ * Do what the guest's interrupt handler would for whatever PGRAPH waits on.
+ * Called with the pfifo lock held, which is dropped to write the registers.
+ */
+void nv2a_replay_acknowledge(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    qemu_mutex_lock(&pg->lock);
+    uint32_t intr = pg->pending_interrupts;
+    uint32_t ctx_user = pg->regs[NV_PGRAPH_CTX_USER];
+    uint32_t ctx_control = pg->regs[NV_PGRAPH_CTX_CONTROL];
+    unsigned int channel_id = GET_MASK(pg->regs[NV_PGRAPH_TRAPPED_ADDR],
+                                       NV_PGRAPH_TRAPPED_ADDR_CHID);
+    uint32_t surface = pg->regs[NV_PGRAPH_SURFACE];
+    bool flip = pg->waiting_for_flip &&
+                GET_MASK(surface, NV_PGRAPH_SURFACE_READ_3D) ==
+                    GET_MASK(surface, NV_PGRAPH_SURFACE_WRITE_3D);
+    qemu_mutex_unlock(&pg->lock);
+
+    qemu_mutex_unlock(&d->pfifo.lock);
+    if (intr & NV_PGRAPH_INTR_CONTEXT_SWITCH) {
+        SET_MASK(ctx_user, NV_PGRAPH_CTX_USER_CHID, channel_id);
+        pgraph_write(d, NV_PGRAPH_CTX_USER, ctx_user, 4);
+        pgraph_write(d, NV_PGRAPH_CTX_CONTROL,
+                     ctx_control | NV_PGRAPH_CTX_CONTROL_CHID, 4);
+    }
+    if (intr) {
+        pgraph_write(d, NV_PGRAPH_INTR, intr, 4);
+    }
+    if (flip) {
+        pgraph_write(d, NV_PGRAPH_INCREMENT, NV_PGRAPH_INCREMENT_READ_3D, 4);
+    }
+    qemu_mutex_lock(&d->pfifo.lock);
+}
+
+/* Called once everything up to the frame end has executed */
+void nv2a_replay_end_frame(NV2AState *d)
+{
+    int64_t time = replay.frame_runs ?
+        qemu_clock_get_us(QEMU_CLOCK_REALTIME) - replay.frame_start : 0;
+
+    replay.total_time += time;
+    replay.pos += NV2A_CAPTURE_CHUNK_LEN(0);
+
+    /* Counters were filed away by the frame's FLIP_STALL */
+    g_autoptr(GString) line = g_string_new(NULL);
+    g_string_append_printf(line,
+                           "{\"frame\": %u, \"time_us\": %" PRId64
+                           ", \"runs\": %u, \"words\": %" PRIu64,
+                           replay.frame, time, replay.frame_runs,
+                           replay.frame_words);
+    qemu_mutex_lock(&d->pgraph.lock);
+    for (int i = 0; i < NV2A_PROF__COUNT; i++) {
+        g_string_append_printf(line, ", \"%s\": %d",
+                               nv2a_profile_get_counter_name(i),
+                               nv2a_profile_get_counter_value(i));
+    }
+    qemu_mutex_unlock(&d->pgraph.lock);
+    printf("%s}\n", line->str);
+    fflush(stdout);
+
+    replay.frame++;
+    replay.frame_runs = 0;
+    replay.frame_words = 0;
+
+    nv2a_replay_acknowledge(d);
+}
@@ -21,6 +21,7 @@
 #ifndef HW_NV2A_DEBUG_H
 #define HW_NV2A_DEBUG_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #define NV2A_XPRINTF(x, ...) do { \
@@ -84,6 +85,17 @@ void nv2a_dbg_renderdoc_capture_frames(uint32_t num_frames);
 # define NV2A_GL_DFRAME_TERMINATOR()               do { } while (0)
 #endif
 
+/* Check for GL errors after every method and at other points along the draw
+ * path. Each check can make the driver synchronize, so these are only for
+ * tracking down a bad call.
+ */
+// #define DEBUG_NV2A_GL_ERRORS
+#if defined(DEBUG_NV2A_GL_ERRORS) || defined(DEBUG_NV2A_GL)
+# define NV2A_GL_CHECK_ERRORS() assert(glGetError() == GL_NO_ERROR)
+#else
+# define NV2A_GL_CHECK_ERRORS() do { } while (0)
+#endif
+
 /* Debug prints to identify when unimplemented or unconfirmed features
  * are being exercised. These cases likely result in graphical problems of
  * varying degree, but should otherwise not crash the system. Enable this
@@ -112,6 +124,10 @@ void nv2a_dbg_renderdoc_capture_frames(uint32_t num_frames);
 
 #define NV2A_PROF_COUNTERS_XMAC \
     _X(NV2A_PROF_BEGIN_ENDS) \
+    _X(NV2A_PROF_DRAWS_ISSUED) \
+    _X(NV2A_PROF_DRAWS_MERGED) \
+    _X(NV2A_PROF_GL_CALLS) \
+    _X(NV2A_PROF_GL_CALLS_ELIDED) \
     _X(NV2A_PROF_DRAW_ARRAYS) \
     _X(NV2A_PROF_INLINE_BUFFERS) \
     _X(NV2A_PROF_INLINE_ARRAYS) \
@@ -120,18 +136,41 @@ void nv2a_dbg_renderdoc_capture_frames(uint32_t num_frames);
     _X(NV2A_PROF_SHADER_GEN) \
     _X(NV2A_PROF_SHADER_BIND) \
     _X(NV2A_PROF_SHADER_BIND_NOTDIRTY) \
+    _X(NV2A_PROF_SHADER_KEY_REHASH) \
+    _X(NV2A_PROF_SHADER_COMPILE_ASYNC) \
+    _X(NV2A_PROF_SHADER_COMPILE_LATENCY_US) \
+    _X(NV2A_PROF_SHADER_DRAW_STALLED) \
     _X(NV2A_PROF_ATTR_BIND) \
     _X(NV2A_PROF_TEX_UPLOAD) \
+    _X(NV2A_PROF_TEX_UPLOAD_COMPRESSED) \
+    _X(NV2A_PROF_TEX_PREFETCH) \
+    _X(NV2A_PROF_TEX_PREFETCH_HIT) \
+    _X(NV2A_PROF_TEX_PREFETCH_WAIT) \
     _X(NV2A_PROF_TEX_BIND) \
+    _X(NV2A_PROF_TEX_DIRTY_VISITED) \
+    _X(NV2A_PROF_TEX_DIRTY_MARKED) \
     _X(NV2A_PROF_GEOM_BUFFER_UPDATE_1) \
     _X(NV2A_PROF_GEOM_BUFFER_UPDATE_2) \
     _X(NV2A_PROF_GEOM_BUFFER_UPDATE_3) \
     _X(NV2A_PROF_GEOM_BUFFER_UPDATE_4) \
     _X(NV2A_PROF_GEOM_BUFFER_UPDATE_4_NOTDIRTY) \
+    _X(NV2A_PROF_GEOM_BUFFER_UPDATE_4_STREAM) \
+    _X(NV2A_PROF_ELEMENT_CACHE_BYTES) \
+    _X(NV2A_PROF_ELEMENT_CACHE_EVICT) \
+    _X(NV2A_PROF_ELEMENT_CACHE_COMPACT) \
+    _X(NV2A_PROF_STREAM_BYTES) \
+    _X(NV2A_PROF_STREAM_WAIT) \
+    _X(NV2A_PROF_VRAM_MIRROR_BYTES) \
     _X(NV2A_PROF_SURF_DOWNLOAD) \
+    _X(NV2A_PROF_SURF_READBACK) \
+    _X(NV2A_PROF_SURF_READBACK_HIT) \
+    _X(NV2A_PROF_SURF_READBACK_WAIT) \
     _X(NV2A_PROF_SURF_UPLOAD) \
     _X(NV2A_PROF_SURF_TO_TEX) \
     _X(NV2A_PROF_SURF_TO_TEX_FALLBACK) \
+    _X(NV2A_PROF_SURF_LOOKUP_HIT) \
+    _X(NV2A_PROF_SURF_LOOKUP_MISS) \
+    _X(NV2A_PROF_SURF_CACHE_SIZE) \
 
 enum NV2A_PROF_COUNTERS_ENUM {
     #define _X(x) x,
@@ -153,11 +192,63 @@ typedef struct NV2AStats {
     unsigned int frame_ptr;
 } NV2AStats;
 
+/* Timed scopes, nested in whatever order they happen to be entered */
+#define NV2A_PROF_SCOPES_XMAC \
+    _X(NV2A_PROF_SCOPE_PROCESS_REQUESTS) \
+    _X(NV2A_PROF_SCOPE_METHOD) \
+    _X(NV2A_PROF_SCOPE_FLUSH_DRAW) \
+    _X(NV2A_PROF_SCOPE_BIND_TEXTURES) \
+    _X(NV2A_PROF_SCOPE_BIND_SHADERS) \
+    _X(NV2A_PROF_SCOPE_SURF_UPLOAD) \
+    _X(NV2A_PROF_SCOPE_SURF_DOWNLOAD) \
+
+enum NV2A_PROF_SCOPES_ENUM {
+    #define _X(x) x,
+    NV2A_PROF_SCOPES_XMAC
+    #undef _X
+    NV2A_PROF_SCOPE__COUNT
+};
+
+#define NV2A_PROF_MAX_NODES 64
+#define NV2A_PROF_MAX_DEPTH 16
+#define NV2A_PROF_NUM_METHODS 0x800
+
+/* A scope as entered from one chain of enclosing scopes */
+typedef struct NV2AProfileNode {
+    int scope;
+    int parent; /* Enclosing node, or -1 at the top */
+    unsigned int calls;
+    int64_t time_ns;
+} NV2AProfileNode;
+
+typedef struct NV2AProfileFrame {
+    int64_t frame_ns;
+    unsigned int num_nodes;
+    NV2AProfileNode nodes[NV2A_PROF_MAX_NODES];
+    /* Kelvin method handlers, by index of the method's base address */
+    struct {
+        unsigned int calls;
+        int64_t time_ns;
+    } methods[NV2A_PROF_NUM_METHODS];
+} NV2AProfileFrame;
+
+typedef struct NV2AProfile {
+    bool enabled;
+    /* The last complete frame is frames[last], the other one is being filled */
+    unsigned int last;
+    NV2AProfileFrame frames[2];
+} NV2AProfile;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 extern NV2AStats g_nv2a_stats;
+extern NV2AProfile g_nv2a_profile;
+
+const char *nv2a_profile_get_scope_name(unsigned int scope);
+const char *nv2a_profile_get_method_name(unsigned int idx);
+char *nv2a_profile_to_json(void);
 
 const char *nv2a_profile_get_counter_name(unsigned int cnt);
 int nv2a_profile_get_counter_value(unsigned int cnt);
@@ -48,6 +48,10 @@ GloContext *glo_context_create(void);
 /* Destroy a previously created OpenGL context */
 void glo_context_destroy(GloContext *context);
 
+/*
+ * Read back the bound framebuffer. The caller sets GL_PACK_ROW_LENGTH to
+ * stride / bytes_per_pixel and GL_PACK_ALIGNMENT to 1 beforehand.
+ */
 void glo_readpixels(GLenum gl_format, GLenum gl_type,
                     unsigned int bytes_per_pixel, unsigned int stride,
                     unsigned int width, unsigned int height, bool vflip,
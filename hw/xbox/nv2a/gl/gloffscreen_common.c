@@ -39,13 +39,7 @@ void glo_readpixels(GLenum gl_format, GLenum gl_type,
     /* TODO: weird strides */
     assert(stride % bytes_per_pixel == 0);
 
-    /* Save guest processes GL state before we ReadPixels() */
-    int rl, pa;
-    glGetIntegerv(GL_PACK_ROW_LENGTH, &rl);
-    glGetIntegerv(GL_PACK_ALIGNMENT, &pa);
-    glPixelStorei(GL_PACK_ROW_LENGTH, stride / bytes_per_pixel);
-    glPixelStorei(GL_PACK_ALIGNMENT, 1);
-
+    /* Pack row length and alignment are left for the caller to set */
     glReadPixels(0, 0, width, height, gl_format, gl_type, data);
 
     if (vflip) {
@@ -61,10 +55,6 @@ void glo_readpixels(GLenum gl_format, GLenum gl_type,
         }
         free(tmp);
     }
-
-    /* Restore GL state */
-    glPixelStorei(GL_PACK_ROW_LENGTH, rl);
-    glPixelStorei(GL_PACK_ALIGNMENT, pa);
 }
 
 bool glo_check_extension(const char* ext_name)
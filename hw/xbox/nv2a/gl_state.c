@@ -0,0 +1,68 @@
+/*
+ * QEMU Geforce NV2A GL state shadowing
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nv2a_int.h"
+
+NV2AGLState g_nv2a_gl_state;
+
+/* Called on the render context whenever its state is no longer known */
+void nv2a_gl_state_reset(void)
+{
+    memset(&g_nv2a_gl_state, 0xff, sizeof(g_nv2a_gl_state));
+
+    /* Texture bindings are tracked per unit, so the unit is always known */
+    g_nv2a_gl_state.active_texture = GL_TEXTURE0;
+    glActiveTexture(GL_TEXTURE0);
+}
+
+/* Deleting objects reverts bindings of them to zero */
+void nv2a_gl_delete_textures(GLsizei n, const GLuint *textures)
+{
+    for (int i = 0; i < n; i++) {
+        for (int unit = 0; unit < NV2A_GL_STATE_TEXTURE_UNITS; unit++) {
+            for (int t = 0; t < NV2A_GL_STATE_TEXTURE_TARGET__COUNT; t++) {
+                if (g_nv2a_gl_state.textures[unit][t] == textures[i]) {
+                    g_nv2a_gl_state.textures[unit][t] = 0;
+                }
+            }
+        }
+    }
+    glDeleteTextures(n, textures);
+}
+
+void nv2a_gl_delete_framebuffers(GLsizei n, const GLuint *framebuffers)
+{
+    for (int i = 0; i < n; i++) {
+        if (g_nv2a_gl_state.draw_framebuffer == framebuffers[i]) {
+            g_nv2a_gl_state.draw_framebuffer = 0;
+        }
+        if (g_nv2a_gl_state.read_framebuffer == framebuffers[i]) {
+            g_nv2a_gl_state.read_framebuffer = 0;
+        }
+    }
+    glDeleteFramebuffers(n, framebuffers);
+}
+
+void nv2a_gl_delete_vertex_arrays(GLsizei n, const GLuint *arrays)
+{
+    for (int i = 0; i < n; i++) {
+        if (g_nv2a_gl_state.vertex_array == arrays[i]) {
+            g_nv2a_gl_state.vertex_array = 0;
+        }
+    }
+    glDeleteVertexArrays(n, arrays);
+}
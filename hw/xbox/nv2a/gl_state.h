@@ -0,0 +1,400 @@
+/*
+ * QEMU Geforce NV2A GL state shadowing
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HW_NV2A_GL_STATE_H
+#define HW_NV2A_GL_STATE_H
+
+#include "gl/gloffscreen.h"
+#include "debug.h"
+
+/*
+ * Shadow of the state pgraph sets on the render context, so calls that would
+ * not change anything are skipped and nothing has to be queried back from the
+ * driver. Every change to shadowed state on the render context has to go
+ * through these helpers, or be followed by nv2a_gl_state_reset(). Only the
+ * puller thread uses the render context, so none of this is locked.
+ */
+
+#define NV2A_GL_STATE_TEXTURE_UNITS 8
+
+#define NV2A_GL_STATE_TEXTURE_TARGETS_XMAC \
+    _X(GL_TEXTURE_1D) \
+    _X(GL_TEXTURE_2D) \
+    _X(GL_TEXTURE_3D) \
+    _X(GL_TEXTURE_CUBE_MAP) \
+    _X(GL_TEXTURE_RECTANGLE) \
+
+#define NV2A_GL_STATE_CAPS_XMAC \
+    _X(GL_BLEND) \
+    _X(GL_CLIP_DISTANCE0) \
+    _X(GL_CLIP_DISTANCE1) \
+    _X(GL_CULL_FACE) \
+    _X(GL_DEPTH_CLAMP) \
+    _X(GL_DEPTH_TEST) \
+    _X(GL_DITHER) \
+    _X(GL_LINE_SMOOTH) \
+    _X(GL_POLYGON_OFFSET_FILL) \
+    _X(GL_POLYGON_OFFSET_LINE) \
+    _X(GL_POLYGON_OFFSET_POINT) \
+    _X(GL_POLYGON_SMOOTH) \
+    _X(GL_PROGRAM_POINT_SIZE) \
+    _X(GL_SCISSOR_TEST) \
+    _X(GL_STENCIL_TEST) \
+
+#define NV2A_GL_STATE_PIXEL_STORE_XMAC \
+    _X(GL_PACK_ALIGNMENT) \
+    _X(GL_PACK_ROW_LENGTH) \
+    _X(GL_UNPACK_ALIGNMENT) \
+    _X(GL_UNPACK_ROW_LENGTH) \
+    _X(GL_UNPACK_SKIP_PIXELS) \
+    _X(GL_UNPACK_SKIP_ROWS) \
+
+enum NV2A_GL_STATE_TEXTURE_TARGETS_ENUM {
+    #define _X(x) NV2A_GL_STATE_##x,
+    NV2A_GL_STATE_TEXTURE_TARGETS_XMAC
+    #undef _X
+    NV2A_GL_STATE_TEXTURE_TARGET__COUNT
+};
+
+enum NV2A_GL_STATE_CAPS_ENUM {
+    #define _X(x) NV2A_GL_STATE_##x,
+    NV2A_GL_STATE_CAPS_XMAC
+    #undef _X
+    NV2A_GL_STATE_CAP__COUNT
+};
+
+enum NV2A_GL_STATE_PIXEL_STORE_ENUM {
+    #define _X(x) NV2A_GL_STATE_##x,
+    NV2A_GL_STATE_PIXEL_STORE_XMAC
+    #undef _X
+    NV2A_GL_STATE_PIXEL_STORE__COUNT
+};
+
+/*
+ * Resetting fills this with ones, which no name, enum or boolean here takes
+ * and which is NaN for the floats, so the next call of each kind goes out.
+ */
+typedef struct NV2AGLState {
+    GLenum active_texture;
+    GLuint textures[NV2A_GL_STATE_TEXTURE_UNITS]
+                   [NV2A_GL_STATE_TEXTURE_TARGET__COUNT];
+    GLuint program;
+    GLuint vertex_array;
+    GLuint draw_framebuffer;
+    GLuint read_framebuffer;
+
+    uint8_t caps[NV2A_GL_STATE_CAP__COUNT];
+    GLint pixel_store[NV2A_GL_STATE_PIXEL_STORE__COUNT];
+
+    uint8_t color_mask[4];
+    uint8_t depth_mask;
+    GLuint stencil_mask;
+    GLenum blend_func[2];
+    GLenum blend_equation;
+    GLfloat blend_color[4];
+    GLenum depth_func;
+    GLenum stencil_func;
+    GLint stencil_ref;
+    GLuint stencil_func_mask;
+    GLenum stencil_op[3];
+    GLenum cull_face;
+    GLenum front_face;
+    GLfloat polygon_offset[2];
+    GLint viewport[4];
+    GLint scissor[4];
+} NV2AGLState;
+
+extern NV2AGLState g_nv2a_gl_state;
+
+void nv2a_gl_state_reset(void);
+void nv2a_gl_delete_textures(GLsizei n, const GLuint *textures);
+void nv2a_gl_delete_framebuffers(GLsizei n, const GLuint *framebuffers);
+void nv2a_gl_delete_vertex_arrays(GLsizei n, const GLuint *arrays);
+
+static inline bool nv2a_gl_state_update(void *shadow, const void *value,
+                                        size_t size)
+{
+    if (!memcmp(shadow, value, size)) {
+        g_nv2a_stats.frame_working.counters[NV2A_PROF_GL_CALLS_ELIDED]++;
+        return false;
+    }
+    memcpy(shadow, value, size);
+    g_nv2a_stats.frame_working.counters[NV2A_PROF_GL_CALLS]++;
+    return true;
+}
+
+#define NV2A_GL_STATE_UPDATE(field, ...) ({ \
+        typeof(g_nv2a_gl_state.field) value_ = __VA_ARGS__; \
+        nv2a_gl_state_update(&g_nv2a_gl_state.field, &value_, \
+                             sizeof(value_)); \
+    })
+
+static inline int nv2a_gl_state_texture_target(GLenum target)
+{
+    switch (target) {
+    #define _X(x) case x: return NV2A_GL_STATE_##x;
+    NV2A_GL_STATE_TEXTURE_TARGETS_XMAC
+    #undef _X
+    default: return -1;
+    }
+}
+
+static inline int nv2a_gl_state_cap(GLenum cap)
+{
+    switch (cap) {
+    #define _X(x) case x: return NV2A_GL_STATE_##x;
+    NV2A_GL_STATE_CAPS_XMAC
+    #undef _X
+    default: return -1;
+    }
+}
+
+static inline int nv2a_gl_state_pixel_store(GLenum pname)
+{
+    switch (pname) {
+    #define _X(x) case x: return NV2A_GL_STATE_##x;
+    NV2A_GL_STATE_PIXEL_STORE_XMAC
+    #undef _X
+    default: return -1;
+    }
+}
+
+static inline void nv2a_gl_active_texture(GLenum texture)
+{
+    if (NV2A_GL_STATE_UPDATE(active_texture, texture)) {
+        glActiveTexture(texture);
+    }
+}
+
+static inline void nv2a_gl_bind_texture(GLenum target, GLuint texture)
+{
+    unsigned int unit = g_nv2a_gl_state.active_texture - GL_TEXTURE0;
+    int idx = nv2a_gl_state_texture_target(target);
+
+    if (unit >= NV2A_GL_STATE_TEXTURE_UNITS || idx < 0) {
+        g_nv2a_stats.frame_working.counters[NV2A_PROF_GL_CALLS]++;
+        glBindTexture(target, texture);
+    } else if (NV2A_GL_STATE_UPDATE(textures[unit][idx], texture)) {
+        glBindTexture(target, texture);
+    }
+}
+
+/*
+ * Texture bound to target on the active unit, as glGet would return it. False
+ * if not known, in which case nothing can be relying on it.
+ */
+static inline bool nv2a_gl_get_texture_binding(GLenum target, GLuint *texture)
+{
+    unsigned int unit = g_nv2a_gl_state.active_texture - GL_TEXTURE0;
+    int idx = nv2a_gl_state_texture_target(target);
+
+    assert(unit < NV2A_GL_STATE_TEXTURE_UNITS && idx >= 0);
+    *texture = g_nv2a_gl_state.textures[unit][idx];
+    return *texture != (GLuint)-1;
+}
+
+static inline void nv2a_gl_use_program(GLuint program)
+{
+    if (NV2A_GL_STATE_UPDATE(program, program)) {
+        glUseProgram(program);
+    }
+}
+
+/* For code that changes the program itself, such as when linking one */
+static inline void nv2a_gl_forget_program(void)
+{
+    g_nv2a_gl_state.program = -1;
+}
+
+static inline void nv2a_gl_bind_vertex_array(GLuint array)
+{
+    if (NV2A_GL_STATE_UPDATE(vertex_array, array)) {
+        glBindVertexArray(array);
+    }
+}
+
+static inline void nv2a_gl_bind_framebuffer(GLenum target, GLuint framebuffer)
+{
+    bool draw = target != GL_READ_FRAMEBUFFER;
+    bool read = target != GL_DRAW_FRAMEBUFFER;
+
+    if ((draw && g_nv2a_gl_state.draw_framebuffer != framebuffer) ||
+        (read && g_nv2a_gl_state.read_framebuffer != framebuffer)) {
+        g_nv2a_stats.frame_working.counters[NV2A_PROF_GL_CALLS]++;
+        glBindFramebuffer(target, framebuffer);
+        if (draw) {
+            g_nv2a_gl_state.draw_framebuffer = framebuffer;
+        }
+        if (read) {
+            g_nv2a_gl_state.read_framebuffer = framebuffer;
+        }
+    } else {
+        g_nv2a_stats.frame_working.counters[NV2A_PROF_GL_CALLS_ELIDED]++;
+    }
+}
+
+static inline void nv2a_gl_set_enabled(GLenum cap, bool enabled)
+{
+    int idx = nv2a_gl_state_cap(cap);
+
+    if (idx < 0 || NV2A_GL_STATE_UPDATE(caps[idx], enabled)) {
+        if (enabled) {
+            glEnable(cap);
+        } else {
+            glDisable(cap);
+        }
+    }
+}
+
+static inline void nv2a_gl_enable(GLenum cap)
+{
+    nv2a_gl_set_enabled(cap, true);
+}
+
+static inline void nv2a_gl_disable(GLenum cap)
+{
+    nv2a_gl_set_enabled(cap, false);
+}
+
+static inline void nv2a_gl_pixel_store(GLenum pname, GLint param)
+{
+    int idx = nv2a_gl_state_pixel_store(pname);
+
+    if (idx < 0 || NV2A_GL_STATE_UPDATE(pixel_store[idx], param)) {
+        glPixelStorei(pname, param);
+    }
+}
+
+static inline void nv2a_gl_color_mask(bool red, bool green, bool blue,
+                                      bool alpha)
+{
+    if (NV2A_GL_STATE_UPDATE(color_mask, { red, green, blue, alpha })) {
+        glColorMask(red, green, blue, alpha);
+    }
+}
+
+/* Color mask as last set, false if not known */
+static inline bool nv2a_gl_get_color_mask(bool mask[4])
+{
+    for (int i = 0; i < 4; i++) {
+        if (g_nv2a_gl_state.color_mask[i] > 1) {
+            return false;
+        }
+        mask[i] = g_nv2a_gl_state.color_mask[i];
+    }
+    return true;
+}
+
+static inline void nv2a_gl_depth_mask(bool flag)
+{
+    if (NV2A_GL_STATE_UPDATE(depth_mask, flag)) {
+        glDepthMask(flag);
+    }
+}
+
+static inline void nv2a_gl_stencil_mask(GLuint mask)
+{
+    if (NV2A_GL_STATE_UPDATE(stencil_mask, mask)) {
+        glStencilMask(mask);
+    }
+}
+
+static inline void nv2a_gl_blend_func(GLenum sfactor, GLenum dfactor)
+{
+    if (NV2A_GL_STATE_UPDATE(blend_func, { sfactor, dfactor })) {
+        glBlendFunc(sfactor, dfactor);
+    }
+}
+
+static inline void nv2a_gl_blend_equation(GLenum mode)
+{
+    if (NV2A_GL_STATE_UPDATE(blend_equation, mode)) {
+        glBlendEquation(mode);
+    }
+}
+
+static inline void nv2a_gl_blend_color(GLfloat red, GLfloat green,
+                                       GLfloat blue, GLfloat alpha)
+{
+    if (NV2A_GL_STATE_UPDATE(blend_color, { red, green, blue, alpha })) {
+        glBlendColor(red, green, blue, alpha);
+    }
+}
+
+static inline void nv2a_gl_depth_func(GLenum func)
+{
+    if (NV2A_GL_STATE_UPDATE(depth_func, func)) {
+        glDepthFunc(func);
+    }
+}
+
+static inline void nv2a_gl_stencil_func(GLenum func, GLint ref, GLuint mask)
+{
+    bool changed = NV2A_GL_STATE_UPDATE(stencil_func, func);
+    changed |= NV2A_GL_STATE_UPDATE(stencil_ref, ref);
+    changed |= NV2A_GL_STATE_UPDATE(stencil_func_mask, mask);
+    if (changed) {
+        glStencilFunc(func, ref, mask);
+    }
+}
+
+static inline void nv2a_gl_stencil_op(GLenum sfail, GLenum dpfail,
+                                      GLenum dppass)
+{
+    if (NV2A_GL_STATE_UPDATE(stencil_op, { sfail, dpfail, dppass })) {
+        glStencilOp(sfail, dpfail, dppass);
+    }
+}
+
+static inline void nv2a_gl_cull_face(GLenum mode)
+{
+    if (NV2A_GL_STATE_UPDATE(cull_face, mode)) {
+        glCullFace(mode);
+    }
+}
+
+static inline void nv2a_gl_front_face(GLenum mode)
+{
+    if (NV2A_GL_STATE_UPDATE(front_face, mode)) {
+        glFrontFace(mode);
+    }
+}
+
+static inline void nv2a_gl_polygon_offset(GLfloat factor, GLfloat units)
+{
+    if (NV2A_GL_STATE_UPDATE(polygon_offset, { factor, units })) {
+        glPolygonOffset(factor, units);
+    }
+}
+
+static inline void nv2a_gl_viewport(GLint x, GLint y, GLsizei width,
+                                    GLsizei height)
+{
+    if (NV2A_GL_STATE_UPDATE(viewport, { x, y, width, height })) {
+        glViewport(x, y, width, height);
+    }
+}
+
+static inline void nv2a_gl_scissor(GLint x, GLint y, GLsizei width,
+                                   GLsizei height)
+{
+    if (NV2A_GL_STATE_UPDATE(scissor, { x, y, width, height })) {
+        glScissor(x, y, width, height);
+    }
+}
+
+#endif
@@ -144,6 +144,22 @@ bool lru_contains_hash(Lru *lru, uint64_t hash)
 	return false;
 }
 
+/* Find the node matching key without inserting it or updating its recency. */
+static inline
+LruNode *lru_find(Lru *lru, uint64_t hash, void *key)
+{
+	unsigned int bin = lru_hash_to_bin(lru, hash);
+	LruNode *iter;
+
+	QTAILQ_FOREACH(iter, &lru->bins[bin], next_bin) {
+		if ((iter->hash == hash) && !lru->compare_nodes(lru, iter, key)) {
+			return iter;
+		}
+	}
+
+	return NULL;
+}
+
 static inline
 LruNode *lru_lookup(Lru *lru, uint64_t hash, void *key)
 {
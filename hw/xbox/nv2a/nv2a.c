@@ -216,6 +216,8 @@ static void nv2a_init_memory(NV2AState *d, MemoryRegion *ram)
     /* fire up pfifo */
     qemu_thread_create(&d->pfifo.thread, "nv2a.pfifo_thread",
                        pfifo_thread, d, QEMU_THREAD_JOINABLE);
+    qemu_thread_create(&d->pfifo.puller_thread, "nv2a.pfifo_puller",
+                       pfifo_puller_thread, d, QEMU_THREAD_JOINABLE);
 }
 
 static void nv2a_init_vga(NV2AState *d)
@@ -244,9 +246,12 @@ static void nv2a_init_vga(NV2AState *d)
 static void nv2a_lock_fifo(NV2AState *d)
 {
     qemu_mutex_lock(&d->pfifo.lock);
-    qemu_cond_broadcast(&d->pfifo.fifo_cond);
     qemu_mutex_unlock_iothread();
-    qemu_cond_wait(&d->pfifo.fifo_idle_cond, &d->pfifo.lock);
+    /* The puller may have been kicked again before we got the lock back */
+    do {
+        qemu_cond_broadcast(&d->pfifo.fifo_cond);
+        qemu_cond_wait(&d->pfifo.fifo_idle_cond, &d->pfifo.lock);
+    } while (!pfifo_is_idle(d));
     qemu_mutex_lock_iothread();
     qemu_mutex_lock(&d->pgraph.lock);
 }
@@ -277,6 +282,7 @@ static void nv2a_reset(NV2AState *d)
     }
 
     memset(d->pfifo.regs, 0, sizeof(d->pfifo.regs));
+    pfifo_queue_reset(d);
     memset(d->pgraph.regs, 0, sizeof(d->pgraph.regs));
     memset(d->pvideo.regs, 0, sizeof(d->pvideo.regs));
 
@@ -307,6 +313,8 @@ static void nv2a_reset(NV2AState *d)
         d->puserdac.palette[i*3+2] = i;
     }
 
+    nv2a_replay_reset(d);
+
     nv2a_unlock_fifo(d);
 }
 
@@ -335,6 +343,10 @@ static void nv2a_realize(PCIDevice *dev, Error **errp)
     qemu_mutex_init(&d->pfifo.lock);
     qemu_cond_init(&d->pfifo.fifo_cond);
     qemu_cond_init(&d->pfifo.fifo_idle_cond);
+    qemu_mutex_init(&d->pfifo.queue.lock);
+    qemu_cond_init(&d->pfifo.queue.cond);
+    /* The puller isn't idle until it first parks */
+    d->pfifo.queue.busy = true;
 }
 
 static void nv2a_exitfn(PCIDevice *dev)
@@ -346,6 +358,10 @@ static void nv2a_exitfn(PCIDevice *dev)
 
     qemu_cond_broadcast(&d->pfifo.fifo_cond);
     qemu_thread_join(&d->pfifo.thread);
+    qemu_mutex_lock(&d->pfifo.queue.lock);
+    qemu_cond_broadcast(&d->pfifo.queue.cond);
+    qemu_mutex_unlock(&d->pfifo.queue.lock);
+    qemu_thread_join(&d->pfifo.puller_thread);
 
     pgraph_destroy(&d->pgraph);
 }
@@ -402,6 +418,8 @@ static int nv2a_pre_load(void *opaque)
 {
     NV2AState *d = opaque;
     nv2a_lock_fifo(d);
+    /* Anything still queued was decoded from the state being replaced */
+    pfifo_queue_reset(d);
     return 0;
 }
 
@@ -423,6 +441,159 @@ const VMStateDescription vmstate_nv2a_pgraph_vertex_attributes = {
     }
 };
 
+static bool nv2a_pfifo_queue_needed(void *opaque)
+{
+    NV2AState *d = opaque;
+    return d->pfifo.queue.head != d->pfifo.queue.tail;
+}
+
+static int nv2a_pfifo_queue_post_load(void *opaque, int version_id)
+{
+    NV2AState *d = opaque;
+    PFIFOMethodQueue *q = &d->pfifo.queue;
+
+    if (q->head >= NV2A_METHOD_QUEUE_WORDS ||
+        q->tail >= NV2A_METHOD_QUEUE_WORDS ||
+        q->wrap > NV2A_METHOD_QUEUE_WORDS) {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/* Methods left behind a pgraph stall, DMA_GET is already past them */
+static const VMStateDescription vmstate_nv2a_pfifo_queue = {
+    .name = "nv2a/pfifo-queue",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = nv2a_pfifo_queue_needed,
+    .post_load = nv2a_pfifo_queue_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32_ARRAY(pfifo.queue.words, NV2AState,
+                             NV2A_METHOD_QUEUE_WORDS),
+        VMSTATE_UINT32(pfifo.queue.head, NV2AState),
+        VMSTATE_UINT32(pfifo.queue.tail, NV2AState),
+        VMSTATE_UINT32(pfifo.queue.wrap, NV2AState),
+        VMSTATE_BOOL(pfifo.queue.sync_pending, NV2AState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateField vmstate_nv2a_fields[] = {
+    // FIXME: Split this up into subsections
+    VMSTATE_PCI_DEVICE(parent_obj, NV2AState),
+    VMSTATE_STRUCT(vga, NV2AState, 0, vmstate_vga_common, VGACommonState),
+    VMSTATE_UINT32(pgraph.pending_interrupts, NV2AState),
+    VMSTATE_UINT32(pgraph.enabled_interrupts, NV2AState),
+    VMSTATE_UINT64(pgraph.context_surfaces_2d.object_instance, NV2AState),
+    VMSTATE_UINT64(pgraph.context_surfaces_2d.dma_image_source, NV2AState),
+    VMSTATE_UINT64(pgraph.context_surfaces_2d.dma_image_dest, NV2AState),
+    VMSTATE_UINT32(pgraph.context_surfaces_2d.color_format, NV2AState),
+    VMSTATE_UINT32(pgraph.context_surfaces_2d.source_pitch, NV2AState),
+    VMSTATE_UINT32(pgraph.context_surfaces_2d.dest_pitch, NV2AState),
+    VMSTATE_UINT64(pgraph.context_surfaces_2d.source_offset, NV2AState),
+    VMSTATE_UINT64(pgraph.context_surfaces_2d.dest_offset, NV2AState),
+    VMSTATE_UINT64(pgraph.image_blit.object_instance, NV2AState),
+    VMSTATE_UINT64(pgraph.image_blit.context_surfaces, NV2AState),
+    VMSTATE_UINT32(pgraph.image_blit.operation, NV2AState),
+    VMSTATE_UINT32(pgraph.image_blit.in_x, NV2AState),
+    VMSTATE_UINT32(pgraph.image_blit.in_y, NV2AState),
+    VMSTATE_UINT32(pgraph.image_blit.out_x, NV2AState),
+    VMSTATE_UINT32(pgraph.image_blit.out_y, NV2AState),
+    VMSTATE_UINT32(pgraph.image_blit.width, NV2AState),
+    VMSTATE_UINT32(pgraph.image_blit.height, NV2AState),
+    VMSTATE_UINT64(pgraph.kelvin.object_instance, NV2AState),
+    VMSTATE_UINT64(pgraph.dma_color, NV2AState),
+    VMSTATE_UINT64(pgraph.dma_zeta, NV2AState),
+    VMSTATE_BOOL(pgraph.surface_color.draw_dirty, NV2AState),
+    VMSTATE_BOOL(pgraph.surface_zeta.draw_dirty, NV2AState),
+    VMSTATE_BOOL(pgraph.surface_color.buffer_dirty, NV2AState),
+    VMSTATE_BOOL(pgraph.surface_zeta.buffer_dirty, NV2AState),
+    VMSTATE_BOOL(pgraph.surface_color.write_enabled_cache, NV2AState),
+    VMSTATE_BOOL(pgraph.surface_zeta.write_enabled_cache, NV2AState),
+    VMSTATE_UINT32(pgraph.surface_color.pitch, NV2AState),
+    VMSTATE_UINT32(pgraph.surface_zeta.pitch, NV2AState),
+    VMSTATE_UINT64(pgraph.surface_color.offset, NV2AState),
+    VMSTATE_UINT64(pgraph.surface_zeta.offset, NV2AState),
+    VMSTATE_UINT32(pgraph.surface_type, NV2AState),
+    VMSTATE_UINT32(pgraph.surface_shape.z_format, NV2AState),
+    VMSTATE_UINT32(pgraph.surface_shape.color_format, NV2AState),
+    VMSTATE_UINT32(pgraph.surface_shape.zeta_format, NV2AState),
+    VMSTATE_UINT32(pgraph.surface_shape.log_width, NV2AState),
+    VMSTATE_UINT32(pgraph.surface_shape.log_height, NV2AState),
+    VMSTATE_UINT32(pgraph.surface_shape.clip_x, NV2AState),
+    VMSTATE_UINT32_V(pgraph.surface_shape.clip_y, NV2AState, 2),
+    VMSTATE_UINT32(pgraph.surface_shape.clip_width, NV2AState),
+    VMSTATE_UINT32(pgraph.surface_shape.clip_height, NV2AState),
+    VMSTATE_UINT32(pgraph.surface_shape.anti_aliasing, NV2AState),
+    VMSTATE_UINT32(pgraph.last_surface_shape.z_format, NV2AState),
+    VMSTATE_UINT32(pgraph.last_surface_shape.color_format, NV2AState),
+    VMSTATE_UINT32(pgraph.last_surface_shape.zeta_format, NV2AState),
+    VMSTATE_UINT32(pgraph.last_surface_shape.log_width, NV2AState),
+    VMSTATE_UINT32(pgraph.last_surface_shape.log_height, NV2AState),
+    VMSTATE_UINT32(pgraph.last_surface_shape.clip_x, NV2AState),
+    VMSTATE_UINT32_V(pgraph.last_surface_shape.clip_y, NV2AState, 2),
+    VMSTATE_UINT32(pgraph.last_surface_shape.clip_width, NV2AState),
+    VMSTATE_UINT32(pgraph.last_surface_shape.clip_height, NV2AState),
+    VMSTATE_UINT32(pgraph.last_surface_shape.anti_aliasing, NV2AState),
+    VMSTATE_UINT64(pgraph.dma_a, NV2AState),
+    VMSTATE_UINT64(pgraph.dma_b, NV2AState),
+    VMSTATE_UINT64(pgraph.dma_state, NV2AState),
+    VMSTATE_UINT64(pgraph.dma_notifies, NV2AState),
+    VMSTATE_UINT64(pgraph.dma_semaphore, NV2AState),
+    VMSTATE_UINT64(pgraph.dma_report, NV2AState),
+    VMSTATE_UINT64(pgraph.report_offset, NV2AState),
+    VMSTATE_UINT64(pgraph.dma_vertex_a, NV2AState),
+    VMSTATE_UINT64(pgraph.dma_vertex_b, NV2AState),
+    VMSTATE_UINT32(pgraph.primitive_mode, NV2AState),
+    VMSTATE_UINT32_ARRAY(pgraph.vertex_state_shader_v0, NV2AState, 4),
+    VMSTATE_UINT32_2DARRAY(pgraph.program_data, NV2AState, NV2A_MAX_TRANSFORM_PROGRAM_LENGTH, VSH_TOKEN_SIZE),
+    VMSTATE_UINT32_2DARRAY(pgraph.vsh_constants, NV2AState, NV2A_VERTEXSHADER_CONSTANTS, 4),
+    VMSTATE_BOOL_ARRAY(pgraph.vsh_constants_dirty, NV2AState, NV2A_VERTEXSHADER_CONSTANTS),
+    VMSTATE_UINT32_2DARRAY(pgraph.ltctxa, NV2AState, NV2A_LTCTXA_COUNT, 4),
+    VMSTATE_BOOL_ARRAY(pgraph.ltctxa_dirty, NV2AState, NV2A_LTCTXA_COUNT),
+    VMSTATE_UINT32_2DARRAY(pgraph.ltctxb, NV2AState, NV2A_LTCTXB_COUNT, 4),
+    VMSTATE_BOOL_ARRAY(pgraph.ltctxb_dirty, NV2AState, NV2A_LTCTXB_COUNT),
+    VMSTATE_UINT32_2DARRAY(pgraph.ltc1, NV2AState, NV2A_LTC1_COUNT, 4),
+    VMSTATE_BOOL_ARRAY(pgraph.ltc1_dirty, NV2AState, NV2A_LTC1_COUNT),
+    VMSTATE_STRUCT_ARRAY(pgraph.vertex_attributes, NV2AState, NV2A_VERTEXSHADER_ATTRIBUTES, 1, vmstate_nv2a_pgraph_vertex_attributes, VertexAttribute),
+    VMSTATE_UINT32(pgraph.inline_array_length, NV2AState),
+    VMSTATE_UINT32_ARRAY(pgraph.inline_array, NV2AState, NV2A_MAX_BATCH_LENGTH),
+    VMSTATE_UINT32(pgraph.inline_elements_length, NV2AState), // fixme
+    VMSTATE_UINT32_ARRAY(pgraph.inline_elements, NV2AState, NV2A_MAX_BATCH_LENGTH),
+    VMSTATE_UINT32(pgraph.inline_buffer_length, NV2AState), // fixme
+    VMSTATE_UINT32(pgraph.draw_arrays_length, NV2AState),
+    VMSTATE_UINT32(pgraph.draw_arrays_max_count, NV2AState),
+    VMSTATE_INT32_ARRAY(pgraph.gl_draw_arrays_start, NV2AState, 1250),
+    VMSTATE_INT32_ARRAY(pgraph.gl_draw_arrays_count, NV2AState, 1250),
+    VMSTATE_UINT32_ARRAY(pgraph.regs, NV2AState, 0x2000),
+    VMSTATE_UINT32(pmc.pending_interrupts, NV2AState),
+    VMSTATE_UINT32(pmc.enabled_interrupts, NV2AState),
+    VMSTATE_UINT32(pfifo.pending_interrupts, NV2AState),
+    VMSTATE_UINT32(pfifo.enabled_interrupts, NV2AState),
+    VMSTATE_UINT32_ARRAY(pfifo.regs, NV2AState, 0x2000),
+    VMSTATE_UINT32_ARRAY(pvideo.regs, NV2AState, 0x1000),
+    VMSTATE_UINT32(ptimer.pending_interrupts, NV2AState),
+    VMSTATE_UINT32(ptimer.enabled_interrupts, NV2AState),
+    VMSTATE_UINT32(ptimer.numerator, NV2AState),
+    VMSTATE_UINT32(ptimer.denominator, NV2AState),
+    VMSTATE_UINT32(ptimer.alarm_time, NV2AState),
+    VMSTATE_UINT32_ARRAY(pfb.regs, NV2AState, 0x1000),
+    VMSTATE_UINT32(pcrtc.pending_interrupts, NV2AState),
+    VMSTATE_UINT32(pcrtc.enabled_interrupts, NV2AState),
+    VMSTATE_UINT64(pcrtc.start, NV2AState),
+    VMSTATE_UINT32(pramdac.core_clock_coeff, NV2AState),
+    VMSTATE_UINT64(pramdac.core_clock_freq, NV2AState),
+    VMSTATE_UINT32(pramdac.memory_clock_coeff, NV2AState),
+    VMSTATE_UINT32(pramdac.video_clock_coeff, NV2AState),
+    VMSTATE_UINT16(puserdac.write_mode_address, NV2AState),
+    VMSTATE_UINT8_ARRAY(puserdac.palette, NV2AState, 256*3),
+    VMSTATE_BOOL(pgraph.waiting_for_flip, NV2AState),
+    VMSTATE_BOOL(pgraph.waiting_for_nop, NV2AState),
+    VMSTATE_UNUSED(1),
+    VMSTATE_BOOL(pgraph.waiting_for_context_switch, NV2AState),
+    VMSTATE_END_OF_LIST()
+};
+
 static const VMStateDescription vmstate_nv2a = {
     .name = "nv2a",
     .version_id = 2,
@@ -430,121 +601,19 @@ static const VMStateDescription vmstate_nv2a = {
     .post_save = nv2a_post_save,
     .post_load = nv2a_post_load,
     .pre_load = nv2a_pre_load,
-    .fields = (VMStateField[]) {
-        // FIXME: Split this up into subsections
-        VMSTATE_PCI_DEVICE(parent_obj, NV2AState),
-        VMSTATE_STRUCT(vga, NV2AState, 0, vmstate_vga_common, VGACommonState),
-        VMSTATE_UINT32(pgraph.pending_interrupts, NV2AState),
-        VMSTATE_UINT32(pgraph.enabled_interrupts, NV2AState),
-        VMSTATE_UINT64(pgraph.context_surfaces_2d.object_instance, NV2AState),
-        VMSTATE_UINT64(pgraph.context_surfaces_2d.dma_image_source, NV2AState),
-        VMSTATE_UINT64(pgraph.context_surfaces_2d.dma_image_dest, NV2AState),
-        VMSTATE_UINT32(pgraph.context_surfaces_2d.color_format, NV2AState),
-        VMSTATE_UINT32(pgraph.context_surfaces_2d.source_pitch, NV2AState),
-        VMSTATE_UINT32(pgraph.context_surfaces_2d.dest_pitch, NV2AState),
-        VMSTATE_UINT64(pgraph.context_surfaces_2d.source_offset, NV2AState),
-        VMSTATE_UINT64(pgraph.context_surfaces_2d.dest_offset, NV2AState),
-        VMSTATE_UINT64(pgraph.image_blit.object_instance, NV2AState),
-        VMSTATE_UINT64(pgraph.image_blit.context_surfaces, NV2AState),
-        VMSTATE_UINT32(pgraph.image_blit.operation, NV2AState),
-        VMSTATE_UINT32(pgraph.image_blit.in_x, NV2AState),
-        VMSTATE_UINT32(pgraph.image_blit.in_y, NV2AState),
-        VMSTATE_UINT32(pgraph.image_blit.out_x, NV2AState),
-        VMSTATE_UINT32(pgraph.image_blit.out_y, NV2AState),
-        VMSTATE_UINT32(pgraph.image_blit.width, NV2AState),
-        VMSTATE_UINT32(pgraph.image_blit.height, NV2AState),
-        VMSTATE_UINT64(pgraph.kelvin.object_instance, NV2AState),
-        VMSTATE_UINT64(pgraph.dma_color, NV2AState),
-        VMSTATE_UINT64(pgraph.dma_zeta, NV2AState),
-        VMSTATE_BOOL(pgraph.surface_color.draw_dirty, NV2AState),
-        VMSTATE_BOOL(pgraph.surface_zeta.draw_dirty, NV2AState),
-        VMSTATE_BOOL(pgraph.surface_color.buffer_dirty, NV2AState),
-        VMSTATE_BOOL(pgraph.surface_zeta.buffer_dirty, NV2AState),
-        VMSTATE_BOOL(pgraph.surface_color.write_enabled_cache, NV2AState),
-        VMSTATE_BOOL(pgraph.surface_zeta.write_enabled_cache, NV2AState),
-        VMSTATE_UINT32(pgraph.surface_color.pitch, NV2AState),
-        VMSTATE_UINT32(pgraph.surface_zeta.pitch, NV2AState),
-        VMSTATE_UINT64(pgraph.surface_color.offset, NV2AState),
-        VMSTATE_UINT64(pgraph.surface_zeta.offset, NV2AState),
-        VMSTATE_UINT32(pgraph.surface_type, NV2AState),
-        VMSTATE_UINT32(pgraph.surface_shape.z_format, NV2AState),
-        VMSTATE_UINT32(pgraph.surface_shape.color_format, NV2AState),
-        VMSTATE_UINT32(pgraph.surface_shape.zeta_format, NV2AState),
-        VMSTATE_UINT32(pgraph.surface_shape.log_width, NV2AState),
-        VMSTATE_UINT32(pgraph.surface_shape.log_height, NV2AState),
-        VMSTATE_UINT32(pgraph.surface_shape.clip_x, NV2AState),
-        VMSTATE_UINT32_V(pgraph.surface_shape.clip_y, NV2AState, 2),
-        VMSTATE_UINT32(pgraph.surface_shape.clip_width, NV2AState),
-        VMSTATE_UINT32(pgraph.surface_shape.clip_height, NV2AState),
-        VMSTATE_UINT32(pgraph.surface_shape.anti_aliasing, NV2AState),
-        VMSTATE_UINT32(pgraph.last_surface_shape.z_format, NV2AState),
-        VMSTATE_UINT32(pgraph.last_surface_shape.color_format, NV2AState),
-        VMSTATE_UINT32(pgraph.last_surface_shape.zeta_format, NV2AState),
-        VMSTATE_UINT32(pgraph.last_surface_shape.log_width, NV2AState),
-        VMSTATE_UINT32(pgraph.last_surface_shape.log_height, NV2AState),
-        VMSTATE_UINT32(pgraph.last_surface_shape.clip_x, NV2AState),
-        VMSTATE_UINT32_V(pgraph.last_surface_shape.clip_y, NV2AState, 2),
-        VMSTATE_UINT32(pgraph.last_surface_shape.clip_width, NV2AState),
-        VMSTATE_UINT32(pgraph.last_surface_shape.clip_height, NV2AState),
-        VMSTATE_UINT32(pgraph.last_surface_shape.anti_aliasing, NV2AState),
-        VMSTATE_UINT64(pgraph.dma_a, NV2AState),
-        VMSTATE_UINT64(pgraph.dma_b, NV2AState),
-        VMSTATE_UINT64(pgraph.dma_state, NV2AState),
-        VMSTATE_UINT64(pgraph.dma_notifies, NV2AState),
-        VMSTATE_UINT64(pgraph.dma_semaphore, NV2AState),
-        VMSTATE_UINT64(pgraph.dma_report, NV2AState),
-        VMSTATE_UINT64(pgraph.report_offset, NV2AState),
-        VMSTATE_UINT64(pgraph.dma_vertex_a, NV2AState),
-        VMSTATE_UINT64(pgraph.dma_vertex_b, NV2AState),
-        VMSTATE_UINT32(pgraph.primitive_mode, NV2AState),
-        VMSTATE_UINT32_ARRAY(pgraph.vertex_state_shader_v0, NV2AState, 4),
-        VMSTATE_UINT32_2DARRAY(pgraph.program_data, NV2AState, NV2A_MAX_TRANSFORM_PROGRAM_LENGTH, VSH_TOKEN_SIZE),
-        VMSTATE_UINT32_2DARRAY(pgraph.vsh_constants, NV2AState, NV2A_VERTEXSHADER_CONSTANTS, 4),
-        VMSTATE_BOOL_ARRAY(pgraph.vsh_constants_dirty, NV2AState, NV2A_VERTEXSHADER_CONSTANTS),
-        VMSTATE_UINT32_2DARRAY(pgraph.ltctxa, NV2AState, NV2A_LTCTXA_COUNT, 4),
-        VMSTATE_BOOL_ARRAY(pgraph.ltctxa_dirty, NV2AState, NV2A_LTCTXA_COUNT),
-        VMSTATE_UINT32_2DARRAY(pgraph.ltctxb, NV2AState, NV2A_LTCTXB_COUNT, 4),
-        VMSTATE_BOOL_ARRAY(pgraph.ltctxb_dirty, NV2AState, NV2A_LTCTXB_COUNT),
-        VMSTATE_UINT32_2DARRAY(pgraph.ltc1, NV2AState, NV2A_LTC1_COUNT, 4),
-        VMSTATE_BOOL_ARRAY(pgraph.ltc1_dirty, NV2AState, NV2A_LTC1_COUNT),
-        VMSTATE_STRUCT_ARRAY(pgraph.vertex_attributes, NV2AState, NV2A_VERTEXSHADER_ATTRIBUTES, 1, vmstate_nv2a_pgraph_vertex_attributes, VertexAttribute),
-        VMSTATE_UINT32(pgraph.inline_array_length, NV2AState),
-        VMSTATE_UINT32_ARRAY(pgraph.inline_array, NV2AState, NV2A_MAX_BATCH_LENGTH),
-        VMSTATE_UINT32(pgraph.inline_elements_length, NV2AState), // fixme
-        VMSTATE_UINT32_ARRAY(pgraph.inline_elements, NV2AState, NV2A_MAX_BATCH_LENGTH),
-        VMSTATE_UINT32(pgraph.inline_buffer_length, NV2AState), // fixme
-        VMSTATE_UINT32(pgraph.draw_arrays_length, NV2AState),
-        VMSTATE_UINT32(pgraph.draw_arrays_max_count, NV2AState),
-        VMSTATE_INT32_ARRAY(pgraph.gl_draw_arrays_start, NV2AState, 1250),
-        VMSTATE_INT32_ARRAY(pgraph.gl_draw_arrays_count, NV2AState, 1250),
-        VMSTATE_UINT32_ARRAY(pgraph.regs, NV2AState, 0x2000),
-        VMSTATE_UINT32(pmc.pending_interrupts, NV2AState),
-        VMSTATE_UINT32(pmc.enabled_interrupts, NV2AState),
-        VMSTATE_UINT32(pfifo.pending_interrupts, NV2AState),
-        VMSTATE_UINT32(pfifo.enabled_interrupts, NV2AState),
-        VMSTATE_UINT32_ARRAY(pfifo.regs, NV2AState, 0x2000),
-        VMSTATE_UINT32_ARRAY(pvideo.regs, NV2AState, 0x1000),
-        VMSTATE_UINT32(ptimer.pending_interrupts, NV2AState),
-        VMSTATE_UINT32(ptimer.enabled_interrupts, NV2AState),
-        VMSTATE_UINT32(ptimer.numerator, NV2AState),
-        VMSTATE_UINT32(ptimer.denominator, NV2AState),
-        VMSTATE_UINT32(ptimer.alarm_time, NV2AState),
-        VMSTATE_UINT32_ARRAY(pfb.regs, NV2AState, 0x1000),
-        VMSTATE_UINT32(pcrtc.pending_interrupts, NV2AState),
-        VMSTATE_UINT32(pcrtc.enabled_interrupts, NV2AState),
-        VMSTATE_UINT64(pcrtc.start, NV2AState),
-        VMSTATE_UINT32(pramdac.core_clock_coeff, NV2AState),
-        VMSTATE_UINT64(pramdac.core_clock_freq, NV2AState),
-        VMSTATE_UINT32(pramdac.memory_clock_coeff, NV2AState),
-        VMSTATE_UINT32(pramdac.video_clock_coeff, NV2AState),
-        VMSTATE_UINT16(puserdac.write_mode_address, NV2AState),
-        VMSTATE_UINT8_ARRAY(puserdac.palette, NV2AState, 256*3),
-        VMSTATE_BOOL(pgraph.waiting_for_flip, NV2AState),
-        VMSTATE_BOOL(pgraph.waiting_for_nop, NV2AState),
-        VMSTATE_UNUSED(1),
-        VMSTATE_BOOL(pgraph.waiting_for_context_switch, NV2AState),
-        VMSTATE_END_OF_LIST()
-    },
+    .fields = vmstate_nv2a_fields,
+    .subsections = (const VMStateDescription*[]) {
+        &vmstate_nv2a_pfifo_queue,
+        NULL
+    }
+};
+
+/* Everything after the PCI and VGA state, saved in push buffer captures */
+const VMStateDescription vmstate_nv2a_capture = {
+    .name = "nv2a/capture",
+    .version_id = 2,
+    .minimum_version_id = 1,
+    .fields = &vmstate_nv2a_fields[2],
 };
 
 static void nv2a_class_init(ObjectClass *klass, void *data)
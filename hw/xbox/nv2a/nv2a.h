@@ -28,5 +28,8 @@ void nv2a_set_surface_scale_factor(unsigned int scale);
 unsigned int nv2a_get_surface_scale_factor(void);
 const uint8_t *nv2a_get_dac_palette(void);
 int nv2a_get_screen_off(void);
+bool nv2a_capture_start(const char *path, unsigned int num_frames);
+bool nv2a_capture_active(void);
+void nv2a_replay_init(const char *path);
 
 #endif
@@ -50,6 +50,7 @@
 
 #include "nv2a.h"
 #include "debug.h"
+#include "gl_state.h"
 #include "shaders.h"
 #include "nv2a_regs.h"
 
@@ -152,6 +153,10 @@ typedef struct SurfaceBinding {
 
     GLuint gl_buffer;
 
+    GLuint readback_pbo;
+    GLsync readback_fence;
+    bool readback_pending;
+
     bool cleared;
     int frame_time;
     int draw_time;
@@ -196,13 +201,79 @@ typedef struct TextureKey {
     hwaddr palette_length;
 } TextureKey;
 
+/* Textures are indexed by the VRAM buckets their data and palette overlap */
+#define NV2A_TEXTURE_INDEX_BUCKET_SHIFT 18
+
+typedef struct TextureIndexLink {
+    QLIST_ENTRY(TextureIndexLink) entry;
+    struct TextureLruNode *node;
+} TextureIndexLink;
+
 typedef struct TextureLruNode {
     LruNode node;
     TextureKey key;
     TextureBinding *binding;
     bool possibly_dirty;
+    TextureIndexLink *index_links;
+    unsigned int num_index_links;
 } TextureLruNode;
 
+#define NV2A_MAX_TEXTURE_LEVELS 16
+
+/*
+ * Inline vertex and index data is streamed through a ring of this size, fenced
+ * in equal segments. A single upload must fit in a segment.
+ */
+#define NV2A_STREAM_BUFFER_SIZE (32 * MiB)
+#define NV2A_STREAM_BUFFER_SEGMENTS 8
+#define NV2A_STREAM_BUFFER_ALIGN 16
+
+/*
+ * Vertex array ranges closer than this are synced to the VRAM mirror as one,
+ * trading a few clean page checks for fewer uploads.
+ */
+#define NV2A_VRAM_MIRROR_MERGE_GAP (64 * KiB)
+
+/* Not used by draws, so the surface upload staging texture can stay bound */
+#define NV2A_SURFACE_UPLOAD_TEXTURE_UNIT NV2A_MAX_TEXTURES
+
+/* CPU side texel data for each face and mipmap level of a texture, ready to
+ * be handed to GL. A NULL level is uploaded straight from texture memory. */
+typedef struct TextureStaging {
+    bool compressed_upload;
+    unsigned int num_faces;
+    unsigned int num_levels;
+    uint8_t *level_data[6][NV2A_MAX_TEXTURE_LEVELS];
+} TextureStaging;
+
+typedef enum TexturePrefetchState {
+    TEXTURE_PREFETCH_QUEUED,
+    TEXTURE_PREFETCH_RUNNING,
+    TEXTURE_PREFETCH_DONE,
+} TexturePrefetchState;
+
+typedef struct TexturePrefetch {
+    QSIMPLEQ_ENTRY(TexturePrefetch) entry;
+    TexturePrefetchState state;
+    bool orphaned;
+
+    TextureKey key;
+    bool compressed_upload;
+    const uint8_t *texture_data;
+    const uint8_t *palette_data;
+
+    /* Hash of the cached binding, which needs no conversion if it matches */
+    bool has_binding;
+    uint64_t binding_hash;
+
+    /* The data may have been written after the worker read it */
+    bool stale;
+
+    /* Filled in by the worker */
+    uint64_t data_hash;
+    TextureStaging *staging;
+} TexturePrefetch;
+
 typedef struct VertexKey {
     size_t count;
     GLuint gl_type;
@@ -214,10 +285,32 @@ typedef struct VertexKey {
 typedef struct VertexLruNode {
     LruNode node;
     VertexKey key;
-    GLuint gl_buffer;
-    bool initialized;
+    bool seen;
+    int buffer; /* Element buffer holding the data, -1 if not resident */
+    size_t offset;
+    size_t size;
+    QTAILQ_ENTRY(VertexLruNode) buffer_entry;
 } VertexLruNode;
 
+/*
+ * Index lists that repeat are suballocated from a few large element buffers,
+ * filled front to back and compacted through a spare buffer when full. Their
+ * data is uploaded in batches, streamed meanwhile.
+ */
+#define NV2A_ELEMENT_CACHE_ENTRIES (50 * 1024)
+#define NV2A_ELEMENT_CACHE_BUFFERS 3
+#define NV2A_ELEMENT_CACHE_ALIGN 16
+#define NV2A_ELEMENT_CACHE_BATCH (256 * KiB)
+
+typedef struct ElementCacheBuffer {
+    GLuint gl_buffer;
+    size_t head;     /* Next free offset */
+    size_t uploaded; /* Data below this offset is on the GPU */
+    size_t live;     /* Bytes held by resident entries */
+    uint8_t *staging; /* Pending data for [uploaded, head) */
+    QTAILQ_HEAD(, VertexLruNode) entries; /* In offset order */
+} ElementCacheBuffer;
+
 typedef struct KelvinState {
     hwaddr object_instance;
 } KelvinState;
@@ -283,6 +376,14 @@ typedef struct PGRAPHState {
         GLint palette_loc[256];
     } disp_rndr;
 
+    struct surf_upload_rndr {
+        GLuint src_fbo, dst_fbo, vao, prog;
+        GLint surface_size_loc, scale_loc;
+        GLuint staging_texture;
+        GLenum staging_internal_format;
+        unsigned int staging_width, staging_height;
+    } surf_upload_rndr;
+
     /* subchannels state we're not sure the location of... */
     ContextSurfaces2DState context_surfaces_2d;
     ImageBlitState image_blit;
@@ -295,6 +396,7 @@ typedef struct PGRAPHState {
     SurfaceShape surface_shape;
     SurfaceShape last_surface_shape;
     QTAILQ_HEAD(, SurfaceBinding) surfaces;
+    GTree *surface_tree;
     SurfaceBinding *color_binding, *zeta_binding;
     struct {
         int clip_x;
@@ -306,16 +408,56 @@ typedef struct PGRAPHState {
     } surface_binding_dim; // FIXME: Refactor
 
     hwaddr dma_a, dma_b;
+    bool texture_compression_s3tc;
     Lru texture_cache;
     TextureLruNode *texture_cache_entries;
+    QLIST_HEAD(, TextureIndexLink) *texture_index;
+    size_t texture_index_size;
     bool texture_dirty[NV2A_MAX_TEXTURES];
     TextureBinding *texture_binding[NV2A_MAX_TEXTURES];
+    TexturePrefetch *texture_prefetch[NV2A_MAX_TEXTURES];
+    struct {
+        QemuMutex lock;
+        QemuCond work_cond;
+        QemuCond done_cond;
+        QSIMPLEQ_HEAD(, TexturePrefetch) queue;
+        QemuThread *threads;
+        unsigned int num_threads;
+        bool shutdown;
+    } texture_prefetch_pool;
 
     Lru shader_cache;
     ShaderLruNode *shader_cache_entries;
     ShaderBinding *shader_binding;
     QemuMutex shader_cache_lock;
     QemuThread shader_disk_thread;
+    ShaderArchive *shader_archive;
+    struct {
+        QemuMutex lock;
+        QemuCond work_cond;
+        QemuCond idle_cond;
+        QSIMPLEQ_HEAD(, ShaderDiskWrite) queue;
+        unsigned int queue_len;
+        bool busy;
+        bool shutdown;
+        QemuThread thread;
+    } shader_writer;
+    struct {
+        QemuMutex lock;
+        QemuCond work_cond;
+        QemuCond done_cond;
+        QSIMPLEQ_HEAD(, ShaderCompileJob) queue;
+        bool shutdown;
+        QemuThread thread;
+    } shader_compiler;
+    bool shader_compile_pending;
+    bool shader_skip_draw;
+
+    /* Key of the bound program, rebuilt block by block as registers change */
+    ShaderState shader_state;
+    uint64_t shader_state_block_hash[SHADER_BLOCK__COUNT];
+    uint64_t shader_state_hash;
+    unsigned int shader_state_dirty;
 
     bool texture_matrix_enable[NV2A_MAX_TEXTURES];
 
@@ -376,10 +518,24 @@ typedef struct PGRAPHState {
 
     Lru element_cache;
     VertexLruNode *element_cache_entries;
+    struct {
+        ElementCacheBuffer buffers[NV2A_ELEMENT_CACHE_BUFFERS];
+        GLuint spare_buffer; /* Compaction target, swapped in afterwards */
+        size_t buffer_size;
+    } element_buffers;
+
+    struct {
+        GLuint gl_buffer;
+        uint8_t *map; /* Persistent mapping, NULL without ARB_buffer_storage */
+        size_t head;
+        unsigned int segment;
+        unsigned int retiring; /* Segments left, fenced after their reads */
+        GLsync fence[NV2A_STREAM_BUFFER_SEGMENTS];
+    } stream_buffer;
 
     unsigned int inline_array_length;
     uint32_t inline_array[NV2A_MAX_BATCH_LENGTH];
-    GLuint gl_inline_array_buffer;
+    GLintptr inline_array_stream_offset;
 
     unsigned int inline_elements_length;
     uint32_t inline_elements[NV2A_MAX_BATCH_LENGTH];
@@ -395,6 +551,18 @@ typedef struct PGRAPHState {
     GLsizei gl_draw_arrays_count[1250];
     bool draw_arrays_prevent_connect;
 
+    /*
+     * Draws whose flush was put off at END, for blocks that follow with no
+     * state change in between to add to. The data they hold comes first in
+     * the inline elements or draw arrays.
+     */
+    struct {
+        bool pending;
+        unsigned int primitive_mode;
+        unsigned int elements;
+        unsigned int arrays;
+    } draw_merge;
+
     GLuint gl_memory_buffer;
     GLuint gl_vertex_array;
 
@@ -417,8 +585,36 @@ typedef struct PGRAPHState {
 
     unsigned int surface_scale_factor;
     uint8_t *scale_buf;
+
+    GLuint readback_src_fbo;
+    GLuint readback_dst_fbo;
+    GLuint readback_texture;
+    uint8_t *download_buf;
+    size_t download_buf_size;
 } PGRAPHState;
 
+/*
+ * Methods decoded by the pusher wait here for the puller, which owns the GL
+ * context. Each run keeps its push buffer encoding, a header word followed by
+ * its data, with jumps, calls and object handles already resolved so that
+ * method lookahead still sees the stream as the guest wrote it.
+ */
+#define NV2A_METHOD_QUEUE_WORDS (16 * KiB)
+
+typedef struct PFIFOMethodQueue {
+    uint32_t words[NV2A_METHOD_QUEUE_WORDS];
+    uint32_t head;       /* Next run to execute, written by the puller */
+    uint32_t tail;       /* Next free word, written by the pusher */
+    uint32_t wrap;       /* Where the pusher last wrapped back to 0 */
+    bool sync_pending;   /* A sync point was queued, decode no further */
+    bool stalled;        /* Puller is waiting on pgraph, not the queue */
+    bool busy;           /* Puller was kicked and hasn't parked since */
+    bool pusher_waiting; /* Pusher wants a kick when the puller moves on */
+    QemuMutex lock;
+    QemuCond cond;
+    bool kick;
+} PFIFOMethodQueue;
+
 typedef struct NV2AState {
     /*< private >*/
     PCIDevice parent_obj;
@@ -451,10 +647,12 @@ typedef struct NV2AState {
         uint32_t regs[0x2000];
         QemuMutex lock;
         QemuThread thread;
+        QemuThread puller_thread;
         QemuCond fifo_cond;
         QemuCond fifo_idle_cond;
         bool fifo_kick;
         bool halt;
+        PFIFOMethodQueue queue;
     } pfifo;
 
     struct {
@@ -513,6 +711,7 @@ typedef struct NV2ABlockInfo {
 extern const NV2ABlockInfo blocktable[NV_NUM_BLOCKS];
 
 extern GloContext *g_nv2a_context_render;
+extern GloContext *g_nv2a_context_shader;
 extern GloContext *g_nv2a_context_display;
 
 void nv2a_update_irq(NV2AState *d);
@@ -578,8 +777,45 @@ void pgraph_process_pending_reports(NV2AState *d);
 void pgraph_process_pending_downloads(NV2AState *d);
 void pgraph_download_dirty_surfaces(NV2AState *d);
 void pgraph_flush(NV2AState *d);
+void pgraph_flush_merged_draws(NV2AState *d);
 
 void *pfifo_thread(void *arg);
+void *pfifo_puller_thread(void *arg);
 void pfifo_kick(NV2AState *d);
+bool pfifo_is_idle(NV2AState *d);
+void pfifo_queue_reset(NV2AState *d);
+
+extern const VMStateDescription vmstate_nv2a_capture;
+void nv2a_capture_methods(uint32_t header, const uint32_t *parameters,
+                          size_t count);
+void nv2a_capture_frame(NV2AState *d);
+bool nv2a_replay_active(void);
+void nv2a_replay_reset(NV2AState *d);
+const uint32_t *nv2a_replay_next_run(NV2AState *d, size_t *len);
+void nv2a_replay_consume(size_t len);
+bool nv2a_replay_at_frame_end(void);
+void nv2a_replay_acknowledge(NV2AState *d);
+void nv2a_replay_end_frame(NV2AState *d);
+
+int64_t nv2a_profile_push(int scope);
+void nv2a_profile_pop(int64_t start);
+void nv2a_profile_pop_method(int64_t start, unsigned int idx);
+void nv2a_profile_frame_end(void);
+
+/* Timed scopes, only to be entered on the puller thread */
+static inline int64_t nv2a_profile_begin(int scope)
+{
+    if (likely(!qatomic_read(&g_nv2a_profile.enabled))) {
+        return 0;
+    }
+    return nv2a_profile_push(scope);
+}
+
+static inline void nv2a_profile_end(int64_t start)
+{
+    if (start) {
+        nv2a_profile_pop(start);
+    }
+}
 
 #endif
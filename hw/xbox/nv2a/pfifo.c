@@ -89,10 +89,20 @@ void pfifo_write(void *opaque, hwaddr addr, uint64_t val, unsigned int size)
     qemu_mutex_unlock(&d->pfifo.lock);
 }
 
+static void pfifo_queue_kick(PFIFOMethodQueue *q)
+{
+    qemu_mutex_lock(&q->lock);
+    q->kick = true;
+    qatomic_set(&q->busy, true);
+    qemu_cond_broadcast(&q->cond);
+    qemu_mutex_unlock(&q->lock);
+}
+
 void pfifo_kick(NV2AState *d)
 {
     d->pfifo.fifo_kick = true;
     qemu_cond_broadcast(&d->pfifo.fifo_cond);
+    pfifo_queue_kick(&d->pfifo.queue);
 }
 
 static bool pgraph_can_fifo_access(NV2AState *d) {
@@ -120,130 +130,248 @@ static bool pgraph_is_flip_stall_complete(NV2AState *d)
     return false;
 }
 
+/* Called with the pgraph lock held */
 static bool pfifo_stall_for_flip(NV2AState *d)
 {
-    bool should_stall = false;
-
-    if (qatomic_read(&d->pgraph.waiting_for_flip)) {
-        qemu_mutex_lock(&d->pgraph.lock);
+    if (d->pgraph.waiting_for_flip) {
         if (!pgraph_is_flip_stall_complete(d)) {
-            should_stall = true;
-        } else {
-            d->pgraph.waiting_for_flip = false;
+            return true;
         }
-        qemu_mutex_unlock(&d->pgraph.lock);
+        d->pgraph.waiting_for_flip = false;
     }
 
-    return should_stall;
+    return false;
+}
+
+/* The pusher's view of the flip stall, it can't clear waiting_for_flip */
+static bool pfifo_pusher_stall_for_flip(NV2AState *d)
+{
+    uint32_t s = qatomic_read(&d->pgraph.regs[NV_PGRAPH_SURFACE]);
+
+    return qatomic_read(&d->pgraph.waiting_for_flip) &&
+           GET_MASK(s, NV_PGRAPH_SURFACE_READ_3D) ==
+               GET_MASK(s, NV_PGRAPH_SURFACE_WRITE_3D);
 }
 
 static bool pfifo_puller_should_stall(NV2AState *d)
 {
-    return pfifo_stall_for_flip(d) || qatomic_read(&d->pgraph.waiting_for_nop) ||
-           qatomic_read(&d->pgraph.waiting_for_context_switch) ||
+    return pfifo_stall_for_flip(d) || d->pgraph.waiting_for_nop ||
+           d->pgraph.waiting_for_context_switch ||
            !pgraph_can_fifo_access(d);
 }
 
-static ssize_t pfifo_run_puller(NV2AState *d, uint32_t method_entry,
-                                uint32_t parameter, uint32_t *parameters,
-                                size_t num_words_available,
-                                size_t max_lookahead_words)
+#define PFIFO_QUEUE_WRAP 0x00000001 /* Encoded like a jump to 0 */
+
+static uint32_t pfifo_queue_header(uint32_t method, unsigned int subchannel,
+                                   bool inc, size_t count)
 {
-    if (pfifo_puller_should_stall(d)) {
-        return -1;
+    assert(count <= 0x7ff);
+    return (inc ? 0 : 0x40000000) | (count << 18) | (subchannel << 13) |
+           method;
+}
+
+/*
+ * Find room for a run of at least min_len words, returning where to write it
+ * and in len how many words fit there, or NULL while the queue is too full.
+ */
+static uint32_t *pfifo_queue_reserve(PFIFOMethodQueue *q, size_t min_len,
+                                     size_t *len)
+{
+    size_t head = qatomic_load_acquire(&q->head);
+    size_t tail = q->tail;
+
+    if (tail >= head) {
+        /* Never let tail catch up with head, that would read as empty */
+        size_t room = NV2A_METHOD_QUEUE_WORDS - tail - (head == 0);
+        if (room >= min_len) {
+            *len = room;
+            return &q->words[tail];
+        }
+        if (head <= min_len) {
+            return NULL;
+        }
+        q->words[tail] = PFIFO_QUEUE_WRAP;
+        q->wrap = tail;
+        tail = 0;
+        qatomic_store_release(&q->tail, tail);
     }
 
+    if (head - tail - 1 < min_len) {
+        return NULL;
+    }
+    *len = head - tail - 1;
+    return &q->words[tail];
+}
+
+static void pfifo_queue_commit(PFIFOMethodQueue *q, size_t len)
+{
+    size_t tail = q->tail + len;
+    if (tail == NV2A_METHOD_QUEUE_WORDS) {
+        q->wrap = tail;
+        tail = 0;
+    }
+    qatomic_store_release(&q->tail, tail);
+}
+
+/* Methods whose effects the CPU may be waiting on, or that stall pgraph */
+static bool pfifo_method_is_sync_point(uint32_t method, uint32_t parameter)
+{
+    switch (method) {
+    case NV097_NO_OPERATION:
+        /* Only a notify stalls */
+        return parameter != 0;
+    case NV_SET_OBJECT:
+    case NV097_WAIT_FOR_IDLE:
+    case NV097_FLIP_STALL:
+    case NV097_GET_REPORT:
+    case NV097_BACK_END_WRITE_SEMAPHORE_RELEASE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ * Decode up to num_words data words of a method run into the queue, returning
+ * how many were taken. Object handles are looked up here, so the puller never
+ * needs the pfifo lock. A run ends at a sync point, so pgraph only ever stalls
+ * on the last method queued.
+ */
+static size_t pfifo_queue_methods(NV2AState *d, uint32_t method,
+                                  unsigned int subchannel, bool inc,
+                                  const uint32_t *words, size_t num_words)
+{
+    PFIFOMethodQueue *q = &d->pfifo.queue;
     uint32_t *pull0 = &d->pfifo.regs[NV_PFIFO_CACHE1_PULL0];
     uint32_t *pull1 = &d->pfifo.regs[NV_PFIFO_CACHE1_PULL1];
     uint32_t *engine_reg = &d->pfifo.regs[NV_PFIFO_CACHE1_ENGINE];
-    uint32_t *status = &d->pfifo.regs[NV_PFIFO_CACHE1_STATUS];
-    ssize_t num_proc = -1;
+    uint32_t *dst;
+    size_t len;
 
-    // TODO think more about locking
-
-    if (!GET_MASK(*pull0, NV_PFIFO_CACHE1_PULL0_ACCESS) ||
-        (*status & NV_PFIFO_CACHE1_STATUS_LOW_MARK)) {
-        return -1;
+    if (!GET_MASK(*pull0, NV_PFIFO_CACHE1_PULL0_ACCESS)) {
+        return 0;
     }
 
-    uint32_t method = method_entry & 0x1FFC;
-    uint32_t subchannel =
-        GET_MASK(method_entry, NV_PFIFO_CACHE1_METHOD_SUBCHANNEL);
-    bool inc = !GET_MASK(method_entry, NV_PFIFO_CACHE1_METHOD_TYPE);
+    assert(subchannel < 8);
+
+    if (method == NV_SET_OBJECT) {
+        /* Binding an object may switch channel, so carry the channel id */
+        dst = pfifo_queue_reserve(q, 3, &len);
+        if (dst == NULL) {
+            return 0;
+        }
 
-    if (method == 0) {
-        RAMHTEntry entry = ramht_lookup(d, parameter);
+        RAMHTEntry entry = ramht_lookup(d, ldl_le_p(words));
         assert(entry.valid);
         // assert(entry.channel_id == state->channel_id);
         assert(entry.engine == ENGINE_GRAPHICS);
 
         /* the engine is bound to the subchannel */
-        assert(subchannel < 8);
         SET_MASK(*engine_reg, 3 << (4*subchannel), entry.engine);
         SET_MASK(*pull1, NV_PFIFO_CACHE1_PULL1_ENGINE, entry.engine);
 
-        // TODO: this is fucked
-        qemu_mutex_unlock(&d->pfifo.lock);
-        qemu_mutex_lock(&d->pgraph.lock);
+        dst[0] = pfifo_queue_header(method, subchannel, inc, 2);
+        dst[1] = entry.instance;
+        dst[2] = entry.channel_id;
+        pfifo_queue_commit(q, 3);
+        q->sync_pending = true;
+        return 1;
+    }
 
-        // Switch contexts if necessary
-        if (pgraph_can_fifo_access(d)) {
-            pgraph_context_switch(d, entry.channel_id);
-            if (!d->pgraph.waiting_for_context_switch) {
-                num_proc =
-                    pgraph_method(d, subchannel, 0, entry.instance, parameters,
-                                  num_words_available, max_lookahead_words, inc);
-            }
-        }
+    assert(method >= 0x100);
 
-        qemu_mutex_unlock(&d->pgraph.lock);
-        qemu_mutex_lock(&d->pfifo.lock);
+    dst = pfifo_queue_reserve(q, 2, &len);
+    if (dst == NULL) {
+        return 0;
+    }
+
+    enum FIFOEngine engine = GET_MASK(*engine_reg, 3 << (4*subchannel));
+    assert(engine == ENGINE_GRAPHICS);
+    SET_MASK(*pull1, NV_PFIFO_CACHE1_PULL1_ENGINE, engine);
 
-    } else if (method >= 0x100) {
-        // method passed to engine
+    size_t count = MIN(num_words, len - 1);
+    for (size_t i = 0; i < count; i++) {
+        uint32_t m = inc ? method + 4 * i : method;
+        uint32_t parameter = ldl_le_p(&words[i]);
 
         /* methods that take objects.
          * TODO: Check this range is correct for the nv2a */
-        if (method >= 0x180 && method < 0x200) {
-            //qemu_mutex_lock_iothread();
+        if (m >= 0x180 && m < 0x200) {
             RAMHTEntry entry = ramht_lookup(d, parameter);
             assert(entry.valid);
             // assert(entry.channel_id == state->channel_id);
             parameter = entry.instance;
-            //qemu_mutex_unlock_iothread();
         }
+        dst[1 + i] = parameter;
+        if (pfifo_method_is_sync_point(m, parameter)) {
+            q->sync_pending = true;
+            count = i + 1;
+            break;
+        }
+    }
+    dst[0] = pfifo_queue_header(method, subchannel, inc, count);
+    pfifo_queue_commit(q, 1 + count);
 
-        enum FIFOEngine engine = GET_MASK(*engine_reg, 3 << (4*subchannel));
-        assert(engine == ENGINE_GRAPHICS);
-        SET_MASK(*pull1, NV_PFIFO_CACHE1_PULL1_ENGINE, engine);
-
-        // TODO: this is fucked
-        qemu_mutex_unlock(&d->pfifo.lock);
-        qemu_mutex_lock(&d->pgraph.lock);
+    return count;
+}
 
-        if (pgraph_can_fifo_access(d)) {
-            num_proc =
-                pgraph_method(d, subchannel, method, parameter, parameters,
-                              num_words_available, max_lookahead_words, inc);
-        }
+/*
+ * Ask the puller for a kick once it next makes progress. Callers check the
+ * queue afterwards, which pairs with the exchange in pfifo_puller_thread.
+ */
+static void pfifo_wait_for_puller(PFIFOMethodQueue *q)
+{
+    qatomic_set(&q->pusher_waiting, true);
+    smp_mb();
+}
 
-        qemu_mutex_unlock(&d->pgraph.lock);
-        qemu_mutex_lock(&d->pfifo.lock);
-    } else {
-        assert(false);
+/*
+ * Only a parked puller is sure not to be holding, or about to take, the pgraph
+ * lock. Whatever it left queued behind a stall is saved with the device state.
+ */
+static bool pfifo_puller_idle(PFIFOMethodQueue *q)
+{
+    pfifo_wait_for_puller(q);
+    if (qatomic_read(&q->busy)) {
+        return false;
     }
+    return qatomic_read(&q->head) == q->tail || qatomic_read(&q->stalled);
+}
 
-    if (num_proc > 0) {
-        *status |= NV_PFIFO_CACHE1_STATUS_LOW_MARK;
-    }
+/* Called with the pfifo lock held, which keeps a parked puller parked */
+bool pfifo_is_idle(NV2AState *d)
+{
+    return pfifo_puller_idle(&d->pfifo.queue);
+}
+
+/* Stop decoding after a sync point until the puller has caught up */
+static bool pfifo_pusher_should_wait_for_sync(NV2AState *d)
+{
+    PFIFOMethodQueue *q = &d->pfifo.queue;
 
-    return num_proc;
+    if (!q->sync_pending) {
+        return false;
+    }
+    pfifo_wait_for_puller(q);
+    /* Pairs with the release in pfifo_run_puller, so pgraph's stall is seen */
+    if (qatomic_load_acquire(&q->head) != q->tail) {
+        return true;
+    }
+    q->sync_pending = false;
+    return false;
 }
 
+/*
+ * Don't decode past what pgraph is stalled on, DMA_GET has to stay with the
+ * methods that have run for the guest to see where pgraph stopped.
+ */
 static bool pfifo_pusher_should_stall(NV2AState *d)
 {
-    return !pgraph_can_fifo_access(d) ||
-           qatomic_read(&d->pgraph.waiting_for_nop);
+    return pfifo_pusher_should_wait_for_sync(d) ||
+           !pgraph_can_fifo_access(d) ||
+           qatomic_read(&d->pgraph.waiting_for_nop) ||
+           qatomic_read(&d->pgraph.waiting_for_context_switch) ||
+           pfifo_pusher_stall_for_flip(d);
 }
 
 static void pfifo_run_pusher(NV2AState *d)
@@ -288,6 +416,7 @@ static void pfifo_run_pusher(NV2AState *d)
 
     hwaddr dma_len;
     uint8_t *dma = nv_dma_map(d, dma_instance, &dma_len);
+    size_t queue_tail = d->pfifo.queue.tail;
 
     while (!pfifo_pusher_should_stall(d)) {
         uint32_t dma_get_v = *dma_get;
@@ -322,25 +451,22 @@ static void pfifo_run_pusher(NV2AState *d)
 
         if (method_count) {
             /* data word of methods command */
-            d->pfifo.regs[NV_PFIFO_CACHE1_DMA_DATA_SHADOW] = word;
-
             assert((method & 3) == 0);
-            uint32_t method_entry = 0;
-            SET_MASK(method_entry, NV_PFIFO_CACHE1_METHOD_ADDRESS, method >> 2);
-            SET_MASK(method_entry, NV_PFIFO_CACHE1_METHOD_TYPE, method_type);
-            SET_MASK(method_entry, NV_PFIFO_CACHE1_METHOD_SUBCHANNEL,
-                     method_subchannel);
 
             *status &= ~NV_PFIFO_CACHE1_STATUS_LOW_MARK;
 
-            ssize_t num_words_processed =
-                pfifo_run_puller(d, method_entry, word, word_ptr,
-                                 MIN(method_count, num_words_available),
-                                 num_words_available);
-            if (num_words_processed < 0) {
+            size_t num_words_processed = pfifo_queue_methods(
+                d, method, method_subchannel,
+                method_type == NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE_INC,
+                word_ptr, MIN(method_count, num_words_available));
+            if (num_words_processed == 0) {
+                pfifo_wait_for_puller(&d->pfifo.queue);
                 break;
             }
 
+            *status |= NV_PFIFO_CACHE1_STATUS_LOW_MARK;
+            d->pfifo.regs[NV_PFIFO_CACHE1_DMA_DATA_SHADOW] =
+                ldl_le_p(word_ptr + num_words_processed - 1);
             dma_get_v += (num_words_processed-1)*4;
 
             if (method_type == NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE_INC) {
@@ -435,6 +561,10 @@ static void pfifo_run_pusher(NV2AState *d)
     // NV2A_DPRINTF("DMA pusher done: max 0x%" HWADDR_PRIx ", 0x%" HWADDR_PRIx " - 0x%" HWADDR_PRIx "\n",
     //      dma_len, control->dma_get, control->dma_put);
 
+    if (d->pfifo.queue.tail != queue_tail) {
+        pfifo_queue_kick(&d->pfifo.queue);
+    }
+
     uint32_t error = GET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_ERROR);
     if (error) {
         NV2A_DPRINTF("pb error: %d\n", error);
@@ -447,39 +577,175 @@ static void pfifo_run_pusher(NV2AState *d)
     }
 }
 
-static void process_requests(NV2AState *d)
+/*
+ * Execute queued methods, with the pgraph lock held. Returns true if there is
+ * more to do right away, false once the queue is empty or pgraph stalls.
+ */
+static bool pfifo_run_puller(NV2AState *d)
 {
-    if (qatomic_read(&d->pgraph.downloads_pending) ||
-        qatomic_read(&d->pgraph.download_dirty_surfaces_pending) ||
-        qatomic_read(&d->pgraph.gl_sync_pending) ||
-        qatomic_read(&d->pgraph.flush_pending) ||
-        qatomic_read(&d->pgraph.shader_cache_writeback_pending)) {
-        qemu_mutex_unlock(&d->pfifo.lock);
-        qemu_mutex_lock(&d->pgraph.lock);
-        if (qatomic_read(&d->pgraph.downloads_pending)) {
-            pgraph_process_pending_downloads(d);
+    const int max_runs = 1024;
+    PFIFOMethodQueue *q = &d->pfifo.queue;
+    size_t head = q->head;
+    size_t tail = qatomic_load_acquire(&q->tail);
+    bool stalled = false;
+    bool capturing = nv2a_capture_active();
+    int runs = 0;
+
+    while (head != tail && runs < max_runs) {
+        if (pfifo_puller_should_stall(d)) {
+            stalled = true;
+            break;
         }
-        if (qatomic_read(&d->pgraph.download_dirty_surfaces_pending)) {
-            pgraph_download_dirty_surfaces(d);
+
+        uint32_t *entry = &q->words[head];
+        if (*entry == PFIFO_QUEUE_WRAP) {
+            head = 0;
+            continue;
         }
-        if (qatomic_read(&d->pgraph.gl_sync_pending)) {
-            pgraph_gl_sync(d);
+
+        uint32_t method = *entry & 0x1ffc;
+        unsigned int subchannel = (*entry >> 13) & 7;
+        size_t count = (*entry >> 18) & 0x7ff;
+        bool inc = !(*entry & 0x40000000);
+        uint32_t *parameters = entry + 1;
+        size_t end = head < tail ? tail : q->wrap;
+        runs++;
+
+        if (method == NV_SET_OBJECT) {
+            // Switch contexts if necessary
+            pgraph_context_switch(d, parameters[1]);
+            if (d->pgraph.waiting_for_context_switch) {
+                stalled = true;
+                break;
+            }
+            pgraph_method(d, subchannel, method, parameters[0], parameters, 1,
+                          1, inc);
+            if (capturing) {
+                nv2a_capture_methods(*entry, parameters, 2);
+            }
+            head += 3;
+        } else {
+            size_t num_proc =
+                pgraph_method(d, subchannel, method, parameters[0], parameters,
+                              count, end - head - 1, inc);
+            if (num_proc < count) {
+                if (capturing && num_proc) {
+                    nv2a_capture_methods(
+                        pfifo_queue_header(method, subchannel, inc, num_proc),
+                        parameters, num_proc);
+                }
+                /* Leave the rest of the run behind a header of its own */
+                head += num_proc;
+                q->words[head] = pfifo_queue_header(
+                    inc ? method + 4 * num_proc : method, subchannel, inc,
+                    count - num_proc);
+            } else {
+                if (capturing) {
+                    nv2a_capture_methods(*entry, parameters, num_proc);
+                }
+                /* Lookahead may have consumed whole runs that follow */
+                head += 1 + num_proc;
+            }
         }
-        if (qatomic_read(&d->pgraph.flush_pending)) {
-            pgraph_flush(d);
+
+        /* Captures are split into frames right after each FLIP_STALL */
+        if (capturing && d->pgraph.waiting_for_flip) {
+            nv2a_capture_frame(d);
         }
-        if (qatomic_read(&d->pgraph.shader_cache_writeback_pending)) {
-            shader_write_cache_reload_list(&d->pgraph);
+
+        if (head == NV2A_METHOD_QUEUE_WORDS) {
+            head = 0;
         }
-        qemu_mutex_unlock(&d->pgraph.lock);
-        qemu_mutex_lock(&d->pfifo.lock);
+    }
+
+    qatomic_store_release(&q->head, head);
+    qatomic_set(&q->stalled, stalled);
+
+    return !stalled && head != tail;
+}
+
+/*
+ * Feed a capture to the puller in place of decoding push buffers, with the
+ * pfifo lock held. Each frame is left to drain before the next one starts.
+ */
+static void pfifo_run_replay(NV2AState *d)
+{
+    PFIFOMethodQueue *q = &d->pfifo.queue;
+    size_t queue_tail = q->tail;
+    const uint32_t *run;
+    size_t len, room;
+
+    while (true) {
+        run = nv2a_replay_next_run(d, &len);
+        if (run != NULL) {
+            uint32_t *dst = pfifo_queue_reserve(q, len, &room);
+            if (dst == NULL) {
+                pfifo_wait_for_puller(q);
+                dst = pfifo_queue_reserve(q, len, &room);
+            }
+            if (dst == NULL) {
+                break;
+            }
+            memcpy(dst, run, len * sizeof(uint32_t));
+            pfifo_queue_commit(q, len);
+            nv2a_replay_consume(len);
+            continue;
+        }
+
+        if (!nv2a_replay_at_frame_end()) {
+            break;
+        }
+        pfifo_wait_for_puller(q);
+        if (qatomic_read(&q->head) != q->tail) {
+            break;
+        }
+        nv2a_replay_end_frame(d);
+    }
+
+    if (q->tail != queue_tail) {
+        pfifo_queue_kick(q);
+    }
+
+    /* Nothing else will answer what pgraph is waiting on */
+    if (qatomic_read(&q->stalled)) {
+        nv2a_replay_acknowledge(d);
+    }
+}
+
+void pfifo_queue_reset(NV2AState *d)
+{
+    PFIFOMethodQueue *q = &d->pfifo.queue;
+    q->head = 0;
+    q->tail = 0;
+    q->wrap = 0;
+    q->sync_pending = false;
+    q->stalled = false;
+}
+
+/* Called with the pgraph lock held */
+static void process_requests(NV2AState *d)
+{
+    if (qatomic_read(&d->pgraph.downloads_pending)) {
+        pgraph_process_pending_downloads(d);
+    }
+    if (qatomic_read(&d->pgraph.download_dirty_surfaces_pending)) {
+        pgraph_download_dirty_surfaces(d);
+    }
+    if (qatomic_read(&d->pgraph.gl_sync_pending)) {
+        pgraph_gl_sync(d);
+    }
+    if (qatomic_read(&d->pgraph.flush_pending)) {
+        pgraph_flush(d);
+    }
+    if (qatomic_read(&d->pgraph.shader_cache_writeback_pending)) {
+        shader_write_cache_reload_list(&d->pgraph);
     }
 }
 
+/* Decodes push buffers into the method queue, never touching GL */
 void *pfifo_thread(void *arg)
 {
     NV2AState *d = (NV2AState *)arg;
-    glo_set_current(g_nv2a_context_render);
 
     rcu_register_thread();
 
@@ -487,16 +753,19 @@ void *pfifo_thread(void *arg)
     while (true) {
         d->pfifo.fifo_kick = false;
 
-        process_requests(d);
-
         if (!d->pfifo.halt) {
-            pfifo_run_pusher(d);
+            if (nv2a_replay_active()) {
+                pfifo_run_replay(d);
+            } else {
+                pfifo_run_pusher(d);
+            }
         }
 
-        pgraph_process_pending_reports(d);
-
         if (!d->pfifo.fifo_kick) {
-            qemu_cond_broadcast(&d->pfifo.fifo_idle_cond);
+            /* Only idle once the puller is done with what was queued */
+            if (pfifo_puller_idle(&d->pfifo.queue)) {
+                qemu_cond_broadcast(&d->pfifo.fifo_idle_cond);
+            }
 
             // Both the pusher and puller are waiting for some action
             qemu_cond_wait(&d->pfifo.fifo_cond, &d->pfifo.lock);
@@ -513,6 +782,63 @@ void *pfifo_thread(void *arg)
     return NULL;
 }
 
+/* Executes queued methods and other pgraph requests on the GL context */
+void *pfifo_puller_thread(void *arg)
+{
+    NV2AState *d = (NV2AState *)arg;
+    PFIFOMethodQueue *q = &d->pfifo.queue;
+
+    glo_set_current(g_nv2a_context_render);
+
+    rcu_register_thread();
+
+    while (!qatomic_read(&d->exiting)) {
+        qatomic_set(&q->kick, false);
+
+        qemu_mutex_lock(&d->pgraph.lock);
+        int64_t prof = nv2a_profile_begin(NV2A_PROF_SCOPE_PROCESS_REQUESTS);
+        process_requests(d);
+        nv2a_profile_end(prof);
+        bool more = pfifo_run_puller(d);
+        if (!more) {
+            /* Don't hold back deferred draws while waiting for more */
+            pgraph_flush_merged_draws(d);
+        }
+        pgraph_process_pending_reports(d);
+        qemu_mutex_unlock(&d->pgraph.lock);
+
+        /* Park unless kicked meanwhile, before telling the pusher */
+        bool park = false;
+        if (!more) {
+            qemu_mutex_lock(&q->lock);
+            park = !q->kick && !qatomic_read(&d->exiting);
+            qatomic_set(&q->busy, !park);
+            qemu_mutex_unlock(&q->lock);
+        }
+
+        if (qatomic_xchg(&q->pusher_waiting, false)) {
+            qemu_mutex_lock(&d->pfifo.lock);
+            d->pfifo.fifo_kick = true;
+            qemu_cond_broadcast(&d->pfifo.fifo_cond);
+            qemu_mutex_unlock(&d->pfifo.lock);
+        }
+
+        if (!park) {
+            continue;
+        }
+
+        qemu_mutex_lock(&q->lock);
+        while (!q->kick && !qatomic_read(&d->exiting)) {
+            qemu_cond_wait(&q->cond, &q->lock);
+        }
+        qemu_mutex_unlock(&q->lock);
+    }
+
+    rcu_unregister_thread();
+
+    return NULL;
+}
+
 static uint32_t ramht_hash(NV2AState *d, uint32_t handle)
 {
     unsigned int ramht_size =
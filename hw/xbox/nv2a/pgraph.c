@@ -27,12 +27,15 @@
 #include "s3tc.h"
 #include "ui/xemu-settings.h"
 #include "qemu/fast-hash.h"
+#include "qemu/range.h"
+#include "exec/ram_addr.h"
 
 const float f16_max = 511.9375f;
 const float f24_max = 1.0E30;
 
 static NV2AState *g_nv2a;
 GloContext *g_nv2a_context_render;
+GloContext *g_nv2a_context_shader;
 GloContext *g_nv2a_context_display;
 
 NV2AStats g_nv2a_stats;
@@ -69,6 +72,8 @@ static void nv2a_profile_flip_stall(void)
         (g_nv2a_stats.frame_ptr + 1) % NV2A_PROF_NUM_FRAMES;
     g_nv2a_stats.frame_count++;
     memset(&g_nv2a_stats.frame_working, 0, sizeof(g_nv2a_stats.frame_working));
+
+    nv2a_profile_frame_end();
 }
 
 static void nv2a_profile_inc_counter(enum NV2A_PROF_COUNTERS_ENUM cnt)
@@ -76,6 +81,25 @@ static void nv2a_profile_inc_counter(enum NV2A_PROF_COUNTERS_ENUM cnt)
     g_nv2a_stats.frame_working.counters[cnt] += 1;
 }
 
+static void nv2a_profile_add_counter(enum NV2A_PROF_COUNTERS_ENUM cnt,
+                                     int value)
+{
+    g_nv2a_stats.frame_working.counters[cnt] += value;
+}
+
+static void nv2a_profile_set_counter(enum NV2A_PROF_COUNTERS_ENUM cnt,
+                                     int value)
+{
+    g_nv2a_stats.frame_working.counters[cnt] = value;
+}
+
+static void nv2a_profile_max_counter(enum NV2A_PROF_COUNTERS_ENUM cnt,
+                                     int value)
+{
+    int *counter = &g_nv2a_stats.frame_working.counters[cnt];
+    *counter = MAX(*counter, value);
+}
+
 const char *nv2a_profile_get_counter_name(unsigned int cnt)
 {
     const char *default_names[NV2A_PROF__COUNT] = {
@@ -386,6 +410,7 @@ static const SurfaceFormatInfo kelvin_surface_zeta_fixed_format_map[] = {
 static void pgraph_gl_fence(void);
 static GLuint pgraph_compile_shader(const char *vs_src, const char *fs_src);
 static void pgraph_init_render_to_texture(NV2AState *d);
+static void pgraph_init_surface_upload(NV2AState *d);
 static void pgraph_init_display_renderer(NV2AState *d);
 static void pgraph_method_log(unsigned int subchannel, unsigned int graphics_class, unsigned int method, uint32_t parameter);
 static void pgraph_allocate_inline_buffer_vertices(PGRAPHState *pg, unsigned int attr);
@@ -398,9 +423,11 @@ static bool pgraph_zeta_write_enabled(PGRAPHState *pg);
 static void pgraph_set_surface_dirty(PGRAPHState *pg, bool color, bool zeta);
 static void pgraph_wait_for_surface_download(SurfaceBinding *e);
 static void pgraph_surface_access_callback(void *opaque, MemoryRegion *mr, hwaddr addr, hwaddr len, bool write);
+static gint pgraph_surface_range_compare(gconstpointer a, gconstpointer b, gpointer user_data);
 static SurfaceBinding *pgraph_surface_put(NV2AState *d, hwaddr addr, SurfaceBinding *e);
 static SurfaceBinding *pgraph_surface_get(NV2AState *d, hwaddr addr);
 static SurfaceBinding *pgraph_surface_get_within(NV2AState *d, hwaddr addr);
+static void pgraph_download_overlapping_surfaces(NV2AState *d, hwaddr start, hwaddr end);
 static void pgraph_unbind_surface(NV2AState *d, bool color);
 static void pgraph_surface_invalidate(NV2AState *d, SurfaceBinding *e);
 static void pgraph_surface_evict_old(NV2AState *d);
@@ -411,6 +438,8 @@ static void pgraph_download_surface_data_to_buffer(NV2AState *d,
                                                    bool swizzle, bool flip,
                                                    bool downscale,
                                                    uint8_t *pixels);
+static void pgraph_surface_readback_start(NV2AState *d, SurfaceBinding *surface);
+static void pgraph_surface_readback_cancel(SurfaceBinding *surface);
 static void pgraph_upload_surface_data(NV2AState *d, SurfaceBinding *surface, bool force);
 static bool pgraph_check_surface_compatibility(SurfaceBinding *s1, SurfaceBinding *s2, bool strict);
 static bool pgraph_check_surface_to_texture_compatibility(const SurfaceBinding *surface, const TextureShape *shape);
@@ -418,13 +447,24 @@ static void pgraph_render_surface_to_texture(NV2AState *d, SurfaceBinding *surfa
 static void pgraph_update_surface_part(NV2AState *d, bool upload, bool color);
 static void pgraph_update_surface(NV2AState *d, bool upload, bool color_write, bool zeta_write);
 static void pgraph_bind_textures(NV2AState *d);
+static bool pgraph_check_bound_textures_dirty(NV2AState *d);
 static void pgraph_apply_anti_aliasing_factor(PGRAPHState *pg, unsigned int *width, unsigned int *height);
 static void pgraph_apply_scaling_factor(PGRAPHState *pg, unsigned int *width, unsigned int *height);
 static void pgraph_get_surface_dimensions(PGRAPHState *pg, unsigned int *width, unsigned int *height);
-static void pgraph_update_memory_buffer(NV2AState *d, hwaddr addr, hwaddr size, bool quick);
+static hwaddr pgraph_vertex_attribute_vram_addr(NV2AState *d, VertexAttribute *attr);
+static void pgraph_upload_vram_mirror_run(NV2AState *d, hwaddr addr, hwaddr end);
+static void pgraph_sync_vram_mirror_range(NV2AState *d, hwaddr start, hwaddr end);
+static void pgraph_sync_vram_mirror(NV2AState *d, unsigned int min_element, unsigned int num_elements);
 static void pgraph_bind_vertex_attributes(NV2AState *d, unsigned int min_element, unsigned int max_element, bool inline_data, unsigned int inline_stride, unsigned int provoking_element);
 static unsigned int pgraph_bind_inline_array(NV2AState *d);
 static bool pgraph_is_texture_stage_active(PGRAPHState *pg, unsigned int stage);
+static void pgraph_init_texture_prefetch(PGRAPHState *pg);
+static void pgraph_destroy_texture_prefetch(PGRAPHState *pg);
+static void pgraph_element_cache_flush(PGRAPHState *pg);
+static void pgraph_prefetch_texture(NV2AState *d, int stage);
+static void pgraph_cancel_texture_prefetches(PGRAPHState *pg);
+static void pgraph_invalidate_texture_prefetches(PGRAPHState *pg, hwaddr addr, hwaddr size);
+static bool pgraph_take_texture_prefetch(PGRAPHState *pg, int stage, const TextureKey *key, uint64_t *data_hash, TextureStaging **staging);
 
 static float convert_f16_to_float(uint16_t f16);
 static float convert_f24_to_float(uint32_t f24);
@@ -432,8 +472,9 @@ static uint8_t cliptobyte(int x);
 static void convert_yuy2_to_rgb(const uint8_t *line, unsigned int ix, uint8_t *r, uint8_t *g, uint8_t* b);
 static void convert_uyvy_to_rgb(const uint8_t *line, unsigned int ix, uint8_t *r, uint8_t *g, uint8_t* b);
 static uint8_t* convert_texture_data(const TextureShape s, const uint8_t *data, const uint8_t *palette_data, unsigned int width, unsigned int height, unsigned int depth, unsigned int row_pitch, unsigned int slice_pitch);
-static void upload_gl_texture(GLenum gl_target, const TextureShape s, const uint8_t *texture_data, const uint8_t *palette_data);
-static TextureBinding* generate_texture(const TextureShape s, const uint8_t *texture_data, const uint8_t *palette_data);
+static void upload_gl_texture(GLenum gl_target, const TextureShape s, const uint8_t *texture_data, const uint8_t *palette_data, bool compressed_upload, uint8_t **staged_levels);
+static TextureBinding* generate_texture(PGRAPHState *pg, const TextureShape s, const uint8_t *texture_data, const uint8_t *palette_data, TextureStaging *staging);
+static void texture_staging_free(TextureStaging *staging);
 static void texture_binding_destroy(gpointer data);
 static void texture_cache_entry_init(Lru *lru, LruNode *node, void *key);
 static void texture_cache_entry_post_evict(Lru *lru, LruNode *node);
@@ -443,7 +484,26 @@ static void vertex_cache_entry_init(Lru *lru, LruNode *node, void *key)
 {
     VertexLruNode *vnode = container_of(node, VertexLruNode, node);
     memcpy(&vnode->key, key, sizeof(struct VertexKey));
-    vnode->initialized = false;
+    vnode->seen = false;
+}
+
+static void vertex_cache_entry_post_evict(Lru *lru, LruNode *node)
+{
+    PGRAPHState *pg = container_of(lru, PGRAPHState, element_cache);
+    VertexLruNode *vnode = container_of(node, VertexLruNode, node);
+    if (vnode->buffer < 0) {
+        return;
+    }
+
+    ElementCacheBuffer *buf = &pg->element_buffers.buffers[vnode->buffer];
+    QTAILQ_REMOVE(&buf->entries, vnode, buffer_entry);
+    buf->live -= vnode->size;
+    if (!buf->live) {
+        /* Nothing left to keep, including anything still pending */
+        buf->head = buf->uploaded = 0;
+    }
+    vnode->buffer = -1;
+    nv2a_profile_inc_counter(NV2A_PROF_ELEMENT_CACHE_EVICT);
 }
 
 static bool vertex_cache_entry_compare(Lru *lru, LruNode *node, void *key)
@@ -640,6 +700,8 @@ void pgraph_flush(NV2AState *d)
 {
     PGRAPHState *pg = &d->pgraph;
 
+    pgraph_flush_merged_draws(d);
+
     bool update_surface = (pg->color_binding || pg->zeta_binding);
 
     /* Clear last surface shape to force recreation of buffers at next draw */
@@ -655,10 +717,13 @@ void pgraph_flush(NV2AState *d)
     }
 
     pgraph_mark_textures_possibly_dirty(d, 0, memory_region_size(d->vram));
+    pgraph_cancel_texture_prefetches(pg);
 
     /* Sync all RAM */
     glBindBuffer(GL_ARRAY_BUFFER, d->pgraph.gl_memory_buffer);
     glBufferSubData(GL_ARRAY_BUFFER, 0, memory_region_size(d->vram), d->vram_ptr);
+    nv2a_profile_add_counter(NV2A_PROF_VRAM_MIRROR_BYTES,
+                             memory_region_size(d->vram));
 
     /* FIXME: Flush more? */
 
@@ -758,6 +823,12 @@ static const struct {
 #undef DEF_METHOD_CASE_4
 };
 
+const char *nv2a_profile_get_method_name(unsigned int idx)
+{
+    assert(idx < ARRAY_SIZE(pgraph_kelvin_methods));
+    return pgraph_kelvin_methods[idx].name;
+}
+
 #define METHOD_RANGE_END_NAME(gclass, name) \
     pgraph_ ## gclass ## _ ## name ## __END
 #define DEF_METHOD(gclass, name) \
@@ -995,7 +1066,7 @@ int pgraph_method(NV2AState *d, unsigned int subchannel,
 {
     int num_processed = 1;
 
-    assert(glGetError() == GL_NO_ERROR);
+    NV2A_GL_CHECK_ERRORS();
 
     PGRAPHState *pg = &d->pgraph;
 
@@ -1038,6 +1109,14 @@ int pgraph_method(NV2AState *d, unsigned int subchannel,
 
     pgraph_method_log(subchannel, graphics_class, method, parameter);
 
+    if (pg->draw_merge.pending &&
+        !(graphics_class == NV_KELVIN_PRIMITIVE &&
+          (method == NV097_SET_BEGIN_END || method == NV097_DRAW_ARRAYS ||
+           method == NV097_ARRAY_ELEMENT16 ||
+           method == NV097_ARRAY_ELEMENT32))) {
+        pgraph_flush_merged_draws(d);
+    }
+
     if (subchannel != 0) {
         // catches context switching issues on xbox d3d
         assert(graphics_class != 0x97);
@@ -1144,8 +1223,13 @@ int pgraph_method(NV2AState *d, unsigned int subchannel,
             goto unhandled;
         }
         size_t num_words_consumed = 1;
+        int64_t prof = nv2a_profile_begin(NV2A_PROF_SCOPE_METHOD);
         handler(d, pg, subchannel, method, parameter, parameters,
                 num_words_available, &num_words_consumed, inc);
+        if (prof) {
+            nv2a_profile_pop_method(prof, METHOD_ADDR_TO_INDEX(
+                pgraph_kelvin_methods[METHOD_ADDR_TO_INDEX(method)].base));
+        }
 
         /* Squash repeated BEGIN,DRAW_ARRAYS,END */
         #define LAM(i, mthd) ((parameters[i*2+1] & 0x31fff) == (mthd))
@@ -1270,6 +1354,9 @@ DEF_METHOD(NV097, FLIP_STALL)
 {
     trace_nv2a_pgraph_flip_stall();
     pgraph_update_surface(d, false, true, true);
+    pgraph_element_cache_flush(pg);
+    nv2a_profile_set_counter(NV2A_PROF_SURF_CACHE_SIZE,
+                             g_tree_nnodes(pg->surface_tree));
     nv2a_profile_flip_stall();
     pg->waiting_for_flip = true;
 }
@@ -2713,6 +2800,303 @@ static void pgraph_reset_draw_arrays(PGRAPHState *pg)
     pg->draw_arrays_prevent_connect = false;
 }
 
+static void pgraph_init_stream_buffer(PGRAPHState *pg)
+{
+    glGenBuffers(1, &pg->stream_buffer.gl_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, pg->stream_buffer.gl_buffer);
+
+    if (glo_check_extension("GL_ARB_buffer_storage")) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+                           GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, NV2A_STREAM_BUFFER_SIZE, NULL, flags);
+        pg->stream_buffer.map = glMapBufferRange(
+            GL_ARRAY_BUFFER, 0, NV2A_STREAM_BUFFER_SIZE, flags);
+        assert(pg->stream_buffer.map != NULL);
+    } else {
+        glBufferData(GL_ARRAY_BUFFER, NV2A_STREAM_BUFFER_SIZE, NULL,
+                     GL_STREAM_DRAW);
+    }
+}
+
+static void pgraph_destroy_stream_buffer(PGRAPHState *pg)
+{
+    for (int i = 0; i < NV2A_STREAM_BUFFER_SEGMENTS; i++) {
+        if (pg->stream_buffer.fence[i]) {
+            glDeleteSync(pg->stream_buffer.fence[i]);
+        }
+    }
+    if (pg->stream_buffer.map) {
+        glBindBuffer(GL_ARRAY_BUFFER, pg->stream_buffer.gl_buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+    glDeleteBuffers(1, &pg->stream_buffer.gl_buffer);
+}
+
+/*
+ * Copy data into the stream buffer, returning its offset there. An upload
+ * never straddles segments. A segment uploads move on from is only fenced by
+ * pgraph_stream_retire, which callers run once the commands reading it have
+ * been issued, so waiting on that fence before reusing the segment covers
+ * every one of them.
+ */
+static GLintptr pgraph_stream_upload(PGRAPHState *pg, const void *data,
+                                     size_t len)
+{
+    const size_t segment_size =
+        NV2A_STREAM_BUFFER_SIZE / NV2A_STREAM_BUFFER_SEGMENTS;
+    assert(len <= segment_size);
+    if (!len) {
+        return 0;
+    }
+
+    size_t offset = ROUND_UP(pg->stream_buffer.head, NV2A_STREAM_BUFFER_ALIGN);
+    if (offset / segment_size != (offset + len - 1) / segment_size) {
+        offset = ROUND_UP(offset, segment_size);
+    }
+    if (offset + len > NV2A_STREAM_BUFFER_SIZE) {
+        offset = 0;
+    }
+
+    unsigned int segment = offset / segment_size;
+    if (segment != pg->stream_buffer.segment) {
+        GLsync *fence = pg->stream_buffer.fence;
+        pg->stream_buffer.retiring |= 1 << pg->stream_buffer.segment;
+        pg->stream_buffer.segment = segment;
+        /* Data for commands not issued yet would be overwritten */
+        assert(!(pg->stream_buffer.retiring & (1 << segment)));
+        if (fence[segment]) {
+            if (glClientWaitSync(fence[segment], GL_SYNC_FLUSH_COMMANDS_BIT,
+                                 0) == GL_TIMEOUT_EXPIRED) {
+                nv2a_profile_inc_counter(NV2A_PROF_STREAM_WAIT);
+                glClientWaitSync(fence[segment], GL_SYNC_FLUSH_COMMANDS_BIT,
+                                 GL_TIMEOUT_IGNORED);
+            }
+            glDeleteSync(fence[segment]);
+            fence[segment] = 0;
+        }
+    }
+
+    if (pg->stream_buffer.map) {
+        memcpy(pg->stream_buffer.map + offset, data, len);
+    } else {
+        glBindBuffer(GL_ARRAY_BUFFER, pg->stream_buffer.gl_buffer);
+        void *ptr = glMapBufferRange(GL_ARRAY_BUFFER, offset, len,
+                                     GL_MAP_WRITE_BIT |
+                                     GL_MAP_INVALIDATE_RANGE_BIT |
+                                     GL_MAP_UNSYNCHRONIZED_BIT);
+        memcpy(ptr, data, len);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+
+    pg->stream_buffer.head = offset + len;
+    nv2a_profile_add_counter(NV2A_PROF_STREAM_BYTES, len);
+
+    return offset;
+}
+
+/* Fence the segments uploads have moved on from, after their last reader */
+static void pgraph_stream_retire(PGRAPHState *pg)
+{
+    for (int i = 0; i < NV2A_STREAM_BUFFER_SEGMENTS; i++) {
+        if (pg->stream_buffer.retiring & (1 << i)) {
+            assert(!pg->stream_buffer.fence[i]);
+            pg->stream_buffer.fence[i] =
+                glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+    }
+    pg->stream_buffer.retiring = 0;
+}
+
+static void pgraph_init_element_cache(PGRAPHState *pg)
+{
+    lru_init(&pg->element_cache);
+    pg->element_cache_entries = g_new0(VertexLruNode,
+                                       NV2A_ELEMENT_CACHE_ENTRIES);
+    for (int i = 0; i < NV2A_ELEMENT_CACHE_ENTRIES; i++) {
+        pg->element_cache_entries[i].buffer = -1;
+        lru_add_free(&pg->element_cache, &pg->element_cache_entries[i].node);
+    }
+
+    pg->element_cache.init_node = vertex_cache_entry_init;
+    pg->element_cache.compare_nodes = vertex_cache_entry_compare;
+    pg->element_cache.post_node_evict = vertex_cache_entry_post_evict;
+
+    /* The budget covers the spare buffer too */
+    size_t budget = MAX(g_config.perf.element_cache_size, 1) * MiB;
+    size_t buffer_size = ROUND_DOWN(budget / (NV2A_ELEMENT_CACHE_BUFFERS + 1),
+                                    NV2A_ELEMENT_CACHE_ALIGN);
+    pg->element_buffers.buffer_size = buffer_size;
+
+    GLuint gl_buffers[NV2A_ELEMENT_CACHE_BUFFERS + 1];
+    glGenBuffers(ARRAY_SIZE(gl_buffers), gl_buffers);
+    for (int i = 0; i < ARRAY_SIZE(gl_buffers); i++) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, gl_buffers[i]);
+        glBufferData(GL_COPY_WRITE_BUFFER, buffer_size, NULL, GL_STATIC_DRAW);
+    }
+
+    for (int i = 0; i < NV2A_ELEMENT_CACHE_BUFFERS; i++) {
+        ElementCacheBuffer *buf = &pg->element_buffers.buffers[i];
+        buf->gl_buffer = gl_buffers[i];
+        buf->staging = g_malloc(NV2A_ELEMENT_CACHE_BATCH);
+        QTAILQ_INIT(&buf->entries);
+    }
+    pg->element_buffers.spare_buffer =
+        gl_buffers[NV2A_ELEMENT_CACHE_BUFFERS];
+}
+
+static void pgraph_destroy_element_cache(PGRAPHState *pg)
+{
+    for (int i = 0; i < NV2A_ELEMENT_CACHE_BUFFERS; i++) {
+        ElementCacheBuffer *buf = &pg->element_buffers.buffers[i];
+        glDeleteBuffers(1, &buf->gl_buffer);
+        g_free(buf->staging);
+    }
+    glDeleteBuffers(1, &pg->element_buffers.spare_buffer);
+    g_free(pg->element_cache_entries);
+}
+
+static void pgraph_element_cache_upload_pending(ElementCacheBuffer *buf)
+{
+    if (buf->head == buf->uploaded) {
+        return;
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buf->gl_buffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, buf->uploaded,
+                    buf->head - buf->uploaded, buf->staging);
+    buf->uploaded = buf->head;
+}
+
+static void pgraph_element_cache_flush(PGRAPHState *pg)
+{
+    size_t resident = 0;
+
+    for (int i = 0; i < NV2A_ELEMENT_CACHE_BUFFERS; i++) {
+        ElementCacheBuffer *buf = &pg->element_buffers.buffers[i];
+        pgraph_element_cache_upload_pending(buf);
+        resident += buf->live;
+    }
+
+    nv2a_profile_set_counter(NV2A_PROF_ELEMENT_CACHE_BYTES, resident);
+}
+
+/*
+ * Slide the entries of a buffer down over the holes left by evictions. They
+ * are copied into the spare buffer, which then takes the place of this one.
+ */
+static void pgraph_element_cache_compact(PGRAPHState *pg,
+                                         ElementCacheBuffer *buf)
+{
+    GLuint dst = pg->element_buffers.spare_buffer;
+    size_t head = 0, run_src = 0, run_dst = 0, run_len = 0;
+    VertexLruNode *vnode;
+
+    pgraph_element_cache_upload_pending(buf);
+    glBindBuffer(GL_COPY_READ_BUFFER, buf->gl_buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, dst);
+
+    QTAILQ_FOREACH(vnode, &buf->entries, buffer_entry) {
+        if (run_len && run_src + run_len == vnode->offset) {
+            run_len += vnode->size;
+        } else {
+            if (run_len) {
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                                    run_src, run_dst, run_len);
+            }
+            run_src = vnode->offset;
+            run_dst = head;
+            run_len = vnode->size;
+        }
+        vnode->offset = head;
+        head += vnode->size;
+    }
+    if (run_len) {
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                            run_src, run_dst, run_len);
+    }
+    assert(head == buf->live);
+
+    pg->element_buffers.spare_buffer = buf->gl_buffer;
+    buf->gl_buffer = dst;
+    buf->head = buf->uploaded = head;
+    nv2a_profile_inc_counter(NV2A_PROF_ELEMENT_CACHE_COMPACT);
+}
+
+/*
+ * Find a buffer with size bytes free at its head, compacting one if that is
+ * enough, or else evicting the least recently used entries until it is.
+ */
+static ElementCacheBuffer *pgraph_element_cache_alloc(PGRAPHState *pg,
+                                                      size_t size)
+{
+    const size_t buffer_size = pg->element_buffers.buffer_size;
+    ElementCacheBuffer *buffers = pg->element_buffers.buffers;
+    LruNode *victim = QTAILQ_LAST(&pg->element_cache.global);
+
+    if (size > buffer_size) {
+        return NULL;
+    }
+
+    while (true) {
+        for (int i = 0; i < NV2A_ELEMENT_CACHE_BUFFERS; i++) {
+            if (buffers[i].head + size <= buffer_size) {
+                return &buffers[i];
+            }
+        }
+        for (int i = 0; i < NV2A_ELEMENT_CACHE_BUFFERS; i++) {
+            if (buffers[i].live + size <= buffer_size) {
+                pgraph_element_cache_compact(pg, &buffers[i]);
+                return &buffers[i];
+            }
+        }
+
+        while (victim &&
+               container_of(victim, VertexLruNode, node)->buffer < 0) {
+            victim = QTAILQ_PREV(victim, next_global);
+        }
+        if (!victim) {
+            return NULL;
+        }
+        LruNode *next = QTAILQ_PREV(victim, next_global);
+        lru_evict_node(&pg->element_cache, victim);
+        victim = next;
+    }
+}
+
+/*
+ * Give an index list a place in the element buffers. Its data goes out with
+ * the next batch, so it can't be drawn from there until then.
+ */
+static void pgraph_element_cache_insert(PGRAPHState *pg, VertexLruNode *vnode,
+                                        const void *data, size_t len)
+{
+    size_t size = ROUND_UP(len, NV2A_ELEMENT_CACHE_ALIGN);
+    ElementCacheBuffer *buf = pgraph_element_cache_alloc(pg, size);
+    if (!buf) {
+        return;
+    }
+
+    if (buf->head - buf->uploaded + size > NV2A_ELEMENT_CACHE_BATCH) {
+        pgraph_element_cache_upload_pending(buf);
+    }
+
+    vnode->buffer = buf - pg->element_buffers.buffers;
+    vnode->offset = buf->head;
+    vnode->size = size;
+    QTAILQ_INSERT_TAIL(&buf->entries, vnode, buffer_entry);
+    buf->live += size;
+
+    if (size > NV2A_ELEMENT_CACHE_BATCH) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buf->gl_buffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, buf->head, len, data);
+        buf->head += size;
+        buf->uploaded = buf->head;
+    } else {
+        memcpy(buf->staging + (buf->head - buf->uploaded), data, len);
+        buf->head += size;
+    }
+}
+
 static void pgraph_reset_inline_buffers(PGRAPHState *pg)
 {
     pg->inline_elements_length = 0;
@@ -2724,11 +3108,12 @@ static void pgraph_reset_inline_buffers(PGRAPHState *pg)
 static void pgraph_flush_draw(NV2AState *d)
 {
     PGRAPHState *pg = &d->pgraph;
-    if (!(pg->color_binding || pg->zeta_binding)) {
+    if (!(pg->color_binding || pg->zeta_binding) || pg->shader_skip_draw) {
         pgraph_reset_inline_buffers(pg);
         return;
     }
     assert(pg->shader_binding);
+    nv2a_profile_inc_counter(NV2A_PROF_DRAWS_ISSUED);
 
     if (pg->draw_arrays_length) {
         NV2A_GL_DPRINTF(false, "Draw Arrays");
@@ -2773,19 +3158,29 @@ static void pgraph_flush_draw(NV2AState *d)
 
         LruNode *node = lru_lookup(&pg->element_cache, h, &k);
         VertexLruNode *found = container_of(node, VertexLruNode, node);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, found->gl_buffer);
-        if (!found->initialized) {
-            nv2a_profile_inc_counter(NV2A_PROF_GEOM_BUFFER_UPDATE_4);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                         pg->inline_elements_length * 4,
-                         pg->inline_elements, GL_STATIC_DRAW);
-            found->initialized = true;
-        } else {
+        ElementCacheBuffer *buf = found->buffer < 0 ? NULL :
+            &pg->element_buffers.buffers[found->buffer];
+        GLintptr indices_offset;
+        if (buf && found->offset + found->size <= buf->uploaded) {
             nv2a_profile_inc_counter(NV2A_PROF_GEOM_BUFFER_UPDATE_4_NOTDIRTY);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buf->gl_buffer);
+            indices_offset = found->offset;
+        } else {
+            /* Only index lists that repeat are kept in the element buffers */
+            if (found->seen && !buf) {
+                nv2a_profile_inc_counter(NV2A_PROF_GEOM_BUFFER_UPDATE_4);
+                pgraph_element_cache_insert(pg, found, pg->inline_elements,
+                                            pg->inline_elements_length * 4);
+            }
+            found->seen = true;
+            nv2a_profile_inc_counter(NV2A_PROF_GEOM_BUFFER_UPDATE_4_STREAM);
+            indices_offset = pgraph_stream_upload(
+                pg, pg->inline_elements, pg->inline_elements_length * 4);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pg->stream_buffer.gl_buffer);
         }
         glDrawElements(pg->shader_binding->gl_primitive_mode,
                        pg->inline_elements_length, GL_UNSIGNED_INT,
-                       (void *)0);
+                       (void *)indices_offset);
     } else if (pg->inline_buffer_length) {
         NV2A_GL_DPRINTF(false, "Inline Buffer");
         nv2a_profile_inc_counter(NV2A_PROF_INLINE_BUFFERS);
@@ -2793,18 +3188,38 @@ static void pgraph_flush_draw(NV2AState *d)
 
         if (pg->compressed_attrs) {
             pg->compressed_attrs = 0;
+            int64_t prof = nv2a_profile_begin(NV2A_PROF_SCOPE_BIND_SHADERS);
             pgraph_bind_shaders(pg);
+            nv2a_profile_end(prof);
+        }
+
+        size_t attr_size = pg->inline_buffer_length * sizeof(float) * 4;
+        unsigned int num_populated = 0;
+        for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+            num_populated += pg->vertex_attributes[i].inline_buffer_populated;
         }
+        /*
+         * Keep a draw well clear of wrapping onto its own data in the
+         * stream buffer, even with every upload padded out to a segment.
+         */
+        bool stream = num_populated * attr_size <= NV2A_STREAM_BUFFER_SIZE / 4;
 
         for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
             VertexAttribute *attr = &pg->vertex_attributes[i];
             if (attr->inline_buffer_populated) {
                 nv2a_profile_inc_counter(NV2A_PROF_GEOM_BUFFER_UPDATE_3);
-                glBindBuffer(GL_ARRAY_BUFFER, attr->gl_inline_buffer);
-                glBufferData(GL_ARRAY_BUFFER,
-                             pg->inline_buffer_length * sizeof(float) * 4,
-                             attr->inline_buffer, GL_STREAM_DRAW);
-                glVertexAttribPointer(i, 4, GL_FLOAT, GL_FALSE, 0, 0);
+                GLintptr offset = 0;
+                if (stream) {
+                    offset = pgraph_stream_upload(pg, attr->inline_buffer,
+                                                  attr_size);
+                    glBindBuffer(GL_ARRAY_BUFFER, pg->stream_buffer.gl_buffer);
+                } else {
+                    glBindBuffer(GL_ARRAY_BUFFER, attr->gl_inline_buffer);
+                    glBufferData(GL_ARRAY_BUFFER, attr_size,
+                                 attr->inline_buffer, GL_STREAM_DRAW);
+                }
+                glVertexAttribPointer(i, 4, GL_FLOAT, GL_FALSE, 0,
+                                      (void *)offset);
                 glEnableVertexAttribArray(i);
                 attr->inline_buffer_populated = false;
                 memcpy(attr->inline_value,
@@ -2830,9 +3245,117 @@ static void pgraph_flush_draw(NV2AState *d)
         NV2A_UNCONFIRMED("EMPTY NV097_SET_BEGIN_END");
     }
 
+    /* Only now has everything streamed for the draw been read */
+    pgraph_stream_retire(pg);
     pgraph_reset_inline_buffers(pg);
 }
 
+/*
+ * Issue the draws put off at END on their own, keeping any vertex data an
+ * open block has added after them.
+ */
+void pgraph_flush_merged_draws(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    if (!pg->draw_merge.pending) {
+        return;
+    }
+    pg->draw_merge.pending = false;
+
+    unsigned int num_elements =
+        pg->inline_elements_length - pg->draw_merge.elements;
+    unsigned int num_arrays = pg->draw_arrays_length - pg->draw_merge.arrays;
+    g_autofree uint32_t *elements = g_memdup2(
+        &pg->inline_elements[pg->draw_merge.elements],
+        num_elements * sizeof(uint32_t));
+    g_autofree GLint *starts = g_memdup2(
+        &pg->gl_draw_arrays_start[pg->draw_merge.arrays],
+        num_arrays * sizeof(GLint));
+    g_autofree GLsizei *counts = g_memdup2(
+        &pg->gl_draw_arrays_count[pg->draw_merge.arrays],
+        num_arrays * sizeof(GLsizei));
+
+    pg->inline_elements_length = pg->draw_merge.elements;
+    pg->draw_arrays_length = pg->draw_merge.arrays;
+    int64_t prof = nv2a_profile_begin(NV2A_PROF_SCOPE_FLUSH_DRAW);
+    pgraph_flush_draw(d);
+    nv2a_profile_end(prof);
+
+    if (num_elements) {
+        memcpy(pg->inline_elements, elements, num_elements * sizeof(uint32_t));
+    }
+    pg->inline_elements_length = num_elements;
+    for (unsigned int i = 0; i < num_arrays; i++) {
+        pg->gl_draw_arrays_start[i] = starts[i];
+        pg->gl_draw_arrays_count[i] = counts[i];
+        pg->draw_arrays_min_start = MIN(pg->draw_arrays_min_start,
+                                        (unsigned int)starts[i]);
+        pg->draw_arrays_max_count = MAX(pg->draw_arrays_max_count,
+                                        starts[i] + counts[i]);
+    }
+    pg->draw_arrays_length = num_arrays;
+}
+
+/*
+ * Make room for vertex data of a block merged into pending draws, which
+ * have to go first if it would overflow the batch, or if indices would
+ * follow draw arrays.
+ */
+static void pgraph_reserve_merged_draw(NV2AState *d, unsigned int elements,
+                                       bool indexed)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    if (pg->draw_merge.pending &&
+        ((indexed && pg->draw_merge.arrays) ||
+         pg->inline_elements_length + elements >= NV2A_MAX_BATCH_LENGTH ||
+         pg->draw_arrays_length + 1 >= ARRAY_SIZE(pg->gl_draw_arrays_start))) {
+        pgraph_flush_merged_draws(d);
+    }
+}
+
+static bool pgraph_can_defer_draw(PGRAPHState *pg)
+{
+    if (!g_config.perf.draw_merging || pg->zpass_pixel_count_enable ||
+        pg->inline_buffer_length || pg->inline_array_length) {
+        return false;
+    }
+
+    if (pg->draw_arrays_length) {
+        return true;
+    }
+
+    /* Index lists can only be joined where primitives don't connect */
+    switch (pg->primitive_mode) {
+    case PRIM_TYPE_POINTS:
+    case PRIM_TYPE_LINES:
+    case PRIM_TYPE_TRIANGLES:
+    case PRIM_TYPE_QUADS:
+        return pg->inline_elements_length > 0;
+    default:
+        return false;
+    }
+}
+
+/*
+ * Only draw methods have come in since the pending draws, so their state
+ * still holds, apart from memory the CPU may have written meanwhile.
+ */
+static bool pgraph_can_merge_draw(NV2AState *d, unsigned int primitive_mode)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    if (primitive_mode != pg->draw_merge.primitive_mode) {
+        return false;
+    }
+    if ((pg->color_binding && pg->color_binding->upload_pending) ||
+        (pg->zeta_binding && pg->zeta_binding->upload_pending)) {
+        return false;
+    }
+    return !pgraph_check_bound_textures_dirty(d);
+}
+
 DEF_METHOD(NV097, SET_BEGIN_END)
 {
     uint32_t control_0 = pg->regs[NV_PGRAPH_CONTROL_0];
@@ -2863,7 +3386,18 @@ DEF_METHOD(NV097, SET_BEGIN_END)
             return;
         }
 
-        pgraph_flush_draw(d);
+        if (pgraph_can_defer_draw(pg)) {
+            /* Issued along with the blocks that follow, if they match */
+            pg->draw_merge.pending = true;
+            pg->draw_merge.primitive_mode = pg->primitive_mode;
+            pg->draw_merge.elements = pg->inline_elements_length;
+            pg->draw_merge.arrays = pg->draw_arrays_length;
+        } else {
+            pg->draw_merge.pending = false;
+            int64_t prof = nv2a_profile_begin(NV2A_PROF_SCOPE_FLUSH_DRAW);
+            pgraph_flush_draw(d);
+            nv2a_profile_end(prof);
+        }
 
         /* End of visibility testing */
         if (pg->zpass_pixel_count_enable) {
@@ -2891,6 +3425,16 @@ DEF_METHOD(NV097, SET_BEGIN_END)
         assert(parameter <= NV097_SET_BEGIN_END_OP_POLYGON);
         pg->primitive_mode = parameter;
 
+        if (pg->draw_merge.pending) {
+            if (!is_nop_draw && pgraph_can_merge_draw(d, parameter)) {
+                /* GL state set up for the pending draws still applies */
+                nv2a_profile_inc_counter(NV2A_PROF_DRAWS_MERGED);
+                pg->draw_arrays_prevent_connect = pg->draw_arrays_length > 0;
+                return;
+            }
+            pgraph_flush_merged_draws(d);
+        }
+
         pgraph_update_surface(d, true, true, depth_test || stencil_test);
         pgraph_reset_inline_buffers(pg);
 
@@ -2900,37 +3444,41 @@ DEF_METHOD(NV097, SET_BEGIN_END)
 
         assert(pg->color_binding || pg->zeta_binding);
 
+        int64_t prof = nv2a_profile_begin(NV2A_PROF_SCOPE_BIND_TEXTURES);
         pgraph_bind_textures(d);
+        nv2a_profile_end(prof);
+        prof = nv2a_profile_begin(NV2A_PROF_SCOPE_BIND_SHADERS);
         pgraph_bind_shaders(pg);
+        nv2a_profile_end(prof);
 
-        glColorMask(mask_red, mask_green, mask_blue, mask_alpha);
-        glDepthMask(!!(control_0 & NV_PGRAPH_CONTROL_0_ZWRITEENABLE));
-        glStencilMask(GET_MASK(pg->regs[NV_PGRAPH_CONTROL_1],
-                               NV_PGRAPH_CONTROL_1_STENCIL_MASK_WRITE));
+        nv2a_gl_color_mask(mask_red, mask_green, mask_blue, mask_alpha);
+        nv2a_gl_depth_mask(!!(control_0 & NV_PGRAPH_CONTROL_0_ZWRITEENABLE));
+        nv2a_gl_stencil_mask(GET_MASK(pg->regs[NV_PGRAPH_CONTROL_1],
+                                      NV_PGRAPH_CONTROL_1_STENCIL_MASK_WRITE));
 
         if (pg->regs[NV_PGRAPH_BLEND] & NV_PGRAPH_BLEND_EN) {
-            glEnable(GL_BLEND);
+            nv2a_gl_enable(GL_BLEND);
             uint32_t sfactor = GET_MASK(pg->regs[NV_PGRAPH_BLEND],
                                         NV_PGRAPH_BLEND_SFACTOR);
             uint32_t dfactor = GET_MASK(pg->regs[NV_PGRAPH_BLEND],
                                         NV_PGRAPH_BLEND_DFACTOR);
             assert(sfactor < ARRAY_SIZE(pgraph_blend_factor_map));
             assert(dfactor < ARRAY_SIZE(pgraph_blend_factor_map));
-            glBlendFunc(pgraph_blend_factor_map[sfactor],
-                        pgraph_blend_factor_map[dfactor]);
+            nv2a_gl_blend_func(pgraph_blend_factor_map[sfactor],
+                               pgraph_blend_factor_map[dfactor]);
 
             uint32_t equation = GET_MASK(pg->regs[NV_PGRAPH_BLEND],
                                          NV_PGRAPH_BLEND_EQN);
             assert(equation < ARRAY_SIZE(pgraph_blend_equation_map));
-            glBlendEquation(pgraph_blend_equation_map[equation]);
+            nv2a_gl_blend_equation(pgraph_blend_equation_map[equation]);
 
             uint32_t blend_color = pg->regs[NV_PGRAPH_BLENDCOLOR];
-            glBlendColor( ((blend_color >> 16) & 0xFF) / 255.0f, /* red */
-                          ((blend_color >> 8) & 0xFF) / 255.0f,  /* green */
-                          (blend_color & 0xFF) / 255.0f,         /* blue */
-                          ((blend_color >> 24) & 0xFF) / 255.0f);/* alpha */
+            nv2a_gl_blend_color(((blend_color >> 16) & 0xFF) / 255.0f, /* r */
+                                ((blend_color >> 8) & 0xFF) / 255.0f,  /* g */
+                                (blend_color & 0xFF) / 255.0f,         /* b */
+                                ((blend_color >> 24) & 0xFF) / 255.0f);/* a */
         } else {
-            glDisable(GL_BLEND);
+            nv2a_gl_disable(GL_BLEND);
         }
 
         /* Face culling */
@@ -2939,40 +3487,40 @@ DEF_METHOD(NV097, SET_BEGIN_END)
             uint32_t cull_face = GET_MASK(pg->regs[NV_PGRAPH_SETUPRASTER],
                                           NV_PGRAPH_SETUPRASTER_CULLCTRL);
             assert(cull_face < ARRAY_SIZE(pgraph_cull_face_map));
-            glCullFace(pgraph_cull_face_map[cull_face]);
-            glEnable(GL_CULL_FACE);
+            nv2a_gl_cull_face(pgraph_cull_face_map[cull_face]);
+            nv2a_gl_enable(GL_CULL_FACE);
         } else {
-            glDisable(GL_CULL_FACE);
+            nv2a_gl_disable(GL_CULL_FACE);
         }
 
         /* Clipping */
-        glEnable(GL_CLIP_DISTANCE0);
-        glEnable(GL_CLIP_DISTANCE1);
+        nv2a_gl_enable(GL_CLIP_DISTANCE0);
+        nv2a_gl_enable(GL_CLIP_DISTANCE1);
 
         /* Front-face select */
-        glFrontFace(pg->regs[NV_PGRAPH_SETUPRASTER]
-                        & NV_PGRAPH_SETUPRASTER_FRONTFACE
-                            ? GL_CCW : GL_CW);
+        nv2a_gl_front_face(pg->regs[NV_PGRAPH_SETUPRASTER]
+                               & NV_PGRAPH_SETUPRASTER_FRONTFACE
+                                   ? GL_CCW : GL_CW);
 
         /* Polygon offset */
         /* FIXME: GL implementation-specific, maybe do this in VS? */
         if (pg->regs[NV_PGRAPH_SETUPRASTER] &
                 NV_PGRAPH_SETUPRASTER_POFFSETFILLENABLE) {
-            glEnable(GL_POLYGON_OFFSET_FILL);
+            nv2a_gl_enable(GL_POLYGON_OFFSET_FILL);
         } else {
-            glDisable(GL_POLYGON_OFFSET_FILL);
+            nv2a_gl_disable(GL_POLYGON_OFFSET_FILL);
         }
         if (pg->regs[NV_PGRAPH_SETUPRASTER] &
                 NV_PGRAPH_SETUPRASTER_POFFSETLINEENABLE) {
-            glEnable(GL_POLYGON_OFFSET_LINE);
+            nv2a_gl_enable(GL_POLYGON_OFFSET_LINE);
         } else {
-            glDisable(GL_POLYGON_OFFSET_LINE);
+            nv2a_gl_disable(GL_POLYGON_OFFSET_LINE);
         }
         if (pg->regs[NV_PGRAPH_SETUPRASTER] &
                 NV_PGRAPH_SETUPRASTER_POFFSETPOINTENABLE) {
-            glEnable(GL_POLYGON_OFFSET_POINT);
+            nv2a_gl_enable(GL_POLYGON_OFFSET_POINT);
         } else {
-            glDisable(GL_POLYGON_OFFSET_POINT);
+            nv2a_gl_disable(GL_POLYGON_OFFSET_POINT);
         }
         if (pg->regs[NV_PGRAPH_SETUPRASTER] &
                 (NV_PGRAPH_SETUPRASTER_POFFSETFILLENABLE |
@@ -2980,27 +3528,27 @@ DEF_METHOD(NV097, SET_BEGIN_END)
                  NV_PGRAPH_SETUPRASTER_POFFSETPOINTENABLE)) {
             GLfloat zfactor = *(float*)&pg->regs[NV_PGRAPH_ZOFFSETFACTOR];
             GLfloat zbias = *(float*)&pg->regs[NV_PGRAPH_ZOFFSETBIAS];
-            glPolygonOffset(zfactor, zbias);
+            nv2a_gl_polygon_offset(zfactor, zbias);
         }
 
         /* Depth testing */
         if (depth_test) {
-            glEnable(GL_DEPTH_TEST);
+            nv2a_gl_enable(GL_DEPTH_TEST);
 
             uint32_t depth_func = GET_MASK(pg->regs[NV_PGRAPH_CONTROL_0],
                                            NV_PGRAPH_CONTROL_0_ZFUNC);
             assert(depth_func < ARRAY_SIZE(pgraph_depth_func_map));
-            glDepthFunc(pgraph_depth_func_map[depth_func]);
+            nv2a_gl_depth_func(pgraph_depth_func_map[depth_func]);
         } else {
-            glDisable(GL_DEPTH_TEST);
+            nv2a_gl_disable(GL_DEPTH_TEST);
         }
 
         if (GET_MASK(pg->regs[NV_PGRAPH_ZCOMPRESSOCCLUDE],
                      NV_PGRAPH_ZCOMPRESSOCCLUDE_ZCLAMP_EN) ==
             NV_PGRAPH_ZCOMPRESSOCCLUDE_ZCLAMP_EN_CLAMP) {
-            glEnable(GL_DEPTH_CLAMP);
+            nv2a_gl_enable(GL_DEPTH_CLAMP);
         } else {
-            glDisable(GL_DEPTH_CLAMP);
+            nv2a_gl_disable(GL_DEPTH_CLAMP);
         }
 
         if (GET_MASK(pg->regs[NV_PGRAPH_CONTROL_3],
@@ -3010,7 +3558,7 @@ DEF_METHOD(NV097, SET_BEGIN_END)
         }
 
         if (stencil_test) {
-            glEnable(GL_STENCIL_TEST);
+            nv2a_gl_enable(GL_STENCIL_TEST);
 
             uint32_t stencil_func = GET_MASK(pg->regs[NV_PGRAPH_CONTROL_1],
                                         NV_PGRAPH_CONTROL_1_STENCIL_FUNC);
@@ -3030,51 +3578,51 @@ DEF_METHOD(NV097, SET_BEGIN_END)
             assert(op_zfail < ARRAY_SIZE(pgraph_stencil_op_map));
             assert(op_zpass < ARRAY_SIZE(pgraph_stencil_op_map));
 
-            glStencilFunc(
+            nv2a_gl_stencil_func(
                 pgraph_stencil_func_map[stencil_func],
                 stencil_ref,
                 func_mask);
 
-            glStencilOp(
+            nv2a_gl_stencil_op(
                 pgraph_stencil_op_map[op_fail],
                 pgraph_stencil_op_map[op_zfail],
                 pgraph_stencil_op_map[op_zpass]);
 
         } else {
-            glDisable(GL_STENCIL_TEST);
+            nv2a_gl_disable(GL_STENCIL_TEST);
         }
 
         /* Dither */
         /* FIXME: GL implementation dependent */
         if (pg->regs[NV_PGRAPH_CONTROL_0] &
                 NV_PGRAPH_CONTROL_0_DITHERENABLE) {
-            glEnable(GL_DITHER);
+            nv2a_gl_enable(GL_DITHER);
         } else {
-            glDisable(GL_DITHER);
+            nv2a_gl_disable(GL_DITHER);
         }
 
-        glEnable(GL_PROGRAM_POINT_SIZE);
+        nv2a_gl_enable(GL_PROGRAM_POINT_SIZE);
 
         bool anti_aliasing = GET_MASK(pg->regs[NV_PGRAPH_ANTIALIASING], NV_PGRAPH_ANTIALIASING_ENABLE);
 
         /* Edge Antialiasing */
         if (!anti_aliasing && pg->regs[NV_PGRAPH_SETUPRASTER] &
                                   NV_PGRAPH_SETUPRASTER_LINESMOOTHENABLE) {
-            glEnable(GL_LINE_SMOOTH);
+            nv2a_gl_enable(GL_LINE_SMOOTH);
         } else {
-            glDisable(GL_LINE_SMOOTH);
+            nv2a_gl_disable(GL_LINE_SMOOTH);
         }
         if (!anti_aliasing && pg->regs[NV_PGRAPH_SETUPRASTER] &
                                   NV_PGRAPH_SETUPRASTER_POLYSMOOTHENABLE) {
-            glEnable(GL_POLYGON_SMOOTH);
+            nv2a_gl_enable(GL_POLYGON_SMOOTH);
         } else {
-            glDisable(GL_POLYGON_SMOOTH);
+            nv2a_gl_disable(GL_POLYGON_SMOOTH);
         }
 
         unsigned int vp_width = pg->surface_binding_dim.width,
                      vp_height = pg->surface_binding_dim.height;
         pgraph_apply_scaling_factor(pg, &vp_width, &vp_height);
-        glViewport(0, 0, vp_width, vp_height);
+        nv2a_gl_viewport(0, 0, vp_width, vp_height);
 
         /* Surface clip */
         /* FIXME: Consider moving to PSH w/ window clip */
@@ -3091,8 +3639,8 @@ DEF_METHOD(NV097, SET_BEGIN_END)
         pgraph_apply_scaling_factor(pg, &xmin, &ymin);
         pgraph_apply_scaling_factor(pg, &scissor_width, &scissor_height);
 
-        glEnable(GL_SCISSOR_TEST);
-        glScissor(xmin, ymin, scissor_width, scissor_height);
+        nv2a_gl_enable(GL_SCISSOR_TEST);
+        nv2a_gl_scissor(xmin, ymin, scissor_width, scissor_height);
 
         /* Visibility testing */
         if (pg->zpass_pixel_count_enable) {
@@ -3115,6 +3663,7 @@ DEF_METHOD(NV097, SET_TEXTURE_OFFSET)
     int slot = (method - NV097_SET_TEXTURE_OFFSET) / 64;
     pg->regs[NV_PGRAPH_TEXOFFSET0 + slot * 4] = parameter;
     pg->texture_dirty[slot] = true;
+    pgraph_prefetch_texture(d, slot);
 }
 
 DEF_METHOD(NV097, SET_TEXTURE_FORMAT)
@@ -3152,12 +3701,14 @@ DEF_METHOD(NV097, SET_TEXTURE_FORMAT)
     SET_MASK(*reg, NV_PGRAPH_TEXFMT0_BASE_SIZE_P, log_depth);
 
     pg->texture_dirty[slot] = true;
+    pgraph_prefetch_texture(d, slot);
 }
 
 DEF_METHOD(NV097, SET_TEXTURE_CONTROL0)
 {
     int slot = (method - NV097_SET_TEXTURE_CONTROL0) / 64;
     pg->regs[NV_PGRAPH_TEXCTL0_0 + slot*4] = parameter;
+    pgraph_prefetch_texture(d, slot);
 }
 
 DEF_METHOD(NV097, SET_TEXTURE_CONTROL1)
@@ -3252,7 +3803,9 @@ static void pgraph_expand_draw_arrays(NV2AState *d)
      * triggered if a set of BEGIN+DA+END triplets is followed by the
      * BEGIN+DA+ARRAY_ELEMENT+... chain that caused this expansion. */
     if (pg->draw_arrays_length > 1) {
+        int64_t prof = nv2a_profile_begin(NV2A_PROF_SCOPE_FLUSH_DRAW);
         pgraph_flush_draw(d);
+        nv2a_profile_end(prof);
     }
     assert((pg->inline_elements_length + count) < NV2A_MAX_BATCH_LENGTH);
     for (unsigned int i = 0; i < count; i++) {
@@ -3272,6 +3825,7 @@ static void pgraph_check_within_begin_end_block(PGRAPHState *pg)
 DEF_METHOD_NON_INC(NV097, ARRAY_ELEMENT16)
 {
     pgraph_check_within_begin_end_block(pg);
+    pgraph_reserve_merged_draw(d, 2, true);
 
     if (pg->draw_arrays_length) {
         pgraph_expand_draw_arrays(d);
@@ -3285,6 +3839,7 @@ DEF_METHOD_NON_INC(NV097, ARRAY_ELEMENT16)
 DEF_METHOD_NON_INC(NV097, ARRAY_ELEMENT32)
 {
     pgraph_check_within_begin_end_block(pg);
+    pgraph_reserve_merged_draw(d, 1, true);
 
     if (pg->draw_arrays_length) {
         pgraph_expand_draw_arrays(d);
@@ -3300,6 +3855,7 @@ DEF_METHOD(NV097, DRAW_ARRAYS)
 
     unsigned int start = GET_MASK(parameter, NV097_DRAW_ARRAYS_START_INDEX);
     unsigned int count = GET_MASK(parameter, NV097_DRAW_ARRAYS_COUNT) + 1;
+    pgraph_reserve_merged_draw(d, count, false);
 
     if (pg->inline_elements_length) {
         /* FIXME: Determine HW behavior for overflow case. */
@@ -3528,25 +4084,25 @@ DEF_METHOD(NV097, CLEAR_SURFACE)
         }
         if (parameter & NV097_CLEAR_SURFACE_Z) {
             gl_mask |= GL_DEPTH_BUFFER_BIT;
-            glDepthMask(GL_TRUE);
+            nv2a_gl_depth_mask(GL_TRUE);
             glClearDepth(gl_clear_depth);
         }
         if (parameter & NV097_CLEAR_SURFACE_STENCIL) {
             gl_mask |= GL_STENCIL_BUFFER_BIT;
-            glStencilMask(0xff);
+            nv2a_gl_stencil_mask(0xff);
             glClearStencil(gl_clear_stencil);
         }
     }
     if (write_color) {
         gl_mask |= GL_COLOR_BUFFER_BIT;
-        glColorMask((parameter & NV097_CLEAR_SURFACE_R)
-                         ? GL_TRUE : GL_FALSE,
-                    (parameter & NV097_CLEAR_SURFACE_G)
-                         ? GL_TRUE : GL_FALSE,
-                    (parameter & NV097_CLEAR_SURFACE_B)
-                         ? GL_TRUE : GL_FALSE,
-                    (parameter & NV097_CLEAR_SURFACE_A)
-                         ? GL_TRUE : GL_FALSE);
+        nv2a_gl_color_mask((parameter & NV097_CLEAR_SURFACE_R)
+                                ? GL_TRUE : GL_FALSE,
+                           (parameter & NV097_CLEAR_SURFACE_G)
+                                ? GL_TRUE : GL_FALSE,
+                           (parameter & NV097_CLEAR_SURFACE_B)
+                                ? GL_TRUE : GL_FALSE,
+                           (parameter & NV097_CLEAR_SURFACE_A)
+                                ? GL_TRUE : GL_FALSE);
         uint32_t clear_color = d->pgraph.regs[NV_PGRAPH_COLORCLEARVALUE];
 
         /* Handle RGB */
@@ -3643,20 +4199,20 @@ DEF_METHOD(NV097, CLEAR_SURFACE)
     pgraph_apply_scaling_factor(pg, &scissor_width, &scissor_height);
 
     /* FIXME: Respect window clip?!?! */
-    glEnable(GL_SCISSOR_TEST);
-    glScissor(xmin, ymin, scissor_width, scissor_height);
+    nv2a_gl_enable(GL_SCISSOR_TEST);
+    nv2a_gl_scissor(xmin, ymin, scissor_width, scissor_height);
 
     /* Dither */
     /* FIXME: Maybe also disable it here? + GL implementation dependent */
     if (pg->regs[NV_PGRAPH_CONTROL_0] & NV_PGRAPH_CONTROL_0_DITHERENABLE) {
-        glEnable(GL_DITHER);
+        nv2a_gl_enable(GL_DITHER);
     } else {
-        glDisable(GL_DITHER);
+        nv2a_gl_disable(GL_DITHER);
     }
 
     glClear(gl_mask);
 
-    glDisable(GL_SCISSOR_TEST);
+    nv2a_gl_disable(GL_SCISSOR_TEST);
 
     pgraph_set_surface_dirty(pg, write_color, write_zeta);
 
@@ -3908,6 +4464,7 @@ static void pgraph_finish_inline_buffer_vertex(PGRAPHState *pg)
 void nv2a_gl_context_init(void)
 {
     g_nv2a_context_render = glo_context_create();
+    g_nv2a_context_shader = glo_context_create();
     g_nv2a_context_display = glo_context_create();
 }
 
@@ -3983,13 +4540,15 @@ void pgraph_init(NV2AState *d)
 
     /* fire up opengl */
     glo_set_current(g_nv2a_context_render);
+    nv2a_gl_state_reset();
 
 #ifdef DEBUG_NV2A_GL
     gl_debug_initialize();
 #endif
 
-    /* DXT textures */
-    assert(glo_check_extension("GL_EXT_texture_compression_s3tc"));
+    /* DXT textures, otherwise they are decoded on the CPU */
+    pg->texture_compression_s3tc =
+        glo_check_extension("GL_EXT_texture_compression_s3tc");
     /*  Internal RGB565 texture format */
     assert(glo_check_extension("GL_ARB_ES2_compatibility"));
 
@@ -3999,10 +4558,20 @@ void pgraph_init(NV2AState *d)
 
 
     glGenFramebuffers(1, &pg->gl_framebuffer);
-    glBindFramebuffer(GL_FRAMEBUFFER, pg->gl_framebuffer);
+    glGenFramebuffers(1, &pg->readback_src_fbo);
+    glGenFramebuffers(1, &pg->readback_dst_fbo);
+    glGenTextures(1, &pg->readback_texture);
+    nv2a_gl_bind_texture(GL_TEXTURE_2D, pg->readback_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    nv2a_gl_bind_texture(GL_TEXTURE_2D, 0);
+    nv2a_gl_bind_framebuffer(GL_FRAMEBUFFER, pg->gl_framebuffer);
 
     pgraph_init_render_to_texture(d);
+    pgraph_init_surface_upload(d);
     QTAILQ_INIT(&pg->surfaces);
+    pg->surface_tree = g_tree_new_full(pgraph_surface_range_compare, NULL,
+                                       g_free, NULL);
 
     QSIMPLEQ_INIT(&pg->report_queue);
 
@@ -4017,26 +4586,23 @@ void pgraph_init(NV2AState *d)
         lru_add_free(&pg->texture_cache, &pg->texture_cache_entries[i].node);
     }
 
+    pg->texture_index_size =
+        memory_region_size(d->vram) >> NV2A_TEXTURE_INDEX_BUCKET_SHIFT;
+    pg->texture_index = g_new(typeof(*pg->texture_index),
+                              pg->texture_index_size);
+    for (i = 0; i < pg->texture_index_size; i++) {
+        QLIST_INIT(&pg->texture_index[i]);
+    }
+
     pg->texture_cache.init_node = texture_cache_entry_init;
     pg->texture_cache.compare_nodes = texture_cache_entry_compare;
     pg->texture_cache.post_node_evict = texture_cache_entry_post_evict;
 
-    // Initialize element cache
-    const size_t element_cache_size = 50*1024;
-    lru_init(&pg->element_cache);
-    pg->element_cache_entries = malloc(element_cache_size * sizeof(VertexLruNode));
-    assert(pg->element_cache_entries != NULL);
-    GLuint element_cache_buffers[element_cache_size];
-    glGenBuffers(element_cache_size, element_cache_buffers);
-    for (i = 0; i < element_cache_size; i++) {
-        pg->element_cache_entries[i].gl_buffer = element_cache_buffers[i];
-        lru_add_free(&pg->element_cache, &pg->element_cache_entries[i].node);
-    }
-
-    pg->element_cache.init_node = vertex_cache_entry_init;
-    pg->element_cache.compare_nodes = vertex_cache_entry_compare;
+    pgraph_init_element_cache(pg);
 
     shader_cache_init(pg);
+    pg->shader_state_dirty = SHADER_BLOCK_ALL;
+    pgraph_init_texture_prefetch(pg);
 
     pg->material_alpha = 0.0f;
     SET_MASK(pg->regs[NV_PGRAPH_CONTROL_3], NV_PGRAPH_CONTROL_3_SHADEMODE,
@@ -4050,15 +4616,20 @@ void pgraph_init(NV2AState *d)
                                               * sizeof(float) * 4);
         attribute->inline_buffer_populated = false;
     }
-    glGenBuffers(1, &pg->gl_inline_array_buffer);
+    pgraph_init_stream_buffer(pg);
 
     glGenBuffers(1, &pg->gl_memory_buffer);
     glBindBuffer(GL_ARRAY_BUFFER, pg->gl_memory_buffer);
-    glBufferData(GL_ARRAY_BUFFER, memory_region_size(d->vram),
-                 NULL, GL_DYNAMIC_DRAW);
+    if (glo_check_extension("GL_ARB_buffer_storage")) {
+        glBufferStorage(GL_ARRAY_BUFFER, memory_region_size(d->vram), NULL,
+                        GL_DYNAMIC_STORAGE_BIT);
+    } else {
+        glBufferData(GL_ARRAY_BUFFER, memory_region_size(d->vram),
+                     NULL, GL_DYNAMIC_DRAW);
+    }
 
     glGenVertexArrays(1, &pg->gl_vertex_array);
-    glBindVertexArray(pg->gl_vertex_array);
+    nv2a_gl_bind_vertex_array(pg->gl_vertex_array);
 
     assert(glGetError() == GL_NO_ERROR);
 
@@ -4076,19 +4647,35 @@ void pgraph_destroy(PGRAPHState *pg)
     glo_set_current(g_nv2a_context_render);
 
     // TODO: clear out surfaces
-
-    glDeleteFramebuffers(1, &pg->gl_framebuffer);
+    g_tree_destroy(pg->surface_tree);
+
+    nv2a_gl_delete_framebuffers(1, &pg->gl_framebuffer);
+    nv2a_gl_delete_framebuffers(1, &pg->readback_src_fbo);
+    nv2a_gl_delete_framebuffers(1, &pg->readback_dst_fbo);
+    nv2a_gl_delete_textures(1, &pg->readback_texture);
+    nv2a_gl_delete_framebuffers(1, &pg->surf_upload_rndr.src_fbo);
+    nv2a_gl_delete_framebuffers(1, &pg->surf_upload_rndr.dst_fbo);
+    nv2a_gl_delete_vertex_arrays(1, &pg->surf_upload_rndr.vao);
+    glDeleteProgram(pg->surf_upload_rndr.prog);
+    nv2a_gl_delete_textures(1, &pg->surf_upload_rndr.staging_texture);
+    pgraph_destroy_stream_buffer(pg);
+    pgraph_destroy_element_cache(pg);
+    g_free(pg->download_buf);
 
     // Clear out shader cache
     shader_write_cache_reload_list(pg);
+    shader_cache_destroy(pg);
     free(pg->shader_cache_entries);
 
     // Clear out texture cache
+    pgraph_destroy_texture_prefetch(pg);
     lru_flush(&pg->texture_cache);
     free(pg->texture_cache_entries);
+    g_free(pg->texture_index);
 
     glo_set_current(NULL);
     glo_context_destroy(g_nv2a_context_render);
+    glo_context_destroy(g_nv2a_context_shader);
     glo_context_destroy(g_nv2a_context_display);
 }
 
@@ -4328,253 +4915,134 @@ static void pgraph_shader_update_constants(PGRAPHState *pg,
     }
 }
 
-static bool pgraph_bind_shaders_test_dirty(PGRAPHState *pg)
+static unsigned int pgraph_bind_shaders_test_dirty(PGRAPHState *pg)
 {
-    #define CR_1(reg) CR_x(reg, 1)
-    #define CR_4(reg) CR_x(reg, 4)
-    #define CR_8(reg) CR_x(reg, 8)
-    #define CF(src, name)  CF_x(typeof(src), (&src), name, 1)
-    #define CFA(src, name) CF_x(typeof(src[0]), src, name, ARRAY_SIZE(src))
+    #define SB(block) (1 << SHADER_BLOCK_ ## block)
+    #define CR_1(reg, blocks) CR_x(reg, 1, blocks)
+    #define CR_4(reg, blocks) CR_x(reg, 4, blocks)
+    #define CR_8(reg, blocks) CR_x(reg, 8, blocks)
+    #define CF(src, name, blocks)  CF_x(typeof(src), (&src), name, 1, blocks)
+    #define CFA(src, name, blocks) CF_x(typeof(src[0]), src, name, ARRAY_SIZE(src), blocks)
     #define CNAME(name) reg_check__ ## name
     #define CX_x__define(type, name, x) static type CNAME(name)[x];
     #define CR_x__define(reg, x) CX_x__define(uint32_t, reg, x)
     #define CF_x__define(type, src, name, x) CX_x__define(type, name, x)
-    #define CR_x__check(reg, x) \
-        for (int i = 0; i < x; i++) { if (pg->regs[reg+i*4] != CNAME(reg)[i]) goto dirty; }
-    #define CF_x__check(type, src, name, x) \
-        for (int i = 0; i < x; i++) { if (src[i] != CNAME(name)[i]) goto dirty; }
-    #define CR_x__update(reg, x) \
-        for (int i = 0; i < x; i++) { CNAME(reg)[i] = pg->regs[reg+i*4]; }
-    #define CF_x__update(type, src, name, x) \
-        for (int i = 0; i < x; i++) { CNAME(name)[i] = src[i]; }
-
+    #define CR_x__check(reg, x, blocks) \
+        for (int i = 0; i < x; i++) { \
+            if (pg->regs[reg+i*4] != CNAME(reg)[i]) { \
+                CNAME(reg)[i] = pg->regs[reg+i*4]; \
+                dirty |= (blocks); \
+            } \
+        }
+    #define CF_x__check(type, src, name, x, blocks) \
+        for (int i = 0; i < x; i++) { \
+            if (src[i] != CNAME(name)[i]) { \
+                CNAME(name)[i] = src[i]; \
+                dirty |= (blocks); \
+            } \
+        }
+
+    /* Each input names the ShaderState blocks derived from it */
     #define DIRTY_REGS \
-        CR_1(NV_PGRAPH_COMBINECTL) \
-        CR_1(NV_PGRAPH_SHADERCTL) \
-        CR_1(NV_PGRAPH_SHADOWCTL) \
-        CR_1(NV_PGRAPH_COMBINESPECFOG0) \
-        CR_1(NV_PGRAPH_COMBINESPECFOG1) \
-        CR_1(NV_PGRAPH_CONTROL_0) \
-        CR_1(NV_PGRAPH_CONTROL_3) \
-        CR_1(NV_PGRAPH_CSV0_C) \
-        CR_1(NV_PGRAPH_CSV0_D) \
-        CR_1(NV_PGRAPH_CSV1_A) \
-        CR_1(NV_PGRAPH_CSV1_B) \
-        CR_1(NV_PGRAPH_SETUPRASTER) \
-        CR_1(NV_PGRAPH_SHADERPROG) \
-        CR_8(NV_PGRAPH_COMBINECOLORI0) \
-        CR_8(NV_PGRAPH_COMBINECOLORO0) \
-        CR_8(NV_PGRAPH_COMBINEALPHAI0) \
-        CR_8(NV_PGRAPH_COMBINEALPHAO0) \
-        CR_8(NV_PGRAPH_COMBINEFACTOR0) \
-        CR_8(NV_PGRAPH_COMBINEFACTOR1) \
-        CR_1(NV_PGRAPH_SHADERCLIPMODE) \
-        CR_4(NV_PGRAPH_TEXCTL0_0) \
-        CR_4(NV_PGRAPH_TEXFMT0) \
-        CR_4(NV_PGRAPH_TEXFILTER0) \
-        CR_8(NV_PGRAPH_WINDOWCLIPX0) \
-        CR_8(NV_PGRAPH_WINDOWCLIPY0) \
-        CF(pg->primitive_mode, primitive_mode) \
-        CF(pg->surface_scale_factor, surface_scale_factor) \
-        CF(pg->compressed_attrs, compressed_attrs) \
-        CFA(pg->texture_matrix_enable, texture_matrix_enable)
-
-    #define CR_x(reg, x) CR_x__define(reg, x)
-    #define CF_x(type, src, name, x) CF_x__define(type, src, name, x)
+        CR_1(NV_PGRAPH_COMBINECTL, SB(COMBINERS)) \
+        CR_1(NV_PGRAPH_SHADERCTL, SB(COMBINERS)) \
+        CR_1(NV_PGRAPH_SHADOWCTL, SB(TEXTURES)) \
+        CR_1(NV_PGRAPH_COMBINESPECFOG0, SB(COMBINERS)) \
+        CR_1(NV_PGRAPH_COMBINESPECFOG1, SB(COMBINERS)) \
+        CR_1(NV_PGRAPH_CONTROL_0, SB(TEXTURES) | SB(VERTEX_PROGRAM)) \
+        CR_1(NV_PGRAPH_CONTROL_3, SB(TEXTURES) | SB(VERTEX) | SB(RASTER)) \
+        CR_1(NV_PGRAPH_CSV0_C, SB(VERTEX) | SB(VERTEX_PROGRAM)) \
+        CR_1(NV_PGRAPH_CSV0_D, SB(VERTEX) | SB(VERTEX_PROGRAM) | SB(RASTER)) \
+        CR_1(NV_PGRAPH_CSV1_A, SB(VERTEX)) \
+        CR_1(NV_PGRAPH_CSV1_B, SB(VERTEX)) \
+        CR_1(NV_PGRAPH_SETUPRASTER, SB(TEXTURES) | SB(RASTER)) \
+        CR_1(NV_PGRAPH_SHADERPROG, SB(COMBINERS) | SB(TEXTURES)) \
+        CR_1(NV_PGRAPH_POINTSIZE, SB(RASTER)) \
+        CR_8(NV_PGRAPH_COMBINECOLORI0, SB(COMBINERS)) \
+        CR_8(NV_PGRAPH_COMBINECOLORO0, SB(COMBINERS)) \
+        CR_8(NV_PGRAPH_COMBINEALPHAI0, SB(COMBINERS)) \
+        CR_8(NV_PGRAPH_COMBINEALPHAO0, SB(COMBINERS)) \
+        CR_1(NV_PGRAPH_SHADERCLIPMODE, SB(TEXTURES)) \
+        CR_4(NV_PGRAPH_TEXCTL0_0, SB(TEXTURES)) \
+        CR_4(NV_PGRAPH_TEXFMT0, SB(TEXTURES)) \
+        CR_4(NV_PGRAPH_TEXFILTER0, SB(TEXTURES)) \
+        CF(pg->primitive_mode, primitive_mode, SB(RASTER)) \
+        CF(pg->surface_scale_factor, surface_scale_factor, SB(RASTER)) \
+        CF(pg->compressed_attrs, compressed_attrs, SB(VERTEX)) \
+        CFA(pg->texture_matrix_enable, texture_matrix_enable, SB(VERTEX)) \
+        CFA(pg->point_params, point_params, SB(RASTER))
+
+    #define CR_x(reg, x, blocks) CR_x__define(reg, x)
+    #define CF_x(type, src, name, x, blocks) CF_x__define(type, src, name, x)
     DIRTY_REGS
     #undef CR_x
     #undef CF_x
 
-    #define CR_x(reg, x) CR_x__check(reg, x)
-    #define CF_x(type, src, name, x) CF_x__check(type, src, name, x)
-    DIRTY_REGS
-    #undef CR_x
-    #undef CF_x
-    return false;
+    unsigned int dirty = 0;
 
-dirty:
-    #define CR_x(reg, x) CR_x__update(reg, x)
-    #define CF_x(type, src, name, x) CF_x__update(type, src, name, x)
+    #define CR_x(reg, x, blocks) CR_x__check(reg, x, blocks)
+    #define CF_x(type, src, name, x, blocks) CF_x__check(type, src, name, x, blocks)
     DIRTY_REGS
     #undef CR_x
     #undef CF_x
-    return true;
-}
-
-static void pgraph_bind_shaders(PGRAPHState *pg)
-{
-    int i, j;
-
-    bool vertex_program = GET_MASK(pg->regs[NV_PGRAPH_CSV0_D],
-                                   NV_PGRAPH_CSV0_D_MODE) == 2;
-
-    bool fixed_function = GET_MASK(pg->regs[NV_PGRAPH_CSV0_D],
-                                   NV_PGRAPH_CSV0_D_MODE) == 0;
-
-    int program_start = GET_MASK(pg->regs[NV_PGRAPH_CSV0_C],
-                                 NV_PGRAPH_CSV0_C_CHEOPS_PROGRAM_START);
-
-    NV2A_GL_DGROUP_BEGIN("%s (VP: %s FFP: %s)", __func__,
-                         vertex_program ? "yes" : "no",
-                         fixed_function ? "yes" : "no");
 
-    bool binding_changed = false;
-    if (!pgraph_bind_shaders_test_dirty(pg) && !pg->program_data_dirty) {
-        nv2a_profile_inc_counter(NV2A_PROF_SHADER_BIND_NOTDIRTY);
-        goto update_constants;
+    if (pg->program_data_dirty) {
+        pg->program_data_dirty = false;
+        dirty |= SB(VERTEX_PROGRAM);
     }
 
-    pg->program_data_dirty = false;
-
-    ShaderBinding* old_binding = pg->shader_binding;
+    return dirty;
+}
 
-    ShaderState state;
-    memset(&state, 0, sizeof(ShaderState));
+static void pgraph_shader_state_build_combiners(PGRAPHState *pg,
+                                                ShaderState *state)
+{
+    state->psh.combiner_control = pg->regs[NV_PGRAPH_COMBINECTL];
+    state->psh.shader_stage_program = pg->regs[NV_PGRAPH_SHADERPROG];
+    state->psh.other_stage_input = pg->regs[NV_PGRAPH_SHADERCTL];
+    state->psh.final_inputs_0 = pg->regs[NV_PGRAPH_COMBINESPECFOG0];
+    state->psh.final_inputs_1 = pg->regs[NV_PGRAPH_COMBINESPECFOG1];
 
-    state.surface_scale_factor = pg->surface_scale_factor;
+    /* Copy content of enabled combiner stages */
+    int num_stages = pg->regs[NV_PGRAPH_COMBINECTL] & 0xFF;
+    for (int i = 0; i < num_stages; i++) {
+        state->psh.rgb_inputs[i] = pg->regs[NV_PGRAPH_COMBINECOLORI0 + i * 4];
+        state->psh.rgb_outputs[i] = pg->regs[NV_PGRAPH_COMBINECOLORO0 + i * 4];
+        state->psh.alpha_inputs[i] = pg->regs[NV_PGRAPH_COMBINEALPHAI0 + i * 4];
+        state->psh.alpha_outputs[i] = pg->regs[NV_PGRAPH_COMBINEALPHAO0 + i * 4];
+        //constant_0[i] = pg->regs[NV_PGRAPH_COMBINEFACTOR0 + i * 4];
+        //constant_1[i] = pg->regs[NV_PGRAPH_COMBINEFACTOR1 + i * 4];
+    }
+}
 
-    state.compressed_attrs = pg->compressed_attrs;
+static void pgraph_shader_state_build_textures(PGRAPHState *pg,
+                                               ShaderState *state)
+{
+    int i, j;
 
-    /* register combiner stuff */
-    state.psh.window_clip_exclusive = pg->regs[NV_PGRAPH_SETUPRASTER]
+    state->psh.window_clip_exclusive = pg->regs[NV_PGRAPH_SETUPRASTER]
                                        & NV_PGRAPH_SETUPRASTER_WINDOWCLIPTYPE;
-    state.psh.combiner_control = pg->regs[NV_PGRAPH_COMBINECTL];
-    state.psh.shader_stage_program = pg->regs[NV_PGRAPH_SHADERPROG];
-    state.psh.other_stage_input = pg->regs[NV_PGRAPH_SHADERCTL];
-    state.psh.final_inputs_0 = pg->regs[NV_PGRAPH_COMBINESPECFOG0];
-    state.psh.final_inputs_1 = pg->regs[NV_PGRAPH_COMBINESPECFOG1];
 
-    state.psh.alpha_test = pg->regs[NV_PGRAPH_CONTROL_0]
+    state->psh.alpha_test = pg->regs[NV_PGRAPH_CONTROL_0]
                             & NV_PGRAPH_CONTROL_0_ALPHATESTENABLE;
-    state.psh.alpha_func = (enum PshAlphaFunc)GET_MASK(pg->regs[NV_PGRAPH_CONTROL_0],
+    state->psh.alpha_func = (enum PshAlphaFunc)GET_MASK(pg->regs[NV_PGRAPH_CONTROL_0],
                                    NV_PGRAPH_CONTROL_0_ALPHAFUNC);
 
-    state.psh.point_sprite = pg->regs[NV_PGRAPH_SETUPRASTER] &
+    state->psh.point_sprite = pg->regs[NV_PGRAPH_SETUPRASTER] &
                                  NV_PGRAPH_SETUPRASTER_POINTSMOOTHENABLE;
 
-    state.psh.shadow_depth_func = (enum PshShadowDepthFunc)GET_MASK(
+    state->psh.shadow_depth_func = (enum PshShadowDepthFunc)GET_MASK(
         pg->regs[NV_PGRAPH_SHADOWCTL], NV_PGRAPH_SHADOWCTL_SHADOW_ZFUNC);
 
-    state.fixed_function = fixed_function;
-
-    /* fixed function stuff */
-    if (fixed_function) {
-        state.skinning = (enum VshSkinning)GET_MASK(pg->regs[NV_PGRAPH_CSV0_D],
-                                               NV_PGRAPH_CSV0_D_SKIN);
-        state.lighting = GET_MASK(pg->regs[NV_PGRAPH_CSV0_C],
-                             NV_PGRAPH_CSV0_C_LIGHTING);
-        state.normalization = pg->regs[NV_PGRAPH_CSV0_C]
-                           & NV_PGRAPH_CSV0_C_NORMALIZATION_ENABLE;
-
-        /* color material */
-        state.emission_src = (enum MaterialColorSource)GET_MASK(pg->regs[NV_PGRAPH_CSV0_C], NV_PGRAPH_CSV0_C_EMISSION);
-        state.ambient_src = (enum MaterialColorSource)GET_MASK(pg->regs[NV_PGRAPH_CSV0_C], NV_PGRAPH_CSV0_C_AMBIENT);
-        state.diffuse_src = (enum MaterialColorSource)GET_MASK(pg->regs[NV_PGRAPH_CSV0_C], NV_PGRAPH_CSV0_C_DIFFUSE);
-        state.specular_src = (enum MaterialColorSource)GET_MASK(pg->regs[NV_PGRAPH_CSV0_C], NV_PGRAPH_CSV0_C_SPECULAR);
-    }
+    state->psh.smooth_shading = GET_MASK(pg->regs[NV_PGRAPH_CONTROL_3],
+                                         NV_PGRAPH_CONTROL_3_SHADEMODE) ==
+                                NV_PGRAPH_CONTROL_3_SHADEMODE_SMOOTH;
 
-    /* vertex program stuff */
-    state.vertex_program = vertex_program,
-    state.z_perspective = pg->regs[NV_PGRAPH_CONTROL_0]
-                        & NV_PGRAPH_CONTROL_0_Z_PERSPECTIVE_ENABLE;
-
-    state.point_params_enable = GET_MASK(pg->regs[NV_PGRAPH_CSV0_D],
-                                         NV_PGRAPH_CSV0_D_POINTPARAMSENABLE);
-    state.point_size =
-        GET_MASK(pg->regs[NV_PGRAPH_POINTSIZE], NV097_SET_POINT_SIZE_V) / 8.0f;
-    if (state.point_params_enable) {
-        for (int i = 0; i < 8; i++) {
-            state.point_params[i] = pg->point_params[i];
-        }
-    }
-
-    /* geometry shader stuff */
-    state.primitive_mode = (enum ShaderPrimitiveMode)pg->primitive_mode;
-    state.polygon_front_mode = (enum ShaderPolygonMode)GET_MASK(pg->regs[NV_PGRAPH_SETUPRASTER],
-                                                           NV_PGRAPH_SETUPRASTER_FRONTFACEMODE);
-    state.polygon_back_mode = (enum ShaderPolygonMode)GET_MASK(pg->regs[NV_PGRAPH_SETUPRASTER],
-                                                          NV_PGRAPH_SETUPRASTER_BACKFACEMODE);
-
-    state.smooth_shading = GET_MASK(pg->regs[NV_PGRAPH_CONTROL_3],
-                                      NV_PGRAPH_CONTROL_3_SHADEMODE) ==
-                             NV_PGRAPH_CONTROL_3_SHADEMODE_SMOOTH;
-    state.psh.smooth_shading = state.smooth_shading;
-
-    state.program_length = 0;
-
-    if (vertex_program) {
-        // copy in vertex program tokens
-        for (i = program_start; i < NV2A_MAX_TRANSFORM_PROGRAM_LENGTH; i++) {
-            uint32_t *cur_token = (uint32_t*)&pg->program_data[i];
-            memcpy(&state.program_data[state.program_length],
-                   cur_token,
-                   VSH_TOKEN_SIZE * sizeof(uint32_t));
-            state.program_length++;
-
-            if (vsh_get_field(cur_token, FLD_FINAL)) {
-                break;
-            }
-        }
-    }
-
-    /* Texgen */
-    for (i = 0; i < 4; i++) {
-        unsigned int reg = (i < 2) ? NV_PGRAPH_CSV1_A : NV_PGRAPH_CSV1_B;
-        for (j = 0; j < 4; j++) {
-            unsigned int masks[] = {
-                (i % 2) ? NV_PGRAPH_CSV1_A_T1_S : NV_PGRAPH_CSV1_A_T0_S,
-                (i % 2) ? NV_PGRAPH_CSV1_A_T1_T : NV_PGRAPH_CSV1_A_T0_T,
-                (i % 2) ? NV_PGRAPH_CSV1_A_T1_R : NV_PGRAPH_CSV1_A_T0_R,
-                (i % 2) ? NV_PGRAPH_CSV1_A_T1_Q : NV_PGRAPH_CSV1_A_T0_Q
-            };
-            state.texgen[i][j] = (enum VshTexgen)GET_MASK(pg->regs[reg], masks[j]);
-        }
-    }
-
-    /* Fog */
-    state.fog_enable = pg->regs[NV_PGRAPH_CONTROL_3]
-                           & NV_PGRAPH_CONTROL_3_FOGENABLE;
-    if (state.fog_enable) {
-        /*FIXME: Use CSV0_D? */
-        state.fog_mode = (enum VshFogMode)GET_MASK(pg->regs[NV_PGRAPH_CONTROL_3],
-                                  NV_PGRAPH_CONTROL_3_FOG_MODE);
-        state.foggen = (enum VshFoggen)GET_MASK(pg->regs[NV_PGRAPH_CSV0_D],
-                                NV_PGRAPH_CSV0_D_FOGGENMODE);
-    } else {
-        /* FIXME: Do we still pass the fogmode? */
-        state.fog_mode = (enum VshFogMode)0;
-        state.foggen = (enum VshFoggen)0;
-    }
-
-    /* Texture matrices */
-    for (i = 0; i < 4; i++) {
-        state.texture_matrix_enable[i] = pg->texture_matrix_enable[i];
-    }
-
-    /* Lighting */
-    if (state.lighting) {
-        for (i = 0; i < NV2A_MAX_LIGHTS; i++) {
-            state.light[i] = (enum VshLight)GET_MASK(pg->regs[NV_PGRAPH_CSV0_D],
-                                      NV_PGRAPH_CSV0_D_LIGHT0 << (i * 2));
-        }
-    }
-
-    /* Copy content of enabled combiner stages */
-    int num_stages = pg->regs[NV_PGRAPH_COMBINECTL] & 0xFF;
-    for (i = 0; i < num_stages; i++) {
-        state.psh.rgb_inputs[i] = pg->regs[NV_PGRAPH_COMBINECOLORI0 + i * 4];
-        state.psh.rgb_outputs[i] = pg->regs[NV_PGRAPH_COMBINECOLORO0 + i * 4];
-        state.psh.alpha_inputs[i] = pg->regs[NV_PGRAPH_COMBINEALPHAI0 + i * 4];
-        state.psh.alpha_outputs[i] = pg->regs[NV_PGRAPH_COMBINEALPHAO0 + i * 4];
-        //constant_0[i] = pg->regs[NV_PGRAPH_COMBINEFACTOR0 + i * 4];
-        //constant_1[i] = pg->regs[NV_PGRAPH_COMBINEFACTOR1 + i * 4];
-    }
-
-    for (i = 0; i < 4; i++) {
-        for (j = 0; j < 4; j++) {
-            state.psh.compare_mode[i][j] =
-                (pg->regs[NV_PGRAPH_SHADERCLIPMODE] >> (4 * i + j)) & 1;
-        }
+    for (i = 0; i < 4; i++) {
+        for (j = 0; j < 4; j++) {
+            state->psh.compare_mode[i][j] =
+                (pg->regs[NV_PGRAPH_SHADERCLIPMODE] >> (4 * i + j)) & 1;
+        }
 
         uint32_t ctl_0 = pg->regs[NV_PGRAPH_TEXCTL0_0 + i*4];
         bool enabled = pgraph_is_texture_stage_active(pg, i) &&
@@ -4583,19 +5051,19 @@ static void pgraph_bind_shaders(PGRAPHState *pg)
             continue;
         }
 
-        state.psh.alphakill[i] = ctl_0 & NV_PGRAPH_TEXCTL0_0_ALPHAKILLEN;
+        state->psh.alphakill[i] = ctl_0 & NV_PGRAPH_TEXCTL0_0_ALPHAKILLEN;
 
         uint32_t tex_fmt = pg->regs[NV_PGRAPH_TEXFMT0 + i*4];
         unsigned int color_format = GET_MASK(tex_fmt, NV_PGRAPH_TEXFMT0_COLOR);
         ColorFormatInfo f = kelvin_color_format_map[color_format];
-        state.psh.rect_tex[i] = f.linear;
+        state->psh.rect_tex[i] = f.linear;
 
         uint32_t border_source = GET_MASK(tex_fmt,
                                           NV_PGRAPH_TEXFMT0_BORDER_SOURCE);
         bool cubemap = GET_MASK(tex_fmt, NV_PGRAPH_TEXFMT0_CUBEMAPENABLE);
-        state.psh.border_logical_size[i][0] = 0.0f;
-        state.psh.border_logical_size[i][1] = 0.0f;
-        state.psh.border_logical_size[i][2] = 0.0f;
+        state->psh.border_logical_size[i][0] = 0.0f;
+        state->psh.border_logical_size[i][1] = 0.0f;
+        state->psh.border_logical_size[i][2] = 0.0f;
         if (border_source != NV_PGRAPH_TEXFMT0_BORDER_SOURCE_COLOR) {
             if (!f.linear && !cubemap) {
                 // The actual texture will be (at least) double the reported
@@ -4608,26 +5076,26 @@ static void pgraph_bind_shaders(PGRAPHState *pg)
                 unsigned int reported_depth =
                     1 << GET_MASK(tex_fmt, NV_PGRAPH_TEXFMT0_BASE_SIZE_P);
 
-                state.psh.border_logical_size[i][0] = reported_width;
-                state.psh.border_logical_size[i][1] = reported_height;
-                state.psh.border_logical_size[i][2] = reported_depth;
+                state->psh.border_logical_size[i][0] = reported_width;
+                state->psh.border_logical_size[i][1] = reported_height;
+                state->psh.border_logical_size[i][2] = reported_depth;
 
                 if (reported_width < 8) {
-                    state.psh.border_inv_real_size[i][0] = 0.0625f;
+                    state->psh.border_inv_real_size[i][0] = 0.0625f;
                 } else {
-                    state.psh.border_inv_real_size[i][0] =
+                    state->psh.border_inv_real_size[i][0] =
                             1.0f / (reported_width * 2.0f);
                 }
                 if (reported_height < 8) {
-                    state.psh.border_inv_real_size[i][1] = 0.0625f;
+                    state->psh.border_inv_real_size[i][1] = 0.0625f;
                 } else {
-                    state.psh.border_inv_real_size[i][1] =
+                    state->psh.border_inv_real_size[i][1] =
                             1.0f / (reported_height * 2.0f);
                 }
                 if (reported_depth < 8) {
-                    state.psh.border_inv_real_size[i][2] = 0.0625f;
+                    state->psh.border_inv_real_size[i][2] = 0.0625f;
                 } else {
-                    state.psh.border_inv_real_size[i][2] =
+                    state->psh.border_inv_real_size[i][2] =
                             1.0f / (reported_depth * 2.0f);
                 }
             } else {
@@ -4645,10 +5113,10 @@ static void pgraph_bind_shaders(PGRAPHState *pg)
          * fragment shader, there may be interpolation artifacts. Fix this to
          * support signed textures more appropriately.
          */
-        state.psh.snorm_tex[i] = (f.gl_internal_format == GL_RGB8_SNORM)
+        state->psh.snorm_tex[i] = (f.gl_internal_format == GL_RGB8_SNORM)
                                  || (f.gl_internal_format == GL_RG8_SNORM);
 
-        state.psh.shadow_map[i] = f.depth;
+        state->psh.shadow_map[i] = f.depth;
 
         uint32_t filter = pg->regs[NV_PGRAPH_TEXFILTER0 + i*4];
         unsigned int min_filter = GET_MASK(filter, NV_PGRAPH_TEXFILTER0_MIN);
@@ -4664,32 +5132,276 @@ static void pgraph_bind_shaders(PGRAPHState *pg)
             kernel = (enum ConvolutionFilter)k;
         }
 
-        state.psh.conv_tex[i] = kernel;
+        state->psh.conv_tex[i] = kernel;
+    }
+}
+
+static void pgraph_shader_state_build_vertex(PGRAPHState *pg,
+                                             ShaderState *state)
+{
+    int i, j;
+
+    state->compressed_attrs = pg->compressed_attrs;
+
+    state->fixed_function = GET_MASK(pg->regs[NV_PGRAPH_CSV0_D],
+                                     NV_PGRAPH_CSV0_D_MODE) == 0;
+
+    /* fixed function stuff */
+    if (state->fixed_function) {
+        state->skinning = (enum VshSkinning)GET_MASK(pg->regs[NV_PGRAPH_CSV0_D],
+                                               NV_PGRAPH_CSV0_D_SKIN);
+        state->lighting = GET_MASK(pg->regs[NV_PGRAPH_CSV0_C],
+                             NV_PGRAPH_CSV0_C_LIGHTING);
+        state->normalization = pg->regs[NV_PGRAPH_CSV0_C]
+                           & NV_PGRAPH_CSV0_C_NORMALIZATION_ENABLE;
+
+        /* color material */
+        state->emission_src = (enum MaterialColorSource)GET_MASK(pg->regs[NV_PGRAPH_CSV0_C], NV_PGRAPH_CSV0_C_EMISSION);
+        state->ambient_src = (enum MaterialColorSource)GET_MASK(pg->regs[NV_PGRAPH_CSV0_C], NV_PGRAPH_CSV0_C_AMBIENT);
+        state->diffuse_src = (enum MaterialColorSource)GET_MASK(pg->regs[NV_PGRAPH_CSV0_C], NV_PGRAPH_CSV0_C_DIFFUSE);
+        state->specular_src = (enum MaterialColorSource)GET_MASK(pg->regs[NV_PGRAPH_CSV0_C], NV_PGRAPH_CSV0_C_SPECULAR);
+    }
+
+    /* Texgen */
+    for (i = 0; i < 4; i++) {
+        unsigned int reg = (i < 2) ? NV_PGRAPH_CSV1_A : NV_PGRAPH_CSV1_B;
+        for (j = 0; j < 4; j++) {
+            unsigned int masks[] = {
+                (i % 2) ? NV_PGRAPH_CSV1_A_T1_S : NV_PGRAPH_CSV1_A_T0_S,
+                (i % 2) ? NV_PGRAPH_CSV1_A_T1_T : NV_PGRAPH_CSV1_A_T0_T,
+                (i % 2) ? NV_PGRAPH_CSV1_A_T1_R : NV_PGRAPH_CSV1_A_T0_R,
+                (i % 2) ? NV_PGRAPH_CSV1_A_T1_Q : NV_PGRAPH_CSV1_A_T0_Q
+            };
+            state->texgen[i][j] = (enum VshTexgen)GET_MASK(pg->regs[reg], masks[j]);
+        }
+    }
+
+    /* Fog */
+    state->fog_enable = pg->regs[NV_PGRAPH_CONTROL_3]
+                           & NV_PGRAPH_CONTROL_3_FOGENABLE;
+    if (state->fog_enable) {
+        /*FIXME: Use CSV0_D? */
+        state->fog_mode = (enum VshFogMode)GET_MASK(pg->regs[NV_PGRAPH_CONTROL_3],
+                                  NV_PGRAPH_CONTROL_3_FOG_MODE);
+        state->foggen = (enum VshFoggen)GET_MASK(pg->regs[NV_PGRAPH_CSV0_D],
+                                NV_PGRAPH_CSV0_D_FOGGENMODE);
+    } else {
+        /* FIXME: Do we still pass the fogmode? */
+        state->fog_mode = (enum VshFogMode)0;
+        state->foggen = (enum VshFoggen)0;
+    }
+
+    /* Texture matrices */
+    for (i = 0; i < 4; i++) {
+        state->texture_matrix_enable[i] = pg->texture_matrix_enable[i];
+    }
+
+    /* Lighting */
+    if (state->lighting) {
+        for (i = 0; i < NV2A_MAX_LIGHTS; i++) {
+            state->light[i] = (enum VshLight)GET_MASK(pg->regs[NV_PGRAPH_CSV0_D],
+                                      NV_PGRAPH_CSV0_D_LIGHT0 << (i * 2));
+        }
+    }
+}
+
+static void pgraph_shader_state_build_vertex_program(PGRAPHState *pg,
+                                                     ShaderState *state)
+{
+    int program_start = GET_MASK(pg->regs[NV_PGRAPH_CSV0_C],
+                                 NV_PGRAPH_CSV0_C_CHEOPS_PROGRAM_START);
+
+    state->vertex_program = GET_MASK(pg->regs[NV_PGRAPH_CSV0_D],
+                                     NV_PGRAPH_CSV0_D_MODE) == 2;
+    state->z_perspective = pg->regs[NV_PGRAPH_CONTROL_0]
+                        & NV_PGRAPH_CONTROL_0_Z_PERSPECTIVE_ENABLE;
+
+    state->program_length = 0;
+
+    if (state->vertex_program) {
+        // copy in vertex program tokens
+        for (int i = program_start; i < NV2A_MAX_TRANSFORM_PROGRAM_LENGTH; i++) {
+            uint32_t *cur_token = (uint32_t*)&pg->program_data[i];
+            memcpy(&state->program_data[state->program_length],
+                   cur_token,
+                   VSH_TOKEN_SIZE * sizeof(uint32_t));
+            state->program_length++;
+
+            if (vsh_get_field(cur_token, FLD_FINAL)) {
+                break;
+            }
+        }
+    }
+}
+
+static void pgraph_shader_state_build_raster(PGRAPHState *pg,
+                                             ShaderState *state)
+{
+    state->surface_scale_factor = pg->surface_scale_factor;
+
+    state->point_params_enable = GET_MASK(pg->regs[NV_PGRAPH_CSV0_D],
+                                          NV_PGRAPH_CSV0_D_POINTPARAMSENABLE);
+    state->point_size =
+        GET_MASK(pg->regs[NV_PGRAPH_POINTSIZE], NV097_SET_POINT_SIZE_V) / 8.0f;
+    if (state->point_params_enable) {
+        for (int i = 0; i < 8; i++) {
+            state->point_params[i] = pg->point_params[i];
+        }
+    }
+
+    /* geometry shader stuff */
+    state->primitive_mode = (enum ShaderPrimitiveMode)pg->primitive_mode;
+    state->polygon_front_mode = (enum ShaderPolygonMode)GET_MASK(pg->regs[NV_PGRAPH_SETUPRASTER],
+                                                           NV_PGRAPH_SETUPRASTER_FRONTFACEMODE);
+    state->polygon_back_mode = (enum ShaderPolygonMode)GET_MASK(pg->regs[NV_PGRAPH_SETUPRASTER],
+                                                          NV_PGRAPH_SETUPRASTER_BACKFACEMODE);
+
+    state->smooth_shading = GET_MASK(pg->regs[NV_PGRAPH_CONTROL_3],
+                                     NV_PGRAPH_CONTROL_3_SHADEMODE) ==
+                            NV_PGRAPH_CONTROL_3_SHADEMODE_SMOOTH;
+}
+
+/*
+ * Brings pg->shader_state up to date, rebuilding and rehashing only the
+ * blocks whose inputs changed since the last call. Returns false if the key
+ * is unchanged.
+ */
+static bool pgraph_shader_state_update(PGRAPHState *pg)
+{
+    static void (* const build[SHADER_BLOCK__COUNT])(PGRAPHState *,
+                                                     ShaderState *) = {
+        [SHADER_BLOCK_COMBINERS] = pgraph_shader_state_build_combiners,
+        [SHADER_BLOCK_TEXTURES] = pgraph_shader_state_build_textures,
+        [SHADER_BLOCK_VERTEX] = pgraph_shader_state_build_vertex,
+        [SHADER_BLOCK_VERTEX_PROGRAM] = pgraph_shader_state_build_vertex_program,
+        [SHADER_BLOCK_RASTER] = pgraph_shader_state_build_raster,
+    };
+
+    unsigned int dirty = pg->shader_state_dirty |
+                         pgraph_bind_shaders_test_dirty(pg);
+    pg->shader_state_dirty = 0;
+    if (!dirty) {
+        return false;
+    }
+
+    for (int i = 0; i < SHADER_BLOCK__COUNT; i++) {
+        if (!(dirty & (1 << i))) {
+            continue;
+        }
+
+        /* Unset fields and padding must hash the same every time */
+        size_t start, end;
+        shader_state_block_range(i, &start, &end);
+        memset((uint8_t *)&pg->shader_state + start, 0, end - start);
+
+        build[i](pg, &pg->shader_state);
+        pg->shader_state_block_hash[i] =
+            shader_state_hash_block(&pg->shader_state, i);
+        nv2a_profile_inc_counter(NV2A_PROF_SHADER_KEY_REHASH);
+    }
+
+    pg->shader_state_hash =
+        shader_state_hash_blocks(pg->shader_state_block_hash);
+
+    return true;
+}
+
+static void pgraph_bind_shaders(PGRAPHState *pg)
+{
+    bool vertex_program = GET_MASK(pg->regs[NV_PGRAPH_CSV0_D],
+                                   NV_PGRAPH_CSV0_D_MODE) == 2;
+
+    bool fixed_function = GET_MASK(pg->regs[NV_PGRAPH_CSV0_D],
+                                   NV_PGRAPH_CSV0_D_MODE) == 0;
+
+    NV2A_GL_DGROUP_BEGIN("%s (VP: %s FFP: %s)", __func__,
+                         vertex_program ? "yes" : "no",
+                         fixed_function ? "yes" : "no");
+
+    bool binding_changed = false;
+    if (!pgraph_shader_state_update(pg) && !pg->shader_compile_pending) {
+        nv2a_profile_inc_counter(NV2A_PROF_SHADER_BIND_NOTDIRTY);
+        goto update_constants;
     }
 
-    uint64_t shader_state_hash = fast_hash((uint8_t*) &state, sizeof(ShaderState));
+    ShaderBinding* old_binding = pg->shader_binding;
+    ShaderState *state = &pg->shader_state;
+
     qemu_mutex_lock(&pg->shader_cache_lock);
-    LruNode *node = lru_lookup(&pg->shader_cache, shader_state_hash, &state);
+    LruNode *node = lru_lookup(&pg->shader_cache, pg->shader_state_hash, state);
     ShaderLruNode *snode = container_of(node, ShaderLruNode, node);
-    if (snode->binding || shader_load_from_memory(snode)) {
+    int policy = g_config.perf.shader_compilation;
+    int64_t latency_us;
+
+    pg->shader_compile_pending = false;
+    pg->shader_skip_draw = false;
+
+    if (snode->binding || (!snode->compile_job &&
+                           shader_load_from_memory(snode))) {
         pg->shader_binding = snode->binding;
-    } else {
-        pg->shader_binding = generate_shaders(&state);
+    } else if (policy == CONFIG_PERF_SHADER_COMPILATION_SYNCHRONOUS &&
+               !snode->compile_job) {
+        pg->shader_binding = generate_shaders(state);
         nv2a_profile_inc_counter(NV2A_PROF_SHADER_GEN);
 
         /* cache it */
         snode->binding = pg->shader_binding;
         if (g_config.perf.cache_shaders) {
-            shader_cache_to_disk(snode);
+            shader_cache_to_disk(pg, snode);
+        }
+    } else {
+        if (!snode->compile_job) {
+            nv2a_profile_inc_counter(NV2A_PROF_SHADER_COMPILE_ASYNC);
+        }
+
+        int timeout_ms = 0;
+        if (policy == CONFIG_PERF_SHADER_COMPILATION_WAIT) {
+            timeout_ms = g_config.perf.shader_compilation_timeout;
+        } else if (policy == CONFIG_PERF_SHADER_COMPILATION_SYNCHRONOUS) {
+            /* Policy changed while this one was compiling */
+            timeout_ms = INT_MAX;
+        }
+
+        if (shader_compile_async(pg, snode, timeout_ms, &latency_us)) {
+            nv2a_profile_inc_counter(NV2A_PROF_SHADER_GEN);
+            nv2a_profile_max_counter(NV2A_PROF_SHADER_COMPILE_LATENCY_US,
+                                     latency_us);
+            pg->shader_binding = snode->binding;
+            if (g_config.perf.cache_shaders) {
+                shader_cache_to_disk(pg, snode);
+            }
+        } else {
+            /*
+             * Not ready yet. Either drop draws until it is, or keep going
+             * with the previous program if it consumes the same primitive
+             * type. The previous program's node was the most recently used
+             * one, so the lookup above cannot have evicted it.
+             */
+            nv2a_profile_inc_counter(NV2A_PROF_SHADER_DRAW_STALLED);
+            pg->shader_compile_pending = true;
+            pg->shader_skip_draw =
+                policy != CONFIG_PERF_SHADER_COMPILATION_FALLBACK ||
+                !old_binding ||
+                old_binding->gl_primitive_mode !=
+                    get_gl_primitive_mode(state->polygon_front_mode,
+                                          state->primitive_mode);
         }
     }
 
     qemu_mutex_unlock(&pg->shader_cache_lock);
 
+    /* Generating or loading a program leaves it in use */
+    nv2a_gl_forget_program();
+
+    if (pg->shader_skip_draw) {
+        NV2A_GL_DGROUP_END();
+        return;
+    }
+
     binding_changed = (pg->shader_binding != old_binding);
     if (binding_changed) {
         nv2a_profile_inc_counter(NV2A_PROF_SHADER_BIND);
-        glUseProgram(pg->shader_binding->gl_program);
+        nv2a_gl_use_program(pg->shader_binding->gl_program);
     }
 
 update_constants:
@@ -4741,14 +5453,18 @@ static void pgraph_set_surface_dirty(PGRAPHState *pg, bool color, bool zeta)
         pg->color_binding->draw_dirty |= color;
         pg->color_binding->frame_time = pg->frame_time;
         pg->color_binding->cleared = false;
-
+        if (color) {
+            pgraph_surface_readback_cancel(pg->color_binding);
+        }
     }
 
     if (pg->zeta_binding) {
         pg->zeta_binding->draw_dirty |= zeta;
         pg->zeta_binding->frame_time = pg->frame_time;
         pg->zeta_binding->cleared = false;
-
+        if (zeta) {
+            pgraph_surface_readback_cancel(pg->zeta_binding);
+        }
     }
 }
 
@@ -4786,7 +5502,7 @@ static GLuint pgraph_compile_shader(const char *vs_src, const char *fs_src)
     glAttachShader(prog, vs);
     glAttachShader(prog, fs);
     glLinkProgram(prog);
-    glUseProgram(prog);
+    nv2a_gl_use_program(prog);
 
     // Flag shaders for deletion (will still be retained for lifetime of prog)
     glDeleteShader(vs);
@@ -4827,13 +5543,76 @@ static void pgraph_init_render_to_texture(NV2AState *d)
                                                     "surface_size");
 
     glGenVertexArrays(1, &pg->s2t_rndr.vao);
-    glBindVertexArray(pg->s2t_rndr.vao);
+    nv2a_gl_bind_vertex_array(pg->s2t_rndr.vao);
     glGenBuffers(1, &pg->s2t_rndr.vbo);
     glBindBuffer(GL_ARRAY_BUFFER, pg->s2t_rndr.vbo);
     glBufferData(GL_ARRAY_BUFFER, 0, NULL, GL_STATIC_DRAW);
     glGenFramebuffers(1, &pg->s2t_rndr.fbo);
 }
 
+static void pgraph_init_surface_upload(NV2AState *d)
+{
+    struct surf_upload_rndr *r = &d->pgraph.surf_upload_rndr;
+    const char *vs =
+        "#version 330\n"
+        "void main()\n"
+        "{\n"
+        "    float x = -1.0 + float((gl_VertexID & 1) << 2);\n"
+        "    float y = -1.0 + float((gl_VertexID & 2) << 1);\n"
+        "    gl_Position = vec4(x, y, 0, 1);\n"
+        "}\n";
+    /* Same bit interleaving as generate_swizzle_masks in swizzle.c */
+    const char *fs =
+        "#version 330\n"
+        "uniform sampler2D tex;\n"
+        "uniform uvec2 surface_size;\n"
+        "uniform uint scale;\n"
+        "layout(location = 0) out vec4 out_Color;\n"
+        "uint swizzle_offset(uint x, uint y)\n"
+        "{\n"
+        "    uint offset = 0u, out_bit = 1u;\n"
+        "    for (uint bit = 1u; bit < surface_size.x || bit < surface_size.y;\n"
+        "         bit <<= 1) {\n"
+        "        if (bit < surface_size.x) {\n"
+        "            offset |= (x & bit) != 0u ? out_bit : 0u;\n"
+        "            out_bit <<= 1;\n"
+        "        }\n"
+        "        if (bit < surface_size.y) {\n"
+        "            offset |= (y & bit) != 0u ? out_bit : 0u;\n"
+        "            out_bit <<= 1;\n"
+        "        }\n"
+        "    }\n"
+        "    return offset;\n"
+        "}\n"
+        "void main()\n"
+        "{\n"
+        "    uint x = uint(gl_FragCoord.x) / scale;\n"
+        "    uint y = surface_size.y - 1u - uint(gl_FragCoord.y) / scale;\n"
+        "    uint offset = swizzle_offset(x, y);\n"
+        "    out_Color = texelFetch(tex, ivec2(offset % surface_size.x,\n"
+        "                                      offset / surface_size.x), 0);\n"
+        "}\n";
+
+    r->prog = pgraph_compile_shader(vs, fs);
+    glProgramUniform1i(r->prog, glGetUniformLocation(r->prog, "tex"),
+                       NV2A_SURFACE_UPLOAD_TEXTURE_UNIT);
+    r->surface_size_loc = glGetUniformLocation(r->prog, "surface_size");
+    r->scale_loc = glGetUniformLocation(r->prog, "scale");
+
+    glGenVertexArrays(1, &r->vao);
+    glGenFramebuffers(1, &r->src_fbo);
+    glGenFramebuffers(1, &r->dst_fbo);
+
+    glGenTextures(1, &r->staging_texture);
+    nv2a_gl_active_texture(GL_TEXTURE0 + NV2A_SURFACE_UPLOAD_TEXTURE_UNIT);
+    nv2a_gl_bind_texture(GL_TEXTURE_2D, r->staging_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    nv2a_gl_active_texture(GL_TEXTURE0);
+}
+
 static bool pgraph_surface_to_texture_can_fastpath(SurfaceBinding *surface,
                                                    TextureShape *shape)
 {
@@ -4887,38 +5666,38 @@ static void pgraph_render_surface_to(NV2AState *d, SurfaceBinding *surface,
                                      GLuint gl_texture, unsigned int width,
                                      unsigned int height)
 {
-    glActiveTexture(GL_TEXTURE0 + texture_unit);
-    glBindFramebuffer(GL_FRAMEBUFFER, d->pgraph.s2t_rndr.fbo);
+    nv2a_gl_active_texture(GL_TEXTURE0 + texture_unit);
+    nv2a_gl_bind_framebuffer(GL_FRAMEBUFFER, d->pgraph.s2t_rndr.fbo);
 
     GLenum draw_buffers[1] = { GL_COLOR_ATTACHMENT0 };
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, gl_target,
                            gl_texture, 0);
     glDrawBuffers(1, draw_buffers);
     assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
-    assert(glGetError() == GL_NO_ERROR);
+    NV2A_GL_CHECK_ERRORS();
 
     float color[] = { 0.0f, 0.0f, 0.0f, 0.0f };
-    glBindTexture(GL_TEXTURE_2D, surface->gl_buffer);
+    nv2a_gl_bind_texture(GL_TEXTURE_2D, surface->gl_buffer);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
     glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, color);
 
-    glBindVertexArray(d->pgraph.s2t_rndr.vao);
+    nv2a_gl_bind_vertex_array(d->pgraph.s2t_rndr.vao);
     glBindBuffer(GL_ARRAY_BUFFER, d->pgraph.s2t_rndr.vbo);
-    glUseProgram(d->pgraph.s2t_rndr.prog);
+    nv2a_gl_use_program(d->pgraph.s2t_rndr.prog);
     glProgramUniform1i(d->pgraph.s2t_rndr.prog, d->pgraph.s2t_rndr.tex_loc,
                        texture_unit);
     glProgramUniform2f(d->pgraph.s2t_rndr.prog,
                        d->pgraph.s2t_rndr.surface_size_loc, width, height);
 
-    glViewport(0, 0, width, height);
-    glColorMask(true, true, true, true);
-    glDisable(GL_DITHER);
-    glDisable(GL_SCISSOR_TEST);
-    glDisable(GL_BLEND);
-    glDisable(GL_STENCIL_TEST);
-    glDisable(GL_CULL_FACE);
-    glDisable(GL_DEPTH_TEST);
+    nv2a_gl_viewport(0, 0, width, height);
+    nv2a_gl_color_mask(true, true, true, true);
+    nv2a_gl_disable(GL_DITHER);
+    nv2a_gl_disable(GL_SCISSOR_TEST);
+    nv2a_gl_disable(GL_BLEND);
+    nv2a_gl_disable(GL_STENCIL_TEST);
+    nv2a_gl_disable(GL_CULL_FACE);
+    nv2a_gl_disable(GL_DEPTH_TEST);
     glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
     glClearColor(0.0f, 0.0f, 1.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
@@ -4926,10 +5705,10 @@ static void pgraph_render_surface_to(NV2AState *d, SurfaceBinding *surface,
 
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, gl_target, 0,
                            0);
-    glBindFramebuffer(GL_FRAMEBUFFER, d->pgraph.gl_framebuffer);
-    glBindVertexArray(d->pgraph.gl_vertex_array);
-    glBindTexture(gl_target, gl_texture);
-    glUseProgram(
+    nv2a_gl_bind_framebuffer(GL_FRAMEBUFFER, d->pgraph.gl_framebuffer);
+    nv2a_gl_bind_vertex_array(d->pgraph.gl_vertex_array);
+    nv2a_gl_bind_texture(gl_target, gl_texture);
+    nv2a_gl_use_program(
         d->pgraph.shader_binding ? d->pgraph.shader_binding->gl_program : 0);
 }
 
@@ -4943,8 +5722,8 @@ static void pgraph_render_surface_to_texture_slow(
     assert(texture_shape->color_format < ARRAY_SIZE(kelvin_color_format_map));
     nv2a_profile_inc_counter(NV2A_PROF_SURF_TO_TEX_FALLBACK);
 
-    glActiveTexture(GL_TEXTURE0 + texture_unit);
-    glBindTexture(texture->gl_target, texture->gl_texture);
+    nv2a_gl_active_texture(GL_TEXTURE0 + texture_unit);
+    nv2a_gl_bind_texture(texture->gl_target, texture->gl_texture);
 
     unsigned int width = surface->width,
                  height = surface->height;
@@ -4962,7 +5741,7 @@ static void pgraph_render_surface_to_texture_slow(
     glTexImage2D(texture->gl_target, 0, f->gl_internal_format, width, height, 0,
                  f->gl_format, f->gl_type, buf);
     g_free(buf);
-    glBindTexture(texture->gl_target, texture->gl_texture);
+    nv2a_gl_bind_texture(texture->gl_target, texture->gl_texture);
 }
 
 /* Note: This function is intended to be called before PGRAPH configures GL
@@ -4994,18 +5773,18 @@ static void pgraph_render_surface_to_texture(NV2AState *d,
                  height = texture_shape->height;
     pgraph_apply_scaling_factor(pg, &width, &height);
 
-    glActiveTexture(GL_TEXTURE0 + texture_unit);
-    glBindTexture(texture->gl_target, texture->gl_texture);
+    nv2a_gl_active_texture(GL_TEXTURE0 + texture_unit);
+    nv2a_gl_bind_texture(texture->gl_target, texture->gl_texture);
     glTexParameteri(texture->gl_target, GL_TEXTURE_BASE_LEVEL, 0);
     glTexParameteri(texture->gl_target, GL_TEXTURE_MAX_LEVEL, 0);
     glTexParameteri(texture->gl_target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexImage2D(texture->gl_target, 0, f->gl_internal_format, width, height, 0,
                  f->gl_format, f->gl_type, NULL);
-    glBindTexture(texture->gl_target, 0);
+    nv2a_gl_bind_texture(texture->gl_target, 0);
     pgraph_render_surface_to(d, surface, texture_unit, texture->gl_target,
                              texture->gl_texture, width, height);
-    glBindTexture(texture->gl_target, texture->gl_texture);
-    glUseProgram(
+    nv2a_gl_bind_texture(texture->gl_target, texture->gl_texture);
+    nv2a_gl_use_program(
         d->pgraph.shader_binding ? d->pgraph.shader_binding->gl_program : 0);
 }
 
@@ -5326,6 +6105,8 @@ static void pgraph_render_display(NV2AState *d, SurfaceBinding *surface)
 
 void pgraph_gl_sync(NV2AState *d)
 {
+    pgraph_flush_merged_draws(d);
+
     uint32_t pline_offset, pstart_addr, pline_compare;
     d->vga.get_offsets(&d->vga, &pline_offset, &pstart_addr, &pline_compare);
     SurfaceBinding *surface = pgraph_surface_get_within(d, d->pcrtc.start + pline_offset);
@@ -5339,13 +6120,13 @@ void pgraph_gl_sync(NV2AState *d)
     /* Wait for queued commands to complete */
     pgraph_upload_surface_data(d, surface, !tcg_enabled());
     pgraph_gl_fence();
-    assert(glGetError() == GL_NO_ERROR);
+    NV2A_GL_CHECK_ERRORS();
 
     /* Render framebuffer in display context */
     glo_set_current(g_nv2a_context_display);
     pgraph_render_display(d, surface);
     pgraph_gl_fence();
-    assert(glGetError() == GL_NO_ERROR);
+    NV2A_GL_CHECK_ERRORS();
 
     /* Switch back to original context */
     glo_set_current(g_nv2a_context_render);
@@ -5500,25 +6281,48 @@ static void pgraph_surface_access_callback(
     }
 }
 
+/*
+ * Surfaces never overlap each other, so ordering them by address range and
+ * treating overlapping ranges as equal lets the tree answer exact, containing
+ * and overlapping lookups alike.
+ */
+static gint pgraph_surface_range_compare(gconstpointer a, gconstpointer b,
+                                         gpointer user_data)
+{
+    const Range *ra = a, *rb = b;
+
+    if (ra->upb < rb->lob) {
+        return -1;
+    }
+    if (ra->lob > rb->upb) {
+        return 1;
+    }
+    return 0;
+}
+
+static SurfaceBinding *pgraph_surface_find_overlapping(NV2AState *d,
+                                                       hwaddr addr,
+                                                       hwaddr size)
+{
+    Range range;
+    range_init_nofail(&range, addr, size);
+    return g_tree_lookup(d->pgraph.surface_tree, &range);
+}
+
 static SurfaceBinding *pgraph_surface_put(NV2AState *d,
     hwaddr addr,
     SurfaceBinding *surface_in)
 {
     assert(pgraph_surface_get(d, addr) == NULL);
 
-    SurfaceBinding *surface, *next;
-    uintptr_t e_end = surface_in->vram_addr + surface_in->size - 1;
-    QTAILQ_FOREACH_SAFE(surface, &d->pgraph.surfaces, entry, next) {
-        uintptr_t s_end = surface->vram_addr + surface->size - 1;
-        bool overlapping = !(surface->vram_addr > e_end
-                             || surface_in->vram_addr > s_end);
-        if (overlapping) {
-            trace_nv2a_pgraph_surface_evict_overlapping(
-                surface->vram_addr, surface->width, surface->height,
-                surface->pitch);
-            pgraph_download_surface_data_if_dirty(d, surface);
-            pgraph_surface_invalidate(d, surface);
-        }
+    SurfaceBinding *surface;
+    while ((surface = pgraph_surface_find_overlapping(
+                d, surface_in->vram_addr, surface_in->size))) {
+        trace_nv2a_pgraph_surface_evict_overlapping(
+            surface->vram_addr, surface->width, surface->height,
+            surface->pitch);
+        pgraph_download_surface_data_if_dirty(d, surface);
+        pgraph_surface_invalidate(d, surface);
     }
 
     SurfaceBinding *surface_out = g_malloc(sizeof(SurfaceBinding));
@@ -5538,32 +6342,51 @@ static SurfaceBinding *pgraph_surface_put(NV2AState *d,
 
     QTAILQ_INSERT_TAIL(&d->pgraph.surfaces, surface_out, entry);
 
+    Range *range = g_new(Range, 1);
+    range_init_nofail(range, surface_out->vram_addr, surface_out->size);
+    g_tree_insert(d->pgraph.surface_tree, range, surface_out);
+
     return surface_out;
 }
 
 static SurfaceBinding *pgraph_surface_get(NV2AState *d, hwaddr addr)
 {
-    SurfaceBinding *surface;
-    QTAILQ_FOREACH (surface, &d->pgraph.surfaces, entry) {
-        if (surface->vram_addr == addr) {
-            return surface;
-        }
+    SurfaceBinding *surface = pgraph_surface_find_overlapping(d, addr, 1);
+    if (surface && surface->vram_addr == addr) {
+        nv2a_profile_inc_counter(NV2A_PROF_SURF_LOOKUP_HIT);
+        return surface;
     }
 
+    nv2a_profile_inc_counter(NV2A_PROF_SURF_LOOKUP_MISS);
     return NULL;
 }
 
 static SurfaceBinding *pgraph_surface_get_within(NV2AState *d, hwaddr addr)
 {
-    SurfaceBinding *surface;
-    QTAILQ_FOREACH (surface, &d->pgraph.surfaces, entry) {
-        if (addr >= surface->vram_addr &&
-            addr < (surface->vram_addr + surface->size)) {
-            return surface;
-        }
+    SurfaceBinding *surface = pgraph_surface_find_overlapping(d, addr, 1);
+    nv2a_profile_inc_counter(surface ? NV2A_PROF_SURF_LOOKUP_HIT :
+                                       NV2A_PROF_SURF_LOOKUP_MISS);
+    return surface;
+}
+
+/* Download every dirty surface overlapping [start, end], in address order */
+static void pgraph_download_overlapping_surfaces(NV2AState *d, hwaddr start,
+                                                 hwaddr end)
+{
+    SurfaceBinding *surface =
+        pgraph_surface_find_overlapping(d, start, end - start + 1);
+    if (surface == NULL) {
+        return;
     }
 
-    return NULL;
+    hwaddr surface_end = surface->vram_addr + surface->size - 1;
+    if (surface->vram_addr > start) {
+        pgraph_download_overlapping_surfaces(d, start, surface->vram_addr - 1);
+    }
+    pgraph_download_surface_data_if_dirty(d, surface);
+    if (surface_end < end) {
+        pgraph_download_overlapping_surfaces(d, surface_end + 1, end);
+    }
 }
 
 static void pgraph_surface_invalidate(NV2AState *d, SurfaceBinding *surface)
@@ -5587,7 +6410,15 @@ static void pgraph_surface_invalidate(NV2AState *d, SurfaceBinding *surface)
         qemu_mutex_lock(&d->pgraph.lock);
     }
 
-    glDeleteTextures(1, &surface->gl_buffer);
+    pgraph_surface_readback_cancel(surface);
+    if (surface->readback_pbo) {
+        glDeleteBuffers(1, &surface->readback_pbo);
+    }
+    nv2a_gl_delete_textures(1, &surface->gl_buffer);
+
+    Range range;
+    range_init_nofail(&range, surface->vram_addr, surface->size);
+    g_tree_remove(d->pgraph.surface_tree, &range);
 
     QTAILQ_REMOVE(&d->pgraph.surfaces, surface, entry);
     g_free(surface);
@@ -5684,6 +6515,16 @@ static void surface_copy_shrink_row(uint8_t *out, uint8_t *in,
 }
 
 
+static uint8_t *pgraph_get_download_buf(PGRAPHState *pg, size_t size)
+{
+    if (pg->download_buf_size < size) {
+        pg->download_buf = g_realloc(pg->download_buf, size);
+        pg->download_buf_size = size;
+    }
+
+    return pg->download_buf;
+}
+
 static void pgraph_download_surface_data_to_buffer(NV2AState *d,
                                                    SurfaceBinding *surface,
                                                    bool swizzle, bool flip,
@@ -5717,11 +6558,9 @@ static void pgraph_download_surface_data_to_buffer(NV2AState *d,
 
     uint8_t *swizzle_buf = pixels;
     if (swizzle) {
-        /* FIXME: Allocate big buffer up front and re-alloc if necessary.
-         * FIXME: Consider swizzle in shader
-         */
+        /* FIXME: Consider swizzle in shader */
         assert(pg->surface_scale_factor == 1 || downscale);
-        swizzle_buf = (uint8_t *)g_malloc(surface->size);
+        swizzle_buf = pgraph_get_download_buf(pg, surface->size);
         gl_read_buf = swizzle_buf;
     }
 
@@ -5732,6 +6571,10 @@ static void pgraph_download_surface_data_to_buffer(NV2AState *d,
         gl_read_buf = pg->scale_buf;
     }
 
+    nv2a_gl_pixel_store(GL_PACK_ROW_LENGTH,
+                        pg->surface_scale_factor * surface->pitch /
+                            surface->fmt.bytes_per_pixel);
+    nv2a_gl_pixel_store(GL_PACK_ALIGNMENT, 1);
     glo_readpixels(
         surface->fmt.gl_format, surface->fmt.gl_type, surface->fmt.bytes_per_pixel,
         pg->surface_scale_factor * surface->pitch,
@@ -5755,7 +6598,6 @@ static void pgraph_download_surface_data_to_buffer(NV2AState *d,
     if (swizzle) {
         swizzle_rect(swizzle_buf, surface->width, surface->height, pixels,
                      surface->pitch, surface->fmt.bytes_per_pixel);
-        g_free(swizzle_buf);
     }
 
     /* Re-bind original framebuffer target */
@@ -5764,6 +6606,168 @@ static void pgraph_download_surface_data_to_buffer(NV2AState *d,
     pgraph_bind_current_surface(d);
 }
 
+static GLbitfield pgraph_surface_blit_mask(SurfaceBinding *surface)
+{
+    switch (surface->fmt.gl_attachment) {
+    case GL_DEPTH_ATTACHMENT:
+        return GL_DEPTH_BUFFER_BIT;
+    case GL_DEPTH_STENCIL_ATTACHMENT:
+        return GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT;
+    default:
+        return GL_COLOR_BUFFER_BIT;
+    }
+}
+
+/*
+ * Queue a copy of the surface's contents, at native resolution, into its
+ * pixel pack buffer. The copy completes in the background and is picked up
+ * by pgraph_surface_readback_finish when the guest needs the data, instead
+ * of stalling on a synchronous glReadPixels at that point.
+ */
+static void pgraph_surface_readback_start(NV2AState *d, SurfaceBinding *surface)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    if (!surface->draw_dirty || surface->readback_pending) {
+        return;
+    }
+
+    nv2a_profile_inc_counter(NV2A_PROF_SURF_READBACK);
+
+    unsigned int width = surface->width, height = surface->height;
+    size_t size = width * height * surface->fmt.bytes_per_pixel;
+
+    if (!surface->readback_pbo) {
+        glGenBuffers(1, &surface->readback_pbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, surface->readback_pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+    } else {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, surface->readback_pbo);
+    }
+
+    nv2a_gl_bind_framebuffer(GL_FRAMEBUFFER, pg->readback_src_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, surface->fmt.gl_attachment,
+                           GL_TEXTURE_2D, surface->gl_buffer, 0);
+    assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+
+    if (pg->surface_scale_factor != 1) {
+        /* Downscale on the GPU so only native resolution data is read back */
+        GLuint last_texture_binding;
+        bool restore_texture =
+            nv2a_gl_get_texture_binding(GL_TEXTURE_2D, &last_texture_binding);
+        nv2a_gl_bind_texture(GL_TEXTURE_2D, pg->readback_texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, surface->fmt.gl_internal_format, width,
+                     height, 0, surface->fmt.gl_format, surface->fmt.gl_type,
+                     NULL);
+        if (restore_texture) {
+            nv2a_gl_bind_texture(GL_TEXTURE_2D, last_texture_binding);
+        }
+        nv2a_gl_bind_framebuffer(GL_DRAW_FRAMEBUFFER, pg->readback_dst_fbo);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, surface->fmt.gl_attachment,
+                               GL_TEXTURE_2D, pg->readback_texture, 0);
+        assert(glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) ==
+               GL_FRAMEBUFFER_COMPLETE);
+
+        nv2a_gl_disable(GL_SCISSOR_TEST);
+        glBlitFramebuffer(0, 0, width * pg->surface_scale_factor,
+                          height * pg->surface_scale_factor, 0, 0, width,
+                          height, pgraph_surface_blit_mask(surface),
+                          GL_NEAREST);
+
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, surface->fmt.gl_attachment,
+                               GL_TEXTURE_2D, 0, 0);
+        nv2a_gl_bind_framebuffer(GL_READ_FRAMEBUFFER, pg->readback_dst_fbo);
+    }
+
+    nv2a_gl_pixel_store(GL_PACK_ROW_LENGTH, 0);
+    nv2a_gl_pixel_store(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, surface->fmt.gl_format,
+                 surface->fmt.gl_type, NULL);
+    nv2a_gl_pixel_store(GL_PACK_ALIGNMENT, 4);
+
+    surface->readback_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    surface->readback_pending = true;
+
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, surface->fmt.gl_attachment,
+                           GL_TEXTURE_2D, 0, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    nv2a_gl_bind_framebuffer(GL_FRAMEBUFFER, pg->gl_framebuffer);
+}
+
+static void pgraph_surface_readback_cancel(SurfaceBinding *surface)
+{
+    if (surface->readback_fence) {
+        glDeleteSync(surface->readback_fence);
+        surface->readback_fence = 0;
+    }
+    surface->readback_pending = false;
+}
+
+/*
+ * Complete a readback started by pgraph_surface_readback_start, writing the
+ * surface in guest layout to pixels. Returns false if there is no readback
+ * of the current surface contents.
+ */
+static bool pgraph_surface_readback_finish(NV2AState *d,
+                                           SurfaceBinding *surface,
+                                           uint8_t *pixels)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    if (!surface->readback_pending) {
+        return false;
+    }
+
+    trace_nv2a_pgraph_surface_download(
+        surface->color ? "COLOR" : "ZETA",
+        surface->swizzle ? "sz" : "lin", surface->vram_addr,
+        surface->width, surface->height, surface->pitch,
+        surface->fmt.bytes_per_pixel);
+
+    nv2a_profile_inc_counter(NV2A_PROF_SURF_READBACK_HIT);
+
+    if (surface->readback_fence) {
+        int result = glClientWaitSync(surface->readback_fence, 0, 0);
+        if (result == GL_TIMEOUT_EXPIRED) {
+            nv2a_profile_inc_counter(NV2A_PROF_SURF_READBACK_WAIT);
+            result = glClientWaitSync(surface->readback_fence,
+                                      GL_SYNC_FLUSH_COMMANDS_BIT,
+                                      (GLuint64)(5000000000));
+        }
+        assert(result == GL_CONDITION_SATISFIED ||
+               result == GL_ALREADY_SIGNALED);
+        glDeleteSync(surface->readback_fence);
+        surface->readback_fence = 0;
+    }
+
+    unsigned int bytes_per_pixel = surface->fmt.bytes_per_pixel;
+    size_t row_len = surface->width * bytes_per_pixel;
+    size_t size = row_len * surface->height;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, surface->readback_pbo);
+    const uint8_t *in = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size,
+                                         GL_MAP_READ_BIT);
+    assert(in != NULL);
+
+    /* Rows come back bottom-up, flip them on the way out */
+    uint8_t *out = surface->swizzle ? pgraph_get_download_buf(pg, surface->size)
+                                    : pixels;
+    for (unsigned int y = 0; y < surface->height; y++) {
+        memcpy(out + y * surface->pitch,
+               in + (surface->height - 1 - y) * row_len, row_len);
+    }
+
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    if (surface->swizzle) {
+        swizzle_rect(out, surface->width, surface->height, pixels,
+                     surface->pitch, bytes_per_pixel);
+    }
+
+    return true;
+}
+
 static void pgraph_download_surface_data(NV2AState *d, SurfaceBinding *surface,
     bool force)
 {
@@ -5774,9 +6778,15 @@ static void pgraph_download_surface_data(NV2AState *d, SurfaceBinding *surface,
     /* FIXME: Respect write enable at last TOU? */
 
     nv2a_profile_inc_counter(NV2A_PROF_SURF_DOWNLOAD);
+    int64_t prof = nv2a_profile_begin(NV2A_PROF_SCOPE_SURF_DOWNLOAD);
 
-    pgraph_download_surface_data_to_buffer(
-        d, surface, true, true, true, d->vram_ptr + surface->vram_addr);
+    if (!pgraph_surface_readback_finish(d, surface,
+                                        d->vram_ptr + surface->vram_addr)) {
+        pgraph_download_surface_data_to_buffer(
+            d, surface, true, true, true, d->vram_ptr + surface->vram_addr);
+    }
+    pgraph_surface_readback_cancel(surface);
+    nv2a_profile_end(prof);
 
     memory_region_set_client_dirty(d->vram, surface->vram_addr,
                                    surface->pitch * surface->height,
@@ -5791,6 +6801,8 @@ static void pgraph_download_surface_data(NV2AState *d, SurfaceBinding *surface,
 
 void pgraph_process_pending_downloads(NV2AState *d)
 {
+    pgraph_flush_merged_draws(d);
+
     SurfaceBinding *surface;
     QTAILQ_FOREACH(surface, &d->pgraph.surfaces, entry) {
         pgraph_download_surface_data(d, surface, false);
@@ -5802,6 +6814,8 @@ void pgraph_process_pending_downloads(NV2AState *d)
 
 void pgraph_download_dirty_surfaces(NV2AState *d)
 {
+    pgraph_flush_merged_draws(d);
+
     SurfaceBinding *surface;
     QTAILQ_FOREACH(surface, &d->pgraph.surfaces, entry) {
         pgraph_download_surface_data_if_dirty(d, surface);
@@ -5812,57 +6826,15 @@ void pgraph_download_dirty_surfaces(NV2AState *d)
 }
 
 
-static void surface_copy_expand_row(uint8_t *out, uint8_t *in,
-                                    unsigned int width,
-                                    unsigned int bytes_per_pixel,
-                                    unsigned int factor)
-{
-    if (bytes_per_pixel == 4) {
-        for (unsigned int x = 0; x < width; x++) {
-            for (unsigned int i = 0; i < factor; i++) {
-                *(uint32_t *)out = *(uint32_t *)in;
-                out += bytes_per_pixel;
-            }
-            in += bytes_per_pixel;
-        }
-    } else if (bytes_per_pixel == 2) {
-        for (unsigned int x = 0; x < width; x++) {
-            for (unsigned int i = 0; i < factor; i++) {
-                *(uint16_t *)out = *(uint16_t *)in;
-                out += bytes_per_pixel;
-            }
-            in += bytes_per_pixel;
-        }
-    } else {
-        for (unsigned int x = 0; x < width; x++) {
-            for (unsigned int i = 0; i < factor; i++) {
-                memcpy(out, in, bytes_per_pixel);
-                out += bytes_per_pixel;
-            }
-            in += bytes_per_pixel;
-        }
-    }
-}
-
-static void surface_copy_expand(uint8_t *out, uint8_t *in, unsigned int width,
-                                unsigned int height,
-                                unsigned int bytes_per_pixel,
-                                unsigned int factor)
-{
-    size_t out_pitch = width * bytes_per_pixel * factor;
-
-    for (unsigned int y = 0; y < height; y++) {
-        surface_copy_expand_row(out, in, width, bytes_per_pixel, factor);
-        uint8_t *row_in = out;
-        for (unsigned int i = 1; i < factor; i++) {
-            out += out_pitch;
-            memcpy(out, row_in, out_pitch);
-        }
-        in += width * bytes_per_pixel;
-        out += out_pitch;
-    }
-}
-
+/*
+ * Uploads the guest copy of a surface straight from VRAM into a staging
+ * texture of the same format, then converts it on the GPU. Linear surfaces
+ * are flipped and scaled by a blit, swizzled color surfaces by a draw that
+ * also unswizzles. Stencil cannot be written from a shader, so swizzled zeta
+ * surfaces are still unswizzled on the CPU first.
+ *
+ * May change the active texture unit.
+ */
 static void pgraph_upload_surface_data(NV2AState *d, SurfaceBinding *surface,
                                        bool force)
 {
@@ -5871,6 +6843,7 @@ static void pgraph_upload_surface_data(NV2AState *d, SurfaceBinding *surface,
     }
 
     nv2a_profile_inc_counter(NV2A_PROF_SURF_UPLOAD);
+    int64_t prof = nv2a_profile_begin(NV2A_PROF_SCOPE_SURF_UPLOAD);
 
     trace_nv2a_pgraph_surface_upload(
                  surface->color ? "COLOR" : "ZETA",
@@ -5879,83 +6852,106 @@ static void pgraph_upload_surface_data(NV2AState *d, SurfaceBinding *surface,
                  surface->fmt.bytes_per_pixel);
 
     PGRAPHState *pg = &d->pgraph;
+    struct surf_upload_rndr *r = &pg->surf_upload_rndr;
 
     surface->upload_pending = false;
     surface->draw_time = pg->draw_time;
+    pgraph_surface_readback_cancel(surface);
 
-    // FIXME: Don't query GL for texture binding
-    GLint last_texture_binding;
-    glGetIntegerv(GL_TEXTURE_BINDING_2D, &last_texture_binding);
-
-    // FIXME: Replace with FBO to not disturb current state
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
-                           0, 0);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
-                           0, 0);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
-                           GL_TEXTURE_2D, 0, 0);
+    unsigned int width = surface->width, height = surface->height;
+    unsigned int scaled_width = width, scaled_height = height;
+    pgraph_apply_scaling_factor(pg, &scaled_width, &scaled_height);
 
-    uint8_t *data = d->vram_ptr;
-    uint8_t *buf = data + surface->vram_addr;
+    uint8_t *buf = d->vram_ptr + surface->vram_addr;
+    unsigned int row_length = width;
+    bool unswizzle_on_gpu = surface->swizzle && surface->color;
 
-    if (surface->swizzle) {
-        buf = (uint8_t*)g_malloc(surface->size);
-        unswizzle_rect(data + surface->vram_addr,
-                       surface->width, surface->height,
-                       buf,
-                       surface->pitch,
+    if (surface->swizzle && !unswizzle_on_gpu) {
+        buf = (uint8_t*)g_malloc(width * height * surface->fmt.bytes_per_pixel);
+        unswizzle_rect(d->vram_ptr + surface->vram_addr, width, height, buf,
+                       width * surface->fmt.bytes_per_pixel,
                        surface->fmt.bytes_per_pixel);
+    } else if (!surface->swizzle) {
+        assert(surface->pitch % surface->fmt.bytes_per_pixel == 0);
+        row_length = surface->pitch / surface->fmt.bytes_per_pixel;
+    }
+
+    nv2a_gl_active_texture(GL_TEXTURE0 + NV2A_SURFACE_UPLOAD_TEXTURE_UNIT);
+    nv2a_gl_pixel_store(GL_UNPACK_ROW_LENGTH, row_length);
+    nv2a_gl_pixel_store(GL_UNPACK_ALIGNMENT, 1);
+    if (r->staging_width == width && r->staging_height == height &&
+        r->staging_internal_format == surface->fmt.gl_internal_format) {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height,
+                        surface->fmt.gl_format, surface->fmt.gl_type, buf);
+    } else {
+        glTexImage2D(GL_TEXTURE_2D, 0, surface->fmt.gl_internal_format, width,
+                     height, 0, surface->fmt.gl_format, surface->fmt.gl_type,
+                     buf);
+        r->staging_width = width;
+        r->staging_height = height;
+        r->staging_internal_format = surface->fmt.gl_internal_format;
     }
+    nv2a_gl_pixel_store(GL_UNPACK_ROW_LENGTH, 0);
+    nv2a_gl_pixel_store(GL_UNPACK_ALIGNMENT, 4);
 
-    /* FIXME: Replace this flip/scaling */
-
-    // This is VRAM so we can't do this inplace!
-    uint8_t *flipped_buf = (uint8_t *)g_malloc(
-        surface->height * surface->width * surface->fmt.bytes_per_pixel);
-    unsigned int irow;
-    for (irow = 0; irow < surface->height; irow++) {
-        memcpy(&flipped_buf[surface->width * (surface->height - irow - 1)
-                                 * surface->fmt.bytes_per_pixel],
-               &buf[surface->pitch * irow],
-               surface->width * surface->fmt.bytes_per_pixel);
-    }
-
-    uint8_t *gl_read_buf = flipped_buf;
-    unsigned int width = surface->width, height = surface->height;
-
-    if (pg->surface_scale_factor > 1) {
-        pgraph_apply_scaling_factor(pg, &width, &height);
-        pg->scale_buf = (uint8_t *)g_realloc(
-            pg->scale_buf, width * height * surface->fmt.bytes_per_pixel);
-        gl_read_buf = pg->scale_buf;
-        uint8_t *out = gl_read_buf, *in = flipped_buf;
-        surface_copy_expand(out, in, surface->width, surface->height,
-                            surface->fmt.bytes_per_pixel,
-                            d->pgraph.surface_scale_factor);
+    if (surface->swizzle && !unswizzle_on_gpu) {
+        g_free(buf);
     }
 
-    int prev_unpack_alignment;
-    glGetIntegerv(GL_UNPACK_ALIGNMENT, &prev_unpack_alignment);
-    if (unlikely((width * surface->fmt.bytes_per_pixel) % 4 != 0)) {
-        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    nv2a_gl_bind_framebuffer(GL_DRAW_FRAMEBUFFER, r->dst_fbo);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, surface->fmt.gl_attachment,
+                           GL_TEXTURE_2D, surface->gl_buffer, 0);
+    assert(glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) ==
+           GL_FRAMEBUFFER_COMPLETE);
+    nv2a_gl_disable(GL_SCISSOR_TEST);
+
+    if (unswizzle_on_gpu) {
+        /* Clear may have set its write mask up before binding surfaces */
+        bool color_mask[4];
+        bool restore_color_mask = nv2a_gl_get_color_mask(color_mask);
+
+        nv2a_gl_bind_vertex_array(r->vao);
+        nv2a_gl_use_program(r->prog);
+        glProgramUniform2ui(r->prog, r->surface_size_loc, width, height);
+        glProgramUniform1ui(r->prog, r->scale_loc, pg->surface_scale_factor);
+
+        nv2a_gl_viewport(0, 0, scaled_width, scaled_height);
+        nv2a_gl_color_mask(true, true, true, true);
+        nv2a_gl_disable(GL_DITHER);
+        nv2a_gl_disable(GL_BLEND);
+        nv2a_gl_disable(GL_STENCIL_TEST);
+        nv2a_gl_disable(GL_CULL_FACE);
+        nv2a_gl_disable(GL_DEPTH_TEST);
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        if (restore_color_mask) {
+            nv2a_gl_color_mask(color_mask[0], color_mask[1], color_mask[2],
+                               color_mask[3]);
+        }
+        nv2a_gl_bind_vertex_array(pg->gl_vertex_array);
+        nv2a_gl_use_program(pg->shader_binding ?
+                            pg->shader_binding->gl_program : 0);
     } else {
-        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-    }
+        nv2a_gl_bind_framebuffer(GL_READ_FRAMEBUFFER, r->src_fbo);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, surface->fmt.gl_attachment,
+                               GL_TEXTURE_2D, r->staging_texture, 0);
+        assert(glCheckFramebufferStatus(GL_READ_FRAMEBUFFER) ==
+               GL_FRAMEBUFFER_COMPLETE);
 
-    glBindTexture(GL_TEXTURE_2D, surface->gl_buffer);
-    glTexImage2D(GL_TEXTURE_2D, 0, surface->fmt.gl_internal_format, width,
-                 height, 0, surface->fmt.gl_format, surface->fmt.gl_type,
-                 gl_read_buf);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, prev_unpack_alignment);
-    g_free(flipped_buf);
-    if (surface->swizzle) {
-        g_free(buf);
+        /* Guest rows are top down, so flip while scaling up */
+        glBlitFramebuffer(0, 0, width, height, 0, scaled_height, scaled_width,
+                          0, pgraph_surface_blit_mask(surface), GL_NEAREST);
+
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, surface->fmt.gl_attachment,
+                               GL_TEXTURE_2D, 0, 0);
     }
 
-    // Rebind previous framebuffer binding
-    glBindTexture(GL_TEXTURE_2D, last_texture_binding);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, surface->fmt.gl_attachment,
+                           GL_TEXTURE_2D, 0, 0);
+    nv2a_gl_bind_framebuffer(GL_FRAMEBUFFER, pg->gl_framebuffer);
 
-    pgraph_bind_current_surface(d);
+    nv2a_profile_end(prof);
 }
 
 static void pgraph_compare_surfaces(SurfaceBinding *s1, SurfaceBinding *s2)
@@ -6049,6 +7045,9 @@ static void pgraph_populate_surface_binding_entry_sized(NV2AState *d,
     entry->upload_pending = true;
     entry->download_pending = false;
     entry->draw_dirty = false;
+    entry->readback_pbo = 0;
+    entry->readback_fence = 0;
+    entry->readback_pending = false;
     entry->dma_addr = dma.address;
     entry->dma_len = dma.limit;
     entry->frame_time = pg->frame_time;
@@ -6192,7 +7191,7 @@ static void pgraph_update_surface_part(NV2AState *d, bool upload, bool color)
 
         if (should_create) {
             glGenTextures(1, &entry.gl_buffer);
-            glBindTexture(GL_TEXTURE_2D, entry.gl_buffer);
+            nv2a_gl_bind_texture(GL_TEXTURE_2D, entry.gl_buffer);
             NV2A_GL_DLABEL(GL_TEXTURE, entry.gl_buffer,
                            "%s format: %0X, width: %d, height: %d "
                            "(addr %" HWADDR_PRIx ")",
@@ -6275,6 +7274,7 @@ static void pgraph_unbind_surface(NV2AState *d, bool color)
             glFramebufferTexture2D(GL_FRAMEBUFFER,
                                    GL_COLOR_ATTACHMENT0,
                                    GL_TEXTURE_2D, 0, 0);
+            pgraph_surface_readback_start(d, pg->color_binding);
             pg->color_binding = NULL;
         }
     } else {
@@ -6285,6 +7285,7 @@ static void pgraph_unbind_surface(NV2AState *d, bool color)
             glFramebufferTexture2D(GL_FRAMEBUFFER,
                                    GL_DEPTH_STENCIL_ATTACHMENT,
                                    GL_TEXTURE_2D, 0, 0);
+            pgraph_surface_readback_start(d, pg->zeta_binding);
             pg->zeta_binding = NULL;
         }
     }
@@ -6370,49 +7371,46 @@ static void pgraph_update_surface(NV2AState *d, bool upload,
     pgraph_surface_evict_old(d);
 }
 
-struct pgraph_texture_possibly_dirty_struct {
-    hwaddr addr, end;
-};
-
-static void pgraph_mark_textures_possibly_dirty_visitor(Lru *lru, LruNode *node, void *opaque)
-{
-    struct pgraph_texture_possibly_dirty_struct *test =
-        (struct pgraph_texture_possibly_dirty_struct *)opaque;
-
-    struct TextureLruNode *tnode = container_of(node, TextureLruNode, node);
-    if (tnode->binding == NULL || tnode->possibly_dirty) {
-        return;
-    }
-
-    uintptr_t k_tex_addr = tnode->key.texture_vram_offset;
-    uintptr_t k_tex_end = k_tex_addr + tnode->key.texture_length - 1;
-    bool overlapping = !(test->addr > k_tex_end || k_tex_addr > test->end);
-
-    if (tnode->key.palette_length > 0) {
-        uintptr_t k_pal_addr = tnode->key.palette_vram_offset;
-        uintptr_t k_pal_end = k_pal_addr + tnode->key.palette_length - 1;
-        overlapping |= !(test->addr > k_pal_end || k_pal_addr > test->end);
-    }
-
-    tnode->possibly_dirty |= overlapping;
-}
-
-
 static void pgraph_mark_textures_possibly_dirty(NV2AState *d,
     hwaddr addr, hwaddr size)
 {
+    PGRAPHState *pg = &d->pgraph;
+
     hwaddr end = TARGET_PAGE_ALIGN(addr + size) - 1;
     addr &= TARGET_PAGE_MASK;
     assert(end <= memory_region_size(d->vram));
 
-    struct pgraph_texture_possibly_dirty_struct test = {
-        .addr = addr,
-        .end = end,
-    };
+    /* Only textures sharing a bucket with the range can overlap it */
+    size_t first = addr >> NV2A_TEXTURE_INDEX_BUCKET_SHIFT;
+    size_t last = MIN(end >> NV2A_TEXTURE_INDEX_BUCKET_SHIFT,
+                      pg->texture_index_size - 1);
+
+    for (size_t bucket = first; bucket <= last; bucket++) {
+        TextureIndexLink *link;
+        QLIST_FOREACH(link, &pg->texture_index[bucket], entry) {
+            TextureLruNode *tnode = link->node;
+            nv2a_profile_inc_counter(NV2A_PROF_TEX_DIRTY_VISITED);
+            if (tnode->binding == NULL || tnode->possibly_dirty) {
+                continue;
+            }
+
+            uintptr_t k_tex_addr = tnode->key.texture_vram_offset;
+            uintptr_t k_tex_end = k_tex_addr + tnode->key.texture_length - 1;
+            bool overlapping = !(addr > k_tex_end || k_tex_addr > end);
+
+            if (tnode->key.palette_length > 0) {
+                uintptr_t k_pal_addr = tnode->key.palette_vram_offset;
+                uintptr_t k_pal_end =
+                    k_pal_addr + tnode->key.palette_length - 1;
+                overlapping |= !(addr > k_pal_end || k_pal_addr > end);
+            }
 
-    lru_visit_active(&d->pgraph.texture_cache,
-                     pgraph_mark_textures_possibly_dirty_visitor,
-                     &test);
+            if (overlapping) {
+                nv2a_profile_inc_counter(NV2A_PROF_TEX_DIRTY_MARKED);
+                tnode->possibly_dirty = true;
+            }
+        }
+    }
 }
 
 static bool pgraph_check_texture_dirty(NV2AState *d, hwaddr addr, hwaddr size)
@@ -6420,8 +7418,14 @@ static bool pgraph_check_texture_dirty(NV2AState *d, hwaddr addr, hwaddr size)
     hwaddr end = TARGET_PAGE_ALIGN(addr + size);
     addr &= TARGET_PAGE_MASK;
     assert(end < memory_region_size(d->vram));
-    return memory_region_test_and_clear_dirty(d->vram, addr, end - addr,
-                                              DIRTY_MEMORY_NV2A_TEX);
+    if (!memory_region_test_and_clear_dirty(d->vram, addr, end - addr,
+                                            DIRTY_MEMORY_NV2A_TEX)) {
+        return false;
+    }
+
+    /* This was the only record of the write, jobs may have missed it */
+    pgraph_invalidate_texture_prefetches(&d->pgraph, addr, end - addr);
+    return true;
 }
 
 static bool pgraph_is_texture_stage_active(PGRAPHState *pg, unsigned int stage)
@@ -6533,117 +7537,144 @@ static void apply_texture_parameters(TextureBinding *binding,
     }
 }
 
-static void pgraph_bind_textures(NV2AState *d)
+typedef struct TextureStage {
+    TextureKey key;
+    ColorFormatInfo f;
+    uint32_t filter;
+    uint32_t address;
+    uint32_t border_color;
+    bool is_indexed;
+    uint8_t *texture_data;
+    uint8_t *palette_data;
+    hwaddr palette_vram_offset;
+    unsigned int palette_length;
+} TextureStage;
+
+static uint8_t *pgraph_map_texture_dma(NV2AState *d, hwaddr dma_obj_address,
+                                       bool strict, hwaddr *len)
 {
-    int i;
+    if (strict) {
+        return (uint8_t*)nv_dma_map(d, dma_obj_address, len);
+    }
+
+    /* Non-strict lookups race with the guest setting up the DMA objects */
+    if (dma_obj_address >= memory_region_size(&d->ramin)) {
+        return NULL;
+    }
+    DMAObject dma = nv_dma_load(d, dma_obj_address);
+    dma.address &= 0x07FFFFFF;
+    if (dma.address >= memory_region_size(d->vram)) {
+        return NULL;
+    }
+    *len = dma.limit;
+    return d->vram_ptr + dma.address;
+}
+
+/*
+ * Decode the texture registers of a stage. With strict set, inconsistent
+ * state is fatal, as it is when binding for a draw. Otherwise false is
+ * returned, so that state the guest has only partially written so far can
+ * be probed when prefetching.
+ */
+static bool pgraph_get_texture_stage(NV2AState *d, int stage, bool strict,
+                                     TextureStage *ts)
+{
+#define CHECK_TEXTURE_STAGE(cond) do { \
+        if (strict) { \
+            assert(cond); \
+        } else if (!(cond)) { \
+            return false; \
+        } \
+    } while (0)
+
     PGRAPHState *pg = &d->pgraph;
+    int i = stage;
 
-    NV2A_GL_DGROUP_BEGIN("%s", __func__);
+    uint32_t ctl_0 = pg->regs[NV_PGRAPH_TEXCTL0_0 + i*4];
+    uint32_t ctl_1 = pg->regs[NV_PGRAPH_TEXCTL1_0 + i*4];
+    uint32_t fmt = pg->regs[NV_PGRAPH_TEXFMT0 + i*4];
+    uint32_t filter = pg->regs[NV_PGRAPH_TEXFILTER0 + i*4];
+    uint32_t address = pg->regs[NV_PGRAPH_TEXADDRESS0 + i*4];
+    uint32_t palette = pg->regs[NV_PGRAPH_TEXPALETTE0 + i*4];
 
-    for (i=0; i<NV2A_MAX_TEXTURES; i++) {
-        uint32_t ctl_0 = pg->regs[NV_PGRAPH_TEXCTL0_0 + i*4];
-        bool enabled = pgraph_is_texture_stage_active(pg, i) &&
-                       GET_MASK(ctl_0, NV_PGRAPH_TEXCTL0_0_ENABLE);
-        /* FIXME: What happens if texture is disabled but stage is active? */
+    unsigned int min_mipmap_level =
+        GET_MASK(ctl_0, NV_PGRAPH_TEXCTL0_0_MIN_LOD_CLAMP);
+    unsigned int max_mipmap_level =
+        GET_MASK(ctl_0, NV_PGRAPH_TEXCTL0_0_MAX_LOD_CLAMP);
 
-        glActiveTexture(GL_TEXTURE0 + i);
-        if (!enabled) {
-            glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
-            glBindTexture(GL_TEXTURE_RECTANGLE, 0);
-            glBindTexture(GL_TEXTURE_1D, 0);
-            glBindTexture(GL_TEXTURE_2D, 0);
-            glBindTexture(GL_TEXTURE_3D, 0);
-            continue;
-        }
+    unsigned int pitch =
+        GET_MASK(ctl_1, NV_PGRAPH_TEXCTL1_0_IMAGE_PITCH);
 
-        uint32_t ctl_1 = pg->regs[NV_PGRAPH_TEXCTL1_0 + i*4];
-        uint32_t fmt = pg->regs[NV_PGRAPH_TEXFMT0 + i*4];
-        uint32_t filter = pg->regs[NV_PGRAPH_TEXFILTER0 + i*4];
-        uint32_t address = pg->regs[NV_PGRAPH_TEXADDRESS0 + i*4];
-        uint32_t palette = pg->regs[NV_PGRAPH_TEXPALETTE0 + i*4];
-
-        unsigned int min_mipmap_level =
-            GET_MASK(ctl_0, NV_PGRAPH_TEXCTL0_0_MIN_LOD_CLAMP);
-        unsigned int max_mipmap_level =
-            GET_MASK(ctl_0, NV_PGRAPH_TEXCTL0_0_MAX_LOD_CLAMP);
-
-        unsigned int pitch =
-            GET_MASK(ctl_1, NV_PGRAPH_TEXCTL1_0_IMAGE_PITCH);
-
-        unsigned int dma_select =
-            GET_MASK(fmt, NV_PGRAPH_TEXFMT0_CONTEXT_DMA);
-        bool cubemap =
-            GET_MASK(fmt, NV_PGRAPH_TEXFMT0_CUBEMAPENABLE);
-        unsigned int dimensionality =
-            GET_MASK(fmt, NV_PGRAPH_TEXFMT0_DIMENSIONALITY);
-        unsigned int color_format = GET_MASK(fmt, NV_PGRAPH_TEXFMT0_COLOR);
-        unsigned int levels = GET_MASK(fmt, NV_PGRAPH_TEXFMT0_MIPMAP_LEVELS);
-        unsigned int log_width = GET_MASK(fmt, NV_PGRAPH_TEXFMT0_BASE_SIZE_U);
-        unsigned int log_height = GET_MASK(fmt, NV_PGRAPH_TEXFMT0_BASE_SIZE_V);
-        unsigned int log_depth = GET_MASK(fmt, NV_PGRAPH_TEXFMT0_BASE_SIZE_P);
-
-        unsigned int rect_width =
-            GET_MASK(pg->regs[NV_PGRAPH_TEXIMAGERECT0 + i*4],
-                     NV_PGRAPH_TEXIMAGERECT0_WIDTH);
-        unsigned int rect_height =
-            GET_MASK(pg->regs[NV_PGRAPH_TEXIMAGERECT0 + i*4],
-                     NV_PGRAPH_TEXIMAGERECT0_HEIGHT);
+    unsigned int dma_select =
+        GET_MASK(fmt, NV_PGRAPH_TEXFMT0_CONTEXT_DMA);
+    bool cubemap =
+        GET_MASK(fmt, NV_PGRAPH_TEXFMT0_CUBEMAPENABLE);
+    unsigned int dimensionality =
+        GET_MASK(fmt, NV_PGRAPH_TEXFMT0_DIMENSIONALITY);
+    unsigned int color_format = GET_MASK(fmt, NV_PGRAPH_TEXFMT0_COLOR);
+    unsigned int levels = GET_MASK(fmt, NV_PGRAPH_TEXFMT0_MIPMAP_LEVELS);
+    unsigned int log_width = GET_MASK(fmt, NV_PGRAPH_TEXFMT0_BASE_SIZE_U);
+    unsigned int log_height = GET_MASK(fmt, NV_PGRAPH_TEXFMT0_BASE_SIZE_V);
+    unsigned int log_depth = GET_MASK(fmt, NV_PGRAPH_TEXFMT0_BASE_SIZE_P);
+
+    unsigned int rect_width =
+        GET_MASK(pg->regs[NV_PGRAPH_TEXIMAGERECT0 + i*4],
+                 NV_PGRAPH_TEXIMAGERECT0_WIDTH);
+    unsigned int rect_height =
+        GET_MASK(pg->regs[NV_PGRAPH_TEXIMAGERECT0 + i*4],
+                 NV_PGRAPH_TEXIMAGERECT0_HEIGHT);
 #ifdef DEBUG_NV2A
-        unsigned int lod_bias =
-            GET_MASK(filter, NV_PGRAPH_TEXFILTER0_MIPMAP_LOD_BIAS);
+    unsigned int lod_bias =
+        GET_MASK(filter, NV_PGRAPH_TEXFILTER0_MIPMAP_LOD_BIAS);
 #endif
-        unsigned int border_source = GET_MASK(fmt,
-                                              NV_PGRAPH_TEXFMT0_BORDER_SOURCE);
-        uint32_t border_color = pg->regs[NV_PGRAPH_BORDERCOLOR0 + i*4];
+    unsigned int border_source = GET_MASK(fmt,
+                                          NV_PGRAPH_TEXFMT0_BORDER_SOURCE);
+    uint32_t border_color = pg->regs[NV_PGRAPH_BORDERCOLOR0 + i*4];
 
-        hwaddr offset = pg->regs[NV_PGRAPH_TEXOFFSET0 + i*4];
+    hwaddr offset = pg->regs[NV_PGRAPH_TEXOFFSET0 + i*4];
 
-        bool palette_dma_select =
-            GET_MASK(palette, NV_PGRAPH_TEXPALETTE0_CONTEXT_DMA);
-        unsigned int palette_length_index =
-            GET_MASK(palette, NV_PGRAPH_TEXPALETTE0_LENGTH);
-        unsigned int palette_offset =
-            palette & NV_PGRAPH_TEXPALETTE0_OFFSET;
+    bool palette_dma_select =
+        GET_MASK(palette, NV_PGRAPH_TEXPALETTE0_CONTEXT_DMA);
+    unsigned int palette_length_index =
+        GET_MASK(palette, NV_PGRAPH_TEXPALETTE0_LENGTH);
+    unsigned int palette_offset =
+        palette & NV_PGRAPH_TEXPALETTE0_OFFSET;
 
-        unsigned int palette_length = 0;
-        switch (palette_length_index) {
-        case NV_PGRAPH_TEXPALETTE0_LENGTH_256: palette_length = 256; break;
-        case NV_PGRAPH_TEXPALETTE0_LENGTH_128: palette_length = 128; break;
-        case NV_PGRAPH_TEXPALETTE0_LENGTH_64: palette_length = 64; break;
-        case NV_PGRAPH_TEXPALETTE0_LENGTH_32: palette_length = 32; break;
-        default: assert(false); break;
-        }
+    unsigned int palette_length = 0;
+    switch (palette_length_index) {
+    case NV_PGRAPH_TEXPALETTE0_LENGTH_256: palette_length = 256; break;
+    case NV_PGRAPH_TEXPALETTE0_LENGTH_128: palette_length = 128; break;
+    case NV_PGRAPH_TEXPALETTE0_LENGTH_64: palette_length = 64; break;
+    case NV_PGRAPH_TEXPALETTE0_LENGTH_32: palette_length = 32; break;
+    default: CHECK_TEXTURE_STAGE(false); break;
+    }
 
+    if (strict) {
         /* Check for unsupported features */
         if (filter & NV_PGRAPH_TEXFILTER0_ASIGNED) NV2A_UNIMPLEMENTED("NV_PGRAPH_TEXFILTER0_ASIGNED");
         if (filter & NV_PGRAPH_TEXFILTER0_RSIGNED) NV2A_UNIMPLEMENTED("NV_PGRAPH_TEXFILTER0_RSIGNED");
         if (filter & NV_PGRAPH_TEXFILTER0_GSIGNED) NV2A_UNIMPLEMENTED("NV_PGRAPH_TEXFILTER0_GSIGNED");
         if (filter & NV_PGRAPH_TEXFILTER0_BSIGNED) NV2A_UNIMPLEMENTED("NV_PGRAPH_TEXFILTER0_BSIGNED");
+    }
 
-        nv2a_profile_inc_counter(NV2A_PROF_TEX_BIND);
-
-        hwaddr dma_len;
-        uint8_t *texture_data;
-        if (dma_select) {
-            texture_data = (uint8_t*)nv_dma_map(d, pg->dma_b, &dma_len);
-        } else {
-            texture_data = (uint8_t*)nv_dma_map(d, pg->dma_a, &dma_len);
-        }
-        assert(offset < dma_len);
-        texture_data += offset;
-        hwaddr texture_vram_offset = texture_data - d->vram_ptr;
-
-        hwaddr palette_dma_len;
-        uint8_t *palette_data;
-        if (palette_dma_select) {
-            palette_data = (uint8_t*)nv_dma_map(d, pg->dma_b, &palette_dma_len);
-        } else {
-            palette_data = (uint8_t*)nv_dma_map(d, pg->dma_a, &palette_dma_len);
-        }
-        assert(palette_offset < palette_dma_len);
-        palette_data += palette_offset;
-        hwaddr palette_vram_offset = palette_data - d->vram_ptr;
-
+    hwaddr dma_len;
+    uint8_t *texture_data = pgraph_map_texture_dma(
+        d, dma_select ? pg->dma_b : pg->dma_a, strict, &dma_len);
+    CHECK_TEXTURE_STAGE(texture_data != NULL);
+    CHECK_TEXTURE_STAGE(offset < dma_len);
+    texture_data += offset;
+    hwaddr texture_vram_offset = texture_data - d->vram_ptr;
+
+    hwaddr palette_dma_len;
+    uint8_t *palette_data = pgraph_map_texture_dma(
+        d, palette_dma_select ? pg->dma_b : pg->dma_a, strict,
+        &palette_dma_len);
+    CHECK_TEXTURE_STAGE(palette_data != NULL);
+    CHECK_TEXTURE_STAGE(palette_offset < palette_dma_len);
+    palette_data += palette_offset;
+    hwaddr palette_vram_offset = palette_data - d->vram_ptr;
+
+    if (strict) {
         NV2A_DPRINTF(" texture %d is format 0x%x, "
                         "off 0x%" HWADDR_PRIx " (r %d, %d or %d, %d, %d; %d%s),"
                         " filter %x %x, levels %d-%d %d bias %d\n",
@@ -6656,154 +7687,251 @@ static void pgraph_bind_textures(NV2AState *d)
                      GET_MASK(filter, NV_PGRAPH_TEXFILTER0_MAG),
                      min_mipmap_level, max_mipmap_level, levels,
                      lod_bias);
+    }
 
-        assert(color_format < ARRAY_SIZE(kelvin_color_format_map));
-        ColorFormatInfo f = kelvin_color_format_map[color_format];
-        if (f.bytes_per_pixel == 0) {
-            fprintf(stderr, "nv2a: unimplemented texture color format 0x%x\n",
-                    color_format);
-            abort();
+    CHECK_TEXTURE_STAGE(color_format < ARRAY_SIZE(kelvin_color_format_map));
+    ColorFormatInfo f = kelvin_color_format_map[color_format];
+    if (f.bytes_per_pixel == 0) {
+        if (!strict) {
+            return false;
         }
+        fprintf(stderr, "nv2a: unimplemented texture color format 0x%x\n",
+                color_format);
+        abort();
+    }
 
-        unsigned int width, height, depth;
-        if (f.linear) {
-            assert(dimensionality == 2);
-            width = rect_width;
-            height = rect_height;
-            depth = 1;
-        } else {
-            width = 1 << log_width;
-            height = 1 << log_height;
-            depth = 1 << log_depth;
-            pitch = 0;
-
-            levels = MIN(levels, max_mipmap_level + 1);
-
-            /* Discard mipmap levels that would be smaller than 1x1.
-             * FIXME: Is this actually needed?
-             *
-             * >> Level 0: 32 x 4
-             *    Level 1: 16 x 2
-             *    Level 2: 8 x 1
-             *    Level 3: 4 x 1
-             *    Level 4: 2 x 1
-             *    Level 5: 1 x 1
-             */
-            levels = MIN(levels, MAX(log_width, log_height) + 1);
-            assert(levels > 0);
-
-            if (dimensionality == 3) {
-                /* FIXME: What about 3D mipmaps? */
-                if (log_width < 2 || log_height < 2) {
-                    /* Base level is smaller than 4x4... */
-                    levels = 1;
-                } else {
-                    levels = MIN(levels, MIN(log_width, log_height) - 1);
-                }
+    unsigned int width, height, depth;
+    if (f.linear) {
+        CHECK_TEXTURE_STAGE(dimensionality == 2);
+        width = rect_width;
+        height = rect_height;
+        depth = 1;
+    } else {
+        width = 1 << log_width;
+        height = 1 << log_height;
+        depth = 1 << log_depth;
+        pitch = 0;
+
+        levels = MIN(levels, max_mipmap_level + 1);
+
+        /* Discard mipmap levels that would be smaller than 1x1.
+         * FIXME: Is this actually needed?
+         *
+         * >> Level 0: 32 x 4
+         *    Level 1: 16 x 2
+         *    Level 2: 8 x 1
+         *    Level 3: 4 x 1
+         *    Level 4: 2 x 1
+         *    Level 5: 1 x 1
+         */
+        levels = MIN(levels, MAX(log_width, log_height) + 1);
+        CHECK_TEXTURE_STAGE(levels > 0);
+
+        if (dimensionality == 3) {
+            /* FIXME: What about 3D mipmaps? */
+            if (log_width < 2 || log_height < 2) {
+                /* Base level is smaller than 4x4... */
+                levels = 1;
+            } else {
+                levels = MIN(levels, MIN(log_width, log_height) - 1);
             }
-            min_mipmap_level = MIN(levels-1, min_mipmap_level);
-            max_mipmap_level = MIN(levels-1, max_mipmap_level);
         }
+        min_mipmap_level = MIN(levels-1, min_mipmap_level);
+        max_mipmap_level = MIN(levels-1, max_mipmap_level);
+    }
 
-        size_t length = 0;
-        if (f.linear) {
-            assert(cubemap == false);
-            assert(dimensionality == 2);
-            length = height * pitch;
-        } else {
-            if (dimensionality >= 2) {
-                unsigned int w = width, h = height;
-                int level;
-                if (f.gl_format != 0) {
-                    for (level = 0; level < levels; level++) {
-                        w = MAX(w, 1);
-                        h = MAX(h, 1);
-                        length += w * h * f.bytes_per_pixel;
-                        w /= 2;
-                        h /= 2;
-                    }
-                } else {
-                    /* Compressed textures are a bit different */
-                    unsigned int block_size =
-                        f.gl_internal_format ==
-                                GL_COMPRESSED_RGBA_S3TC_DXT1_EXT ?
-                            8 : 16;
-                    for (level = 0; level < levels; level++) {
-                        w = MAX(w, 1);
-                        h = MAX(h, 1);
-                        unsigned int phys_w = (w + 3) & ~3,
-                                     phys_h = (h + 3) & ~3;
-                        length += phys_w/4 * phys_h/4 * block_size;
-                        w /= 2;
-                        h /= 2;
-                    }
-                }
-                if (cubemap) {
-                    assert(dimensionality == 2);
-                    length = (length + NV2A_CUBEMAP_FACE_ALIGNMENT - 1) & ~(NV2A_CUBEMAP_FACE_ALIGNMENT - 1);
-                    length *= 6;
+    size_t length = 0;
+    if (f.linear) {
+        CHECK_TEXTURE_STAGE(cubemap == false);
+        CHECK_TEXTURE_STAGE(dimensionality == 2);
+        length = height * pitch;
+    } else {
+        if (dimensionality >= 2) {
+            unsigned int w = width, h = height;
+            int level;
+            if (f.gl_format != 0) {
+                for (level = 0; level < levels; level++) {
+                    w = MAX(w, 1);
+                    h = MAX(h, 1);
+                    length += w * h * f.bytes_per_pixel;
+                    w /= 2;
+                    h /= 2;
                 }
-                if (dimensionality >= 3) {
-                    length *= depth;
+            } else {
+                /* Compressed textures are a bit different */
+                unsigned int block_size =
+                    f.gl_internal_format ==
+                            GL_COMPRESSED_RGBA_S3TC_DXT1_EXT ?
+                        8 : 16;
+                for (level = 0; level < levels; level++) {
+                    w = MAX(w, 1);
+                    h = MAX(h, 1);
+                    unsigned int phys_w = (w + 3) & ~3,
+                                 phys_h = (h + 3) & ~3;
+                    length += phys_w/4 * phys_h/4 * block_size;
+                    w /= 2;
+                    h /= 2;
                 }
             }
+            if (cubemap) {
+                CHECK_TEXTURE_STAGE(dimensionality == 2);
+                length = (length + NV2A_CUBEMAP_FACE_ALIGNMENT - 1) & ~(NV2A_CUBEMAP_FACE_ALIGNMENT - 1);
+                length *= 6;
+            }
+            if (dimensionality >= 3) {
+                length *= depth;
+            }
         }
+    }
 
-        bool is_bordered = border_source != NV_PGRAPH_TEXFMT0_BORDER_SOURCE_COLOR;
+    bool is_bordered = border_source != NV_PGRAPH_TEXFMT0_BORDER_SOURCE_COLOR;
+
+    CHECK_TEXTURE_STAGE((texture_vram_offset + length)
+                        < memory_region_size(d->vram));
+    CHECK_TEXTURE_STAGE((palette_vram_offset + palette_length)
+                        < memory_region_size(d->vram));
+    bool is_indexed = (color_format ==
+            NV097_SET_TEXTURE_FORMAT_COLOR_SZ_I8_A8R8G8B8);
+
+    memset(ts, 0, sizeof(TextureStage));
+
+    TextureShape *state = &ts->key.state;
+    state->cubemap = cubemap;
+    state->dimensionality = dimensionality;
+    state->color_format = color_format;
+    state->levels = levels;
+    state->width = width;
+    state->height = height;
+    state->depth = depth;
+    state->min_mipmap_level = min_mipmap_level;
+    state->max_mipmap_level = max_mipmap_level;
+    state->pitch = pitch;
+    state->border = is_bordered;
+
+    ts->key.texture_vram_offset = texture_vram_offset;
+    ts->key.texture_length = length;
+    if (is_indexed) {
+        ts->key.palette_vram_offset = palette_vram_offset;
+        ts->key.palette_length = palette_length;
+    }
+
+    ts->f = f;
+    ts->filter = filter;
+    ts->address = address;
+    ts->border_color = border_color;
+    ts->is_indexed = is_indexed;
+    ts->texture_data = texture_data;
+    ts->palette_data = palette_data;
+    ts->palette_vram_offset = palette_vram_offset;
+    ts->palette_length = palette_length;
 
-        assert((texture_vram_offset + length) < memory_region_size(d->vram));
-        assert((palette_vram_offset + palette_length)
-               < memory_region_size(d->vram));
-        bool is_indexed = (color_format ==
-                NV097_SET_TEXTURE_FORMAT_COLOR_SZ_I8_A8R8G8B8);
-        bool possibly_dirty = false;
-        bool possibly_dirty_checked = false;
+    return true;
 
-        SurfaceBinding *surface = pgraph_surface_get(d, texture_vram_offset);
-        TextureBinding *tbind = pg->texture_binding[i];
-        if (!pg->texture_dirty[i] && tbind) {
-            bool reusable = false;
-            if (surface && tbind->draw_time == surface->draw_time) {
-                reusable = true;
-            } else if (!surface) {
-                possibly_dirty = pgraph_check_texture_possibly_dirty(
-                        d,
-                        texture_vram_offset,
+#undef CHECK_TEXTURE_STAGE
+}
+
+/*
+ * Whether a texture bound for the last draw may have changed since: it was
+ * written by the CPU, or it is a surface that draws may have rendered to.
+ */
+static bool pgraph_check_bound_textures_dirty(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+        uint32_t ctl_0 = pg->regs[NV_PGRAPH_TEXCTL0_0 + i*4];
+        if (!pgraph_is_texture_stage_active(pg, i) ||
+            !GET_MASK(ctl_0, NV_PGRAPH_TEXCTL0_0_ENABLE)) {
+            continue;
+        }
+
+        TextureStage ts;
+        if (!pgraph_get_texture_stage(d, i, false, &ts) ||
+            pgraph_surface_get(d, ts.key.texture_vram_offset)) {
+            return true;
+        }
+        if (memory_region_get_dirty(d->vram, ts.key.texture_vram_offset,
+                                    ts.key.texture_length,
+                                    DIRTY_MEMORY_NV2A_TEX)) {
+            return true;
+        }
+        if (ts.key.palette_length &&
+            memory_region_get_dirty(d->vram, ts.palette_vram_offset,
+                                    ts.key.palette_length,
+                                    DIRTY_MEMORY_NV2A_TEX)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void pgraph_bind_textures(NV2AState *d)
+{
+    int i;
+    PGRAPHState *pg = &d->pgraph;
+
+    NV2A_GL_DGROUP_BEGIN("%s", __func__);
+
+    for (i=0; i<NV2A_MAX_TEXTURES; i++) {
+        uint32_t ctl_0 = pg->regs[NV_PGRAPH_TEXCTL0_0 + i*4];
+        bool enabled = pgraph_is_texture_stage_active(pg, i) &&
+                       GET_MASK(ctl_0, NV_PGRAPH_TEXCTL0_0_ENABLE);
+        /* FIXME: What happens if texture is disabled but stage is active? */
+
+        nv2a_gl_active_texture(GL_TEXTURE0 + i);
+        if (!enabled) {
+            nv2a_gl_bind_texture(GL_TEXTURE_CUBE_MAP, 0);
+            nv2a_gl_bind_texture(GL_TEXTURE_RECTANGLE, 0);
+            nv2a_gl_bind_texture(GL_TEXTURE_1D, 0);
+            nv2a_gl_bind_texture(GL_TEXTURE_2D, 0);
+            nv2a_gl_bind_texture(GL_TEXTURE_3D, 0);
+            continue;
+        }
+
+        TextureStage ts;
+        pgraph_get_texture_stage(d, i, true, &ts);
+
+        nv2a_profile_inc_counter(NV2A_PROF_TEX_BIND);
+
+        TextureShape state = ts.key.state;
+        hwaddr texture_vram_offset = ts.key.texture_vram_offset;
+        size_t length = ts.key.texture_length;
+
+        bool possibly_dirty = false;
+        bool possibly_dirty_checked = false;
+
+        SurfaceBinding *surface = pgraph_surface_get(d, texture_vram_offset);
+        TextureBinding *tbind = pg->texture_binding[i];
+        if (!pg->texture_dirty[i] && tbind) {
+            bool reusable = false;
+            if (surface && tbind->draw_time == surface->draw_time) {
+                reusable = true;
+            } else if (!surface) {
+                possibly_dirty = pgraph_check_texture_possibly_dirty(
+                        d,
+                        texture_vram_offset,
                         length,
-                        palette_vram_offset,
-                        is_indexed ? palette_length : 0);
+                        ts.palette_vram_offset,
+                        ts.key.palette_length);
                 possibly_dirty_checked = true;
                 reusable = !possibly_dirty;
             }
 
             if (reusable) {
-                glBindTexture(pg->texture_binding[i]->gl_target,
-                              pg->texture_binding[i]->gl_texture);
+                nv2a_gl_bind_texture(pg->texture_binding[i]->gl_target,
+                                     pg->texture_binding[i]->gl_texture);
                 apply_texture_parameters(pg->texture_binding[i],
-                                         &f,
-                                         dimensionality,
-                                         filter,
-                                         address,
-                                         is_bordered,
-                                         border_color);
+                                         &ts.f,
+                                         state.dimensionality,
+                                         ts.filter,
+                                         ts.address,
+                                         state.border,
+                                         ts.border_color);
                 continue;
             }
         }
 
-        TextureShape state;
-        memset(&state, 0, sizeof(TextureShape));
-        state.cubemap = cubemap;
-        state.dimensionality = dimensionality;
-        state.color_format = color_format;
-        state.levels = levels;
-        state.width = width;
-        state.height = height;
-        state.depth = depth;
-        state.min_mipmap_level = min_mipmap_level;
-        state.max_mipmap_level = max_mipmap_level;
-        state.pitch = pitch;
-        state.border = is_bordered;
-
         /*
          * Check active surfaces to see if this texture was a render target
          */
@@ -6814,38 +7942,23 @@ static void pgraph_bind_textures(NV2AState *d)
 
             if (surf_to_tex && surface->upload_pending) {
                 pgraph_upload_surface_data(d, surface, false);
+                nv2a_gl_active_texture(GL_TEXTURE0 + i);
             }
         }
 
-        if (!surf_to_tex) {
+        if (!surf_to_tex && length > 0) {
             // FIXME: Restructure to support rendering surfaces to cubemap faces
 
             // Writeback any surfaces which this texture may index
-            hwaddr tex_vram_end = texture_vram_offset + length - 1;
-            QTAILQ_FOREACH(surface, &d->pgraph.surfaces, entry) {
-                hwaddr surf_vram_end = surface->vram_addr + surface->size - 1;
-                bool overlapping = !(surface->vram_addr >= tex_vram_end
-                                     || texture_vram_offset >= surf_vram_end);
-                if (overlapping) {
-                    pgraph_download_surface_data_if_dirty(d, surface);
-                }
-            }
-        }
-
-        TextureKey key;
-        memset(&key, 0, sizeof(TextureKey));
-        key.state = state;
-        key.texture_vram_offset = texture_vram_offset;
-        key.texture_length = length;
-        if (is_indexed) {
-            key.palette_vram_offset = palette_vram_offset;
-            key.palette_length = palette_length;
+            pgraph_download_overlapping_surfaces(
+                d, texture_vram_offset, texture_vram_offset + length - 1);
         }
 
         // Search for existing texture binding in cache
-        uint64_t tex_binding_hash = fast_hash((uint8_t*)&key, sizeof(key));
+        uint64_t tex_binding_hash = fast_hash((uint8_t*)&ts.key,
+                                              sizeof(ts.key));
         LruNode *found = lru_lookup(&pg->texture_cache,
-                                     tex_binding_hash, &key);
+                                     tex_binding_hash, &ts.key);
         TextureLruNode *key_out = container_of(found, TextureLruNode, node);
         possibly_dirty |= (key_out->binding == NULL) || key_out->possibly_dirty;
 
@@ -6854,16 +7967,19 @@ static void pgraph_bind_textures(NV2AState *d)
                     d,
                     texture_vram_offset,
                     length,
-                    palette_vram_offset,
-                    is_indexed ? palette_length : 0);
+                    ts.palette_vram_offset,
+                    ts.key.palette_length);
         }
 
         // Calculate hash of texture data, if necessary
         uint64_t tex_data_hash = 0;
-        if (!surf_to_tex && possibly_dirty) {
-            tex_data_hash = fast_hash(texture_data, length);
-            if (is_indexed) {
-                tex_data_hash ^= fast_hash(palette_data, palette_length);
+        TextureStaging *staging = NULL;
+        if (!surf_to_tex && possibly_dirty &&
+            !pgraph_take_texture_prefetch(pg, i, &ts.key, &tex_data_hash,
+                                          &staging)) {
+            tex_data_hash = fast_hash(ts.texture_data, length);
+            if (ts.is_indexed) {
+                tex_data_hash ^= fast_hash(ts.palette_data, ts.palette_length);
             }
         }
 
@@ -6877,14 +7993,18 @@ static void pgraph_bind_textures(NV2AState *d)
         }
 
         if (key_out->binding == NULL) {
-            // Must create the texture
-            key_out->binding = generate_texture(state, texture_data, palette_data);
+            // Must create the texture, possibly from prefetched texels
+            key_out->binding = generate_texture(pg, state, ts.texture_data,
+                                                ts.palette_data, staging);
             key_out->binding->data_hash = tex_data_hash;
             key_out->binding->scale = 1;
         } else {
             // Saved an upload! Reuse existing texture in graphics memory.
-            glBindTexture(key_out->binding->gl_target,
-                          key_out->binding->gl_texture);
+            if (staging) {
+                texture_staging_free(staging);
+            }
+            nv2a_gl_bind_texture(key_out->binding->gl_target,
+                                 key_out->binding->gl_texture);
         }
 
         key_out->possibly_dirty = false;
@@ -6905,22 +8025,26 @@ static void pgraph_bind_textures(NV2AState *d)
         }
 
         apply_texture_parameters(binding,
-                                 &f,
-                                 dimensionality,
-                                 filter,
-                                 address,
-                                 is_bordered,
-                                 border_color);
+                                 &ts.f,
+                                 state.dimensionality,
+                                 ts.filter,
+                                 ts.address,
+                                 state.border,
+                                 ts.border_color);
 
         if (pg->texture_binding[i]) {
             if (pg->texture_binding[i]->gl_target != binding->gl_target) {
-                glBindTexture(pg->texture_binding[i]->gl_target, 0);
+                nv2a_gl_bind_texture(pg->texture_binding[i]->gl_target, 0);
             }
             texture_binding_destroy(pg->texture_binding[i]);
         }
         pg->texture_binding[i] = binding;
         pg->texture_dirty[i] = false;
     }
+
+    /* Jobs bind did not claim are for state that has been bound already */
+    pgraph_cancel_texture_prefetches(pg);
+
     NV2A_GL_DGROUP_END();
 }
 
@@ -6966,28 +8090,139 @@ static void pgraph_get_surface_dimensions(PGRAPHState *pg,
     }
 }
 
-static void pgraph_update_memory_buffer(NV2AState *d, hwaddr addr, hwaddr size,
-                                        bool quick)
+static hwaddr pgraph_vertex_attribute_vram_addr(NV2AState *d,
+                                                VertexAttribute *attr)
 {
-    glBindBuffer(GL_ARRAY_BUFFER, d->pgraph.gl_memory_buffer);
+    PGRAPHState *pg = &d->pgraph;
+    hwaddr dma_len;
+    uint8_t *attr_data = (uint8_t *)nv_dma_map(
+        d, attr->dma_select ? pg->dma_vertex_b : pg->dma_vertex_a, &dma_len);
+    assert(attr->offset < dma_len);
+    return attr_data + attr->offset - d->vram_ptr;
+}
 
-    hwaddr end = TARGET_PAGE_ALIGN(addr + size);
-    addr &= TARGET_PAGE_MASK;
-    assert(end < memory_region_size(d->vram));
+/* Upload [addr, end) to the VRAM mirror if it is still dirty */
+static void pgraph_upload_vram_mirror_run(NV2AState *d, hwaddr addr,
+                                          hwaddr end)
+{
+    PGRAPHState *pg = &d->pgraph;
 
-    static hwaddr last_addr, last_end;
-    if (quick && (addr >= last_addr) && (end <= last_end)) {
+    /* Cleared before copying, so writes racing with the copy are kept */
+    memory_region_reset_dirty(d->vram, addr, end - addr, DIRTY_MEMORY_NV2A);
+    nv2a_profile_inc_counter(NV2A_PROF_GEOM_BUFFER_UPDATE_1);
+    nv2a_profile_add_counter(NV2A_PROF_VRAM_MIRROR_BYTES, end - addr);
+
+    if (!pg->stream_buffer.map) {
+        glBindBuffer(GL_ARRAY_BUFFER, pg->gl_memory_buffer);
+        glBufferSubData(GL_ARRAY_BUFFER, addr, end - addr,
+                        d->vram_ptr + addr);
         return;
     }
-    last_addr = addr;
-    last_end = end;
 
-    size = end - addr;
-    if (memory_region_test_and_clear_dirty(d->vram, addr, size,
-                                           DIRTY_MEMORY_NV2A)) {
-        glBufferSubData(GL_ARRAY_BUFFER, addr, size,
-                        d->vram_ptr + addr);
-        nv2a_profile_inc_counter(NV2A_PROF_GEOM_BUFFER_UPDATE_1);
+    /*
+     * Stage through the persistently mapped stream buffer and let the GPU
+     * copy it across, ordered against draws still reading the old contents.
+     */
+    const size_t segment_size =
+        NV2A_STREAM_BUFFER_SIZE / NV2A_STREAM_BUFFER_SEGMENTS;
+    glBindBuffer(GL_COPY_READ_BUFFER, pg->stream_buffer.gl_buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, pg->gl_memory_buffer);
+    while (addr < end) {
+        size_t len = MIN(end - addr, segment_size);
+        GLintptr offset = pgraph_stream_upload(pg, d->vram_ptr + addr, len);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset,
+                            addr, len);
+        /* Runs are synced before a draw streams anything of its own, so
+         * the copy is the last reader of whatever has been left behind. */
+        pgraph_stream_retire(pg);
+        addr += len;
+    }
+}
+
+/* Upload each run of dirty pages in the page aligned range [start, end) */
+static void pgraph_sync_vram_mirror_range(NV2AState *d, hwaddr start,
+                                          hwaddr end)
+{
+    /* Syncs the dirty bitmap, once for the whole range */
+    if (!memory_region_get_dirty(d->vram, start, end - start,
+                                 DIRTY_MEMORY_NV2A)) {
+        return;
+    }
+
+    /*
+     * Walk the bitmap for runs of dirty pages. A page dirtied after it was
+     * found clean here is picked up by the next draw.
+     */
+    ram_addr_t base = memory_region_get_ram_addr(d->vram);
+    hwaddr addr = start;
+    while (addr < end) {
+        hwaddr run_start = cpu_physical_memory_find_dirty(
+            base + addr, end - addr, DIRTY_MEMORY_NV2A, true) - base;
+        if (run_start >= end) {
+            break;
+        }
+        run_start = MAX(run_start, addr);
+        hwaddr run_end = cpu_physical_memory_find_dirty(
+            base + run_start, end - run_start, DIRTY_MEMORY_NV2A, false) - base;
+        run_end = MIN(run_end, end);
+        pgraph_upload_vram_mirror_run(d, run_start, run_end);
+        addr = run_end;
+    }
+}
+
+/*
+ * Bring the parts of the VRAM mirror a draw sources up to date. Attribute
+ * ranges are gathered and merged first, so interleaved and neighbouring
+ * arrays are scanned once and their dirty pages go up in as few uploads as
+ * possible.
+ */
+static void pgraph_sync_vram_mirror(NV2AState *d, unsigned int min_element,
+                                    unsigned int num_elements)
+{
+    PGRAPHState *pg = &d->pgraph;
+    hwaddr start[NV2A_VERTEXSHADER_ATTRIBUTES];
+    hwaddr end[NV2A_VERTEXSHADER_ATTRIBUTES];
+    int num_ranges = 0;
+
+    for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+        VertexAttribute *attr = &pg->vertex_attributes[i];
+
+        /* Stride 0 attributes are read on the CPU as a constant */
+        if (!attr->count || !attr->stride) {
+            continue;
+        }
+
+        hwaddr addr = pgraph_vertex_attribute_vram_addr(d, attr) +
+                      min_element * attr->stride;
+        hwaddr len = (num_elements - 1) * attr->stride +
+                     attr->size * attr->count;
+        hwaddr range_start = addr & TARGET_PAGE_MASK;
+        hwaddr range_end = TARGET_PAGE_ALIGN(addr + len);
+        assert(range_end <= memory_region_size(d->vram));
+
+        int j;
+        for (j = num_ranges++; j > 0 && start[j - 1] > range_start; j--) {
+            start[j] = start[j - 1];
+            end[j] = end[j - 1];
+        }
+        start[j] = range_start;
+        end[j] = range_end;
+    }
+
+    int num_merged = 0;
+    for (int i = 0; i < num_ranges; i++) {
+        if (num_merged &&
+            start[i] <= end[num_merged - 1] + NV2A_VRAM_MIRROR_MERGE_GAP) {
+            end[num_merged - 1] = MAX(end[num_merged - 1], end[i]);
+        } else {
+            start[num_merged] = start[i];
+            end[num_merged] = end[i];
+            num_merged++;
+        }
+    }
+
+    for (int i = 0; i < num_merged; i++) {
+        pgraph_sync_vram_mirror_range(d, start[i], end[i]);
     }
 }
 
@@ -7061,7 +8296,6 @@ static void pgraph_bind_vertex_attributes(NV2AState *d,
                                           unsigned int provoking_element)
 {
     PGRAPHState *pg = &d->pgraph;
-    bool updated_memory_buffer = false;
     unsigned int num_elements = max_element - min_element + 1;
 
     if (inline_data) {
@@ -7073,6 +8307,11 @@ static void pgraph_bind_vertex_attributes(NV2AState *d,
 
     pg->compressed_attrs = 0;
 
+    if (!inline_data) {
+        pgraph_sync_vram_mirror(d, min_element, num_elements);
+        glBindBuffer(GL_ARRAY_BUFFER, pg->gl_memory_buffer);
+    }
+
     for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
         VertexAttribute *attr = &pg->vertex_attributes[i];
 
@@ -7092,21 +8331,14 @@ static void pgraph_bind_vertex_attributes(NV2AState *d,
 
         hwaddr start = 0;
         if (inline_data) {
-            glBindBuffer(GL_ARRAY_BUFFER, pg->gl_inline_array_buffer);
-            attrib_data_addr = attr->inline_array_offset;
+            glBindBuffer(GL_ARRAY_BUFFER, pg->stream_buffer.gl_buffer);
+            attrib_data_addr = pg->inline_array_stream_offset +
+                               attr->inline_array_offset;
             stride = inline_stride;
         } else {
-            hwaddr dma_len;
-            uint8_t *attr_data = (uint8_t *)nv_dma_map(
-                d, attr->dma_select ? pg->dma_vertex_b : pg->dma_vertex_a,
-                &dma_len);
-            assert(attr->offset < dma_len);
-            attrib_data_addr = attr_data + attr->offset - d->vram_ptr;
+            attrib_data_addr = pgraph_vertex_attribute_vram_addr(d, attr);
             stride = attr->stride;
             start = attrib_data_addr + min_element * stride;
-            pgraph_update_memory_buffer(d, start, num_elements * stride,
-                                        updated_memory_buffer);
-            updated_memory_buffer = true;
         }
 
         uint32_t provoking_element_index = provoking_element - min_element;
@@ -7171,10 +8403,8 @@ static unsigned int pgraph_bind_inline_array(NV2AState *d)
     NV2A_DPRINTF("draw inline array %d, %d\n", vertex_size, index_count);
 
     nv2a_profile_inc_counter(NV2A_PROF_GEOM_BUFFER_UPDATE_2);
-    glBindBuffer(GL_ARRAY_BUFFER, pg->gl_inline_array_buffer);
-    glBufferData(GL_ARRAY_BUFFER, NV2A_MAX_BATCH_LENGTH * sizeof(uint32_t),
-                 NULL, GL_STREAM_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, index_count * vertex_size, pg->inline_array);
+    pg->inline_array_stream_offset =
+        pgraph_stream_upload(pg, pg->inline_array, index_count * vertex_size);
     pgraph_bind_vertex_attributes(d, 0, index_count-1, true, vertex_size,
                                   index_count-1);
 
@@ -7308,13 +8538,31 @@ static uint8_t* convert_texture_data(const TextureShape s,
     }
 }
 
-static void upload_gl_texture(GLenum gl_target,
-                              const TextureShape s,
-                              const uint8_t *texture_data,
-                              const uint8_t *palette_data)
+static bool upload_gl_texture_compressed(PGRAPHState *pg,
+                                         const TextureShape s,
+                                         const ColorFormatInfo *f)
+{
+    /* Upload DXT data as-is when the driver can sample it. Bordered textures
+     * need texels skipped from within blocks, and NV2A volume textures
+     * interleave the slices of each 4x4x4 block, so both of those still go
+     * through the CPU decoder.
+     */
+    return pg->texture_compression_s3tc && g_config.perf.compressed_textures &&
+           f->gl_format == 0 && !s.border && s.dimensionality == 2;
+}
+
+typedef struct TextureLevel {
+    unsigned int width, height, depth;
+    unsigned int pitch;
+    size_t offset;
+} TextureLevel;
+
+/* Lay out the mipmap levels of one face as they are stored in guest memory */
+static unsigned int get_texture_levels(const TextureShape s,
+                                       GLenum gl_target,
+                                       TextureLevel *levels)
 {
     ColorFormatInfo f = kelvin_color_format_map[s.color_format];
-    nv2a_profile_inc_counter(NV2A_PROF_TEX_UPLOAD);
 
     unsigned int adjusted_width = s.width;
     unsigned int adjusted_height = s.height;
@@ -7327,47 +8575,49 @@ static void upload_gl_texture(GLenum gl_target,
         adjusted_depth = MAX(16, s.depth * 2);
     }
 
-    switch(gl_target) {
-    case GL_TEXTURE_1D:
-        assert(false);
-        break;
-    case GL_TEXTURE_RECTANGLE: {
-        /* Can't handle strides unaligned to pixels */
-        assert(s.pitch % f.bytes_per_pixel == 0);
-
-        uint8_t *converted = convert_texture_data(s, texture_data,
-                                                  palette_data,
-                                                  adjusted_width,
-                                                  adjusted_height, 1,
-                                                  adjusted_pitch, 0);
-        glPixelStorei(GL_UNPACK_ROW_LENGTH,
-                      converted ? 0 : adjusted_pitch / f.bytes_per_pixel);
-        glTexImage2D(gl_target, 0, f.gl_internal_format,
-                     adjusted_width, adjusted_height, 0,
-                     f.gl_format, f.gl_type,
-                     converted ? converted : texture_data);
-
-        if (converted) {
-          g_free(converted);
-        }
-
-        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-        break;
+    unsigned int width = adjusted_width;
+    unsigned int height = adjusted_height;
+    unsigned int depth = adjusted_depth;
+    size_t offset = 0;
+
+    if (gl_target == GL_TEXTURE_RECTANGLE) {
+        levels[0] = (TextureLevel){ adjusted_width, adjusted_height, 1,
+                                    adjusted_pitch, 0 };
+        return 1;
     }
-    case GL_TEXTURE_2D:
-    case GL_TEXTURE_CUBE_MAP_POSITIVE_X:
-    case GL_TEXTURE_CUBE_MAP_NEGATIVE_X:
-    case GL_TEXTURE_CUBE_MAP_POSITIVE_Y:
-    case GL_TEXTURE_CUBE_MAP_NEGATIVE_Y:
-    case GL_TEXTURE_CUBE_MAP_POSITIVE_Z:
-    case GL_TEXTURE_CUBE_MAP_NEGATIVE_Z: {
 
-        unsigned int width = adjusted_width, height = adjusted_height;
+    assert(s.levels <= NV2A_MAX_TEXTURE_LEVELS);
+
+    int level;
+    for (level = 0; level < s.levels; level++) {
+        size_t level_size;
 
-        int level;
-        for (level = 0; level < s.levels; level++) {
+        if (gl_target == GL_TEXTURE_3D) {
+            assert(f.linear == false);
+            if (f.gl_format == 0) { /* compressed */
+                assert(width % 4 == 0 && height % 4 == 0 &&
+                       "Compressed 3D texture virtual size");
+                width = MAX(width, 4);
+                height = MAX(height, 4);
+                depth = MAX(depth, 1);
+
+                unsigned int block_size;
+                if (f.gl_internal_format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) {
+                    block_size = 8;
+                } else {
+                    block_size = 16;
+                }
+                level_size = width/4 * height/4 * depth * block_size;
+            } else {
+                width = MAX(width, 1);
+                height = MAX(height, 1);
+                depth = MAX(depth, 1);
+                level_size = width * height * depth * f.bytes_per_pixel;
+            }
+        } else {
             width = MAX(width, 1);
             height = MAX(height, 1);
+            depth = 1;
 
             if (f.gl_format == 0) { /* compressed */
                  // https://docs.microsoft.com/en-us/windows/win32/direct3d10/d3d10-graphics-programming-guide-resources-block-compression#virtual-size-versus-physical-size
@@ -7376,12 +8626,154 @@ static void upload_gl_texture(GLenum gl_target,
                         8 : 16;
                 unsigned int physical_width = (width + 3) & ~3,
                              physical_height = (height + 3) & ~3;
+                level_size =
+                    physical_width / 4 * physical_height / 4 * block_size;
+            } else {
+                level_size = width * height * f.bytes_per_pixel;
+            }
+        }
+
+        levels[level] = (TextureLevel){ width, height, depth,
+                                        width * f.bytes_per_pixel, offset };
+        offset += level_size;
+
+        width /= 2;
+        height /= 2;
+        depth /= 2;
+    }
+
+    return s.levels;
+}
+
+/*
+ * Convert one mipmap level into something GL can consume: unswizzle it,
+ * expand palettes and YUV and decode DXT as required. Returns NULL if the
+ * level can be uploaded straight from texture_data. This only touches CPU
+ * memory, so it is safe to call from the prefetch workers.
+ */
+static uint8_t *convert_texture_level(const TextureShape s,
+                                      GLenum gl_target,
+                                      bool compressed_upload,
+                                      const TextureLevel *l,
+                                      const uint8_t *texture_data,
+                                      const uint8_t *palette_data)
+{
+    ColorFormatInfo f = kelvin_color_format_map[s.color_format];
+
+    if (gl_target == GL_TEXTURE_RECTANGLE) {
+        return convert_texture_data(s, texture_data, palette_data,
+                                    l->width, l->height, 1, l->pitch, 0);
+    }
+
+    if (f.gl_format == 0) { /* compressed */
+        if (gl_target == GL_TEXTURE_3D) {
+            return decompress_3d_texture_data(f.gl_internal_format,
+                                              texture_data, l->width,
+                                              l->height, l->depth);
+        }
+        if (compressed_upload) {
+            return NULL;
+        }
+        return decompress_2d_texture_data(f.gl_internal_format, texture_data,
+                                          (l->width + 3) & ~3,
+                                          (l->height + 3) & ~3);
+    }
+
+    unsigned int slice_pitch = l->pitch * l->height;
+    uint8_t *unswizzled = (uint8_t*)g_malloc(slice_pitch * l->depth);
+    if (gl_target == GL_TEXTURE_3D) {
+        unswizzle_box(texture_data, l->width, l->height, l->depth, unswizzled,
+                      l->pitch, slice_pitch, f.bytes_per_pixel);
+    } else {
+        unswizzle_rect(texture_data, l->width, l->height,
+                       unswizzled, l->pitch, f.bytes_per_pixel);
+    }
+
+    uint8_t *converted = convert_texture_data(s, unswizzled, palette_data,
+                                              l->width, l->height, l->depth,
+                                              l->pitch, slice_pitch);
+    if (converted) {
+        g_free(unswizzled);
+        return converted;
+    }
+    return unswizzled;
+}
+
+static void upload_gl_texture(GLenum gl_target,
+                              const TextureShape s,
+                              const uint8_t *texture_data,
+                              const uint8_t *palette_data,
+                              bool compressed_upload,
+                              uint8_t **staged_levels)
+{
+    ColorFormatInfo f = kelvin_color_format_map[s.color_format];
+    nv2a_profile_inc_counter(NV2A_PROF_TEX_UPLOAD);
+
+    GLenum layout_target = gl_target;
+    if (gl_target != GL_TEXTURE_RECTANGLE && gl_target != GL_TEXTURE_3D) {
+        layout_target = GL_TEXTURE_2D;
+    }
+
+    TextureLevel levels[NV2A_MAX_TEXTURE_LEVELS];
+    unsigned int num_levels = get_texture_levels(s, layout_target, levels);
+
+    unsigned int adjusted_width = levels[0].width;
+
+    int level;
+    for (level = 0; level < num_levels; level++) {
+        const TextureLevel *l = &levels[level];
+        const uint8_t *level_data = texture_data + l->offset;
+        uint8_t *converted = staged_levels ?
+            staged_levels[level] :
+            convert_texture_level(s, layout_target, compressed_upload, l,
+                                  level_data, palette_data);
+
+        switch(gl_target) {
+        case GL_TEXTURE_1D:
+            assert(false);
+            break;
+        case GL_TEXTURE_RECTANGLE: {
+            /* Can't handle strides unaligned to pixels */
+            assert(s.pitch % f.bytes_per_pixel == 0);
+
+            nv2a_gl_pixel_store(GL_UNPACK_ROW_LENGTH,
+                                converted ? 0 : l->pitch / f.bytes_per_pixel);
+            glTexImage2D(gl_target, 0, f.gl_internal_format,
+                         l->width, l->height, 0,
+                         f.gl_format, f.gl_type,
+                         converted ? converted : level_data);
+            nv2a_gl_pixel_store(GL_UNPACK_ROW_LENGTH, 0);
+            break;
+        }
+        case GL_TEXTURE_2D:
+        case GL_TEXTURE_CUBE_MAP_POSITIVE_X:
+        case GL_TEXTURE_CUBE_MAP_NEGATIVE_X:
+        case GL_TEXTURE_CUBE_MAP_POSITIVE_Y:
+        case GL_TEXTURE_CUBE_MAP_NEGATIVE_Y:
+        case GL_TEXTURE_CUBE_MAP_POSITIVE_Z:
+        case GL_TEXTURE_CUBE_MAP_NEGATIVE_Z: {
+            unsigned int width = l->width, height = l->height;
+
+            if (f.gl_format == 0) { /* compressed */
+                unsigned int physical_width = (width + 3) & ~3;
+
+                if (compressed_upload) {
+                    nv2a_profile_inc_counter(NV2A_PROF_TEX_UPLOAD_COMPRESSED);
+                    unsigned int physical_height = (height + 3) & ~3;
+                    unsigned int block_size =
+                        f.gl_internal_format ==
+                                GL_COMPRESSED_RGBA_S3TC_DXT1_EXT ?
+                            8 : 16;
+                    glCompressedTexImage2D(
+                        gl_target, level, f.gl_internal_format, width, height,
+                        0, physical_width / 4 * physical_height / 4 * block_size,
+                        level_data);
+                    break;
+                }
+
                 if (physical_width != width) {
-                    glPixelStorei(GL_UNPACK_ROW_LENGTH, physical_width);
+                    nv2a_gl_pixel_store(GL_UNPACK_ROW_LENGTH, physical_width);
                 }
-                uint8_t *converted = decompress_2d_texture_data(
-                    f.gl_internal_format, texture_data, physical_width,
-                    physical_height);
                 unsigned int tex_width = width;
                 unsigned int tex_height = height;
 
@@ -7389,40 +8781,29 @@ static void upload_gl_texture(GLenum gl_target,
                     // FIXME: Consider preserving the border.
                     // There does not seem to be a way to reference the border
                     // texels in a cubemap, so they are discarded.
-                    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 4);
-                    glPixelStorei(GL_UNPACK_SKIP_ROWS, 4);
+                    nv2a_gl_pixel_store(GL_UNPACK_SKIP_PIXELS, 4);
+                    nv2a_gl_pixel_store(GL_UNPACK_SKIP_ROWS, 4);
                     tex_width = s.width;
                     tex_height = s.height;
                     if (physical_width == width) {
-                        glPixelStorei(GL_UNPACK_ROW_LENGTH, adjusted_width);
+                        nv2a_gl_pixel_store(GL_UNPACK_ROW_LENGTH, adjusted_width);
                     }
                 }
 
                 glTexImage2D(gl_target, level, GL_RGBA, tex_width, tex_height, 0,
                              GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, converted);
-                g_free(converted);
                 if (physical_width != width) {
-                    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+                    nv2a_gl_pixel_store(GL_UNPACK_ROW_LENGTH, 0);
                 }
                 if (s.cubemap && adjusted_width != s.width) {
-                    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
-                    glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+                    nv2a_gl_pixel_store(GL_UNPACK_SKIP_PIXELS, 0);
+                    nv2a_gl_pixel_store(GL_UNPACK_SKIP_ROWS, 0);
                     if (physical_width == width) {
-                        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+                        nv2a_gl_pixel_store(GL_UNPACK_ROW_LENGTH, 0);
                     }
                 }
-                texture_data +=
-                    physical_width / 4 * physical_height / 4 * block_size;
             } else {
-                unsigned int pitch = width * f.bytes_per_pixel;
-                uint8_t *unswizzled = (uint8_t*)g_malloc(height * pitch);
-                unswizzle_rect(texture_data, width, height,
-                               unswizzled, pitch, f.bytes_per_pixel);
-                uint8_t *converted = convert_texture_data(s, unswizzled,
-                                                          palette_data,
-                                                          width, height, 1,
-                                                          pitch, 0);
-                uint8_t *pixel_data = converted ? converted : unswizzled;
+                uint8_t *pixel_data = converted;
                 unsigned int tex_width = width;
                 unsigned int tex_height = height;
 
@@ -7430,112 +8811,160 @@ static void upload_gl_texture(GLenum gl_target,
                     // FIXME: Consider preserving the border.
                     // There does not seem to be a way to reference the border
                     // texels in a cubemap, so they are discarded.
-                    glPixelStorei(GL_UNPACK_ROW_LENGTH, adjusted_width);
+                    nv2a_gl_pixel_store(GL_UNPACK_ROW_LENGTH, adjusted_width);
                     tex_width = s.width;
                     tex_height = s.height;
-                    pixel_data += 4 * f.bytes_per_pixel + 4 * pitch;
+                    pixel_data += 4 * f.bytes_per_pixel + 4 * l->pitch;
                 }
 
                 glTexImage2D(gl_target, level, f.gl_internal_format, tex_width,
                              tex_height, 0, f.gl_format, f.gl_type,
                              pixel_data);
                 if (s.cubemap && s.border) {
-                    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+                    nv2a_gl_pixel_store(GL_UNPACK_ROW_LENGTH, 0);
                 }
-                if (converted) {
-                    g_free(converted);
-                }
-                g_free(unswizzled);
-
-                texture_data += width * height * f.bytes_per_pixel;
             }
-
-            width /= 2;
-            height /= 2;
+            break;
+        }
+        case GL_TEXTURE_3D: {
+            if (f.gl_format == 0) { /* compressed */
+                glTexImage3D(gl_target, level,  GL_RGBA8,
+                             l->width, l->height, l->depth, 0,
+                             GL_RGBA, GL_UNSIGNED_INT_8_8_8_8,
+                             converted);
+            } else {
+                glTexImage3D(gl_target, level, f.gl_internal_format,
+                             l->width, l->height, l->depth, 0,
+                             f.gl_format, f.gl_type,
+                             converted);
+            }
+            break;
+        }
+        default:
+            assert(false);
+            break;
         }
 
-        break;
+        if (!staged_levels) {
+            g_free(converted);
+        }
     }
-    case GL_TEXTURE_3D: {
+}
 
-        unsigned int width = adjusted_width;
-        unsigned int height = adjusted_height;
-        unsigned int depth = adjusted_depth;
+static GLenum get_gl_texture_target(const TextureShape s)
+{
+    ColorFormatInfo f = kelvin_color_format_map[s.color_format];
 
+    if (s.cubemap) {
         assert(f.linear == false);
+        assert(s.dimensionality == 2);
+        return GL_TEXTURE_CUBE_MAP;
+    }
 
-        int level;
-        for (level = 0; level < s.levels; level++) {
-            if (f.gl_format == 0) { /* compressed */
-                assert(width % 4 == 0 && height % 4 == 0 &&
-                       "Compressed 3D texture virtual size");
-                width = MAX(width, 4);
-                height = MAX(height, 4);
-                depth = MAX(depth, 1);
-
-                unsigned int block_size;
-                if (f.gl_internal_format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) {
-                    block_size = 8;
-                } else {
-                    block_size = 16;
-                }
+    if (f.linear) {
+        /* linear textures use unnormalised texcoords.
+         * GL_TEXTURE_RECTANGLE_ARB conveniently also does, but
+         * does not allow repeat and mirror wrap modes.
+         *  (or mipmapping, but xbox d3d says 'Non swizzled and non
+         *   compressed textures cannot be mip mapped.')
+         * Not sure if that'll be an issue. */
 
-                size_t texture_size = width/4 * height/4 * depth * block_size;
+        /* FIXME: GLSL 330 provides us with textureSize()! Use that? */
+        assert(s.dimensionality == 2);
+        return GL_TEXTURE_RECTANGLE;
+    }
 
-                uint8_t *converted = decompress_3d_texture_data(f.gl_internal_format, texture_data, width, height, depth);
+    switch(s.dimensionality) {
+    case 1: return GL_TEXTURE_1D;
+    case 2: return GL_TEXTURE_2D;
+    case 3: return GL_TEXTURE_3D;
+    default:
+        assert(false);
+        return 0;
+    }
+}
 
-                glTexImage3D(gl_target, level,  GL_RGBA8,
-                             width, height, depth, 0,
-                             GL_RGBA, GL_UNSIGNED_INT_8_8_8_8,
-                             converted);
+static size_t get_cubemap_face_length(const TextureShape s)
+{
+    ColorFormatInfo f = kelvin_color_format_map[s.color_format];
+    unsigned int block_size;
+    if (f.gl_internal_format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) {
+        block_size = 8;
+    } else {
+        block_size = 16;
+    }
 
-                g_free(converted);
+    size_t length = 0;
+    unsigned int w = s.width;
+    unsigned int h = s.height;
+    if (!f.linear && s.border) {
+        w = MAX(16, w * 2);
+        h = MAX(16, h * 2);
+    }
 
-                texture_data += texture_size;
-            } else {
-                width = MAX(width, 1);
-                height = MAX(height, 1);
-                depth = MAX(depth, 1);
+    int level;
+    for (level = 0; level < s.levels; level++) {
+        if (f.gl_format == 0) {
+            length += w/4 * h/4 * block_size;
+        } else {
+            length += w * h * f.bytes_per_pixel;
+        }
 
-                unsigned int row_pitch = width * f.bytes_per_pixel;
-                unsigned int slice_pitch = row_pitch * height;
-                uint8_t *unswizzled = (uint8_t*)g_malloc(slice_pitch * depth);
-                unswizzle_box(texture_data, width, height, depth, unswizzled,
-                               row_pitch, slice_pitch, f.bytes_per_pixel);
+        w /= 2;
+        h /= 2;
+    }
 
-                uint8_t *converted = convert_texture_data(s, unswizzled,
-                                                          palette_data,
-                                                          width, height, depth,
-                                                          row_pitch, slice_pitch);
+    return (length + NV2A_CUBEMAP_FACE_ALIGNMENT - 1) & ~(NV2A_CUBEMAP_FACE_ALIGNMENT - 1);
+}
 
-                glTexImage3D(gl_target, level, f.gl_internal_format,
-                             width, height, depth, 0,
-                             f.gl_format, f.gl_type,
-                             converted ? converted : unswizzled);
+/* Do all of the CPU side work of generate_texture up front */
+static TextureStaging *texture_staging_prepare(const TextureShape s,
+                                               bool compressed_upload,
+                                               const uint8_t *texture_data,
+                                               const uint8_t *palette_data)
+{
+    GLenum gl_target = get_gl_texture_target(s);
+    size_t face_length = 0;
 
-                if (converted) {
-                    g_free(converted);
-                }
-                g_free(unswizzled);
+    TextureStaging *staging = g_malloc0(sizeof(TextureStaging));
+    staging->compressed_upload = compressed_upload;
+    staging->num_faces = 1;
+    if (gl_target == GL_TEXTURE_CUBE_MAP) {
+        gl_target = GL_TEXTURE_2D;
+        staging->num_faces = 6;
+        face_length = get_cubemap_face_length(s);
+    }
 
-                texture_data += width * height * depth * f.bytes_per_pixel;
-            }
+    TextureLevel levels[NV2A_MAX_TEXTURE_LEVELS];
+    staging->num_levels = get_texture_levels(s, gl_target, levels);
 
-            width /= 2;
-            height /= 2;
-            depth /= 2;
+    for (int face = 0; face < staging->num_faces; face++) {
+        const uint8_t *face_data = texture_data + face * face_length;
+        for (int level = 0; level < staging->num_levels; level++) {
+            staging->level_data[face][level] = convert_texture_level(
+                s, gl_target, compressed_upload, &levels[level],
+                face_data + levels[level].offset, palette_data);
         }
-        break;
     }
-    default:
-        assert(false);
-        break;
+
+    return staging;
+}
+
+static void texture_staging_free(TextureStaging *staging)
+{
+    for (int face = 0; face < staging->num_faces; face++) {
+        for (int level = 0; level < staging->num_levels; level++) {
+            g_free(staging->level_data[face][level]);
+        }
     }
+    g_free(staging);
 }
 
-static TextureBinding* generate_texture(const TextureShape s,
+static TextureBinding* generate_texture(PGRAPHState *pg,
+                                        const TextureShape s,
                                         const uint8_t *texture_data,
-                                        const uint8_t *palette_data)
+                                        const uint8_t *palette_data,
+                                        TextureStaging *staging)
 {
     ColorFormatInfo f = kelvin_color_format_map[s.color_format];
 
@@ -7543,36 +8972,9 @@ static TextureBinding* generate_texture(const TextureShape s,
     GLuint gl_texture;
     glGenTextures(1, &gl_texture);
 
-    GLenum gl_target;
-    if (s.cubemap) {
-        assert(f.linear == false);
-        assert(s.dimensionality == 2);
-        gl_target = GL_TEXTURE_CUBE_MAP;
-    } else {
-        if (f.linear) {
-            /* linear textures use unnormalised texcoords.
-             * GL_TEXTURE_RECTANGLE_ARB conveniently also does, but
-             * does not allow repeat and mirror wrap modes.
-             *  (or mipmapping, but xbox d3d says 'Non swizzled and non
-             *   compressed textures cannot be mip mapped.')
-             * Not sure if that'll be an issue. */
-
-            /* FIXME: GLSL 330 provides us with textureSize()! Use that? */
-            gl_target = GL_TEXTURE_RECTANGLE;
-            assert(s.dimensionality == 2);
-        } else {
-            switch(s.dimensionality) {
-            case 1: gl_target = GL_TEXTURE_1D; break;
-            case 2: gl_target = GL_TEXTURE_2D; break;
-            case 3: gl_target = GL_TEXTURE_3D; break;
-            default:
-                assert(false);
-                break;
-            }
-        }
-    }
+    GLenum gl_target = get_gl_texture_target(s);
 
-    glBindTexture(gl_target, gl_texture);
+    nv2a_gl_bind_texture(gl_target, gl_texture);
 
     NV2A_GL_DLABEL(GL_TEXTURE, gl_texture,
                    "offset: 0x%08lx, format: 0x%02X%s, %d dimensions%s, "
@@ -7582,52 +8984,26 @@ static TextureBinding* generate_texture(const TextureShape s,
                    s.dimensionality, s.cubemap ? " (Cubemap)" : "",
                    s.width, s.height, s.depth);
 
-    if (gl_target == GL_TEXTURE_CUBE_MAP) {
-
-        ColorFormatInfo f = kelvin_color_format_map[s.color_format];
-        unsigned int block_size;
-        if (f.gl_internal_format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) {
-            block_size = 8;
-        } else {
-            block_size = 16;
-        }
-
-        size_t length = 0;
-        unsigned int w = s.width;
-        unsigned int h = s.height;
-        if (!f.linear && s.border) {
-            w = MAX(16, w * 2);
-            h = MAX(16, h * 2);
-        }
-
-        int level;
-        for (level = 0; level < s.levels; level++) {
-            if (f.gl_format == 0) {
-                length += w/4 * h/4 * block_size;
-            } else {
-                length += w * h * f.bytes_per_pixel;
-            }
+    bool compressed_upload = staging ? staging->compressed_upload :
+                             upload_gl_texture_compressed(pg, s, &f);
 
-            w /= 2;
-            h /= 2;
+    if (gl_target == GL_TEXTURE_CUBE_MAP) {
+        size_t length = get_cubemap_face_length(s);
+        int face;
+        for (face = 0; face < 6; face++) {
+            upload_gl_texture(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, s,
+                              texture_data + face * length, palette_data,
+                              compressed_upload,
+                              staging ? staging->level_data[face] : NULL);
         }
-
-        length = (length + NV2A_CUBEMAP_FACE_ALIGNMENT - 1) & ~(NV2A_CUBEMAP_FACE_ALIGNMENT - 1);
-
-        upload_gl_texture(GL_TEXTURE_CUBE_MAP_POSITIVE_X,
-                          s, texture_data + 0 * length, palette_data);
-        upload_gl_texture(GL_TEXTURE_CUBE_MAP_NEGATIVE_X,
-                          s, texture_data + 1 * length, palette_data);
-        upload_gl_texture(GL_TEXTURE_CUBE_MAP_POSITIVE_Y,
-                          s, texture_data + 2 * length, palette_data);
-        upload_gl_texture(GL_TEXTURE_CUBE_MAP_NEGATIVE_Y,
-                          s, texture_data + 3 * length, palette_data);
-        upload_gl_texture(GL_TEXTURE_CUBE_MAP_POSITIVE_Z,
-                          s, texture_data + 4 * length, palette_data);
-        upload_gl_texture(GL_TEXTURE_CUBE_MAP_NEGATIVE_Z,
-                          s, texture_data + 5 * length, palette_data);
     } else {
-        upload_gl_texture(gl_target, s, texture_data, palette_data);
+        upload_gl_texture(gl_target, s, texture_data, palette_data,
+                          compressed_upload,
+                          staging ? staging->level_data[0] : NULL);
+    }
+
+    if (staging) {
+        texture_staging_free(staging);
     }
 
     /* Linear textures don't support mipmapping */
@@ -7665,24 +9041,87 @@ static void texture_binding_destroy(gpointer data)
     assert(binding->refcnt > 0);
     binding->refcnt--;
     if (binding->refcnt == 0) {
-        glDeleteTextures(1, &binding->gl_texture);
+        nv2a_gl_delete_textures(1, &binding->gl_texture);
         g_free(binding);
     }
 }
 
 /* functions for texture LRU cache */
+static unsigned int texture_index_link_range(PGRAPHState *pg,
+                                             TextureLruNode *tnode,
+                                             unsigned int link,
+                                             hwaddr addr, hwaddr length)
+{
+    if (length == 0) {
+        return link;
+    }
+
+    size_t first = addr >> NV2A_TEXTURE_INDEX_BUCKET_SHIFT;
+    size_t last = (addr + length - 1) >> NV2A_TEXTURE_INDEX_BUCKET_SHIFT;
+    assert(last < pg->texture_index_size);
+
+    for (size_t bucket = first; bucket <= last; bucket++) {
+        TextureIndexLink *l = &tnode->index_links[link++];
+        l->node = tnode;
+        QLIST_INSERT_HEAD(&pg->texture_index[bucket], l, entry);
+    }
+
+    return link;
+}
+
+static unsigned int texture_index_count_buckets(hwaddr addr, hwaddr length)
+{
+    if (length == 0) {
+        return 0;
+    }
+    return ((addr + length - 1) >> NV2A_TEXTURE_INDEX_BUCKET_SHIFT) -
+           (addr >> NV2A_TEXTURE_INDEX_BUCKET_SHIFT) + 1;
+}
+
+static void texture_index_insert(PGRAPHState *pg, TextureLruNode *tnode)
+{
+    const TextureKey *key = &tnode->key;
+
+    tnode->num_index_links =
+        texture_index_count_buckets(key->texture_vram_offset,
+                                    key->texture_length) +
+        texture_index_count_buckets(key->palette_vram_offset,
+                                    key->palette_length);
+    tnode->index_links = g_new(TextureIndexLink, tnode->num_index_links);
+
+    unsigned int link = 0;
+    link = texture_index_link_range(pg, tnode, link, key->texture_vram_offset,
+                                    key->texture_length);
+    link = texture_index_link_range(pg, tnode, link, key->palette_vram_offset,
+                                    key->palette_length);
+    assert(link == tnode->num_index_links);
+}
+
+static void texture_index_remove(TextureLruNode *tnode)
+{
+    for (unsigned int i = 0; i < tnode->num_index_links; i++) {
+        QLIST_REMOVE(&tnode->index_links[i], entry);
+    }
+    g_free(tnode->index_links);
+    tnode->index_links = NULL;
+    tnode->num_index_links = 0;
+}
+
 static void texture_cache_entry_init(Lru *lru, LruNode *node, void *key)
 {
+    PGRAPHState *pg = container_of(lru, PGRAPHState, texture_cache);
     TextureLruNode *tnode = container_of(node, TextureLruNode, node);
     memcpy(&tnode->key, key, sizeof(TextureKey));
 
     tnode->binding = NULL;
     tnode->possibly_dirty = false;
+    texture_index_insert(pg, tnode);
 }
 
 static void texture_cache_entry_post_evict(Lru *lru, LruNode *node)
 {
     TextureLruNode *tnode = container_of(node, TextureLruNode, node);
+    texture_index_remove(tnode);
     if (tnode->binding) {
         texture_binding_destroy(tnode->binding);
         tnode->binding = NULL;
@@ -7696,6 +9135,321 @@ static bool texture_cache_entry_compare(Lru *lru, LruNode *node, void *key)
     return memcmp(&tnode->key, key, sizeof(TextureKey));
 }
 
+/* texture prefetch workers */
+static void texture_prefetch_free(TexturePrefetch *job)
+{
+    if (job->staging) {
+        texture_staging_free(job->staging);
+    }
+    g_free(job);
+}
+
+static void texture_prefetch_cancel_locked(PGRAPHState *pg,
+                                           TexturePrefetch *job)
+{
+    switch (job->state) {
+    case TEXTURE_PREFETCH_QUEUED:
+        QSIMPLEQ_REMOVE(&pg->texture_prefetch_pool.queue, job,
+                        TexturePrefetch, entry);
+        texture_prefetch_free(job);
+        break;
+    case TEXTURE_PREFETCH_RUNNING:
+        /* The worker frees it once done */
+        job->orphaned = true;
+        break;
+    case TEXTURE_PREFETCH_DONE:
+        texture_prefetch_free(job);
+        break;
+    }
+}
+
+static void texture_prefetch_run(TexturePrefetch *job)
+{
+    /* Reads guest memory as is. A write racing with the job sets the dirty
+     * bits again, which marks the job stale by the time bind checks them. */
+    job->data_hash = fast_hash(job->texture_data, job->key.texture_length);
+    if (job->key.palette_length) {
+        job->data_hash ^= fast_hash(job->palette_data,
+                                    job->key.palette_length);
+    }
+
+    /* Unchanged since it was last uploaded, bind will reuse that */
+    if (!job->has_binding || job->binding_hash != job->data_hash) {
+        job->staging = texture_staging_prepare(job->key.state,
+                                               job->compressed_upload,
+                                               job->texture_data,
+                                               job->palette_data);
+    }
+}
+
+static void *texture_prefetch_thread(void *opaque)
+{
+    PGRAPHState *pg = opaque;
+
+    qemu_mutex_lock(&pg->texture_prefetch_pool.lock);
+    while (true) {
+        while (!pg->texture_prefetch_pool.shutdown &&
+               QSIMPLEQ_EMPTY(&pg->texture_prefetch_pool.queue)) {
+            qemu_cond_wait(&pg->texture_prefetch_pool.work_cond,
+                           &pg->texture_prefetch_pool.lock);
+        }
+        if (pg->texture_prefetch_pool.shutdown) {
+            break;
+        }
+
+        TexturePrefetch *job = QSIMPLEQ_FIRST(&pg->texture_prefetch_pool.queue);
+        QSIMPLEQ_REMOVE_HEAD(&pg->texture_prefetch_pool.queue, entry);
+        job->state = TEXTURE_PREFETCH_RUNNING;
+        qemu_mutex_unlock(&pg->texture_prefetch_pool.lock);
+
+        texture_prefetch_run(job);
+
+        qemu_mutex_lock(&pg->texture_prefetch_pool.lock);
+        job->state = TEXTURE_PREFETCH_DONE;
+        if (job->orphaned) {
+            texture_prefetch_free(job);
+        } else {
+            qemu_cond_broadcast(&pg->texture_prefetch_pool.done_cond);
+        }
+    }
+    qemu_mutex_unlock(&pg->texture_prefetch_pool.lock);
+
+    return NULL;
+}
+
+static void pgraph_init_texture_prefetch(PGRAPHState *pg)
+{
+    qemu_mutex_init(&pg->texture_prefetch_pool.lock);
+    qemu_cond_init(&pg->texture_prefetch_pool.work_cond);
+    qemu_cond_init(&pg->texture_prefetch_pool.done_cond);
+    QSIMPLEQ_INIT(&pg->texture_prefetch_pool.queue);
+    pg->texture_prefetch_pool.shutdown = false;
+
+    /* Leave room for the vCPU, PFIFO and audio threads */
+    unsigned int num_threads = MIN(4, g_get_num_processors() / 2);
+    pg->texture_prefetch_pool.num_threads = num_threads;
+    pg->texture_prefetch_pool.threads = g_new(QemuThread, num_threads);
+    for (int i = 0; i < num_threads; i++) {
+        qemu_thread_create(&pg->texture_prefetch_pool.threads[i],
+                           "nv2a.tex_prefetch", texture_prefetch_thread, pg,
+                           QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void pgraph_destroy_texture_prefetch(PGRAPHState *pg)
+{
+    qemu_mutex_lock(&pg->texture_prefetch_pool.lock);
+    pg->texture_prefetch_pool.shutdown = true;
+    qemu_cond_broadcast(&pg->texture_prefetch_pool.work_cond);
+    qemu_mutex_unlock(&pg->texture_prefetch_pool.lock);
+
+    for (int i = 0; i < pg->texture_prefetch_pool.num_threads; i++) {
+        qemu_thread_join(&pg->texture_prefetch_pool.threads[i]);
+    }
+    g_free(pg->texture_prefetch_pool.threads);
+    pg->texture_prefetch_pool.num_threads = 0;
+
+    /* Whatever is left is queued or done and owned by a stage */
+    for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+        if (pg->texture_prefetch[i]) {
+            texture_prefetch_free(pg->texture_prefetch[i]);
+            pg->texture_prefetch[i] = NULL;
+        }
+    }
+
+    qemu_cond_destroy(&pg->texture_prefetch_pool.work_cond);
+    qemu_cond_destroy(&pg->texture_prefetch_pool.done_cond);
+    qemu_mutex_destroy(&pg->texture_prefetch_pool.lock);
+}
+
+/*
+ * Hash and convert the texture of a stage in the background as soon as its
+ * registers are written, so that pgraph_bind_textures only has to wait for
+ * it. Returns without queueing anything when the state is incomplete or bind
+ * would not look at the texture data.
+ */
+static void pgraph_prefetch_texture(NV2AState *d, int stage)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    if (pg->texture_prefetch_pool.num_threads == 0) {
+        return;
+    }
+
+    uint32_t ctl_0 = pg->regs[NV_PGRAPH_TEXCTL0_0 + stage*4];
+    TextureStage ts;
+    if (!GET_MASK(ctl_0, NV_PGRAPH_TEXCTL0_0_ENABLE) ||
+        !pgraph_get_texture_stage(d, stage, false, &ts)) {
+        return;
+    }
+
+    /* The same texture is often written again with each of its methods */
+    TexturePrefetch *job = pg->texture_prefetch[stage];
+    if (job && !job->stale && !memcmp(&job->key, &ts.key, sizeof(TextureKey))) {
+        return;
+    }
+    if (job) {
+        qemu_mutex_lock(&pg->texture_prefetch_pool.lock);
+        texture_prefetch_cancel_locked(pg, job);
+        qemu_mutex_unlock(&pg->texture_prefetch_pool.lock);
+        pg->texture_prefetch[stage] = NULL;
+    }
+
+    /* Volume textures are left for bind */
+    const TextureShape *s = &ts.key.state;
+    if (s->dimensionality != 2 || ts.key.texture_length == 0 ||
+        (ts.f.linear && (s->pitch % ts.f.bytes_per_pixel) != 0)) {
+        return;
+    }
+
+    /* Bind writes back any surface in the way before hashing, and render
+     * targets are copied on the GPU. */
+    if (pgraph_surface_find_overlapping(d, ts.key.texture_vram_offset,
+                                        ts.key.texture_length) ||
+        (ts.key.palette_length &&
+         pgraph_surface_find_overlapping(d, ts.palette_vram_offset,
+                                         ts.key.palette_length))) {
+        return;
+    }
+
+    /*
+     * Take the dirty state before the worker reads the data, so that bind
+     * sees exactly the writes the job may have missed. Textures overlapping
+     * the range are marked possibly dirty as bind would have, and stages
+     * bound to one must look it up again instead of trusting the bits.
+     */
+    bool dirty = pgraph_check_texture_possibly_dirty(d,
+                                                     ts.key.texture_vram_offset,
+                                                     ts.key.texture_length,
+                                                     ts.palette_vram_offset,
+                                                     ts.key.palette_length);
+    if (dirty) {
+        for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+            pg->texture_dirty[i] = true;
+        }
+    }
+
+    uint64_t tex_binding_hash = fast_hash((uint8_t*)&ts.key,
+                                          sizeof(ts.key));
+    LruNode *found = lru_find(&pg->texture_cache, tex_binding_hash, &ts.key);
+    TextureBinding *binding = NULL;
+    if (found) {
+        TextureLruNode *tnode = container_of(found, TextureLruNode, node);
+        binding = tnode->binding;
+        dirty |= tnode->possibly_dirty;
+    }
+    if (binding && !dirty) {
+        return;
+    }
+
+    job = g_malloc0(sizeof(TexturePrefetch));
+    job->state = TEXTURE_PREFETCH_QUEUED;
+    memcpy(&job->key, &ts.key, sizeof(TextureKey));
+    job->compressed_upload = upload_gl_texture_compressed(pg, *s, &ts.f);
+    job->texture_data = ts.texture_data;
+    job->palette_data = ts.palette_data;
+    if (binding) {
+        job->has_binding = true;
+        job->binding_hash = binding->data_hash;
+    }
+
+    qemu_mutex_lock(&pg->texture_prefetch_pool.lock);
+    pg->texture_prefetch[stage] = job;
+    QSIMPLEQ_INSERT_TAIL(&pg->texture_prefetch_pool.queue, job, entry);
+    qemu_cond_signal(&pg->texture_prefetch_pool.work_cond);
+    qemu_mutex_unlock(&pg->texture_prefetch_pool.lock);
+
+    nv2a_profile_inc_counter(NV2A_PROF_TEX_PREFETCH);
+}
+
+static void pgraph_cancel_texture_prefetches(PGRAPHState *pg)
+{
+    qemu_mutex_lock(&pg->texture_prefetch_pool.lock);
+    for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+        if (pg->texture_prefetch[i]) {
+            texture_prefetch_cancel_locked(pg, pg->texture_prefetch[i]);
+            pg->texture_prefetch[i] = NULL;
+        }
+    }
+    qemu_mutex_unlock(&pg->texture_prefetch_pool.lock);
+}
+
+/*
+ * Called whenever the texture dirty bits of a range are cleared. A job reading
+ * from the range may have copied the data before the write that set them, and
+ * once cleared bind could no longer tell.
+ */
+static void pgraph_invalidate_texture_prefetches(PGRAPHState *pg,
+                                                 hwaddr addr, hwaddr size)
+{
+    hwaddr end = addr + size - 1;
+
+    for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+        TexturePrefetch *job = pg->texture_prefetch[i];
+        if (job == NULL) {
+            continue;
+        }
+
+        hwaddr tex_addr = job->key.texture_vram_offset;
+        hwaddr tex_end = tex_addr + job->key.texture_length - 1;
+        bool overlapping = !(addr > tex_end || tex_addr > end);
+        if (job->key.palette_length > 0) {
+            hwaddr pal_addr = job->key.palette_vram_offset;
+            hwaddr pal_end = pal_addr + job->key.palette_length - 1;
+            overlapping |= !(addr > pal_end || pal_addr > end);
+        }
+        job->stale |= overlapping;
+    }
+}
+
+/*
+ * Hand over the hash of a stage's texture data and, if its binding has to
+ * be recreated, the prefetched texels. Waits for a job that is already
+ * running and runs one that has not started yet on the calling thread.
+ * Returns false if there is no usable job for this texture.
+ */
+static bool pgraph_take_texture_prefetch(PGRAPHState *pg, int stage,
+                                         const TextureKey *key,
+                                         uint64_t *data_hash,
+                                         TextureStaging **staging)
+{
+    TexturePrefetch *job = pg->texture_prefetch[stage];
+    if (job == NULL) {
+        return false;
+    }
+    pg->texture_prefetch[stage] = NULL;
+
+    bool taken = false;
+
+    qemu_mutex_lock(&pg->texture_prefetch_pool.lock);
+    if (!job->stale && !memcmp(&job->key, key, sizeof(TextureKey))) {
+        if (job->state == TEXTURE_PREFETCH_QUEUED) {
+            QSIMPLEQ_REMOVE(&pg->texture_prefetch_pool.queue, job,
+                            TexturePrefetch, entry);
+            job->state = TEXTURE_PREFETCH_RUNNING;
+            qemu_mutex_unlock(&pg->texture_prefetch_pool.lock);
+            texture_prefetch_run(job);
+            qemu_mutex_lock(&pg->texture_prefetch_pool.lock);
+            job->state = TEXTURE_PREFETCH_DONE;
+        } else if (job->state == TEXTURE_PREFETCH_RUNNING) {
+            nv2a_profile_inc_counter(NV2A_PROF_TEX_PREFETCH_WAIT);
+            while (job->state != TEXTURE_PREFETCH_DONE) {
+                qemu_cond_wait(&pg->texture_prefetch_pool.done_cond,
+                               &pg->texture_prefetch_pool.lock);
+            }
+        }
+        nv2a_profile_inc_counter(NV2A_PROF_TEX_PREFETCH_HIT);
+        *data_hash = job->data_hash;
+        *staging = job->staging;
+        job->staging = NULL;
+        taken = true;
+    }
+    texture_prefetch_cancel_locked(pg, job);
+    qemu_mutex_unlock(&pg->texture_prefetch_pool.lock);
+
+    return taken;
+}
+
 static unsigned int kelvin_map_stencil_op(uint32_t parameter)
 {
     unsigned int op;
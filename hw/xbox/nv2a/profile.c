@@ -0,0 +1,261 @@
+/*
+ * QEMU Geforce NV2A PGRAPH timing profiler
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nv2a_int.h"
+
+#include "qemu/timer.h"
+#include "monitor/hmp.h"
+#include "monitor/monitor.h"
+#include "qapi/qapi-commands-machine.h"
+#include "qapi/qmp/qdict.h"
+#include "qapi/type-helpers.h"
+
+NV2AProfile g_nv2a_profile;
+
+/*
+ * Working totals for the frame in progress, in host cycle counter ticks.
+ * Scopes are only entered on the puller thread so none of this is locked.
+ */
+static struct {
+    /* Node for each scope entered from a node (or the top, at index 0) + 1 */
+    uint8_t child[NV2A_PROF_MAX_NODES + 1][NV2A_PROF_SCOPE__COUNT];
+    int scope[NV2A_PROF_MAX_NODES];
+    int parent[NV2A_PROF_MAX_NODES];
+    unsigned int num_nodes;
+
+    unsigned int calls[NV2A_PROF_MAX_NODES];
+    int64_t ticks[NV2A_PROF_MAX_NODES];
+    struct {
+        unsigned int calls;
+        int64_t ticks;
+    } methods[NV2A_PROF_NUM_METHODS];
+
+    int stack[NV2A_PROF_MAX_DEPTH];
+    int64_t start[NV2A_PROF_MAX_DEPTH];
+    unsigned int depth;
+
+    bool dirty;
+    int64_t frame_start_ticks;
+    int64_t frame_start_ns;
+} prof;
+
+const char *nv2a_profile_get_scope_name(unsigned int scope)
+{
+    static const char *names[NV2A_PROF_SCOPE__COUNT] = {
+        #define _X(x) stringify(x),
+        NV2A_PROF_SCOPES_XMAC
+        #undef _X
+    };
+
+    assert(scope < NV2A_PROF_SCOPE__COUNT);
+    return names[scope] + 16; /* 'NV2A_PROF_SCOPE_' */
+}
+
+int64_t nv2a_profile_push(int scope)
+{
+    int parent = prof.depth ? prof.stack[prof.depth - 1] : -1;
+    int node = prof.child[parent + 1][scope] - 1;
+
+    if (node < 0) {
+        if (prof.num_nodes == NV2A_PROF_MAX_NODES) {
+            /* Untracked, time is left with the enclosing scope */
+            return 0;
+        }
+        node = prof.num_nodes++;
+        prof.scope[node] = scope;
+        prof.parent[node] = parent;
+        prof.child[parent + 1][scope] = node + 1;
+    }
+
+    if (prof.depth == NV2A_PROF_MAX_DEPTH) {
+        return 0;
+    }
+    /* Zero means not timed, the counter is never there in practice */
+    int64_t start = MAX(cpu_get_host_ticks(), 1);
+    prof.start[prof.depth] = start;
+    prof.stack[prof.depth++] = node;
+    prof.dirty = true;
+
+    return start;
+}
+
+/* Frame end charges a scope's time so far to the frame it started in */
+static int64_t nv2a_profile_scope_ticks(int64_t start, int64_t now)
+{
+    return now - MAX(start, prof.frame_start_ticks);
+}
+
+void nv2a_profile_pop(int64_t start)
+{
+    int64_t ticks = nv2a_profile_scope_ticks(start, cpu_get_host_ticks());
+
+    assert(prof.depth > 0);
+    int node = prof.stack[--prof.depth];
+    prof.calls[node]++;
+    prof.ticks[node] += ticks;
+}
+
+void nv2a_profile_pop_method(int64_t start, unsigned int idx)
+{
+    int64_t ticks = nv2a_profile_scope_ticks(start, cpu_get_host_ticks());
+
+    assert(prof.depth > 0 && idx < NV2A_PROF_NUM_METHODS);
+    int node = prof.stack[--prof.depth];
+    prof.calls[node]++;
+    prof.ticks[node] += ticks;
+    prof.methods[idx].calls++;
+    prof.methods[idx].ticks += ticks;
+}
+
+static void nv2a_profile_reset_working(void)
+{
+    memset(prof.calls, 0, sizeof(prof.calls));
+    memset(prof.ticks, 0, sizeof(prof.ticks));
+    memset(prof.methods, 0, sizeof(prof.methods));
+    prof.dirty = false;
+}
+
+/* Called on the puller thread at every flip */
+void nv2a_profile_frame_end(void)
+{
+    int64_t now_ticks = cpu_get_host_ticks();
+    int64_t now_ns = get_clock();
+    int64_t frame_ticks = now_ticks - prof.frame_start_ticks;
+    int64_t frame_ns = now_ns - prof.frame_start_ns;
+
+    /*
+     * Flips happen inside method handlers, so scopes are still open. Split
+     * them here, so neither frame gets the other's share when they close.
+     */
+    for (int i = 0; i < prof.depth; i++) {
+        prof.ticks[prof.stack[i]] +=
+            nv2a_profile_scope_ticks(prof.start[i], now_ticks);
+    }
+
+    prof.frame_start_ticks = now_ticks;
+    prof.frame_start_ns = now_ns;
+
+    if (!qatomic_read(&g_nv2a_profile.enabled) || frame_ticks <= 0) {
+        if (prof.dirty) {
+            nv2a_profile_reset_working();
+        }
+        return;
+    }
+
+    /* The counter rate isn't known up front, so calibrate it every frame */
+    double ns_per_tick = (double)frame_ns / frame_ticks;
+
+    /*
+     * Readers may still be looking at the frame published before last, in
+     * which case they see a mix of two frames. That's fine for display.
+     */
+    unsigned int next = !g_nv2a_profile.last;
+    NV2AProfileFrame *f = &g_nv2a_profile.frames[next];
+
+    f->frame_ns = frame_ns;
+    f->num_nodes = prof.num_nodes;
+    for (int i = 0; i < prof.num_nodes; i++) {
+        f->nodes[i].scope = prof.scope[i];
+        f->nodes[i].parent = prof.parent[i];
+        f->nodes[i].calls = prof.calls[i];
+        f->nodes[i].time_ns = prof.ticks[i] * ns_per_tick;
+    }
+    for (int i = 0; i < NV2A_PROF_NUM_METHODS; i++) {
+        f->methods[i].calls = prof.methods[i].calls;
+        f->methods[i].time_ns = prof.methods[i].ticks * ns_per_tick;
+    }
+    qatomic_store_release(&g_nv2a_profile.last, next);
+
+    nv2a_profile_reset_working();
+}
+
+char *nv2a_profile_to_json(void)
+{
+    unsigned int last = qatomic_load_acquire(&g_nv2a_profile.last);
+    const NV2AProfileFrame *f = &g_nv2a_profile.frames[last];
+    GString *json = g_string_new(NULL);
+
+    g_string_append_printf(json, "{\"enabled\": true, \"frame_us\": %.1f, "
+                           "\"scopes\": [", f->frame_ns / 1000.0);
+    for (int i = 0; i < f->num_nodes; i++) {
+        const NV2AProfileNode *n = &f->nodes[i];
+        g_string_append_printf(json, "%s{\"id\": %d, \"parent\": %d, "
+                               "\"name\": \"%s\", \"calls\": %u, "
+                               "\"time_us\": %.1f}",
+                               i ? ", " : "", i, n->parent,
+                               nv2a_profile_get_scope_name(n->scope),
+                               n->calls, n->time_ns / 1000.0);
+    }
+
+    g_string_append(json, "], \"methods\": [");
+    bool first = true;
+    for (int i = 0; i < NV2A_PROF_NUM_METHODS; i++) {
+        if (!f->methods[i].calls) {
+            continue;
+        }
+        g_string_append_printf(json, "%s{\"name\": \"%s\", \"calls\": %u, "
+                               "\"time_us\": %.1f}",
+                               first ? "" : ", ",
+                               nv2a_profile_get_method_name(i),
+                               f->methods[i].calls,
+                               f->methods[i].time_ns / 1000.0);
+        first = false;
+    }
+
+    g_string_append(json, "], \"counters\": {");
+    for (int i = 0; i < NV2A_PROF__COUNT; i++) {
+        g_string_append_printf(json, "%s\"%s\": %d", i ? ", " : "",
+                               nv2a_profile_get_counter_name(i),
+                               nv2a_profile_get_counter_value(i));
+    }
+    g_string_append(json, "}}");
+
+    return g_string_free(json, false);
+}
+
+HumanReadableText *qmp_x_query_nv2a_profile(Error **errp)
+{
+    g_autoptr(GString) buf = g_string_new("");
+
+    if (!qatomic_read(&g_nv2a_profile.enabled)) {
+        g_string_append(buf, "{\"enabled\": false}\n");
+        return human_readable_text_from_str(buf);
+    }
+
+    g_autofree char *json = nv2a_profile_to_json();
+    g_string_append_printf(buf, "%s\n", json);
+
+    return human_readable_text_from_str(buf);
+}
+
+void qmp_x_nv2a_profile_set_state(bool enable, Error **errp)
+{
+    if (enable && !g_nv2a_context_render) {
+        error_setg(errp, "NV2A not initialized");
+        return;
+    }
+
+    qatomic_set(&g_nv2a_profile.enabled, enable);
+}
+
+void hmp_nv2a_profile(Monitor *mon, const QDict *qdict)
+{
+    Error *err = NULL;
+
+    qmp_x_nv2a_profile_set_state(qdict_get_bool(qdict, "enable"), &err);
+    hmp_handle_error(mon, err);
+}
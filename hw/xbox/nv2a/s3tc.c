@@ -23,126 +23,124 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/bswap.h"
 #include "s3tc.h"
 
+/* Texels are written as 32-bit words holding R, G, B and A from the most to
+ * the least significant byte, to be uploaded as GL_UNSIGNED_INT_8_8_8_8.
+ */
+static inline uint32_t pack_rgba(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+{
+    return (r << 24) | (g << 16) | (b << 8) | a;
+}
+
 static inline void decode_bc1_colors(uint16_t c0,
                                      uint16_t c1,
-                                     uint8_t r[4],
-                                     uint8_t g[4],
-                                     uint8_t b[4],
-                                     uint8_t a[16],
+                                     uint32_t palette[4],
                                      bool transparent)
 {
-    r[0] = ((c0 & 0xF800) >> 8) * 0xFF / 0xF8,
-    g[0] = ((c0 & 0x07E0) >> 3) * 0xFF / 0xFC,
-    b[0] = ((c0 & 0x001F) << 3) * 0xFF / 0xF8,
-    a[0] = 255;
+    uint8_t r0 = ((c0 & 0xF800) >> 8) * 0xFF / 0xF8,
+            g0 = ((c0 & 0x07E0) >> 3) * 0xFF / 0xFC,
+            b0 = ((c0 & 0x001F) << 3) * 0xFF / 0xF8;
+
+    uint8_t r1 = ((c1 & 0xF800) >> 8) * 0xFF / 0xF8,
+            g1 = ((c1 & 0x07E0) >> 3) * 0xFF / 0xFC,
+            b1 = ((c1 & 0x001F) << 3) * 0xFF / 0xF8;
 
-    r[1] = ((c1 & 0xF800) >> 8) * 0xFF / 0xF8,
-    g[1] = ((c1 & 0x07E0) >> 3) * 0xFF / 0xFC,
-    b[1] = ((c1 & 0x001F) << 3) * 0xFF / 0xF8,
-    a[1] = 255;
+    palette[0] = pack_rgba(r0, g0, b0, 255);
+    palette[1] = pack_rgba(r1, g1, b1, 255);
 
     if (transparent) {
-        r[2] = (r[0]+r[1])/2;
-        g[2] = (g[0]+g[1])/2;
-        b[2] = (b[0]+b[1])/2;
-        a[2] = 255;
-
-        r[3] = 0;
-        g[3] = 0;
-        b[3] = 0;
-        a[3] = 0;
+        palette[2] = pack_rgba((r0 + r1) / 2, (g0 + g1) / 2, (b0 + b1) / 2,
+                               255);
+        palette[3] = 0;
     } else {
-        r[2] = (2*r[0]+r[1])/3;
-        g[2] = (2*g[0]+g[1])/3,
-        b[2] = (2*b[0]+b[1])/3;
-        a[2] = 255;
-
-        r[3] = (r[0]+2*r[1])/3;
-        g[3] = (g[0]+2*g[1])/3;
-        b[3] = (b[0]+2*b[1])/3;
-        a[3] = 255;
+        palette[2] = pack_rgba((2 * r0 + r1) / 3, (2 * g0 + g1) / 3,
+                               (2 * b0 + b1) / 3, 255);
+        palette[3] = pack_rgba((r0 + 2 * r1) / 3, (g0 + 2 * g1) / 3,
+                               (b0 + 2 * b1) / 3, 255);
     }
 }
 
-static inline void write_block_to_texture(uint8_t *converted_data,
+/* Writes one 4x4 block, a row of four texels at a time. */
+static inline void write_block_to_texture(uint32_t *out,
+                                          unsigned int row_stride,
                                           uint32_t indices,
-                                          int i, int j, int width,
-                                          int z_pos_factor,
-                                          uint8_t r[4],
-                                          uint8_t g[4],
-                                          uint8_t b[4],
-                                          uint8_t a[16],
-                                          bool separate_alpha)
+                                          const uint32_t palette[4])
+{
+    for (int y = 0; y < 4; y++, out += row_stride, indices >>= 8) {
+        out[0] = palette[indices & 0x03];
+        out[1] = palette[(indices >> 2) & 0x03];
+        out[2] = palette[(indices >> 4) & 0x03];
+        out[3] = palette[(indices >> 6) & 0x03];
+    }
+}
+
+/* Same as above, with the alpha of every texel taken from its own `bits`
+ * wide index into `alpha_palette` rather than from the color palette.
+ */
+static inline void write_block_to_texture_alpha(uint32_t *out,
+                                                unsigned int row_stride,
+                                                uint32_t indices,
+                                                const uint32_t palette[4],
+                                                uint64_t alpha_indices,
+                                                unsigned int bits,
+                                                const uint8_t *alpha_palette)
 {
-    int x0 = i * 4,
-        y0 = j * 4;
-
-    int x1 = x0 + 4,
-        y1 = y0 + 4;
-
-    for (int y = y0; y < y1; y++) {
-        int y_index = 4 * (y - y0);
-        int z_plus_y_pos_factor = z_pos_factor + y * width;
-        for (int x = x0; x < x1; x++) {
-            int xy_index = y_index + x - x0;
-            uint8_t index = (indices >> 2 * xy_index) & 0x03;
-            uint8_t alpha_index = separate_alpha ? xy_index : index;
-            uint32_t color = (r[index] << 24) | (g[index] << 16) | (b[index] << 8) | a[alpha_index];
-            *(uint32_t*)(converted_data + (z_plus_y_pos_factor + x) * 4) = color;
+    const uint64_t alpha_mask = (1 << bits) - 1;
+
+    for (int y = 0; y < 4; y++, out += row_stride) {
+        for (int x = 0; x < 4; x++) {
+            out[x] = (palette[indices & 0x03] & 0xFFFFFF00) |
+                     alpha_palette[alpha_indices & alpha_mask];
+            indices >>= 2;
+            alpha_indices >>= bits;
         }
     }
 }
 
 static inline void decompress_dxt1_block(const uint8_t block_data[8],
-                                         uint8_t *converted_data,
-                                         int i, int j, int width,
-                                         int z_pos_factor)
+                                         uint32_t *out,
+                                         unsigned int row_stride)
 {
-    uint16_t c0 = ((uint16_t*)block_data)[0],
-             c1 = ((uint16_t*)block_data)[1];
-    uint8_t r[4], g[4], b[4], a[16];
-    decode_bc1_colors(c0, c1, r, g, b, a, c0 <= c1);
-
-    uint32_t indices = ((uint32_t*)block_data)[1];
-    write_block_to_texture(converted_data, indices,
-                           i, j, width, z_pos_factor,
-                           r, g, b, a, false);
+    uint16_t c0 = lduw_le_p(block_data),
+             c1 = lduw_le_p(block_data + 2);
+    uint32_t palette[4];
+    decode_bc1_colors(c0, c1, palette, c0 <= c1);
+
+    write_block_to_texture(out, row_stride, ldl_le_p(block_data + 4),
+                           palette);
 }
 
 static inline void decompress_dxt3_block(const uint8_t block_data[16],
-                                         uint8_t *converted_data,
-                                         int i, int j, int width,
-                                         int z_pos_factor)
+                                         uint32_t *out,
+                                         unsigned int row_stride)
 {
-    uint16_t c0 = ((uint16_t*)block_data)[4],
-             c1 = ((uint16_t*)block_data)[5];
-    uint8_t r[4], g[4], b[4], a[16];
-    decode_bc1_colors(c0, c1, r, g, b, a, false);
-
-    uint64_t alpha = ((uint64_t*)block_data)[0];
-    for (int a_i=0; a_i < 16; a_i++) {
-        a[a_i] = (((alpha >> 4*a_i) & 0x0F) << 4) * 0xFF / 0xF0;
-    }
-
-    uint32_t indices = ((uint32_t*)block_data)[3];
-    write_block_to_texture(converted_data, indices,
-                           i, j, width, z_pos_factor,
-                           r, g, b, a, true);
+    /* 4-bit alpha, expanded by bit replication */
+    static const uint8_t a_palette[16] = {
+        0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+        0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF,
+    };
+
+    uint16_t c0 = lduw_le_p(block_data + 8),
+             c1 = lduw_le_p(block_data + 10);
+    uint32_t palette[4];
+    decode_bc1_colors(c0, c1, palette, false);
+
+    write_block_to_texture_alpha(out, row_stride, ldl_le_p(block_data + 12),
+                                 palette, ldq_le_p(block_data), 4,
+                                 a_palette);
 }
 
 static inline void decompress_dxt5_block(const uint8_t block_data[16],
-                                         uint8_t *converted_data,
-                                         int i, int j, int width,
-                                         int z_pos_factor)
+                                         uint32_t *out,
+                                         unsigned int row_stride)
 {
-    uint16_t c0 = ((uint16_t*)block_data)[4],
-             c1 = ((uint16_t*)block_data)[5];
-    uint8_t r[4], g[4], b[4], a[16];
-    decode_bc1_colors(c0, c1, r, g, b, a, false);
+    uint16_t c0 = lduw_le_p(block_data + 8),
+             c1 = lduw_le_p(block_data + 10);
+    uint32_t palette[4];
+    decode_bc1_colors(c0, c1, palette, false);
 
-    uint64_t alpha = ((uint64_t*)block_data)[0];
     uint8_t a0 = block_data[0];
     uint8_t a1 = block_data[1];
     uint8_t a_palette[8];
@@ -163,14 +161,32 @@ static inline void decompress_dxt5_block(const uint8_t block_data[16],
         a_palette[6] = 0;
         a_palette[7] = 255;
     }
-    for (int a_i = 0; a_i < 16; a_i++) {
-        a[a_i] = a_palette[(alpha >> (16+3*a_i)) & 0x07];
-    }
 
-    uint32_t indices = ((uint32_t*)block_data)[3];
-    write_block_to_texture(converted_data, indices,
-                           i, j, width, z_pos_factor,
-                           r, g, b, a, true);
+    write_block_to_texture_alpha(out, row_stride, ldl_le_p(block_data + 12),
+                                 palette, ldq_le_p(block_data) >> 16, 3,
+                                 a_palette);
+}
+
+static inline void decompress_block(GLint color_format,
+                                    const uint8_t *data,
+                                    unsigned int block_index,
+                                    uint32_t *out,
+                                    unsigned int row_stride)
+{
+    switch (color_format) {
+    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+        decompress_dxt1_block(data + 8 * block_index, out, row_stride);
+        break;
+    case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+        decompress_dxt3_block(data + 16 * block_index, out, row_stride);
+        break;
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        decompress_dxt5_block(data + 16 * block_index, out, row_stride);
+        break;
+    default:
+        assert(false);
+        break;
+    }
 }
 
 uint8_t *decompress_3d_texture_data(GLint color_format,
@@ -186,7 +202,7 @@ uint8_t *decompress_3d_texture_data(GLint color_format,
     int num_blocks_x = width/4,
         num_blocks_y = height/4,
         num_blocks_z = depth/block_depth;
-    uint8_t *converted_data = (uint8_t*)g_malloc(width * height * depth * 4);
+    uint32_t *converted_data = g_malloc(width * height * depth * 4);
     for (int k = 0; k < num_blocks_z; k++) {
         for (int j = 0; j < num_blocks_y; j++) {
             for (int i = 0; i < num_blocks_x; i++) {
@@ -194,26 +210,17 @@ uint8_t *decompress_3d_texture_data(GLint color_format,
 
                     int block_index = k * num_blocks_y * num_blocks_x + j * num_blocks_x + i;
                     int sub_block_index = block_index * block_depth + slice;
-                    int z_pos_factor = (k * block_depth + slice) * width * height;
-
-                    if (color_format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) {
-                        decompress_dxt1_block(data + 8 * sub_block_index, converted_data,
-                                              i, j, width, z_pos_factor);
-                    } else if (color_format == GL_COMPRESSED_RGBA_S3TC_DXT3_EXT) {
-                        decompress_dxt3_block(data + 16 * sub_block_index, converted_data,
-                                              i, j, width, z_pos_factor);
-                    } else if (color_format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT) {
-                        decompress_dxt5_block(data + 16 * sub_block_index, converted_data,
-                                              i, j, width, z_pos_factor);
-                    } else {
-                        assert(false);
-                    }
+                    int z = k * block_depth + slice;
+                    uint32_t *out = converted_data + z * width * height +
+                                    j * 4 * width + i * 4;
 
+                    decompress_block(color_format, data, sub_block_index,
+                                     out, width);
                 }
             }
         }
     }
-    return converted_data;
+    return (uint8_t *)converted_data;
 }
 
 uint8_t *decompress_2d_texture_data(GLint color_format, const uint8_t *data,
@@ -222,23 +229,13 @@ uint8_t *decompress_2d_texture_data(GLint color_format, const uint8_t *data,
     assert((width > 0) && (width % 4 == 0));
     assert((height > 0) && (height % 4 == 0));
     int num_blocks_x = width / 4, num_blocks_y = height / 4;
-    uint8_t *converted_data = (uint8_t *)g_malloc(width * height * 4);
+    uint32_t *converted_data = g_malloc(width * height * 4);
     for (int j = 0; j < num_blocks_y; j++) {
-        for (int i = 0; i < num_blocks_x; i++) {
-            int block_index = j * num_blocks_x + i;
-            if (color_format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) {
-                decompress_dxt1_block(data + 8 * block_index,
-                                      converted_data, i, j, width, 0);
-            } else if (color_format == GL_COMPRESSED_RGBA_S3TC_DXT3_EXT) {
-                decompress_dxt3_block(data + 16 * block_index,
-                                      converted_data, i, j, width, 0);
-            } else if (color_format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT) {
-                decompress_dxt5_block(data + 16 * block_index,
-                                      converted_data, i, j, width, 0);
-            } else {
-                assert(false);
-            }
+        uint32_t *out = converted_data + j * 4 * width;
+        for (int i = 0; i < num_blocks_x; i++, out += 4) {
+            decompress_block(color_format, data, j * num_blocks_x + i,
+                             out, width);
         }
     }
-    return converted_data;
+    return (uint8_t *)converted_data;
 }
@@ -20,13 +20,15 @@
  */
 
 #include "qemu/osdep.h"
-#include <locale.h>
 
 #include "shaders_common.h"
 #include "shaders.h"
 #include "nv2a_int.h"
 #include "ui/xemu-settings.h"
 #include "xemu-version.h"
+#include "qemu/crc32c.h"
+#include "qemu/cutils.h"
+#include "qemu/timer.h"
 
 void mstring_append_fmt(MString *qstring, const char *fmt, ...)
 {
@@ -761,14 +763,18 @@ GLSL_DEFINE(materialEmissionColor, GLSL_LTCTXA(NV_IGRAPH_XF_LTCTXA_CM_COL) ".xyz
         mstring_append_fmt(
             body,
             "  float d_e = length(position * modelViewMat0);\n"
-            "  oPts.x = 1/sqrt(%f + %f*d_e + %f*d_e*d_e) + %f;\n",
-            state->point_params[0], state->point_params[1], state->point_params[2],
-            state->point_params[6]);
-        mstring_append_fmt(body, "  oPts.x = min(oPts.x*%f + %f, 64.0) * %d;\n",
-                           state->point_params[3], state->point_params[7],
+            "  oPts.x = 1/sqrt(%s + %s*d_e + %s*d_e*d_e) + %s;\n",
+            GLSL_FLOAT(state->point_params[0]),
+            GLSL_FLOAT(state->point_params[1]),
+            GLSL_FLOAT(state->point_params[2]),
+            GLSL_FLOAT(state->point_params[6]));
+        mstring_append_fmt(body, "  oPts.x = min(oPts.x*%s + %s, 64.0) * %d;\n",
+                           GLSL_FLOAT(state->point_params[3]),
+                           GLSL_FLOAT(state->point_params[7]),
                            state->surface_scale_factor);
     } else {
-        mstring_append_fmt(body, "  oPts.x = %f * %d;\n", state->point_size,
+        mstring_append_fmt(body, "  oPts.x = %s * %d;\n",
+                           GLSL_FLOAT(state->point_size),
                            state->surface_scale_factor);
     }
 
@@ -1129,13 +1135,6 @@ void update_shader_constant_locations(ShaderBinding *binding, const ShaderState
 
 ShaderBinding *generate_shaders(const ShaderState *state)
 {
-    char *previous_numeric_locale = setlocale(LC_NUMERIC, NULL);
-    if (previous_numeric_locale) {
-        previous_numeric_locale = g_strdup(previous_numeric_locale);
-    }
-
-    /* Ensure numeric values are printed with '.' radix, no grouping */
-    setlocale(LC_NUMERIC, "C");
     GLuint program = glCreateProgram();
 
     /* Create an optional geometry shader and find primitive type */
@@ -1194,21 +1193,444 @@ ShaderBinding *generate_shaders(const ShaderState *state)
 
     update_shader_constant_locations(ret, state);
 
-    if (previous_numeric_locale) {
-        setlocale(LC_NUMERIC, previous_numeric_locale);
-        g_free(previous_numeric_locale);
-    }
-
     return ret;
 }
 
 static const char *shader_gl_vendor = NULL;
+static const char *shader_gl_renderer = NULL;
+
+/* Upper bound on program binaries waiting to be written to disk */
+#define SHADER_WRITER_MAX_PENDING 1024
 
-static void shader_create_cache_folder(void)
+static void *shader_writer_thread(void *opaque);
+static void *shader_compiler_thread(void *opaque);
+static void shader_compile_cancel(PGRAPHState *pg, ShaderLruNode *snode);
+
+/*
+ * Shader archive
+ *
+ * Program binaries are kept in a single file next to the reload list:
+ *
+ *   ShaderArchiveHeader
+ *   ShaderArchiveRecord, ShaderState, program binary  (8 byte aligned)
+ *   ...
+ *   ShaderArchiveIndexEntry[num_entries]              (sorted by hash)
+ *   ShaderArchiveRecord, ...                          (journal)
+ *
+ * The file is mapped read-only at startup and entries are looked up through
+ * the sorted index, so program binaries are only paged in when a shader is
+ * actually bound. Binaries generated while running are appended after the
+ * index, and folded back into the sorted part the next time the archive is
+ * opened. A record that fails its checksum is dropped at that point.
+ *
+ * scripts/xemu-shader-cache.py can inspect, verify and prune archives.
+ */
+
+#define SHADER_ARCHIVE_MAGIC "XSHADERS"
+#define SHADER_ARCHIVE_VERSION 2
+#define SHADER_ARCHIVE_RECORD_MAGIC 0x43455253 /* "SREC" */
+
+typedef struct ShaderArchiveHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t state_size;
+    char xemu_version[64];
+    char gl_vendor[128];
+    char gl_renderer[128];
+    uint32_t binary_format;
+    uint32_t num_entries;
+    uint64_t index_offset;
+    uint64_t journal_offset;
+    uint32_t index_crc;
+    uint32_t header_crc;
+} ShaderArchiveHeader;
+
+typedef struct ShaderArchiveIndexEntry {
+    uint64_t hash;
+    uint64_t offset;
+} ShaderArchiveIndexEntry;
+
+typedef struct ShaderArchiveRecord {
+    uint32_t magic;
+    uint32_t program_format;
+    uint64_t hash;
+    uint64_t program_size;
+    uint32_t state_crc;
+    uint32_t program_crc;
+} ShaderArchiveRecord;
+
+QEMU_BUILD_BUG_ON(sizeof(ShaderArchiveHeader) != 368);
+QEMU_BUILD_BUG_ON(sizeof(ShaderArchiveIndexEntry) != 16);
+QEMU_BUILD_BUG_ON(sizeof(ShaderArchiveRecord) != 32);
+
+struct ShaderArchive {
+    char *path;
+    ShaderArchiveHeader header;
+    GMappedFile *map;
+    const uint8_t *data;
+    size_t size;
+    const ShaderArchiveIndexEntry *index;
+    uint32_t num_entries;
+    uint64_t journal_offset;
+    QemuEvent ready;
+};
+
+static uint32_t shader_archive_crc(const void *data, size_t len)
 {
-    char *shader_path = g_strdup_printf("%sshaders", xemu_settings_get_base_path());
-    qemu_mkdir(shader_path);
-    g_free(shader_path);
+    return crc32c(0xffffffff, data, len);
+}
+
+static size_t shader_archive_record_size(uint64_t program_size)
+{
+    return ROUND_UP(sizeof(ShaderArchiveRecord) + sizeof(ShaderState) +
+                    program_size, 8);
+}
+
+static uint32_t shader_archive_header_crc(const ShaderArchiveHeader *header)
+{
+    ShaderArchiveHeader tmp = *header;
+    tmp.header_crc = 0;
+    return shader_archive_crc(&tmp, sizeof(tmp));
+}
+
+static void shader_archive_init_header(ShaderArchive *archive)
+{
+    ShaderArchiveHeader *h = &archive->header;
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, SHADER_ARCHIVE_MAGIC, sizeof(h->magic));
+    h->version = SHADER_ARCHIVE_VERSION;
+    h->state_size = sizeof(ShaderState);
+    pstrcpy(h->xemu_version, sizeof(h->xemu_version), xemu_version);
+    pstrcpy(h->gl_vendor, sizeof(h->gl_vendor), shader_gl_vendor);
+    pstrcpy(h->gl_renderer, sizeof(h->gl_renderer), shader_gl_renderer);
+
+    GLint num_formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+    if (num_formats > 0) {
+        GLint *formats = g_new(GLint, num_formats);
+        glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, formats);
+        h->binary_format = formats[0];
+        g_free(formats);
+    }
+}
+
+static bool shader_archive_read_record(ShaderArchive *archive, uint64_t offset,
+                                       ShaderArchiveRecord *rec,
+                                       const uint8_t **state,
+                                       const uint8_t **program)
+{
+    if (offset < sizeof(ShaderArchiveHeader) ||
+        offset > archive->size ||
+        archive->size - offset < sizeof(*rec) + sizeof(ShaderState)) {
+        return false;
+    }
+    memcpy(rec, archive->data + offset, sizeof(*rec));
+    if (rec->magic != SHADER_ARCHIVE_RECORD_MAGIC ||
+        rec->program_size > archive->size - offset - sizeof(*rec) -
+                            sizeof(ShaderState)) {
+        return false;
+    }
+
+    *state = archive->data + offset + sizeof(*rec);
+    *program = *state + sizeof(ShaderState);
+
+    return shader_archive_crc(*state, sizeof(ShaderState)) == rec->state_crc;
+}
+
+static bool shader_archive_validate(ShaderArchive *archive)
+{
+    const ShaderArchiveHeader *expected = &archive->header;
+    ShaderArchiveHeader header;
+
+    if (archive->size < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, archive->data, sizeof(header));
+
+    /* Binaries are only usable with the exact same build and driver */
+    if (memcmp(header.magic, expected->magic, sizeof(header.magic)) ||
+        header.version != expected->version ||
+        header.state_size != expected->state_size ||
+        memcmp(header.xemu_version, expected->xemu_version,
+               sizeof(header.xemu_version)) ||
+        memcmp(header.gl_vendor, expected->gl_vendor,
+               sizeof(header.gl_vendor)) ||
+        memcmp(header.gl_renderer, expected->gl_renderer,
+               sizeof(header.gl_renderer)) ||
+        header.binary_format != expected->binary_format) {
+        return false;
+    }
+
+    if (header.header_crc != shader_archive_header_crc(&header)) {
+        return false;
+    }
+
+    uint64_t index_len = (uint64_t)header.num_entries *
+                         sizeof(ShaderArchiveIndexEntry);
+    if (header.index_offset < sizeof(header) ||
+        header.index_offset % 8 ||
+        header.index_offset > archive->size ||
+        index_len > archive->size - header.index_offset ||
+        header.journal_offset != header.index_offset + index_len) {
+        return false;
+    }
+
+    const void *index = archive->data + header.index_offset;
+    if (header.index_crc != shader_archive_crc(index, index_len)) {
+        return false;
+    }
+
+    archive->index = index;
+    archive->num_entries = header.num_entries;
+    archive->journal_offset = header.journal_offset;
+
+    return true;
+}
+
+static void shader_archive_unmap(ShaderArchive *archive)
+{
+    if (archive->map) {
+        g_mapped_file_unref(archive->map);
+    }
+    archive->map = NULL;
+    archive->data = NULL;
+    archive->size = 0;
+    archive->index = NULL;
+    archive->num_entries = 0;
+    archive->journal_offset = 0;
+}
+
+static bool shader_archive_map(ShaderArchive *archive)
+{
+    shader_archive_unmap(archive);
+
+    archive->map = g_mapped_file_new(archive->path, false, NULL);
+    if (!archive->map) {
+        return false;
+    }
+    archive->data = (const uint8_t *)g_mapped_file_get_contents(archive->map);
+    archive->size = g_mapped_file_get_length(archive->map);
+
+    if (!shader_archive_validate(archive)) {
+        shader_archive_unmap(archive);
+        return false;
+    }
+
+    return true;
+}
+
+static gint shader_archive_index_compare(gconstpointer a, gconstpointer b)
+{
+    const ShaderArchiveIndexEntry *ea = a, *eb = b;
+
+    if (ea->hash != eb->hash) {
+        return ea->hash < eb->hash ? -1 : 1;
+    }
+    /* Later records supersede earlier ones with the same hash */
+    return ea->offset < eb->offset ? -1 : ea->offset > eb->offset;
+}
+
+static bool shader_archive_check_record(ShaderArchive *archive,
+                                        uint64_t offset, uint64_t *hash,
+                                        uint64_t *next)
+{
+    ShaderArchiveRecord rec;
+    const uint8_t *state, *program;
+
+    if (!shader_archive_read_record(archive, offset, &rec, &state,
+                                    &program) ||
+        shader_archive_crc(program, rec.program_size) != rec.program_crc) {
+        return false;
+    }
+
+    *hash = rec.hash;
+    *next = offset + shader_archive_record_size(rec.program_size);
+
+    return true;
+}
+
+/* Atomically replace path with tmp_path, leaving path as it was on failure */
+static bool shader_archive_replace(const char *tmp_path, const char *path)
+{
+#ifdef _WIN32
+    return MoveFileExA(tmp_path, path, MOVEFILE_REPLACE_EXISTING |
+                                       MOVEFILE_WRITE_THROUGH);
+#else
+    return rename(tmp_path, path) == 0;
+#endif
+}
+
+/*
+ * Rewrite the archive with every valid record, including any appended to the
+ * journal, under a freshly sorted index. Corrupt records are dropped.
+ */
+static bool shader_archive_compact(ShaderArchive *archive)
+{
+    GArray *entries = g_array_new(false, false,
+                                  sizeof(ShaderArchiveIndexEntry));
+    ShaderArchiveIndexEntry entry;
+    uint64_t next;
+
+    if (archive->data) {
+        for (uint32_t i = 0; i < archive->num_entries; i++) {
+            if (shader_archive_check_record(archive, archive->index[i].offset,
+                                            &entry.hash, &next)) {
+                entry.offset = archive->index[i].offset;
+                g_array_append_val(entries, entry);
+            }
+        }
+
+        uint64_t offset = archive->journal_offset;
+        while (offset < archive->size &&
+               shader_archive_check_record(archive, offset, &entry.hash,
+                                           &next)) {
+            /* A torn tail from an interrupted write ends the journal */
+            entry.offset = offset;
+            g_array_append_val(entries, entry);
+            offset = next;
+        }
+    }
+
+    g_array_sort(entries, shader_archive_index_compare);
+
+    /* Keep only the last record for each hash */
+    guint out = 0;
+    for (guint i = 0; i < entries->len; i++) {
+        ShaderArchiveIndexEntry *e =
+            &g_array_index(entries, ShaderArchiveIndexEntry, i);
+        if (i + 1 < entries->len &&
+            g_array_index(entries, ShaderArchiveIndexEntry, i + 1).hash ==
+                e->hash) {
+            continue;
+        }
+        g_array_index(entries, ShaderArchiveIndexEntry, out++) = *e;
+    }
+    g_array_set_size(entries, out);
+
+    char *tmp_path = g_strdup_printf("%s.tmp", archive->path);
+    FILE *f = qemu_fopen(tmp_path, "wb");
+    if (!f) {
+        goto error;
+    }
+
+    ShaderArchiveHeader header = archive->header;
+    uint64_t offset = sizeof(header);
+    if (fwrite(&header, sizeof(header), 1, f) != 1) {
+        goto error_close;
+    }
+
+    static const uint8_t padding[8];
+    for (guint i = 0; i < entries->len; i++) {
+        ShaderArchiveIndexEntry *e =
+            &g_array_index(entries, ShaderArchiveIndexEntry, i);
+        ShaderArchiveRecord rec;
+        memcpy(&rec, archive->data + e->offset, sizeof(rec));
+        size_t len = sizeof(rec) + sizeof(ShaderState) + rec.program_size;
+        size_t padded = shader_archive_record_size(rec.program_size);
+        if (fwrite(archive->data + e->offset, len, 1, f) != 1 ||
+            (padded > len && fwrite(padding, padded - len, 1, f) != 1)) {
+            goto error_close;
+        }
+        e->offset = offset;
+        offset += padded;
+    }
+
+    size_t index_len = entries->len * sizeof(ShaderArchiveIndexEntry);
+    if (index_len && fwrite(entries->data, index_len, 1, f) != 1) {
+        goto error_close;
+    }
+
+    header.num_entries = entries->len;
+    header.index_offset = offset;
+    header.journal_offset = offset + index_len;
+    header.index_crc = shader_archive_crc(entries->data, index_len);
+    header.header_crc = shader_archive_header_crc(&header);
+    if (fseek(f, 0, SEEK_SET) != 0 ||
+        fwrite(&header, sizeof(header), 1, f) != 1) {
+        goto error_close;
+    }
+    if (fclose(f) != 0) {
+        goto error;
+    }
+
+    /* The old file can't be replaced while it is still mapped on Windows */
+    shader_archive_unmap(archive);
+    if (!shader_archive_replace(tmp_path, archive->path)) {
+        /* The old archive is untouched, keep using it */
+        shader_archive_map(archive);
+        goto error;
+    }
+
+    g_free(tmp_path);
+    g_array_free(entries, true);
+    return shader_archive_map(archive);
+
+error_close:
+    fclose(f);
+error:
+    fprintf(stderr, "nv2a: Failed to write shader archive %s\n",
+            archive->path);
+    qemu_unlink(tmp_path);
+    g_free(tmp_path);
+    g_array_free(entries, true);
+    return false;
+}
+
+static void shader_archive_open(ShaderArchive *archive)
+{
+    if (shader_archive_map(archive) &&
+        archive->size == archive->journal_offset) {
+        return;
+    }
+
+    /*
+     * Either there are new records in the journal, or the archive is
+     * missing, corrupt or was written by a different build or driver, in
+     * which case it is replaced by an empty one.
+     */
+    shader_archive_compact(archive);
+}
+
+static const ShaderArchiveIndexEntry *shader_archive_lookup(
+    ShaderArchive *archive, uint64_t hash)
+{
+    uint32_t lo = 0, hi = archive->num_entries;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (archive->index[mid].hash < hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo < archive->num_entries && archive->index[lo].hash == hash) {
+        return &archive->index[lo];
+    }
+
+    return NULL;
+}
+
+static bool shader_archive_append(ShaderArchive *archive, FILE *f,
+                                  const ShaderDiskWrite *job)
+{
+    static const uint8_t padding[8];
+    ShaderArchiveRecord rec = {
+        .magic = SHADER_ARCHIVE_RECORD_MAGIC,
+        .program_format = job->program_format,
+        .hash = job->hash,
+        .program_size = job->program_size,
+        .state_crc = shader_archive_crc(&job->state, sizeof(ShaderState)),
+        .program_crc = shader_archive_crc(job->program, job->program_size),
+    };
+    size_t len = sizeof(rec) + sizeof(ShaderState) + job->program_size;
+    size_t padded = shader_archive_record_size(job->program_size);
+
+    return fwrite(&rec, sizeof(rec), 1, f) == 1 &&
+           fwrite(&job->state, sizeof(ShaderState), 1, f) == 1 &&
+           fwrite(job->program, job->program_size, 1, f) == 1 &&
+           (padded == len || fwrite(padding, padded - len, 1, f) == 1);
 }
 
 static char *shader_get_lru_cache_path(void)
@@ -1237,6 +1659,14 @@ void shader_write_cache_reload_list(PGRAPHState *pg)
     char *shader_lru_path = shader_get_lru_cache_path();
     qemu_thread_join(&pg->shader_disk_thread);
 
+    /* Make sure every entry in the list has actually hit the disk */
+    qemu_mutex_lock(&pg->shader_writer.lock);
+    while (pg->shader_writer.busy ||
+           !QSIMPLEQ_EMPTY(&pg->shader_writer.queue)) {
+        qemu_cond_wait(&pg->shader_writer.idle_cond, &pg->shader_writer.lock);
+    }
+    qemu_mutex_unlock(&pg->shader_writer.lock);
+
     FILE *lru_list = qemu_fopen(shader_lru_path, "wb");
     g_free(shader_lru_path);
     if (!lru_list) {
@@ -1253,15 +1683,36 @@ void shader_write_cache_reload_list(PGRAPHState *pg)
     qemu_event_set(&pg->shader_cache_writeback_complete);
 }
 
+static void shader_free_program(ShaderLruNode *snode)
+{
+    if (!snode->program_mapped) {
+        g_free(snode->program);
+    }
+    snode->program = NULL;
+    snode->program_mapped = false;
+}
+
 bool shader_load_from_memory(ShaderLruNode *snode)
 {
-    assert(glGetError() == GL_NO_ERROR);
+    NV2A_GL_CHECK_ERRORS();
 
     if (!snode->program) {
         return false;
     }
 
+    /* Binaries are checked lazily so that untouched ones are never read */
+    if (snode->program_mapped &&
+        shader_archive_crc(snode->program, snode->program_size) !=
+            snode->program_crc) {
+        NV2A_DPRINTF("shader binary in archive is corrupt\n");
+        shader_free_program(snode);
+        return false;
+    }
+
     GLuint gl_program = glCreateProgram();
+    /* Per-call checks are compiled out, drop errors left over from earlier */
+    while (glGetError() != GL_NO_ERROR) {
+    }
     glProgramBinary(gl_program, snode->program_format, snode->program, snode->program_size);
     GLint gl_error = glGetError();
     if (gl_error != GL_NO_ERROR) {
@@ -1289,45 +1740,16 @@ bool shader_load_from_memory(ShaderLruNode *snode)
                                                        snode->state.primitive_mode);
     snode->binding = binding;
 
-    g_free(snode->program);
-    snode->program = NULL;
+    shader_free_program(snode);
 
     update_shader_constant_locations(binding, &snode->state);
 
     return true;
 }
 
-static char *shader_get_bin_directory(uint64_t hash)
-{
-    const char *cfg_dir = xemu_settings_get_base_path();
-    uint64_t bin_mask = 0xffffUL << 48;
-    char *shader_bin_dir = g_strdup_printf("%s/shaders/%04lx",
-                                           cfg_dir, (hash & bin_mask) >> 48);
-    return shader_bin_dir;
-}
-
-static char *shader_get_binary_path(const char *shader_bin_dir, uint64_t hash)
+static void shader_load_from_archive(PGRAPHState *pg, uint64_t hash)
 {
-    uint64_t bin_mask = 0xffffUL << 48;
-    return g_strdup_printf("%s/%012lx", shader_bin_dir,
-                           hash & (~bin_mask));
-}
-
-static void shader_load_from_disk(PGRAPHState *pg, uint64_t hash)
-{
-    char *shader_bin_dir = shader_get_bin_directory(hash);
-    char *shader_path = shader_get_binary_path(shader_bin_dir, hash);
-    char *cached_xemu_version = NULL;
-    char *cached_gl_vendor = NULL;
-    void *program_buffer = NULL;
-
-    uint64_t cached_xemu_version_len;
-    uint64_t gl_vendor_len;
-    GLenum program_binary_format;
-    ShaderState state;
-    size_t shader_size;
-
-    g_free(shader_bin_dir);
+    ShaderArchive *archive = pg->shader_archive;
 
     qemu_mutex_lock(&pg->shader_cache_lock);
     if (lru_contains_hash(&pg->shader_cache, hash)) {
@@ -1336,86 +1758,50 @@ static void shader_load_from_disk(PGRAPHState *pg, uint64_t hash)
     }
     qemu_mutex_unlock(&pg->shader_cache_lock);
 
-    FILE *shader_file = qemu_fopen(shader_path, "rb");
-    if (!shader_file) {
-        goto error;
-    }
-
-    size_t nread;
-    #define READ_OR_ERR(data, data_len) \
-        do { \
-            nread = fread(data, data_len, 1, shader_file); \
-            if (nread != 1) { \
-                fclose(shader_file); \
-                goto error; \
-            } \
-        } while (0)
-
-    READ_OR_ERR(&cached_xemu_version_len, sizeof(cached_xemu_version_len));
-
-    cached_xemu_version = g_malloc(cached_xemu_version_len +1);
-    READ_OR_ERR(cached_xemu_version, cached_xemu_version_len);
-    if (strcmp(cached_xemu_version, xemu_version) != 0) {
-        fclose(shader_file);
-        goto error;
+    const ShaderArchiveIndexEntry *entry = shader_archive_lookup(archive, hash);
+    if (!entry) {
+        return;
     }
 
-    READ_OR_ERR(&gl_vendor_len, sizeof(gl_vendor_len));
-
-    cached_gl_vendor = g_malloc(gl_vendor_len);
-    READ_OR_ERR(cached_gl_vendor, gl_vendor_len);
-    if (strcmp(cached_gl_vendor, shader_gl_vendor) != 0) {
-        fclose(shader_file);
-        goto error;
+    ShaderArchiveRecord rec;
+    const uint8_t *state, *program;
+    if (!shader_archive_read_record(archive, entry->offset, &rec, &state,
+                                    &program) || rec.hash != hash) {
+        return;
     }
 
-    READ_OR_ERR(&program_binary_format, sizeof(program_binary_format));
-    READ_OR_ERR(&state, sizeof(state));
-    READ_OR_ERR(&shader_size, sizeof(shader_size));
-
-    program_buffer = g_malloc(shader_size);
-    READ_OR_ERR(program_buffer, shader_size);
-
-    #undef READ_OR_ERR
-
-    fclose(shader_file);
-    g_free(shader_path);
-    g_free(cached_xemu_version);
-    g_free(cached_gl_vendor);
-
     qemu_mutex_lock(&pg->shader_cache_lock);
-    LruNode *node = lru_lookup(&pg->shader_cache, hash, &state);
+    LruNode *node = lru_lookup(&pg->shader_cache, hash, (void *)state);
     ShaderLruNode *snode = container_of(node, ShaderLruNode, node);
 
     /* If we happened to regenerate this shader already, then we may as well use the new one */
-    if (snode->binding) {
+    if (snode->binding || snode->compile_job) {
         qemu_mutex_unlock(&pg->shader_cache_lock);
         return;
     }
 
-    snode->program_format = program_binary_format;
-    snode->program_size = shader_size;
-    snode->program = program_buffer;
+    shader_free_program(snode);
+    snode->program_format = rec.program_format;
+    snode->program_size = rec.program_size;
+    snode->program = (void *)program;
+    snode->program_mapped = true;
+    snode->program_crc = rec.program_crc;
     snode->cached = true;
     qemu_mutex_unlock(&pg->shader_cache_lock);
-    return;
-
-error:
-    /* Delete the shader so it won't be loaded again */
-    qemu_unlink(shader_path);
-    g_free(shader_path);
-    g_free(program_buffer);
-    g_free(cached_xemu_version);
-    g_free(cached_gl_vendor);
 }
 
 static void *shader_reload_lru_from_disk(void *arg)
 {
+    PGRAPHState *pg = (PGRAPHState*) arg;
+
     if (!g_config.perf.cache_shaders) {
+        qemu_event_set(&pg->shader_archive->ready);
         return NULL;
     }
 
-    PGRAPHState *pg = (PGRAPHState*) arg;
+    shader_archive_open(pg->shader_archive);
+    qemu_event_set(&pg->shader_archive->ready);
+
     char *shader_lru_path = shader_get_lru_cache_path();
 
     FILE *lru_shaders_list = qemu_fopen(shader_lru_path, "rb");
@@ -1426,8 +1812,9 @@ static void *shader_reload_lru_from_disk(void *arg)
 
     uint64_t hash;
     while (fread(&hash, sizeof(uint64_t), 1, lru_shaders_list) == 1) {
-        shader_load_from_disk(pg, hash);
+        shader_load_from_archive(pg, hash);
     }
+    fclose(lru_shaders_list);
 
     return NULL;
 }
@@ -1439,16 +1826,17 @@ static void shader_cache_entry_init(Lru *lru, LruNode *node, void *state)
     snode->cached = false;
     snode->binding = NULL;
     snode->program = NULL;
-    snode->save_thread = NULL;
+    snode->program_mapped = false;
+    snode->compile_job = NULL;
 }
 
 static void shader_cache_entry_post_evict(Lru *lru, LruNode *node)
 {
     ShaderLruNode *snode = container_of(node, ShaderLruNode, node);
 
-    if (snode->save_thread) {
-        qemu_thread_join(snode->save_thread);
-        g_free(snode->save_thread);
+    if (snode->compile_job) {
+        shader_compile_cancel(container_of(lru, PGRAPHState, shader_cache),
+                              snode);
     }
 
     if (snode->binding) {
@@ -1456,14 +1844,10 @@ static void shader_cache_entry_post_evict(Lru *lru, LruNode *node)
         g_free(snode->binding);
     }
 
-    if (snode->program) {
-        g_free(snode->program);
-    }
+    shader_free_program(snode);
 
     snode->cached = false;
-    snode->save_thread = NULL;
     snode->binding = NULL;
-    snode->program = NULL;
     memset(&snode->state, 0, sizeof(ShaderState));
 }
 
@@ -1477,9 +1861,14 @@ void shader_cache_init(PGRAPHState *pg)
 {
     if (!shader_gl_vendor) {
         shader_gl_vendor = (const char *) glGetString(GL_VENDOR);
+        shader_gl_renderer = (const char *) glGetString(GL_RENDERER);
     }
 
-    shader_create_cache_folder();
+    pg->shader_archive = g_new0(ShaderArchive, 1);
+    pg->shader_archive->path = g_strdup_printf("%s/shader_cache.bin",
+                                               xemu_settings_get_base_path());
+    shader_archive_init_header(pg->shader_archive);
+    qemu_event_init(&pg->shader_archive->ready, false);
 
     /* FIXME: Make this configurable */
     const size_t shader_cache_size = 50*1024;
@@ -1494,77 +1883,124 @@ void shader_cache_init(PGRAPHState *pg)
     pg->shader_cache.compare_nodes = shader_cache_entry_compare;
     pg->shader_cache.post_node_evict = shader_cache_entry_post_evict;
 
+    qemu_mutex_init(&pg->shader_writer.lock);
+    qemu_cond_init(&pg->shader_writer.work_cond);
+    qemu_cond_init(&pg->shader_writer.idle_cond);
+    QSIMPLEQ_INIT(&pg->shader_writer.queue);
+    pg->shader_writer.queue_len = 0;
+    pg->shader_writer.busy = false;
+    pg->shader_writer.shutdown = false;
+    qemu_thread_create(&pg->shader_writer.thread, "pgraph.shader_writer",
+                       shader_writer_thread, pg, QEMU_THREAD_JOINABLE);
+
+    qemu_mutex_init(&pg->shader_compiler.lock);
+    qemu_cond_init(&pg->shader_compiler.work_cond);
+    qemu_cond_init(&pg->shader_compiler.done_cond);
+    QSIMPLEQ_INIT(&pg->shader_compiler.queue);
+    pg->shader_compiler.shutdown = false;
+    qemu_thread_create(&pg->shader_compiler.thread, "pgraph.shader_compiler",
+                       shader_compiler_thread, pg, QEMU_THREAD_JOINABLE);
+
     qemu_thread_create(&pg->shader_disk_thread, "pgraph.shader_cache",
                        shader_reload_lru_from_disk, pg, QEMU_THREAD_JOINABLE);
 }
 
-static void *shader_write_to_disk(void *arg)
+void shader_cache_destroy(PGRAPHState *pg)
 {
-    ShaderLruNode *snode = (ShaderLruNode*) arg;
-
-    char *shader_bin = shader_get_bin_directory(snode->node.hash);
-    char *shader_path = shader_get_binary_path(shader_bin, snode->node.hash);
-
-    static uint64_t gl_vendor_len;
-    if (gl_vendor_len == 0) {
-        gl_vendor_len = (uint64_t) (strlen(shader_gl_vendor) + 1);
+    qemu_mutex_lock(&pg->shader_compiler.lock);
+    pg->shader_compiler.shutdown = true;
+    qemu_cond_broadcast(&pg->shader_compiler.work_cond);
+    qemu_mutex_unlock(&pg->shader_compiler.lock);
+    qemu_thread_join(&pg->shader_compiler.thread);
+
+    ShaderCompileJob *compile_job, *compile_next;
+    QSIMPLEQ_FOREACH_SAFE(compile_job, &pg->shader_compiler.queue, entry,
+                          compile_next) {
+        g_free(compile_job);
     }
 
-    static uint64_t xemu_version_len = 0;
-    if (xemu_version_len == 0) {
-        xemu_version_len = (uint64_t) (strlen(xemu_version) + 1);
-    }
+    qemu_cond_destroy(&pg->shader_compiler.done_cond);
+    qemu_cond_destroy(&pg->shader_compiler.work_cond);
+    qemu_mutex_destroy(&pg->shader_compiler.lock);
 
-    qemu_mkdir(shader_bin);
-    g_free(shader_bin);
+    qemu_mutex_lock(&pg->shader_writer.lock);
+    pg->shader_writer.shutdown = true;
+    qemu_cond_broadcast(&pg->shader_writer.work_cond);
+    qemu_mutex_unlock(&pg->shader_writer.lock);
+    qemu_thread_join(&pg->shader_writer.thread);
 
-    FILE *shader_file = qemu_fopen(shader_path, "wb");
-    if (!shader_file) {
-        goto error;
+    ShaderDiskWrite *job, *next;
+    QSIMPLEQ_FOREACH_SAFE(job, &pg->shader_writer.queue, entry, next) {
+        g_free(job->program);
+        g_free(job);
     }
 
-    size_t written;
-    #define WRITE_OR_ERR(data, data_size) \
-        do { \
-            written = fwrite(data, data_size, 1, shader_file); \
-            if (written != 1) { \
-                fclose(shader_file); \
-                goto error; \
-            } \
-        } while (0)
-
-    WRITE_OR_ERR(&xemu_version_len, sizeof(xemu_version_len));
-    WRITE_OR_ERR(xemu_version, xemu_version_len);
-
-    WRITE_OR_ERR(&gl_vendor_len, sizeof(gl_vendor_len));
-    WRITE_OR_ERR(shader_gl_vendor, gl_vendor_len);
+    qemu_cond_destroy(&pg->shader_writer.idle_cond);
+    qemu_cond_destroy(&pg->shader_writer.work_cond);
+    qemu_mutex_destroy(&pg->shader_writer.lock);
 
-    WRITE_OR_ERR(&snode->program_format, sizeof(snode->program_format));
-    WRITE_OR_ERR(&snode->state, sizeof(snode->state));
-
-    WRITE_OR_ERR(&snode->program_size, sizeof(snode->program_size));
-    WRITE_OR_ERR(snode->program, snode->program_size);
-
-    #undef WRITE_OR_ERR
+    shader_archive_unmap(pg->shader_archive);
+    qemu_event_destroy(&pg->shader_archive->ready);
+    g_free(pg->shader_archive->path);
+    g_free(pg->shader_archive);
+    pg->shader_archive = NULL;
+}
 
-    fclose(shader_file);
+static void *shader_writer_thread(void *opaque)
+{
+    PGRAPHState *pg = opaque;
+    ShaderArchive *archive = pg->shader_archive;
+
+    /* Records may only be appended once the archive has been compacted */
+    qemu_event_wait(&archive->ready);
+
+    qemu_mutex_lock(&pg->shader_writer.lock);
+    while (true) {
+        while (!pg->shader_writer.shutdown &&
+               QSIMPLEQ_EMPTY(&pg->shader_writer.queue)) {
+            qemu_cond_wait(&pg->shader_writer.work_cond,
+                           &pg->shader_writer.lock);
+        }
+        if (pg->shader_writer.shutdown) {
+            break;
+        }
 
-    g_free(shader_path);
-    g_free(snode->program);
-    snode->program = NULL;
+        /* Take everything queued so far and write it out as one batch */
+        QSIMPLEQ_HEAD(, ShaderDiskWrite) batch =
+            QSIMPLEQ_HEAD_INITIALIZER(batch);
+        QSIMPLEQ_CONCAT(&batch, &pg->shader_writer.queue);
+        pg->shader_writer.queue_len = 0;
+        pg->shader_writer.busy = true;
+        qemu_mutex_unlock(&pg->shader_writer.lock);
+
+        FILE *archive_file = archive->data ?
+                             qemu_fopen(archive->path, "ab") : NULL;
+        ShaderDiskWrite *job, *next;
+        QSIMPLEQ_FOREACH_SAFE(job, &batch, entry, next) {
+            if (archive_file &&
+                !shader_archive_append(archive, archive_file, job)) {
+                fprintf(stderr, "nv2a: Failed to write shader binary to %s\n",
+                        archive->path);
+                fclose(archive_file);
+                archive_file = NULL;
+            }
+            g_free(job->program);
+            g_free(job);
+        }
+        if (archive_file) {
+            fclose(archive_file);
+        }
 
-    return NULL;
+        qemu_mutex_lock(&pg->shader_writer.lock);
+        pg->shader_writer.busy = false;
+        qemu_cond_broadcast(&pg->shader_writer.idle_cond);
+    }
+    qemu_mutex_unlock(&pg->shader_writer.lock);
 
-error:
-    fprintf(stderr, "nv2a: Failed to write shader binary file to %s\n", shader_path);
-    qemu_unlink(shader_path);
-    g_free(shader_path);
-    g_free(snode->program);
-    snode->program = NULL;
     return NULL;
 }
 
-void shader_cache_to_disk(ShaderLruNode *snode)
+void shader_cache_to_disk(PGRAPHState *pg, ShaderLruNode *snode)
 {
     if (!snode->binding || snode->cached) {
         return;
@@ -1573,27 +2009,162 @@ void shader_cache_to_disk(ShaderLruNode *snode)
     GLint program_size;
     glGetProgramiv(snode->binding->gl_program, GL_PROGRAM_BINARY_LENGTH, &program_size);
 
-    if (snode->program) {
-        g_free(snode->program);
-        snode->program = NULL;
-    }
+    shader_free_program(snode);
 
     /* program_size might be zero on some systems, if no binary formats are supported */
     if (program_size == 0) {
         return;
     }
 
-    snode->program = g_malloc(program_size);
+    qemu_mutex_lock(&pg->shader_writer.lock);
+    if (pg->shader_writer.queue_len >= SHADER_WRITER_MAX_PENDING) {
+        /* Writer is backed up, don't hold up PGRAPH on disk I/O */
+        qemu_mutex_unlock(&pg->shader_writer.lock);
+        return;
+    }
+    qemu_mutex_unlock(&pg->shader_writer.lock);
+
+    ShaderDiskWrite *job = g_malloc(sizeof(ShaderDiskWrite));
+    job->hash = snode->node.hash;
+    job->program = g_malloc(program_size);
     GLsizei program_size_copied;
+    while (glGetError() != GL_NO_ERROR) {
+    }
     glGetProgramBinary(snode->binding->gl_program, program_size, &program_size_copied,
-                       &snode->program_format, snode->program);
+                       &job->program_format, job->program);
     assert(glGetError() == GL_NO_ERROR);
 
-    snode->program_size = program_size_copied;
+    job->program_size = program_size_copied;
+    memcpy(&job->state, &snode->state, sizeof(ShaderState));
     snode->cached = true;
 
-    char name[24];
-    snprintf(name, sizeof(name), "scache-%llx", (unsigned long long) snode->node.hash);
-    snode->save_thread = g_malloc0(sizeof(QemuThread));
-    qemu_thread_create(snode->save_thread, name, shader_write_to_disk, snode, QEMU_THREAD_JOINABLE);
+    qemu_mutex_lock(&pg->shader_writer.lock);
+    QSIMPLEQ_INSERT_TAIL(&pg->shader_writer.queue, job, entry);
+    pg->shader_writer.queue_len++;
+    qemu_cond_signal(&pg->shader_writer.work_cond);
+    qemu_mutex_unlock(&pg->shader_writer.lock);
+}
+
+static void shader_free_binding(ShaderBinding *binding)
+{
+    glDeleteProgram(binding->gl_program);
+    g_free(binding);
+}
+
+static void *shader_compiler_thread(void *opaque)
+{
+    PGRAPHState *pg = opaque;
+
+    /* Programs are created in a context shared with the render context */
+    glo_set_current(g_nv2a_context_shader);
+
+    qemu_mutex_lock(&pg->shader_compiler.lock);
+    while (true) {
+        while (!pg->shader_compiler.shutdown &&
+               QSIMPLEQ_EMPTY(&pg->shader_compiler.queue)) {
+            qemu_cond_wait(&pg->shader_compiler.work_cond,
+                           &pg->shader_compiler.lock);
+        }
+        if (pg->shader_compiler.shutdown) {
+            break;
+        }
+
+        ShaderCompileJob *job = QSIMPLEQ_FIRST(&pg->shader_compiler.queue);
+        QSIMPLEQ_REMOVE_HEAD(&pg->shader_compiler.queue, entry);
+        job->state = SHADER_COMPILE_RUNNING;
+        qemu_mutex_unlock(&pg->shader_compiler.lock);
+
+        ShaderBinding *binding = generate_shaders(&job->shader_state);
+        glUseProgram(0);
+
+        /* Link must be complete before the program is used elsewhere */
+        glFinish();
+
+        qemu_mutex_lock(&pg->shader_compiler.lock);
+        if (job->orphaned) {
+            shader_free_binding(binding);
+            g_free(job);
+            continue;
+        }
+        job->binding = binding;
+        job->done_time = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+        job->state = SHADER_COMPILE_DONE;
+        qemu_cond_broadcast(&pg->shader_compiler.done_cond);
+    }
+    qemu_mutex_unlock(&pg->shader_compiler.lock);
+
+    glo_set_current(NULL);
+
+    return NULL;
+}
+
+/*
+ * Compile the program for snode in the background. Waits for up to
+ * timeout_ms for it to finish. On success the program is attached to snode,
+ * the time it took from being queued is returned in latency_us and true is
+ * returned. Must be called with shader_cache_lock held.
+ */
+bool shader_compile_async(PGRAPHState *pg, ShaderLruNode *snode, int timeout_ms,
+                          int64_t *latency_us)
+{
+    qemu_mutex_lock(&pg->shader_compiler.lock);
+
+    ShaderCompileJob *job = snode->compile_job;
+    if (!job) {
+        job = g_malloc0(sizeof(ShaderCompileJob));
+        job->state = SHADER_COMPILE_QUEUED;
+        memcpy(&job->shader_state, &snode->state, sizeof(ShaderState));
+        job->queued_time = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+        QSIMPLEQ_INSERT_TAIL(&pg->shader_compiler.queue, job, entry);
+        qemu_cond_signal(&pg->shader_compiler.work_cond);
+        snode->compile_job = job;
+    }
+
+    if (job->state != SHADER_COMPILE_DONE && timeout_ms > 0) {
+        int64_t deadline = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + timeout_ms;
+        int64_t remaining = timeout_ms;
+        while (job->state != SHADER_COMPILE_DONE && remaining > 0) {
+            qemu_cond_timedwait(&pg->shader_compiler.done_cond,
+                                &pg->shader_compiler.lock, remaining);
+            remaining = deadline - qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+        }
+    }
+
+    bool done = job->state == SHADER_COMPILE_DONE;
+    qemu_mutex_unlock(&pg->shader_compiler.lock);
+
+    if (!done) {
+        return false;
+    }
+
+    snode->binding = job->binding;
+    snode->compile_job = NULL;
+    *latency_us = job->done_time - job->queued_time;
+    g_free(job);
+
+    return true;
+}
+
+static void shader_compile_cancel(PGRAPHState *pg, ShaderLruNode *snode)
+{
+    ShaderCompileJob *job = snode->compile_job;
+    snode->compile_job = NULL;
+
+    qemu_mutex_lock(&pg->shader_compiler.lock);
+    switch (job->state) {
+    case SHADER_COMPILE_QUEUED:
+        QSIMPLEQ_REMOVE(&pg->shader_compiler.queue, job, ShaderCompileJob,
+                        entry);
+        g_free(job);
+        break;
+    case SHADER_COMPILE_RUNNING:
+        /* The compiler thread frees it once it is done */
+        job->orphaned = true;
+        break;
+    case SHADER_COMPILE_DONE:
+        shader_free_binding(job->binding);
+        g_free(job);
+        break;
+    }
+    qemu_mutex_unlock(&pg->shader_compiler.lock);
 }
@@ -22,6 +22,8 @@
 #define HW_NV2A_SHADERS_H
 
 #include "qemu/thread.h"
+#include "qemu/queue.h"
+#include "qemu/fast-hash.h"
 #include "qapi/qmp/qstring.h"
 #include "gl/gloffscreen.h"
 
@@ -56,10 +58,25 @@ enum MaterialColorSource {
     MATERIAL_COLOR_SRC_SPECULAR,
 };
 
-typedef struct ShaderState {
-    unsigned int surface_scale_factor;
+/*
+ * ShaderState is hashed in independent blocks, each a contiguous byte range of
+ * the structure, so that a register write only has to rebuild and rehash the
+ * blocks derived from it. Keep the fields below grouped accordingly.
+ */
+enum ShaderStateBlock {
+    SHADER_BLOCK_COMBINERS,      /* psh.combiner_control ... psh.alpha_outputs */
+    SHADER_BLOCK_TEXTURES,       /* psh.point_sprite ... end of psh */
+    SHADER_BLOCK_VERTEX,         /* compressed_attrs ... fixed_function */
+    SHADER_BLOCK_VERTEX_PROGRAM, /* vertex_program ... z_perspective */
+    SHADER_BLOCK_RASTER,         /* surface_scale_factor ... end */
+    SHADER_BLOCK__COUNT,
+};
 
+#define SHADER_BLOCK_ALL ((1 << SHADER_BLOCK__COUNT) - 1)
+
+typedef struct ShaderState {
     PshState psh;
+
     uint16_t compressed_attrs;
 
     bool texture_matrix_enable[4];
@@ -89,6 +106,8 @@ typedef struct ShaderState {
     int program_length;
     bool z_perspective;
 
+    unsigned int surface_scale_factor;
+
     /* primitive format for geometry shader */
     enum ShaderPolygonMode polygon_front_mode;
     enum ShaderPolygonMode polygon_back_mode;
@@ -101,6 +120,38 @@ typedef struct ShaderState {
     bool smooth_shading;
 } ShaderState;
 
+static inline void shader_state_block_range(enum ShaderStateBlock block,
+                                            size_t *start, size_t *end)
+{
+    static const size_t bounds[SHADER_BLOCK__COUNT + 1] = {
+        offsetof(ShaderState, psh),
+        offsetof(ShaderState, psh.point_sprite),
+        offsetof(ShaderState, compressed_attrs),
+        offsetof(ShaderState, vertex_program),
+        offsetof(ShaderState, surface_scale_factor),
+        sizeof(ShaderState),
+    };
+
+    *start = bounds[block];
+    *end = bounds[block + 1];
+}
+
+static inline uint64_t shader_state_hash_block(const ShaderState *state,
+                                               enum ShaderStateBlock block)
+{
+    size_t start, end;
+    shader_state_block_range(block, &start, &end);
+    return fast_hash((const uint8_t *)state + start, end - start);
+}
+
+/* Combines per-block hashes into the shader cache key */
+static inline uint64_t shader_state_hash_blocks(
+    const uint64_t block_hashes[SHADER_BLOCK__COUNT])
+{
+    return fast_hash((const uint8_t *)block_hashes,
+                     SHADER_BLOCK__COUNT * sizeof(uint64_t));
+}
+
 typedef struct ShaderBinding {
     GLuint gl_program;
     GLenum gl_primitive_mode;
@@ -136,26 +187,59 @@ typedef struct ShaderBinding {
     GLint material_alpha_loc;
 } ShaderBinding;
 
+typedef enum ShaderCompileState {
+    SHADER_COMPILE_QUEUED,
+    SHADER_COMPILE_RUNNING,
+    SHADER_COMPILE_DONE,
+} ShaderCompileState;
+
+/* A program being generated and linked by the background shader compiler */
+typedef struct ShaderCompileJob {
+    QSIMPLEQ_ENTRY(ShaderCompileJob) entry;
+    ShaderCompileState state;
+    bool orphaned;
+    ShaderState shader_state;
+    ShaderBinding *binding;
+    int64_t queued_time;
+    int64_t done_time;
+} ShaderCompileJob;
+
 typedef struct ShaderLruNode {
     LruNode node;
     bool cached;
     void *program;
     size_t program_size;
     GLenum program_format;
+    bool program_mapped;
+    uint32_t program_crc;
     ShaderState state;
     ShaderBinding *binding;
-    QemuThread *save_thread;
+    ShaderCompileJob *compile_job;
 } ShaderLruNode;
 
+/* A program binary waiting to be written out by the shader cache writer */
+typedef struct ShaderDiskWrite {
+    QSIMPLEQ_ENTRY(ShaderDiskWrite) entry;
+    uint64_t hash;
+    GLenum program_format;
+    ShaderState state;
+    size_t program_size;
+    void *program;
+} ShaderDiskWrite;
+
 typedef struct PGRAPHState PGRAPHState;
+typedef struct ShaderArchive ShaderArchive;
 
 GLenum get_gl_primitive_mode(enum ShaderPolygonMode polygon_mode, enum ShaderPrimitiveMode primitive_mode);
 void update_shader_constant_locations(ShaderBinding *binding, const ShaderState *state);
 ShaderBinding *generate_shaders(const ShaderState *state);
 
 void shader_cache_init(PGRAPHState *pg);
+void shader_cache_destroy(PGRAPHState *pg);
 void shader_write_cache_reload_list(PGRAPHState *pg);
 bool shader_load_from_memory(ShaderLruNode *snode);
-void shader_cache_to_disk(ShaderLruNode *snode);
+void shader_cache_to_disk(PGRAPHState *pg, ShaderLruNode *snode);
+bool shader_compile_async(PGRAPHState *pg, ShaderLruNode *snode, int timeout_ms,
+                          int64_t *latency_us);
 
 #endif
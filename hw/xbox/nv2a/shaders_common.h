@@ -91,6 +91,19 @@ void mstring_append_int(MString *mstr, int val)
    mstring_append_fmt(mstr, "%" PRId64, val);
 }
 
+/*
+ * Formats val like "%f" into buf, but always with '.' as the radix, as GLSL
+ * expects, whatever the locale of the calling thread.
+ */
+static inline
+const char *glsl_float(char *buf, float val)
+{
+   return g_ascii_formatd(buf, G_ASCII_DTOSTR_BUF_SIZE, "%f", val);
+}
+
+/* For format arguments, the buffer lives until the end of the statement */
+#define GLSL_FLOAT(val) glsl_float((char[G_ASCII_DTOSTR_BUF_SIZE]){ 0 }, (val))
+
 static inline
 MString *mstring_new(void)
 {
@@ -24,6 +24,10 @@
 #include <assert.h>
 #include "qemu/osdep.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "swizzle.h"
 
 /* This should be pretty straightforward.
@@ -55,32 +59,189 @@ static void generate_swizzle_masks(unsigned int width,
     *mask_z = z;
 }
 
-/* This fills a pattern with a value if your value has bits abcd and your
- * pattern is 11010100100 this will return: 0a0b0c00d00
+/* Rather than scattering the bits of every coordinate into its mask, walk
+ * the swizzled coordinates incrementally. Forcing the bits outside the mask
+ * to one lets the carry of an increment ripple straight through them, so
+ * for a swizzled value v the next one is ((v | ~mask) + 1) & mask, which is
+ * the same as (v - mask) & mask.
  */
-static uint32_t fill_pattern(uint32_t pattern, uint32_t value)
+static inline uint32_t swizzle_step(uint32_t v, uint32_t mask)
 {
-    uint32_t result = 0;
-    uint32_t bit = 1;
-    while(value) {
-        if (pattern & bit) {
-            /* Copy bit to result */
-            result |= value & 1 ? bit : 0;
-            value >>= 1;
+    return (v - mask) & mask;
+}
+
+/* 2D textures of at least 4x4 texels start with the pattern ..yxyx, so each
+ * 4x4 tile is stored as 4 consecutive 2x2 blocks:
+ *
+ *   block 0: (0,0) (1,0) (0,1) (1,1)    block 1: (2,0) (3,0) (2,1) (3,1)
+ *   block 2: (0,2) (1,2) (0,3) (1,3)    block 3: (2,2) (3,2) (2,3) (3,3)
+ *
+ * A linear row of the tile is therefore made of one half of two blocks.
+ */
+#define TILE_MASK_X 0x5
+#define TILE_MASK_Y 0xA
+
+static bool swizzle_can_use_tiles(unsigned int width, unsigned int height,
+                                  unsigned int depth, uint32_t mask_x,
+                                  uint32_t mask_y)
+{
+    return depth == 1 && (width % 4) == 0 && (height % 4) == 0 &&
+           (mask_x & 0xF) == TILE_MASK_X && (mask_y & 0xF) == TILE_MASK_Y;
+}
+
+static inline void swizzle_tile(uint8_t *linear, unsigned int pitch,
+                                uint8_t *tile, unsigned int bytes_per_pixel,
+                                bool unswizzle)
+{
+#ifdef __SSE2__
+    if (bytes_per_pixel == 4) {
+        __m128i *blocks = (__m128i *)tile;
+        if (unswizzle) {
+            __m128i b0 = _mm_loadu_si128(&blocks[0]);
+            __m128i b1 = _mm_loadu_si128(&blocks[1]);
+            __m128i b2 = _mm_loadu_si128(&blocks[2]);
+            __m128i b3 = _mm_loadu_si128(&blocks[3]);
+            _mm_storeu_si128((__m128i *)linear, _mm_unpacklo_epi64(b0, b1));
+            _mm_storeu_si128((__m128i *)(linear + pitch),
+                             _mm_unpackhi_epi64(b0, b1));
+            _mm_storeu_si128((__m128i *)(linear + 2 * pitch),
+                             _mm_unpacklo_epi64(b2, b3));
+            _mm_storeu_si128((__m128i *)(linear + 3 * pitch),
+                             _mm_unpackhi_epi64(b2, b3));
+        } else {
+            __m128i r0 = _mm_loadu_si128((const __m128i *)linear);
+            __m128i r1 = _mm_loadu_si128((const __m128i *)(linear + pitch));
+            __m128i r2 = _mm_loadu_si128((const __m128i *)(linear + 2 * pitch));
+            __m128i r3 = _mm_loadu_si128((const __m128i *)(linear + 3 * pitch));
+            _mm_storeu_si128(&blocks[0], _mm_unpacklo_epi64(r0, r1));
+            _mm_storeu_si128(&blocks[1], _mm_unpackhi_epi64(r0, r1));
+            _mm_storeu_si128(&blocks[2], _mm_unpacklo_epi64(r2, r3));
+            _mm_storeu_si128(&blocks[3], _mm_unpackhi_epi64(r2, r3));
+        }
+        return;
+    }
+#endif
+
+    const unsigned int pair = 2 * bytes_per_pixel;
+    const unsigned int block = 4 * bytes_per_pixel;
+
+    for (unsigned int row = 0; row < 4; row++) {
+        uint8_t *line = linear + row * pitch;
+        uint8_t *left = tile + (row >> 1) * 2 * block + (row & 1) * pair;
+        uint8_t *right = left + block;
+        if (unswizzle) {
+            memcpy(line, left, pair);
+            memcpy(line + pair, right, pair);
+        } else {
+            memcpy(left, line, pair);
+            memcpy(right, line + pair, pair);
         }
-        bit <<= 1;
     }
-    return result;
 }
 
-static unsigned int get_swizzled_offset(
-    unsigned int x, unsigned int y, unsigned int z,
-    uint32_t mask_x, uint32_t mask_y, uint32_t mask_z,
-    unsigned int bytes_per_pixel)
+static inline void swizzle_box_tiled(uint8_t *linear, unsigned int width,
+                                     unsigned int height, uint8_t *swizzled,
+                                     unsigned int row_pitch, uint32_t mask_x,
+                                     uint32_t mask_y,
+                                     unsigned int bytes_per_pixel,
+                                     bool unswizzle)
 {
-    return bytes_per_pixel * (fill_pattern(mask_x, x)
-                           | fill_pattern(mask_y, y)
-                           | fill_pattern(mask_z, z));
+    const uint32_t step_x = mask_x & ~TILE_MASK_X;
+    const uint32_t step_y = mask_y & ~TILE_MASK_Y;
+
+    uint32_t off_y = 0;
+    for (unsigned int y = 0; y < height; y += 4) {
+        uint8_t *row = linear + y * row_pitch;
+        uint32_t off_x = 0;
+        for (unsigned int x = 0; x < width; x += 4) {
+            swizzle_tile(row + x * bytes_per_pixel, row_pitch,
+                         swizzled + (off_x | off_y) * bytes_per_pixel,
+                         bytes_per_pixel, unswizzle);
+            off_x = swizzle_step(off_x, step_x);
+        }
+        off_y = swizzle_step(off_y, step_y);
+    }
+}
+
+static inline void swizzle_box_generic(uint8_t *linear, unsigned int width,
+                                       unsigned int height, unsigned int depth,
+                                       uint8_t *swizzled,
+                                       unsigned int row_pitch,
+                                       unsigned int slice_pitch,
+                                       uint32_t mask_x, uint32_t mask_y,
+                                       uint32_t mask_z,
+                                       unsigned int bytes_per_pixel,
+                                       bool unswizzle)
+{
+    uint32_t off_z = 0;
+    for (unsigned int z = 0; z < depth; z++) {
+        uint32_t off_y = 0;
+        for (unsigned int y = 0; y < height; y++) {
+            uint8_t *row = linear + z * slice_pitch + y * row_pitch;
+            const uint32_t off_yz = off_y | off_z;
+            uint32_t off_x = 0;
+            for (unsigned int x = 0; x < width; x++) {
+                uint8_t *texel = swizzled + (off_x | off_yz) * bytes_per_pixel;
+                if (unswizzle) {
+                    memcpy(row + x * bytes_per_pixel, texel, bytes_per_pixel);
+                } else {
+                    memcpy(texel, row + x * bytes_per_pixel, bytes_per_pixel);
+                }
+                off_x = swizzle_step(off_x, mask_x);
+            }
+            off_y = swizzle_step(off_y, mask_y);
+        }
+        off_z = swizzle_step(off_z, mask_z);
+    }
+}
+
+static inline void swizzle_box_bpp(uint8_t *linear, unsigned int width,
+                                   unsigned int height, unsigned int depth,
+                                   uint8_t *swizzled, unsigned int row_pitch,
+                                   unsigned int slice_pitch,
+                                   unsigned int bytes_per_pixel,
+                                   bool unswizzle)
+{
+    uint32_t mask_x, mask_y, mask_z;
+    generate_swizzle_masks(width, height, depth, &mask_x, &mask_y, &mask_z);
+
+    if (swizzle_can_use_tiles(width, height, depth, mask_x, mask_y)) {
+        swizzle_box_tiled(linear, width, height, swizzled, row_pitch,
+                          mask_x, mask_y, bytes_per_pixel, unswizzle);
+    } else {
+        swizzle_box_generic(linear, width, height, depth, swizzled, row_pitch,
+                            slice_pitch, mask_x, mask_y, mask_z,
+                            bytes_per_pixel, unswizzle);
+    }
+}
+
+/* Dispatch on the texel size so every copy above is done with a fixed size
+ * the compiler can turn into a single load and store.
+ */
+static void swizzle_box_internal(uint8_t *linear, unsigned int width,
+                                 unsigned int height, unsigned int depth,
+                                 uint8_t *swizzled, unsigned int row_pitch,
+                                 unsigned int slice_pitch,
+                                 unsigned int bytes_per_pixel, bool unswizzle)
+{
+    switch (bytes_per_pixel) {
+    case 1:
+        swizzle_box_bpp(linear, width, height, depth, swizzled, row_pitch,
+                        slice_pitch, 1, unswizzle);
+        break;
+    case 2:
+        swizzle_box_bpp(linear, width, height, depth, swizzled, row_pitch,
+                        slice_pitch, 2, unswizzle);
+        break;
+    case 4:
+        swizzle_box_bpp(linear, width, height, depth, swizzled, row_pitch,
+                        slice_pitch, 4, unswizzle);
+        break;
+    default:
+        swizzle_box_bpp(linear, width, height, depth, swizzled, row_pitch,
+                        slice_pitch, bytes_per_pixel, unswizzle);
+        break;
+    }
 }
 
 void swizzle_box(
@@ -93,23 +254,8 @@ void swizzle_box(
     unsigned int slice_pitch,
     unsigned int bytes_per_pixel)
 {
-    uint32_t mask_x, mask_y, mask_z;
-    generate_swizzle_masks(width, height, depth, &mask_x, &mask_y, &mask_z);
-
-    int x, y, z;
-    for (z = 0; z < depth; z++) {
-        for (y = 0; y < height; y++) {
-            for (x = 0; x < width; x++) {
-                const uint8_t *src = src_buf
-                                         + y * row_pitch + x * bytes_per_pixel;
-                uint8_t *dst = dst_buf +
-                    get_swizzled_offset(x, y, z, mask_x, mask_y, mask_z,
-                                        bytes_per_pixel);
-                memcpy(dst, src, bytes_per_pixel);
-            }
-        }
-        src_buf += slice_pitch;
-    }
+    swizzle_box_internal((uint8_t *)src_buf, width, height, depth, dst_buf,
+                         row_pitch, slice_pitch, bytes_per_pixel, false);
 }
 
 void unswizzle_box(
@@ -122,22 +268,8 @@ void unswizzle_box(
     unsigned int slice_pitch,
     unsigned int bytes_per_pixel)
 {
-    uint32_t mask_x, mask_y, mask_z;
-    generate_swizzle_masks(width, height, depth, &mask_x, &mask_y, &mask_z);
-
-    int x, y, z;
-    for (z = 0; z < depth; z++) {
-        for (y = 0; y < height; y++) {
-            for (x = 0; x < width; x++) {
-                const uint8_t *src = src_buf
-                    + get_swizzled_offset(x, y, z, mask_x, mask_y, mask_z,
-                                          bytes_per_pixel);
-                uint8_t *dst = dst_buf + y * row_pitch + x * bytes_per_pixel;
-                memcpy(dst, src, bytes_per_pixel);
-            }
-        }
-        dst_buf += slice_pitch;
-    }
+    swizzle_box_internal(dst_buf, width, height, depth, (uint8_t *)src_buf,
+                         row_pitch, slice_pitch, bytes_per_pixel, true);
 }
 
 void unswizzle_rect(
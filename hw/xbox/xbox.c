@@ -352,6 +352,13 @@ void xbox_init_common(MachineState *machine,
     /* GPU! */
     nv2a_init(agp_bus, PCI_DEVFN(0, 0), ram_memory);
 
+    char *nv2a_replay_file =
+        object_property_get_str(qdev_get_machine(), "nv2a-replay", NULL);
+    if (nv2a_replay_file && *nv2a_replay_file) {
+        nv2a_replay_init(nv2a_replay_file);
+    }
+    g_free(nv2a_replay_file);
+
     /* FIXME: Stub the memory controller */
     pci_create_simple(pci_bus, PCI_DEVFN(0, 3), "pci-testdev");
 
@@ -484,6 +491,22 @@ static void machine_set_video_encoder(Object *obj, const char *value,
     ms->video_encoder = g_strdup(value);
 }
 
+static char *machine_get_nv2a_replay(Object *obj, Error **errp)
+{
+    XboxMachineState *ms = XBOX_MACHINE(obj);
+
+    return g_strdup(ms->nv2a_replay);
+}
+
+static void machine_set_nv2a_replay(Object *obj, const char *value,
+                                    Error **errp)
+{
+    XboxMachineState *ms = XBOX_MACHINE(obj);
+
+    g_free(ms->nv2a_replay);
+    ms->nv2a_replay = g_strdup(value);
+}
+
 static inline void xbox_machine_initfn(Object *obj)
 {
     object_property_add_str(obj, "bootrom", machine_get_bootrom,
@@ -516,6 +539,11 @@ static inline void xbox_machine_initfn(Object *obj)
                                     "Set the encoder presented to the OS: conexant (default), focus, xcalibur");
     object_property_set_str(obj, "video-encoder", "conexant", &error_fatal);
 
+    object_property_add_str(obj, "nv2a-replay", machine_get_nv2a_replay,
+                            machine_set_nv2a_replay);
+    object_property_set_description(obj, "nv2a-replay",
+                                    "Replay an nv2a push buffer capture instead of running the guest");
+
 }
 
 static void xbox_machine_class_init(ObjectClass *oc, void *data)
@@ -47,6 +47,7 @@ typedef struct XboxMachineState {
     bool short_animation;
     char *smc_version;
     char *video_encoder;
+    char *nv2a_replay;
 } XboxMachineState;
 
 typedef struct XboxMachineClass {
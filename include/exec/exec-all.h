@@ -790,6 +790,18 @@ static inline void mmap_unlock(void) {}
 
 void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length);
 void tlb_set_dirty(CPUState *cpu, target_ulong vaddr);
+#ifdef XBOX
+/**
+ * tlb_flush_host_range:
+ * @cpu: CPU whose TLB should be flushed
+ * @host: host address of the start of the range
+ * @length: length of the range in bytes
+ *
+ * Flush the TLB entries of every page mapped onto host memory in
+ * [@host, @host + @length), at whatever virtual address it is mapped.
+ */
+void tlb_flush_host_range(CPUState *cpu, void *host, size_t length);
+#endif
 
 MemoryRegionSection *
 address_space_translate_for_iotlb(CPUState *cpu, int asidx, hwaddr addr,
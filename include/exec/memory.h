@@ -1957,6 +1957,18 @@ void memory_region_set_dirty(MemoryRegion *mr, hwaddr addr,
 bool memory_region_test_and_clear_dirty(MemoryRegion *mr, hwaddr addr,
                                         hwaddr size, unsigned client);
 
+/**
+ * memory_region_get_dirty: Check whether any byte in a range is dirty for a
+ *                          specified client, without clearing it.
+ *
+ * @mr: the memory region being queried.
+ * @addr: the address (relative to the start of the region) being queried.
+ * @size: the size of the range being queried.
+ * @client: the user of the logging information; typically %DIRTY_MEMORY_VGA.
+ */
+bool memory_region_get_dirty(MemoryRegion *mr, hwaddr addr, hwaddr size,
+                             unsigned client);
+
 /**
  * memory_region_set_client_dirty: Mark a range of bytes as dirty
  *                                 in a memory region for a specified client.
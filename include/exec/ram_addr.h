@@ -227,6 +227,51 @@ static inline bool cpu_physical_memory_all_dirty(ram_addr_t start,
     return dirty;
 }
 
+/*
+ * Returns the address of the first page in [start, start + length) whose
+ * dirty bit for client is set (or clear, if dirty is false), or the end of
+ * the range if there is none. The bitmap is not synced first.
+ */
+static inline ram_addr_t cpu_physical_memory_find_dirty(ram_addr_t start,
+                                                        ram_addr_t length,
+                                                        unsigned client,
+                                                        bool dirty)
+{
+    DirtyMemoryBlocks *blocks;
+    unsigned long end, page;
+    unsigned long idx, offset, base;
+
+    assert(client < DIRTY_MEMORY_NUM);
+
+    end = TARGET_PAGE_ALIGN(start + length) >> TARGET_PAGE_BITS;
+    page = start >> TARGET_PAGE_BITS;
+
+    RCU_READ_LOCK_GUARD();
+
+    blocks = qatomic_rcu_read(&ram_list.dirty_memory[client]);
+
+    idx = page / DIRTY_MEMORY_BLOCK_SIZE;
+    offset = page % DIRTY_MEMORY_BLOCK_SIZE;
+    base = page - offset;
+    while (page < end) {
+        unsigned long next = MIN(end, base + DIRTY_MEMORY_BLOCK_SIZE);
+        unsigned long num = next - base;
+        unsigned long found = dirty ?
+            find_next_bit(blocks->blocks[idx], num, offset) :
+            find_next_zero_bit(blocks->blocks[idx], num, offset);
+        if (found < num) {
+            return (ram_addr_t)(base + found) << TARGET_PAGE_BITS;
+        }
+
+        page = next;
+        idx++;
+        offset = 0;
+        base += DIRTY_MEMORY_BLOCK_SIZE;
+    }
+
+    return (ram_addr_t)end << TARGET_PAGE_BITS;
+}
+
 static inline bool cpu_physical_memory_get_dirty_flag(ram_addr_t addr,
                                                       unsigned client)
 {
@@ -237,11 +282,12 @@ static inline bool cpu_physical_memory_is_clean(ram_addr_t addr)
 {
     bool nv2a = cpu_physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_NV2A);
     bool nv2a_tex = cpu_physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_NV2A_TEX);
+    bool mcpx = cpu_physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_MCPX);
     bool vga = cpu_physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_VGA);
     bool code = cpu_physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_CODE);
     bool migration =
         cpu_physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_MIGRATION);
-    return !(nv2a && nv2a_tex && vga && code && migration);
+    return !(nv2a && nv2a_tex && mcpx && vga && code && migration);
 }
 
 static inline uint8_t cpu_physical_memory_range_includes_clean(ram_addr_t start,
@@ -258,6 +304,10 @@ static inline uint8_t cpu_physical_memory_range_includes_clean(ram_addr_t start,
         !cpu_physical_memory_all_dirty(start, length, DIRTY_MEMORY_NV2A_TEX)) {
         ret |= (1 << DIRTY_MEMORY_NV2A_TEX);
     }
+    if (mask & (1 << DIRTY_MEMORY_MCPX) &&
+        !cpu_physical_memory_all_dirty(start, length, DIRTY_MEMORY_MCPX)) {
+        ret |= (1 << DIRTY_MEMORY_MCPX);
+    }
     if (mask & (1 << DIRTY_MEMORY_VGA) &&
         !cpu_physical_memory_all_dirty(start, length, DIRTY_MEMORY_VGA)) {
         ret |= (1 << DIRTY_MEMORY_VGA);
@@ -339,6 +389,10 @@ static inline void cpu_physical_memory_set_dirty_range(ram_addr_t start,
                 bitmap_set_atomic(blocks[DIRTY_MEMORY_NV2A_TEX]->blocks[idx],
                                   offset, next - page);
             }
+            if (unlikely(mask & (1 << DIRTY_MEMORY_MCPX))) {
+                bitmap_set_atomic(blocks[DIRTY_MEMORY_MCPX]->blocks[idx],
+                                  offset, next - page);
+            }
 
             page = next;
             idx++;
@@ -389,6 +443,7 @@ static inline void cpu_physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
                     qatomic_or(&blocks[DIRTY_MEMORY_VGA][idx][offset], temp);
                     qatomic_or(&blocks[DIRTY_MEMORY_NV2A][idx][offset], temp);
                     qatomic_or(&blocks[DIRTY_MEMORY_NV2A_TEX][idx][offset], temp);
+                    qatomic_or(&blocks[DIRTY_MEMORY_MCPX][idx][offset], temp);
 
                     if (global_dirty_tracking) {
                         qatomic_or(
@@ -464,6 +519,7 @@ static inline void cpu_physical_memory_clear_dirty_range(ram_addr_t start,
     cpu_physical_memory_test_and_clear_dirty(start, length, DIRTY_MEMORY_VGA);
     cpu_physical_memory_test_and_clear_dirty(start, length, DIRTY_MEMORY_NV2A);
     cpu_physical_memory_test_and_clear_dirty(start, length, DIRTY_MEMORY_NV2A_TEX);
+    cpu_physical_memory_test_and_clear_dirty(start, length, DIRTY_MEMORY_MCPX);
     cpu_physical_memory_test_and_clear_dirty(start, length, DIRTY_MEMORY_CODE);
 }
 
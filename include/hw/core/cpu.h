@@ -27,6 +27,7 @@
 #include "exec/memattrs.h"
 #include "qapi/qapi-types-run-state.h"
 #include "qemu/bitmap.h"
+#include "qemu/interval-tree.h"
 #include "qemu/rcu_queue.h"
 #include "qemu/queue.h"
 #include "qemu/thread.h"
@@ -217,12 +218,10 @@ typedef struct CPUBreakpoint {
 typedef void (*MemAccessCallbackFunc)(void *opaque, MemoryRegion *mr, hwaddr addr, hwaddr len, bool write);
 
 typedef struct MemAccessCallback {
+    IntervalTreeNode node; /* Watched ram_addr range */
     MemoryRegion *mr;
-    hwaddr addr;
-    hwaddr len;
     MemAccessCallbackFunc func;
     void *opaque;
-    QTAILQ_ENTRY(MemAccessCallback) entry;
 } MemAccessCallback;
 #endif
 
@@ -396,7 +395,7 @@ struct CPUState {
     QTAILQ_HEAD(, CPUWatchpoint) watchpoints;
     CPUWatchpoint *watchpoint_hit;
 
-    QTAILQ_HEAD(, MemAccessCallback) mem_access_callbacks;
+    IntervalTreeRoot mem_access_callbacks;
 
     void *opaque;
 
@@ -0,0 +1,75 @@
+/*
+ * Interval tree over closed [start, last] ranges
+ *
+ * An AVL tree ordered by start address, where every node also tracks the
+ * largest end address in its subtree, so finding the ranges that overlap a
+ * query is logarithmic in the number of ranges stored. Ranges may overlap
+ * each other and share the same start.
+ *
+ * Nodes are embedded in the caller's structures and never allocated by the
+ * tree. There's no locking, callers serialize access themselves.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#ifndef QEMU_INTERVAL_TREE_H
+#define QEMU_INTERVAL_TREE_H
+
+typedef struct IntervalTreeNode {
+    struct IntervalTreeNode *left, *right;
+    uint64_t start;
+    uint64_t last;
+    uint64_t subtree_last;
+    int height;
+} IntervalTreeNode;
+
+typedef struct IntervalTreeRoot {
+    IntervalTreeNode *node;
+} IntervalTreeRoot;
+
+static inline bool interval_tree_empty(const IntervalTreeRoot *root)
+{
+    return root->node == NULL;
+}
+
+/**
+ * interval_tree_insert:
+ * @node: node with start and last set, not already in a tree
+ * @root: tree to add it to
+ */
+void interval_tree_insert(IntervalTreeNode *node, IntervalTreeRoot *root);
+
+/**
+ * interval_tree_remove:
+ * @node: node previously inserted into @root
+ * @root: tree to remove it from
+ */
+void interval_tree_remove(IntervalTreeNode *node, IntervalTreeRoot *root);
+
+/**
+ * interval_tree_iter_first:
+ * @root: tree to search
+ * @start: first address of the query
+ * @last: last address of the query, inclusive
+ *
+ * Returns the node with the lowest start that overlaps [@start, @last], or
+ * NULL if there's none.
+ */
+IntervalTreeNode *interval_tree_iter_first(IntervalTreeRoot *root,
+                                           uint64_t start, uint64_t last);
+
+/**
+ * interval_tree_iter_next:
+ * @root: tree to search
+ * @node: node previously returned for the same query
+ * @start: first address of the query
+ * @last: last address of the query, inclusive
+ *
+ * Returns the next node that overlaps [@start, @last] after @node, or NULL.
+ * The tree must not be modified between calls for the same query.
+ */
+IntervalTreeNode *interval_tree_iter_next(IntervalTreeRoot *root,
+                                          IntervalTreeNode *node,
+                                          uint64_t start, uint64_t last);
+
+#endif
@@ -0,0 +1,238 @@
+#!/usr/bin/env python3
+"""
+Write synthetic nv2a captures and check replays of them.
+
+The layout mirrors the NV2ACapture* structures in hw/xbox/nv2a/capture.c.
+Captures are only ever read in host byte order, as xemu writes them.
+
+A synthetic capture sets PGRAPH up through register chunks rather than a
+saved state, so it replays without ROMs or a captured guest:
+
+    xemu-nv2a-capture.py synth synthetic.cap
+    xemu -nv2a_replay synthetic.cap > replay.log
+    xemu-nv2a-capture.py check synthetic.cap replay.log
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+MAGIC = b'XNV2ACAP'
+VERSION = 1
+
+HEADER = struct.Struct('=8sIIQQ')
+CHUNK = struct.Struct('=IIQ')
+
+assert HEADER.size == 32
+assert CHUNK.size == 16
+
+CHUNK_STATE = 1
+CHUNK_VRAM = 2
+CHUNK_RAMIN = 3
+CHUNK_METHODS = 4
+CHUNK_FRAME = 5
+CHUNK_PGRAPH_REGS = 6
+
+VRAM_SIZE = 64 * 1024 * 1024
+RAMIN_SIZE = 1024 * 1024
+
+NV_PGRAPH_CTX_CONTROL = 0x144
+NV_PGRAPH_CTX_CONTROL_CHID = 1 << 16
+NV_PGRAPH_CTX_USER = 0x148
+NV_PGRAPH_FIFO = 0x720
+NV_PGRAPH_FIFO_ACCESS = 1 << 0
+
+NV_SET_OBJECT = 0x0000
+NV097_SET_FLIP_READ = 0x0120
+NV097_FLIP_INCREMENT_WRITE = 0x012C
+NV097_FLIP_STALL = 0x0130
+NV097_SET_TRANSFORM_CONSTANT = 0x0B80
+NV097_SET_TRANSFORM_CONSTANT_LOAD = 0x1EA4
+
+NV_KELVIN_PRIMITIVE = 0x97
+KELVIN_INSTANCE = 0x1000
+CONSTANTS_PER_RUN = 4
+MAX_CONSTANTS = 192
+
+
+def round_up(n, d):
+    return (n + d - 1) // d * d
+
+
+def run_header(method, count, subchannel=0):
+    # Same encoding as pfifo_queue_header() in hw/xbox/nv2a/pfifo.c
+    return (count << 18) | (subchannel << 13) | method
+
+
+def run_len(header):
+    # Bound objects are carried with their instance and channel
+    method = header & 0x1ffc
+    return 3 if method == NV_SET_OBJECT else 1 + ((header >> 18) & 0x7ff)
+
+
+def chunk(kind, payload=b'', addr=0):
+    pad = round_up(len(payload), 8) - len(payload)
+    return CHUNK.pack(kind, len(payload), addr) + payload + b'\0' * pad
+
+
+def words(values):
+    return struct.pack('=%dI' % len(values), *values)
+
+
+def synth(num_frames, constant_runs):
+    out = [HEADER.pack(MAGIC, VERSION, num_frames, VRAM_SIZE, RAMIN_SIZE)]
+
+    # A kelvin object for subchannel 0, on a channel PGRAPH already owns
+    out.append(chunk(CHUNK_RAMIN, words([NV_KELVIN_PRIMITIVE, 0, 0, 0]),
+                     KELVIN_INSTANCE))
+    out.append(chunk(CHUNK_PGRAPH_REGS, words([
+        NV_PGRAPH_FIFO, NV_PGRAPH_FIFO_ACCESS,
+        NV_PGRAPH_CTX_CONTROL, NV_PGRAPH_CTX_CONTROL_CHID,
+        NV_PGRAPH_CTX_USER, 0,
+    ])))
+
+    for frame in range(num_frames):
+        runs = []
+        if frame == 0:
+            runs += [run_header(NV_SET_OBJECT, 2), KELVIN_INSTANCE, 0]
+            # Flip read, write and modulo
+            runs += [run_header(NV097_SET_FLIP_READ, 3), 0, 0, 2]
+        runs += [run_header(NV097_SET_TRANSFORM_CONSTANT_LOAD, 1), 0]
+        for i in range(constant_runs):
+            runs.append(run_header(NV097_SET_TRANSFORM_CONSTANT,
+                                   CONSTANTS_PER_RUN * 4))
+            runs += [(frame << 16) | (i << 4) | j
+                     for j in range(CONSTANTS_PER_RUN * 4)]
+        runs += [run_header(NV097_FLIP_INCREMENT_WRITE, 1), 0]
+        runs += [run_header(NV097_FLIP_STALL, 1), 0]
+        out.append(chunk(CHUNK_METHODS, words(runs)))
+        out.append(chunk(CHUNK_FRAME))
+
+    return b''.join(out)
+
+
+def read_frames(path):
+    """Runs and words of each frame, as the replay counts them"""
+    with open(path, 'rb') as f:
+        data = f.read()
+    if len(data) < HEADER.size:
+        raise ValueError('file too small for header')
+    magic, version, num_frames, _, _ = HEADER.unpack_from(data)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError('not a version %d capture' % VERSION)
+
+    frames = []
+    runs = num_words = 0
+    pos = HEADER.size
+    while pos < len(data):
+        if pos + CHUNK.size > len(data):
+            raise ValueError('truncated chunk at %d' % pos)
+        kind, size, _ = CHUNK.unpack_from(data, pos)
+        payload = data[pos + CHUNK.size:pos + CHUNK.size + size]
+        if len(payload) != size:
+            raise ValueError('truncated chunk at %d' % pos)
+        if kind == CHUNK_METHODS:
+            run = struct.unpack('=%dI' % (size // 4), payload)
+            i = 0
+            while i < len(run):
+                n = run_len(run[i])
+                if i + n > len(run):
+                    raise ValueError('truncated method run at %d' % pos)
+                runs += 1
+                num_words += n
+                i += n
+        elif kind == CHUNK_FRAME:
+            frames.append((runs, num_words))
+            runs = num_words = 0
+        pos += CHUNK.size + round_up(size, 8)
+
+    if len(frames) != num_frames:
+        raise ValueError('header says %d frames, found %d' %
+                         (num_frames, len(frames)))
+    return frames
+
+
+def read_replay(path):
+    """Frame and summary lines from a replay's output"""
+    frames = []
+    summary = None
+    with open(path) as f:
+        for line in f:
+            if not line.startswith('{'):
+                continue
+            try:
+                record = json.loads(line)
+            except ValueError:
+                continue
+            if 'frame' in record:
+                frames.append(record)
+            elif 'frames' in record:
+                summary = record
+    return frames, summary
+
+
+def cmd_synth(args):
+    if args.constant_runs * CONSTANTS_PER_RUN > MAX_CONSTANTS:
+        print('at most %d constant runs fit' %
+              (MAX_CONSTANTS // CONSTANTS_PER_RUN), file=sys.stderr)
+        return 1
+    with open(args.capture, 'wb') as f:
+        f.write(synth(args.frames, args.constant_runs))
+    return 0
+
+
+def cmd_check(args):
+    expected = read_frames(args.capture)
+    frames, summary = read_replay(args.replay)
+    errors = []
+
+    if len(frames) != len(expected):
+        errors.append('replayed %d frames, capture has %d' %
+                      (len(frames), len(expected)))
+    for i, (record, (runs, num_words)) in enumerate(zip(frames, expected)):
+        got = (record.get('frame'), record.get('runs'), record.get('words'))
+        if got != (i, runs, num_words):
+            errors.append('frame %d: got frame %s, %s runs, %s words, '
+                          'expected %d runs, %d words' %
+                          ((i,) + got + (runs, num_words)))
+    if summary is None:
+        errors.append('replay did not finish')
+    elif summary['frames'] != len(expected):
+        errors.append('summary counts %d frames, capture has %d' %
+                      (summary['frames'], len(expected)))
+
+    for e in errors:
+        print('%s: %s' % (args.replay, e), file=sys.stderr)
+    if not errors:
+        print('%d frames replayed as captured' % len(expected))
+    return 1 if errors else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().split('\n')[0])
+    sub = parser.add_subparsers(dest='command', required=True)
+
+    p = sub.add_parser('synth', help='write a synthetic capture')
+    p.add_argument('capture')
+    p.add_argument('-f', '--frames', type=int, default=4,
+                   help='number of frames')
+    p.add_argument('-c', '--constant-runs', type=int, default=8,
+                   help='transform constant runs in each frame')
+    p.set_defaults(func=cmd_synth)
+
+    p = sub.add_parser('check', help='compare a replay with its capture')
+    p.add_argument('capture')
+    p.add_argument('replay', help='output of xemu -nv2a_replay')
+    p.set_defaults(func=cmd_check)
+
+    args = parser.parse_args()
+    try:
+        return args.func(args)
+    except (OSError, ValueError) as e:
+        print('%s: %s' % (args.capture, e), file=sys.stderr)
+        return 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
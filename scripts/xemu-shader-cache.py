@@ -0,0 +1,227 @@
+#!/usr/bin/env python3
+"""
+Inspect, verify and prune the nv2a shader archive (shader_cache.bin).
+
+The layout mirrors the ShaderArchive* structures in hw/xbox/nv2a/shaders.c.
+Archives are only ever read in host byte order, as xemu writes them.
+"""
+
+import argparse
+import os
+import struct
+import sys
+
+MAGIC = b'XSHADERS'
+VERSION = 2
+RECORD_MAGIC = 0x43455253
+
+HEADER = struct.Struct('=8sII64s128s128sIIQQII')
+INDEX_ENTRY = struct.Struct('=QQ')
+RECORD = struct.Struct('=IIQQII')
+
+assert HEADER.size == 368
+assert INDEX_ENTRY.size == 16
+assert RECORD.size == 32
+
+
+def crc32c(data, crc=0xffffffff):
+    # Same as crc32c(0xffffffff, ...) in util/crc32c.c, finalized
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = (crc >> 1) ^ (0x82F63B78 & -(crc & 1))
+    return crc ^ 0xffffffff
+
+
+def cstr(b):
+    return b.split(b'\0', 1)[0].decode(errors='replace')
+
+
+def round_up(n, d):
+    return (n + d - 1) // d * d
+
+
+class Archive:
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            self.data = f.read()
+        if len(self.data) < HEADER.size:
+            raise ValueError('file too small for header')
+        (self.magic, self.version, self.state_size, self.xemu_version,
+         self.gl_vendor, self.gl_renderer, self.binary_format,
+         self.num_entries, self.index_offset, self.journal_offset,
+         self.index_crc, self.header_crc) = HEADER.unpack_from(self.data)
+        if self.magic != MAGIC or self.version != VERSION:
+            raise ValueError('not a version %d shader archive' % VERSION)
+
+    def header_bytes(self, num_entries, index_offset, journal_offset,
+                     index_crc):
+        fields = [self.magic, self.version, self.state_size,
+                  self.xemu_version, self.gl_vendor, self.gl_renderer,
+                  self.binary_format, num_entries, index_offset,
+                  journal_offset, index_crc, 0]
+        fields[-1] = crc32c(HEADER.pack(*fields))
+        return HEADER.pack(*fields)
+
+    def header_ok(self):
+        expected = self.header_bytes(self.num_entries, self.index_offset,
+                                     self.journal_offset, self.index_crc)
+        return expected == self.data[:HEADER.size]
+
+    def index(self):
+        end = self.index_offset + self.num_entries * INDEX_ENTRY.size
+        if end != self.journal_offset or end > len(self.data):
+            raise ValueError('index out of bounds')
+        if crc32c(self.data[self.index_offset:end]) != self.index_crc:
+            raise ValueError('index checksum mismatch')
+        return [INDEX_ENTRY.unpack_from(self.data, self.index_offset + i *
+                                        INDEX_ENTRY.size)
+                for i in range(self.num_entries)]
+
+    def record(self, offset):
+        """Returns (hash, total record size) or None if the record is bad"""
+        if offset + RECORD.size + self.state_size > len(self.data):
+            return None
+        (magic, _, h, program_size, state_crc,
+         program_crc) = RECORD.unpack_from(self.data, offset)
+        state = offset + RECORD.size
+        program = state + self.state_size
+        if (magic != RECORD_MAGIC or
+                program + program_size > len(self.data) or
+                crc32c(self.data[state:program]) != state_crc or
+                crc32c(self.data[program:program + program_size]) !=
+                program_crc):
+            return None
+        return h, round_up(RECORD.size + self.state_size + program_size, 8)
+
+    def records(self):
+        """Yields (hash, offset, size, in_journal) for every valid record"""
+        for h, offset in self.index():
+            r = self.record(offset)
+            if r is None or r[0] != h:
+                print('warning: bad record for %016x at %d' % (h, offset),
+                      file=sys.stderr)
+                continue
+            yield h, offset, r[1], False
+        offset = self.journal_offset
+        while offset < len(self.data):
+            r = self.record(offset)
+            if r is None:
+                print('warning: %d trailing bytes in journal are not a valid '
+                      'record' % (len(self.data) - offset), file=sys.stderr)
+                break
+            yield r[0], offset, r[1], True
+            offset += r[1]
+
+    def write(self, path, records):
+        """Writes records (later ones win) out as a compacted archive"""
+        latest = {}
+        for h, offset, size, _ in records:
+            latest[h] = (offset, size)
+        body = bytearray()
+        index = bytearray()
+        for h in sorted(latest):
+            offset, size = latest[h]
+            index += INDEX_ENTRY.pack(h, HEADER.size + len(body))
+            body += self.data[offset:offset + size]
+        index_offset = HEADER.size + len(body)
+        header = self.header_bytes(len(latest), index_offset,
+                                   index_offset + len(index),
+                                   crc32c(bytes(index)))
+        tmp = path + '.tmp'
+        with open(tmp, 'wb') as f:
+            f.write(header)
+            f.write(body)
+            f.write(index)
+        os.replace(tmp, path)
+        return len(latest)
+
+
+def read_list(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    return [h for (h,) in struct.iter_unpack('=Q', data[:len(data) // 8 * 8])]
+
+
+def cmd_info(archive, args):
+    print('xemu version:  %s' % cstr(archive.xemu_version))
+    print('GL vendor:     %s' % cstr(archive.gl_vendor))
+    print('GL renderer:   %s' % cstr(archive.gl_renderer))
+    print('binary format: 0x%x' % archive.binary_format)
+    print('state size:    %d' % archive.state_size)
+    print('header:        %s' % ('ok' if archive.header_ok() else 'CORRUPT'))
+    print('indexed:       %d' % archive.num_entries)
+    print('journal bytes: %d' % (len(archive.data) - archive.journal_offset))
+    print('file size:     %d' % len(archive.data))
+    if args.list:
+        for h, offset, size, journal in archive.records():
+            print('%016x %10d %8d%s' % (h, offset, size,
+                                        ' (journal)' if journal else ''))
+    return 0
+
+
+def cmd_verify(archive, args):
+    if not archive.header_ok():
+        print('header checksum mismatch')
+        return 1
+    indexed = len(archive.index())
+    records = list(archive.records())
+    good = sum(1 for r in records if not r[3])
+    print('%d/%d indexed records ok, %d journal records' %
+          (good, indexed, len(records) - good))
+    return 0 if good == indexed else 1
+
+
+def cmd_prune(archive, args):
+    records = list(archive.records())
+    if args.keep_list:
+        keep = set(read_list(args.keep_list))
+        records = [r for r in records if r[0] in keep]
+    if args.max_entries is not None:
+        if args.keep_list:
+            # The reload list is ordered most recently used first
+            order = {h: i for i, h in enumerate(read_list(args.keep_list))}
+            records.sort(key=lambda r: order[r[0]])
+            records = records[:args.max_entries]
+            records.sort(key=lambda r: r[1])
+        else:
+            records = records[-args.max_entries:]
+    n = archive.write(args.output or args.archive, records)
+    print('wrote %d entries' % n)
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().split('\n')[0])
+    sub = parser.add_subparsers(dest='command', required=True)
+
+    p = sub.add_parser('info', help='show archive header')
+    p.add_argument('archive')
+    p.add_argument('-l', '--list', action='store_true',
+                   help='list every record')
+    p.set_defaults(func=cmd_info)
+
+    p = sub.add_parser('verify', help='check every checksum')
+    p.add_argument('archive')
+    p.set_defaults(func=cmd_verify)
+
+    p = sub.add_parser('prune', help='compact, optionally dropping entries')
+    p.add_argument('archive')
+    p.add_argument('-k', '--keep-list', metavar='SHADER_CACHE_LIST',
+                   help='drop entries not named in this reload list')
+    p.add_argument('-n', '--max-entries', type=int,
+                   help='keep at most this many entries')
+    p.add_argument('-o', '--output', help='write here instead of in place')
+    p.set_defaults(func=cmd_prune)
+
+    args = parser.parse_args()
+    try:
+        archive = Archive(args.archive)
+        return args.func(archive, args)
+    except (OSError, ValueError) as e:
+        print('%s: %s' % (args.archive, e), file=sys.stderr)
+        return 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -2210,7 +2210,8 @@ void memory_region_set_log(MemoryRegion *mr, bool log, unsigned client)
 #ifdef XBOX
     assert((client == DIRTY_MEMORY_VGA) \
         || (client == DIRTY_MEMORY_NV2A) \
-        || (client == DIRTY_MEMORY_NV2A_TEX));
+        || (client == DIRTY_MEMORY_NV2A_TEX) \
+        || (client == DIRTY_MEMORY_MCPX));
     if (mr->alias) {
         memory_region_set_log(mr->alias, log, client);
         return;
@@ -2313,6 +2314,19 @@ bool memory_region_test_and_clear_dirty(MemoryRegion *mr, hwaddr addr,
             memory_region_get_ram_addr(mr) + addr, size, client);
 }
 
+bool memory_region_get_dirty(MemoryRegion *mr, hwaddr addr, hwaddr size,
+                             unsigned client)
+{
+    if (mr->alias) {
+        return memory_region_get_dirty(mr->alias, addr - mr->alias_offset,
+                                       size, client);
+    }
+    assert(mr->terminates);
+    memory_region_sync_dirty_bitmap(mr);
+    return cpu_physical_memory_get_dirty(memory_region_get_ram_addr(mr) + addr,
+                                         size, client);
+}
+
 void memory_region_clear_dirty_bitmap(MemoryRegion *mr, hwaddr start,
                                       hwaddr len)
 {
@@ -858,27 +858,27 @@ void cpu_watchpoint_remove_all(CPUState *cpu, int mask)
 
 #ifdef XBOX
 
-static inline bool access_callback_address_matches(MemAccessCallback *cb,
-                                                   hwaddr addr, hwaddr len)
+int mem_access_callback_address_matches(CPUState *cpu, hwaddr addr, hwaddr len)
 {
-    hwaddr watch_end = cb->addr + cb->len - 1;
-    hwaddr access_end = addr + len - 1;
+    if (interval_tree_iter_first(&cpu->mem_access_callbacks,
+                                 addr, addr + len - 1)) {
+        return BP_MEM_READ | BP_MEM_WRITE;
+    }
 
-    return !(addr > watch_end || cb->addr > access_end);
+    return 0;
 }
 
-int mem_access_callback_address_matches(CPUState *cpu, hwaddr addr, hwaddr len)
+/*
+ * Drops the TLB entries of only the pages mapping the watched range, so they
+ * are refilled with or without the watchpoint flag as appropriate.
+ */
+static void mem_access_callback_flush(CPUState *cpu, MemAccessCallback *cb)
 {
-    int ret = 0;
+    ram_addr_t offset = cb->node.start - memory_region_get_ram_addr(cb->mr);
 
-    MemAccessCallback *cb;
-    QTAILQ_FOREACH(cb, &cpu->mem_access_callbacks, entry) {
-        if (access_callback_address_matches(cb, addr, len)) {
-            ret |= BP_MEM_READ | BP_MEM_WRITE;
-        }
-    }
-
-    return ret;
+    tlb_flush_host_range(cpu,
+                         (uint8_t *)memory_region_get_ram_ptr(cb->mr) + offset,
+                         cb->node.last - cb->node.start + 1);
 }
 
 int mem_access_callback_insert(CPUState *cpu, MemoryRegion *mr, hwaddr offset,
@@ -889,28 +889,25 @@ int mem_access_callback_insert(CPUState *cpu, MemoryRegion *mr, hwaddr offset,
 
     MemAccessCallback *cb_ = g_malloc(sizeof(*cb_));
     cb_->mr = mr;
-    cb_->addr = memory_region_get_ram_addr(mr) + offset;
-    cb_->len = len;
+    cb_->node.start = memory_region_get_ram_addr(mr) + offset;
+    cb_->node.last = cb_->node.start + len - 1;
     cb_->func = func;
     cb_->opaque = opaque;
-    QTAILQ_INSERT_TAIL(&cpu->mem_access_callbacks, cb_, entry);
+    interval_tree_insert(&cb_->node, &cpu->mem_access_callbacks);
     if (cb) {
         *cb = cb_;
     }
 
-    // FIXME: flush only applicable pages
-    tlb_flush(cpu);
+    mem_access_callback_flush(cpu, cb_);
 
     return 0;
 }
 
 void mem_access_callback_remove_by_ref(CPUState *cpu, MemAccessCallback *cb)
 {
-    QTAILQ_REMOVE(&cpu->mem_access_callbacks, cb, entry);
+    interval_tree_remove(&cb->node, &cpu->mem_access_callbacks);
+    mem_access_callback_flush(cpu, cb);
     g_free(cb);
-
-    // FIXME: flush only applicable pages
-    tlb_flush(cpu);
 }
 
 void mem_check_access_callback_vaddr(CPUState *cpu,
@@ -925,16 +922,19 @@ void mem_check_access_callback_vaddr(CPUState *cpu,
 void mem_check_access_callback_ramaddr(CPUState *cpu,
                                        hwaddr ram_addr, vaddr len, int flags)
 {
-    MemAccessCallback *cb;
-    QTAILQ_FOREACH(cb, &cpu->mem_access_callbacks, entry) {
-        if (access_callback_address_matches(cb, ram_addr, len)) {
-            ram_addr_t ram_addr_base = memory_region_get_ram_addr(cb->mr);
-            assert(ram_addr_base != RAM_ADDR_INVALID);
-            ram_addr_t hit_addr = MAX(ram_addr, cb->addr);
-            hwaddr mr_offset = hit_addr - ram_addr_base;
-            bool is_write = (flags & BP_MEM_WRITE) != 0;
-            cb->func(cb->opaque, cb->mr, mr_offset, len, is_write);
-        }
+    IntervalTreeRoot *root = &cpu->mem_access_callbacks;
+    hwaddr last = ram_addr + len - 1;
+    IntervalTreeNode *node;
+
+    for (node = interval_tree_iter_first(root, ram_addr, last); node;
+         node = interval_tree_iter_next(root, node, ram_addr, last)) {
+        MemAccessCallback *cb = container_of(node, MemAccessCallback, node);
+        ram_addr_t ram_addr_base = memory_region_get_ram_addr(cb->mr);
+        assert(ram_addr_base != RAM_ADDR_INVALID);
+        ram_addr_t hit_addr = MAX(ram_addr, node->start);
+        hwaddr mr_offset = hit_addr - ram_addr_base;
+        bool is_write = (flags & BP_MEM_WRITE) != 0;
+        cb->func(cb->opaque, cb->mr, mr_offset, len, is_write);
     }
 }
 
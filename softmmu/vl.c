@@ -2772,6 +2772,22 @@ void qemu_init(int argc, char **argv)
         }
     }
 
+    // Replay an nv2a capture in place of running the guest
+    char *replay_arg = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i] && strcmp(argv[i], "-nv2a_replay") == 0) {
+            argv[i] = NULL;
+            if (i < argc - 1 && argv[i+1]) {
+                char *escaped_replay_path = strdup_double_commas(argv[i+1]);
+                replay_arg = g_strdup_printf(",nv2a-replay=%s",
+                                             escaped_replay_path);
+                free(escaped_replay_path);
+                argv[i+1] = NULL;
+            }
+            break;
+        }
+    }
+
     const char *avpack_str = (const char *[]){
         "scart",
         "hdtv",
@@ -2782,16 +2798,18 @@ void qemu_init(int argc, char **argv)
         "none",
     }[g_config.sys.avpack];
 
-    fake_argv[fake_argc++] = g_strdup_printf("xbox%s%s%s,avpack=%s",
+    fake_argv[fake_argc++] = g_strdup_printf("xbox%s%s%s%s,avpack=%s",
         (bootrom_arg != NULL) ? bootrom_arg : "",
         g_config.general.skip_boot_anim ? ",short-animation=on" : "",
         ",kernel-irqchip=off",
+        (replay_arg != NULL) ? replay_arg : "",
         avpack_str
         );
 
     if (bootrom_arg != NULL) {
         g_free(bootrom_arg);
     }
+    g_free(replay_arg);
 
     const char *eeprom_path = get_eeprom_path();
     if (eeprom_path) {
@@ -0,0 +1,179 @@
+/*
+ * MCPX APU sample fetch speed benchmark
+ *
+ * Renders frames for a set of buffer voices, whose data is scattered over
+ * guest pages through an SGE table, either one sample at a time with the
+ * table looked up for every sample, or a page run at a time with the bulk
+ * conversion kernels.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include <math.h>
+#include "qemu/bswap.h"
+#include "hw/xbox/mcpx/apu_regs.h"
+#include "hw/xbox/mcpx/fpconv.h"
+#include "hw/xbox/mcpx/pcm.h"
+
+#define PAGE_SIZE 4096
+#define NUM_PAGES 1024
+#define NUM_VOICES 64
+#define FRAME_SAMPLES 32
+
+typedef struct PCMBenchOpts {
+    const char *name;
+    unsigned int sample_size;
+    unsigned int container_size;
+    bool stereo;
+    bool bulk;
+} PCMBenchOpts;
+
+static const PCMBenchOpts formats[] = {
+    { "u8-mono", NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_U8, 1, false },
+    { "u8-stereo", NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_U8, 1, true },
+    { "s16-mono", NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_S16, 2, false },
+    { "s16-stereo", NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_S16, 2, true },
+    { "s24-stereo", NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_S24, 4, true },
+    { "s32-stereo", NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_S32, 4, true },
+};
+
+/* Guest RAM, with the SGE table in the first two pages and data after it */
+static uint8_t *ram;
+
+static uint32_t sge_lookup(uint32_t linear_addr)
+{
+    uint32_t entry = linear_addr / PAGE_SIZE;
+    return ldl_le_p(&ram[entry * 8]) + linear_addr % PAGE_SIZE;
+}
+
+static float load_sample(const PCMBenchOpts *opts, uint32_t addr)
+{
+    switch (opts->sample_size) {
+    case NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_U8:
+        return uint8_to_float(ram[addr]);
+    case NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_S16:
+        return int16_to_float(lduw_le_p(&ram[addr]));
+    case NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_S24:
+        return int24_to_float(ldl_le_p(&ram[addr]));
+    default:
+        return int32_to_float(ldl_le_p(&ram[addr]));
+    }
+}
+
+static void render_per_sample(const PCMBenchOpts *opts, uint32_t linear_addr,
+                              size_t stride, float out[][2])
+{
+    for (int i = 0; i < FRAME_SAMPLES; i++) {
+        uint32_t addr = sge_lookup(linear_addr + i * stride);
+        out[i][0] = load_sample(opts, addr);
+        out[i][1] = opts->stereo ?
+                    load_sample(opts, addr + opts->container_size) :
+                    out[i][0];
+    }
+}
+
+static void render_bulk(const PCMBenchOpts *opts, uint32_t linear_addr,
+                        size_t stride, float out[][2])
+{
+    uint8_t buf[FRAME_SAMPLES * 8];
+    size_t len = FRAME_SAMPLES * stride;
+    size_t done = 0;
+    const uint8_t *src = NULL;
+
+    while (done < len) {
+        uint32_t offset = linear_addr + done;
+        size_t run = MIN(len - done, PAGE_SIZE - offset % PAGE_SIZE);
+        if (run == len) {
+            src = &ram[sge_lookup(offset)];
+            break;
+        }
+        memcpy(&buf[done], &ram[sge_lookup(offset)], run);
+        done += run;
+        src = buf;
+    }
+
+    pcm_to_float(out, src, FRAME_SAMPLES, stride, opts->sample_size,
+                 opts->container_size, opts->stereo);
+}
+
+static void test_pcm_speed(const void *opaque)
+{
+    const PCMBenchOpts *opts = opaque;
+    const unsigned int frames = 20000;
+    size_t stride = opts->container_size * (opts->stereo ? 2 : 1);
+    uint32_t voice_size = (NUM_PAGES - 2) * PAGE_SIZE / NUM_VOICES;
+    uint32_t cbo[NUM_VOICES];
+    float out[FRAME_SAMPLES][2];
+    float sum = 0;
+
+    for (int v = 0; v < NUM_VOICES; v++) {
+        cbo[v] = g_test_rand_int_range(0, voice_size / stride);
+    }
+
+    g_test_timer_start();
+    for (unsigned int frame = 0; frame < frames; frame++) {
+        for (int v = 0; v < NUM_VOICES; v++) {
+            if ((cbo[v] + FRAME_SAMPLES) * stride > voice_size) {
+                cbo[v] = 0;
+            }
+            uint32_t linear_addr = v * voice_size + cbo[v] * stride;
+            if (opts->bulk) {
+                render_bulk(opts, linear_addr, stride, out);
+            } else {
+                render_per_sample(opts, linear_addr, stride, out);
+            }
+            sum += out[0][0] + out[FRAME_SAMPLES - 1][1];
+            cbo[v] += FRAME_SAMPLES;
+        }
+    }
+    g_test_timer_elapsed();
+
+    g_test_message("%s %s: %.1f Msamples/sec (sum %f)", opts->name,
+                   opts->bulk ? "bulk" : "per-sample",
+                   (double)frames * NUM_VOICES * FRAME_SAMPLES / 1e6 /
+                   g_test_timer_last(), sum);
+}
+
+int main(int argc, char **argv)
+{
+    char name[96];
+
+    g_test_init(&argc, &argv, NULL);
+
+    /* Scatter the linear pages over physical ones, as a guest heap would */
+    ram = g_malloc(NUM_PAGES * PAGE_SIZE);
+    for (int i = 0; i < NUM_PAGES * PAGE_SIZE; i++) {
+        ram[i] = g_test_rand_int();
+    }
+    uint32_t *pages = g_new(uint32_t, NUM_PAGES - 2);
+    for (int i = 0; i < NUM_PAGES - 2; i++) {
+        pages[i] = i + 2;
+    }
+    for (int i = NUM_PAGES - 3; i > 0; i--) {
+        int j = g_test_rand_int_range(0, i + 1);
+        uint32_t tmp = pages[i];
+        pages[i] = pages[j];
+        pages[j] = tmp;
+    }
+    for (int i = 0; i < NUM_PAGES - 2; i++) {
+        stl_le_p(&ram[i * 8], pages[i] * PAGE_SIZE);
+        stl_le_p(&ram[i * 8 + 4], 0);
+    }
+    g_free(pages);
+
+    for (int i = 0; i < ARRAY_SIZE(formats); i++) {
+        for (int bulk = 0; bulk < 2; bulk++) {
+            PCMBenchOpts *o = g_memdup2(&formats[i], sizeof(formats[i]));
+            o->bulk = bulk;
+            snprintf(name, sizeof(name), "/mcpx/benchmark/pcm/%s/%s",
+                     o->name, bulk ? "bulk" : "per-sample");
+            g_test_add_data_func_full(name, o, test_pcm_speed, g_free);
+        }
+    }
+
+    int ret = g_test_run();
+    g_free(ram);
+    return ret;
+}
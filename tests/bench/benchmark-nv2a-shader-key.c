@@ -0,0 +1,115 @@
+/*
+ * nv2a shader key hashing speed benchmark
+ *
+ * Compares hashing the whole ShaderState on every dirty bind against
+ * rehashing only the blocks touched between draws, for a few method stream
+ * shapes seen in traces.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "hw/xbox/nv2a/shaders.h"
+
+#define SB(block) (1 << SHADER_BLOCK_ ## block)
+
+typedef struct ShaderKeyBenchOpts {
+    const char *name;
+    /* Blocks dirtied before each draw, cycled through */
+    unsigned int pattern[4];
+    bool incremental;
+} ShaderKeyBenchOpts;
+
+static const ShaderKeyBenchOpts streams[] = {
+    /* Same material, textures swapped per mesh */
+    { "texture-swap", { SB(TEXTURES), SB(TEXTURES), SB(TEXTURES), 0 } },
+    /* Material changes touch combiners and texture stages together */
+    { "material", { SB(COMBINERS) | SB(TEXTURES), SB(TEXTURES),
+                    SB(COMBINERS) | SB(TEXTURES), 0 } },
+    /* Fixed function lighting toggled between passes */
+    { "fixed-function", { SB(VERTEX), SB(VERTEX) | SB(TEXTURES),
+                          SB(VERTEX), SB(RASTER) } },
+    /* Skinned meshes reload the vertex program for every draw */
+    { "vertex-program", { SB(VERTEX_PROGRAM), SB(VERTEX_PROGRAM) | SB(TEXTURES),
+                          SB(VERTEX_PROGRAM), SB(VERTEX_PROGRAM) } },
+    { "everything", { SHADER_BLOCK_ALL, SHADER_BLOCK_ALL, SHADER_BLOCK_ALL,
+                      SHADER_BLOCK_ALL } },
+};
+
+static void fill_random(void *buf, size_t len)
+{
+    uint8_t *p = buf;
+    for (size_t i = 0; i < len; i++) {
+        p[i] = g_test_rand_int();
+    }
+}
+
+static void test_shader_key_speed(const void *opaque)
+{
+    const ShaderKeyBenchOpts *opts = opaque;
+    const unsigned int draws = 4 * 1000 * 1000;
+    ShaderState *variants = g_new(ShaderState, 2);
+    ShaderState *state = g_new0(ShaderState, 1);
+    uint64_t block_hash[SHADER_BLOCK__COUNT] = { 0 };
+    uint64_t key = 0;
+
+    /* Stand-ins for two register configurations the stream alternates between */
+    fill_random(variants, 2 * sizeof(ShaderState));
+
+    g_test_timer_start();
+    for (unsigned int draw = 0; draw < draws; draw++) {
+        const ShaderState *src = &variants[draw & 1];
+        unsigned int dirty = opts->pattern[draw % ARRAY_SIZE(opts->pattern)];
+        if (!dirty) {
+            continue;
+        }
+
+        if (!opts->incremental) {
+            memset(state, 0, sizeof(ShaderState));
+            memcpy(state, src, sizeof(ShaderState));
+            key ^= fast_hash((const uint8_t *)state, sizeof(ShaderState));
+            continue;
+        }
+
+        for (int i = 0; i < SHADER_BLOCK__COUNT; i++) {
+            if (!(dirty & (1 << i))) {
+                continue;
+            }
+            size_t start, end;
+            shader_state_block_range(i, &start, &end);
+            memset((uint8_t *)state + start, 0, end - start);
+            memcpy((uint8_t *)state + start, (const uint8_t *)src + start,
+                   end - start);
+            block_hash[i] = shader_state_hash_block(state, i);
+        }
+        key ^= shader_state_hash_blocks(block_hash);
+    }
+    g_test_timer_elapsed();
+
+    g_test_message("%s %s: %.1f ns/draw (key %016" PRIx64 ")",
+                   opts->name, opts->incremental ? "incremental" : "full",
+                   g_test_timer_last() * 1e9 / draws, key);
+
+    g_free(state);
+    g_free(variants);
+}
+
+int main(int argc, char **argv)
+{
+    char name[96];
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (int i = 0; i < ARRAY_SIZE(streams); i++) {
+        for (int incremental = 0; incremental < 2; incremental++) {
+            ShaderKeyBenchOpts *o = g_memdup2(&streams[i], sizeof(streams[i]));
+            o->incremental = incremental;
+            snprintf(name, sizeof(name), "/nv2a/benchmark/shader-key/%s/%s",
+                     o->name, incremental ? "incremental" : "full");
+            g_test_add_data_func_full(name, o, test_shader_key_speed, g_free);
+        }
+    }
+
+    return g_test_run();
+}
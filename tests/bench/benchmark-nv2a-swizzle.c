@@ -0,0 +1,76 @@
+/*
+ * nv2a texture swizzling speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "hw/xbox/nv2a/swizzle.h"
+
+typedef struct SwizzleBenchOpts {
+    unsigned int width, height, depth;
+    unsigned int bpp;
+    bool unswizzle;
+} SwizzleBenchOpts;
+
+static void test_swizzle_speed(const void *opaque)
+{
+    const SwizzleBenchOpts *opts = opaque;
+    size_t size = (size_t)opts->width * opts->height * opts->depth * opts->bpp;
+    unsigned int row_pitch = opts->width * opts->bpp;
+    unsigned int slice_pitch = row_pitch * opts->height;
+    const size_t total = 1 * GiB;
+    size_t remain;
+
+    uint8_t *in = g_malloc(size);
+    uint8_t *out = g_malloc(size);
+    memset(in, g_test_rand_int(), size);
+
+    g_test_timer_start();
+    for (remain = total; remain >= size; remain -= size) {
+        if (opts->unswizzle) {
+            unswizzle_box(in, opts->width, opts->height, opts->depth, out,
+                          row_pitch, slice_pitch, opts->bpp);
+        } else {
+            swizzle_box(in, opts->width, opts->height, opts->depth, out,
+                        row_pitch, slice_pitch, opts->bpp);
+        }
+    }
+    g_test_timer_elapsed();
+
+    g_test_message("%s %ux%ux%u bpp %u: %.2f MB/sec",
+                   opts->unswizzle ? "unswizzle" : "swizzle",
+                   opts->width, opts->height, opts->depth, opts->bpp,
+                   (total - remain) / MiB / g_test_timer_last());
+
+    g_free(out);
+    g_free(in);
+}
+
+int main(int argc, char **argv)
+{
+    static SwizzleBenchOpts opts[] = {
+        { 64, 64, 1, 4 },     { 256, 256, 1, 1 },   { 256, 256, 1, 2 },
+        { 256, 256, 1, 4 },   { 1024, 1024, 1, 4 }, { 512, 512, 1, 2 },
+        { 64, 64, 64, 4 },    { 1024, 1, 1, 4 },
+    };
+    char name[96];
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (int i = 0; i < ARRAY_SIZE(opts); i++) {
+        for (int unswizzle = 0; unswizzle < 2; unswizzle++) {
+            SwizzleBenchOpts *o = g_memdup2(&opts[i], sizeof(opts[i]));
+            o->unswizzle = unswizzle;
+            snprintf(name, sizeof(name),
+                     "/nv2a/benchmark/%s/%ux%ux%u/bpp-%u",
+                     unswizzle ? "unswizzle" : "swizzle",
+                     o->width, o->height, o->depth, o->bpp);
+            g_test_add_data_func_full(name, o, test_swizzle_speed, g_free);
+        }
+    }
+
+    return g_test_run();
+}
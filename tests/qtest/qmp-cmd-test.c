@@ -342,6 +342,47 @@ static void test_object_add_failure_modes(void)
     qtest_quit(qts);
 }
 
+static void assert_nv2a_profile_disabled(QTestState *qts)
+{
+    QDict *resp, *ret;
+
+    resp = qtest_qmp(qts, "{'execute': 'x-query-nv2a-profile'}");
+    g_assert_nonnull(resp);
+    ret = qdict_get_qdict(resp, "return");
+    g_assert_nonnull(ret);
+    g_assert_cmpstr(qdict_get_str(ret, "human-readable-text"), ==,
+                    "{\"enabled\": false}\n");
+    qobject_unref(resp);
+}
+
+static void test_nv2a_profile_state(void)
+{
+    QTestState *qts;
+    QDict *resp;
+
+    qts = qtest_init(common_args);
+
+    /* querying must not turn timing on */
+    assert_nv2a_profile_disabled(qts);
+    assert_nv2a_profile_disabled(qts);
+
+    /* nothing to time without an NV2A */
+    resp = qtest_qmp(qts, "{'execute': 'x-nv2a-profile-set-state',"
+                     " 'arguments': {'enable': true}}");
+    g_assert_nonnull(resp);
+    qmp_expect_error_and_unref(resp, "GenericError");
+    assert_nv2a_profile_disabled(qts);
+
+    resp = qtest_qmp(qts, "{'execute': 'x-nv2a-profile-set-state',"
+                     " 'arguments': {'enable': false}}");
+    g_assert_nonnull(resp);
+    g_assert(qdict_haskey(resp, "return"));
+    qobject_unref(resp);
+    assert_nv2a_profile_disabled(qts);
+
+    qtest_quit(qts);
+}
+
 int main(int argc, char *argv[])
 {
     QmpSchema schema;
@@ -354,6 +395,7 @@ int main(int argc, char *argv[])
 
     qtest_add_func("qmp/object-add-failure-modes",
                    test_object_add_failure_modes);
+    qtest_add_func("qmp/nv2a-profile-state", test_nv2a_profile_state);
 
     ret = g_test_run();
 
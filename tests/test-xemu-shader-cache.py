@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+#
+# Check scripts/xemu-shader-cache.py against a shader archive in the format
+# hw/xbox/nv2a/shaders.c writes: two indexed records, followed by a journal
+# holding a new record and a newer copy of an indexed one.
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+
+import importlib.util
+import os
+import shutil
+import sys
+import tempfile
+import unittest
+
+SCRIPT = sys.argv[1]
+ARCHIVE = sys.argv[2]
+
+spec = importlib.util.spec_from_file_location('xemu_shader_cache', SCRIPT)
+xsc = importlib.util.module_from_spec(spec)
+spec.loader.exec_module(xsc)
+
+
+class TestShaderCache(unittest.TestCase):
+    def setUp(self):
+        self.tmpdir = tempfile.mkdtemp()
+
+    def tearDown(self):
+        shutil.rmtree(self.tmpdir)
+
+    def test_crc32c(self):
+        # Check value of CRC-32C (Castagnoli), as util/crc32c.c computes it
+        self.assertEqual(xsc.crc32c(b'123456789'), 0xe3069283)
+
+    def test_read(self):
+        archive = xsc.Archive(ARCHIVE)
+        self.assertTrue(archive.header_ok())
+        self.assertEqual(xsc.cstr(archive.gl_vendor), 'test vendor')
+        self.assertEqual([h for h, _ in archive.index()],
+                         [0x1111222233334444, 0x9999aaaabbbbcccc])
+        records = [(h, journal) for h, _, _, journal in archive.records()]
+        self.assertEqual(records, [(0x1111222233334444, False),
+                                   (0x9999aaaabbbbcccc, False),
+                                   (0x5555666677778888, True),
+                                   (0x1111222233334444, True)])
+
+    def test_prune_round_trip(self):
+        archive = xsc.Archive(ARCHIVE)
+        records = list(archive.records())
+        out = os.path.join(self.tmpdir, 'shader_cache.bin')
+        self.assertEqual(archive.write(out, records), 3)
+
+        pruned = xsc.Archive(out)
+        self.assertTrue(pruned.header_ok())
+        self.assertEqual(pruned.journal_offset, len(pruned.data))
+        latest = {h: archive.data[offset:offset + size]
+                  for h, offset, size, _ in records}
+        for h, offset, size, journal in pruned.records():
+            self.assertFalse(journal)
+            self.assertEqual(pruned.data[offset:offset + size], latest.pop(h))
+        self.assertEqual(latest, {})
+
+
+if __name__ == '__main__':
+    unittest.main(argv=sys.argv[:1])
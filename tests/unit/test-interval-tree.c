@@ -0,0 +1,141 @@
+/*
+ * Test interval tree
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/interval-tree.h"
+
+#define NUM_NODES 1000
+
+typedef struct TestRange {
+    IntervalTreeNode node;
+    bool inserted;
+} TestRange;
+
+static int check_subtree(IntervalTreeNode *n, uint64_t *subtree_last)
+{
+    uint64_t left_last = 0, right_last = 0;
+    uint64_t expected = 0;
+    int left, right;
+
+    if (!n) {
+        return 0;
+    }
+
+    left = check_subtree(n->left, &left_last);
+    right = check_subtree(n->right, &right_last);
+    g_assert_cmpint(abs(left - right), <=, 1);
+    g_assert_cmpint(n->height, ==, 1 + MAX(left, right));
+
+    expected = n->last;
+    if (n->left) {
+        g_assert_cmpuint(n->left->start, <=, n->start);
+        expected = MAX(expected, left_last);
+    }
+    if (n->right) {
+        g_assert_cmpuint(n->right->start, >=, n->start);
+        expected = MAX(expected, right_last);
+    }
+    g_assert_cmpuint(n->subtree_last, ==, expected);
+
+    *subtree_last = expected;
+    return n->height;
+}
+
+static void check_query(IntervalTreeRoot *root, TestRange *ranges,
+                        uint64_t start, uint64_t last)
+{
+    IntervalTreeNode *n;
+    unsigned int found = 0, expected = 0;
+    uint64_t prev_start = 0;
+
+    for (n = interval_tree_iter_first(root, start, last); n;
+         n = interval_tree_iter_next(root, n, start, last)) {
+        g_assert_cmpuint(n->start, <=, last);
+        g_assert_cmpuint(n->last, >=, start);
+        g_assert_cmpuint(n->start, >=, prev_start);
+        prev_start = n->start;
+        found++;
+    }
+
+    for (int i = 0; i < NUM_NODES; i++) {
+        if (ranges[i].inserted && ranges[i].node.start <= last &&
+            ranges[i].node.last >= start) {
+            expected++;
+        }
+    }
+    g_assert_cmpuint(found, ==, expected);
+}
+
+static void test_interval_tree_basic(void)
+{
+    IntervalTreeRoot root = { 0 };
+    IntervalTreeNode a = { .start = 0x1000, .last = 0x1fff };
+    IntervalTreeNode b = { .start = 0x1800, .last = 0x27ff };
+    IntervalTreeNode c = { .start = 0x1000, .last = 0x1000 };
+
+    g_assert_true(interval_tree_empty(&root));
+    interval_tree_insert(&a, &root);
+    interval_tree_insert(&b, &root);
+    interval_tree_insert(&c, &root);
+
+    g_assert_null(interval_tree_iter_first(&root, 0, 0xfff));
+    g_assert_null(interval_tree_iter_first(&root, 0x2800, UINT64_MAX));
+    g_assert_true(interval_tree_iter_first(&root, 0x2000, 0x2000) == &b);
+
+    /* Both ranges starting at 0x1000 come first, in some order */
+    IntervalTreeNode *n = interval_tree_iter_first(&root, 0x1000, 0x1800);
+    IntervalTreeNode *m = interval_tree_iter_next(&root, n, 0x1000, 0x1800);
+    g_assert_true((n == &a && m == &c) || (n == &c && m == &a));
+    g_assert_true(interval_tree_iter_next(&root, m, 0x1000, 0x1800) == &b);
+    g_assert_null(interval_tree_iter_next(&root, &b, 0x1000, 0x1800));
+
+    interval_tree_remove(&a, &root);
+    g_assert_true(interval_tree_iter_first(&root, 0x1001, 0x17ff) == NULL);
+    interval_tree_remove(&c, &root);
+    interval_tree_remove(&b, &root);
+    g_assert_true(interval_tree_empty(&root));
+}
+
+static void test_interval_tree_random(void)
+{
+    IntervalTreeRoot root = { 0 };
+    TestRange *ranges = g_new0(TestRange, NUM_NODES);
+    uint64_t subtree_last;
+
+    for (int i = 0; i < 100000; i++) {
+        TestRange *r = &ranges[g_test_rand_int_range(0, NUM_NODES)];
+
+        if (r->inserted) {
+            interval_tree_remove(&r->node, &root);
+        } else {
+            /* Mostly small ranges, a few spanning many others */
+            uint64_t len = g_test_rand_int_range(0, 10) ? 64 : 8192;
+            r->node.start = g_test_rand_int_range(0, 1 << 20);
+            r->node.last = r->node.start + g_test_rand_int_range(0, len);
+            interval_tree_insert(&r->node, &root);
+        }
+        r->inserted = !r->inserted;
+
+        if (i % 1000 == 0) {
+            check_subtree(root.node, &subtree_last);
+        }
+
+        uint64_t start = g_test_rand_int_range(0, 1 << 20);
+        check_query(&root, ranges, start,
+                    start + g_test_rand_int_range(0, 4096));
+    }
+
+    g_free(ranges);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/interval-tree/basic", test_interval_tree_basic);
+    g_test_add_func("/interval-tree/random", test_interval_tree_random);
+    return g_test_run();
+}
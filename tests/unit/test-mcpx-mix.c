@@ -0,0 +1,187 @@
+/*
+ * Test MCPX APU mixing kernels
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "hw/xbox/mcpx/fpconv.h"
+#include "hw/xbox/mcpx/mix.h"
+
+/* Odd so every kernel also goes through its scalar tail */
+#define NUM_SAMPLES 1027
+
+/* Largest difference in units in the last place tolerated between kernels */
+#define MAX_ULPS 1
+
+static void fill_random(float *buf, int count, double range)
+{
+    for (int i = 0; i < count; i++) {
+        buf[i] = g_test_rand_double_range(-range, range);
+    }
+}
+
+static int64_t float_ordered(float f)
+{
+    int32_t i;
+    memcpy(&i, &f, sizeof(i));
+    return i < 0 ? (int64_t)INT32_MIN - i : i;
+}
+
+static void assert_float_close(float actual, float expected)
+{
+    if (isnan(expected)) {
+        g_assert_true(isnan(actual));
+        return;
+    }
+    g_assert_cmpint(llabs(float_ordered(actual) - float_ordered(expected)),
+                    <=, MAX_ULPS);
+}
+
+static void check_accumulate(void)
+{
+    float *src = g_new(float, NUM_SAMPLES);
+    float *dst = g_new(float, NUM_SAMPLES);
+    float *ref = g_new(float, NUM_SAMPLES);
+    float gain = g_test_rand_double_range(0, 1);
+
+    fill_random(src, NUM_SAMPLES, 2);
+    fill_random(dst, NUM_SAMPLES, 2);
+    memcpy(ref, dst, NUM_SAMPLES * sizeof(*ref));
+
+    for (int i = 0; i < NUM_SAMPLES; i++) {
+        ref[i] += gain * src[i];
+    }
+    mix_accumulate(dst, src, gain, NUM_SAMPLES);
+    for (int i = 0; i < NUM_SAMPLES; i++) {
+        assert_float_close(dst[i], ref[i]);
+    }
+
+    g_free(src);
+    g_free(dst);
+    g_free(ref);
+}
+
+static void check_clamp(void)
+{
+    float *buf = g_new(float, NUM_SAMPLES);
+    float *ref = g_new(float, NUM_SAMPLES);
+
+    fill_random(buf, NUM_SAMPLES, 4);
+    buf[0] = NAN;
+    buf[1] = INFINITY;
+    buf[2] = -INFINITY;
+    buf[NUM_SAMPLES - 1] = NAN;
+    for (int i = 0; i < NUM_SAMPLES; i++) {
+        ref[i] = fmin(fmax(buf[i], -1.0), 1.0);
+    }
+
+    mix_clamp(buf, -1.0f, 1.0f, NUM_SAMPLES);
+    for (int i = 0; i < NUM_SAMPLES; i++) {
+        g_assert_true(buf[i] == ref[i]);
+    }
+
+    g_free(buf);
+    g_free(ref);
+}
+
+static void check_svf_lp(void)
+{
+    float *left = g_new(float, NUM_SAMPLES);
+    float *right = g_new(float, NUM_SAMPLES);
+    float *ref_left = g_new(float, NUM_SAMPLES);
+    float *ref_right = g_new(float, NUM_SAMPLES);
+    sv_filter filters[2], ref_filters[2];
+
+    memset(filters, 0, sizeof(filters));
+    setup_svf(&filters[0], 0.2f, 0.7f, F_LP);
+    setup_svf(&filters[1], 0.05f, 1.3f, F_LP);
+    filters[0].l = 0.1f;
+    filters[1].b = -0.2f;
+    memcpy(ref_filters, filters, sizeof(filters));
+    ref_filters[0].op = &ref_filters[0].l;
+    ref_filters[1].op = &ref_filters[1].l;
+
+    fill_random(left, NUM_SAMPLES, 1);
+    fill_random(right, NUM_SAMPLES, 1);
+    for (int i = 0; i < NUM_SAMPLES; i++) {
+        ref_left[i] = run_svf(&ref_filters[0], left[i]);
+        ref_right[i] = run_svf(&ref_filters[1], right[i]);
+    }
+
+    /* In two calls, to check the filter state carries over */
+    mix_svf_lp(&filters[0], &filters[1], left, right, 100);
+    mix_svf_lp(&filters[0], &filters[1], &left[100], &right[100],
+               NUM_SAMPLES - 100);
+    for (int i = 0; i < NUM_SAMPLES; i++) {
+        assert_float_close(left[i], ref_left[i]);
+        assert_float_close(right[i], ref_right[i]);
+    }
+    for (int ch = 0; ch < 2; ch++) {
+        assert_float_close(filters[ch].h, ref_filters[ch].h);
+        assert_float_close(filters[ch].b, ref_filters[ch].b);
+        assert_float_close(filters[ch].l, ref_filters[ch].l);
+        assert_float_close(filters[ch].n, ref_filters[ch].n);
+        assert_float_close(filters[ch].p, ref_filters[ch].p);
+    }
+
+    g_free(left);
+    g_free(right);
+    g_free(ref_left);
+    g_free(ref_right);
+}
+
+static void check_float_to_24b(void)
+{
+    static const float edges[] = {
+        0.0f, -0.0f, 1.0f, -1.0f, 2.0f, -2.0f, 0x7fffff / 8388608.0f,
+        0x7ffffe / 8388608.0f, 0.5f / 8388608.0f, 1.5f / 8388608.0f,
+        -0.5f / 8388608.0f, -2.5f / 8388608.0f, 1e-40f, INFINITY,
+        -INFINITY, NAN, 1e38f, -1e38f,
+    };
+
+    float *src = g_new(float, NUM_SAMPLES);
+    uint32_t *dst = g_new(uint32_t, NUM_SAMPLES);
+
+    fill_random(src, NUM_SAMPLES, 1.1);
+    memcpy(&src[17], edges, sizeof(edges));
+
+    mix_float_to_24b(dst, src, NUM_SAMPLES);
+    for (int i = 0; i < NUM_SAMPLES; i++) {
+        g_assert_cmphex(dst[i], ==, float_to_24b(src[i]));
+    }
+
+    g_free(src);
+    g_free(dst);
+}
+
+/* Every kernel against the scalar code, for each instruction set available */
+static void test_kernels(void)
+{
+    do {
+        check_accumulate();
+        check_clamp();
+        check_svf_lp();
+        check_float_to_24b();
+    } while (mix_test_next_accel());
+}
+
+static void test_attenuate(void)
+{
+    for (int vol = 0; vol < 0x1000; vol++) {
+        float expected = (vol == 0xFFF) ? 0.0
+                         : powf(10.0f, vol / (64.0 * -20.0f));
+        g_assert_true(mix_attenuate(vol) == expected);
+        g_assert_true(mix_attenuate(vol | 0xF000) == expected);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/mcpx/mix/kernels", test_kernels);
+    g_test_add_func("/mcpx/mix/attenuate", test_attenuate);
+    return g_test_run();
+}
@@ -0,0 +1,228 @@
+/*
+ * Test nv2a S3TC texture decompression
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "hw/xbox/nv2a/s3tc.h"
+
+typedef struct S3TCBlock {
+    const char *name;
+    GLint format;
+    uint8_t data[16];
+} S3TCBlock;
+
+/* Blocks exercising the palette modes of each format */
+static const S3TCBlock corpus[] = {
+    { "dxt1-opaque", GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,
+      { 0xFF, 0xFF, 0x00, 0x00, 0xE4, 0xE4, 0xE4, 0xE4 } },
+    { "dxt1-punchthrough", GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,
+      { 0x00, 0x00, 0xFF, 0xFF, 0x1B, 0x1B, 0x1B, 0x1B } },
+    { "dxt1-equal-endpoints", GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,
+      { 0x1F, 0xF8, 0x1F, 0xF8, 0xFF, 0x00, 0xAA, 0x55 } },
+    { "dxt1-green", GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,
+      { 0xE0, 0x07, 0x20, 0x00, 0x4E, 0x93, 0x39, 0xE4 } },
+    { "dxt3-alpha-ramp", GL_COMPRESSED_RGBA_S3TC_DXT3_EXT,
+      { 0x10, 0x32, 0x54, 0x76, 0x98, 0xBA, 0xDC, 0xFE,
+        0x00, 0xF8, 0x1F, 0x00, 0xE4, 0x1B, 0x4E, 0xB1 } },
+    { "dxt3-c0-less-than-c1", GL_COMPRESSED_RGBA_S3TC_DXT3_EXT,
+      { 0xFF, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0xFF, 0x00,
+        0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF } },
+    { "dxt5-eight-alpha", GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
+      { 0xF0, 0x10, 0x88, 0xC6, 0xFA, 0x88, 0xC6, 0xFA,
+        0x1F, 0x00, 0xE0, 0x07, 0xE4, 0xE4, 0x1B, 0x1B } },
+    { "dxt5-six-alpha", GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
+      { 0x10, 0xF0, 0x88, 0xC6, 0xFA, 0x88, 0xC6, 0xFA,
+        0x1F, 0x00, 0xE0, 0x07, 0x00, 0x55, 0xAA, 0xFF } },
+    { "dxt5-zero-alpha", GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
+      { 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00 } },
+};
+
+/* Reference decoder: straightforward per-texel evaluation of the formats */
+static void ref_decode_colors(uint16_t c0, uint16_t c1, bool transparent,
+                              uint8_t r[4], uint8_t g[4], uint8_t b[4],
+                              uint8_t a[4])
+{
+    r[0] = ((c0 & 0xF800) >> 8) * 0xFF / 0xF8;
+    g[0] = ((c0 & 0x07E0) >> 3) * 0xFF / 0xFC;
+    b[0] = ((c0 & 0x001F) << 3) * 0xFF / 0xF8;
+    r[1] = ((c1 & 0xF800) >> 8) * 0xFF / 0xF8;
+    g[1] = ((c1 & 0x07E0) >> 3) * 0xFF / 0xFC;
+    b[1] = ((c1 & 0x001F) << 3) * 0xFF / 0xF8;
+    a[0] = a[1] = a[2] = a[3] = 255;
+
+    if (transparent) {
+        r[2] = (r[0] + r[1]) / 2;
+        g[2] = (g[0] + g[1]) / 2;
+        b[2] = (b[0] + b[1]) / 2;
+        r[3] = g[3] = b[3] = a[3] = 0;
+    } else {
+        r[2] = (2 * r[0] + r[1]) / 3;
+        g[2] = (2 * g[0] + g[1]) / 3;
+        b[2] = (2 * b[0] + b[1]) / 3;
+        r[3] = (r[0] + 2 * r[1]) / 3;
+        g[3] = (g[0] + 2 * g[1]) / 3;
+        b[3] = (b[0] + 2 * b[1]) / 3;
+    }
+}
+
+static uint32_t ref_decode_texel(GLint format, const uint8_t *block,
+                                 unsigned int x, unsigned int y)
+{
+    unsigned int t = 4 * y + x;
+    const uint8_t *color = format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT ?
+                           block : block + 8;
+    uint16_t c0 = lduw_le_p(color), c1 = lduw_le_p(color + 2);
+    uint8_t r[4], g[4], b[4], a[4];
+    ref_decode_colors(c0, c1,
+                      format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT && c0 <= c1,
+                      r, g, b, a);
+
+    unsigned int index = (ldl_le_p(color + 4) >> (2 * t)) & 3;
+    uint8_t alpha = a[index];
+
+    if (format == GL_COMPRESSED_RGBA_S3TC_DXT3_EXT) {
+        alpha = ((ldq_le_p(block) >> (4 * t)) & 0xF) * 0xFF / 0xF;
+    } else if (format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT) {
+        unsigned int a0 = block[0], a1 = block[1];
+        unsigned int ai = (ldq_le_p(block) >> (16 + 3 * t)) & 7;
+        if (ai == 0) {
+            alpha = a0;
+        } else if (ai == 1) {
+            alpha = a1;
+        } else if (a0 > a1) {
+            alpha = ((8 - ai) * a0 + (ai - 1) * a1) / 7;
+        } else if (ai == 6) {
+            alpha = 0;
+        } else if (ai == 7) {
+            alpha = 255;
+        } else {
+            alpha = ((6 - ai) * a0 + (ai - 1) * a1) / 5;
+        }
+    }
+
+    return (r[index] << 24) | (g[index] << 16) | (b[index] << 8) | alpha;
+}
+
+static void check_2d(GLint format, const uint8_t *data, unsigned int width,
+                     unsigned int height)
+{
+    unsigned int block_size = format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT ?
+                              8 : 16;
+    uint32_t *out = (uint32_t *)decompress_2d_texture_data(format, data,
+                                                           width, height);
+
+    for (unsigned int y = 0; y < height; y++) {
+        for (unsigned int x = 0; x < width; x++) {
+            const uint8_t *block =
+                data + ((y / 4) * (width / 4) + x / 4) * block_size;
+            g_assert_cmphex(out[y * width + x], ==,
+                            ref_decode_texel(format, block, x % 4, y % 4));
+        }
+    }
+
+    g_free(out);
+}
+
+static void test_corpus(const void *opaque)
+{
+    const S3TCBlock *block = opaque;
+    check_2d(block->format, block->data, 4, 4);
+}
+
+static void test_random_2d(const void *opaque)
+{
+    GLint format = GPOINTER_TO_INT(opaque);
+    const unsigned int width = 64, height = 32;
+    size_t size = width * height;
+    uint8_t *data = g_malloc(size);
+
+    for (int i = 0; i < 16; i++) {
+        for (size_t j = 0; j < size; j++) {
+            data[j] = g_test_rand_int();
+        }
+        check_2d(format, data, width, height);
+    }
+
+    g_free(data);
+}
+
+static void test_random_3d(const void *opaque)
+{
+    GLint format = GPOINTER_TO_INT(opaque);
+    unsigned int block_size = format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT ?
+                              8 : 16;
+    static const unsigned int depths[] = { 1, 2, 4, 8 };
+    const unsigned int width = 16, height = 8;
+
+    for (int d = 0; d < ARRAY_SIZE(depths); d++) {
+        unsigned int depth = depths[d];
+        unsigned int block_depth = MIN(depth, 4);
+        size_t size = width * height * depth;
+        uint8_t *data = g_malloc(size);
+        for (size_t j = 0; j < size; j++) {
+            data[j] = g_test_rand_int();
+        }
+
+        uint32_t *out = (uint32_t *)decompress_3d_texture_data(
+            format, data, width, height, depth);
+
+        /* Slices of each block are stored next to each other */
+        for (unsigned int z = 0; z < depth; z++) {
+            for (unsigned int y = 0; y < height; y++) {
+                for (unsigned int x = 0; x < width; x++) {
+                    unsigned int block_index =
+                        ((z / block_depth) * (height / 4) + y / 4) *
+                            (width / 4) + x / 4;
+                    const uint8_t *block =
+                        data + (block_index * block_depth + z % block_depth) *
+                                   block_size;
+                    g_assert_cmphex(
+                        out[(z * height + y) * width + x], ==,
+                        ref_decode_texel(format, block, x % 4, y % 4));
+                }
+            }
+        }
+
+        g_free(out);
+        g_free(data);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static const struct {
+        const char *name;
+        GLint format;
+    } formats[] = {
+        { "dxt1", GL_COMPRESSED_RGBA_S3TC_DXT1_EXT },
+        { "dxt3", GL_COMPRESSED_RGBA_S3TC_DXT3_EXT },
+        { "dxt5", GL_COMPRESSED_RGBA_S3TC_DXT5_EXT },
+    };
+    char name[64];
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (int i = 0; i < ARRAY_SIZE(corpus); i++) {
+        snprintf(name, sizeof(name), "/nv2a/s3tc/corpus/%s", corpus[i].name);
+        g_test_add_data_func(name, &corpus[i], test_corpus);
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(formats); i++) {
+        snprintf(name, sizeof(name), "/nv2a/s3tc/random-2d/%s",
+                 formats[i].name);
+        g_test_add_data_func(name, GINT_TO_POINTER(formats[i].format),
+                             test_random_2d);
+        snprintf(name, sizeof(name), "/nv2a/s3tc/random-3d/%s",
+                 formats[i].name);
+        g_test_add_data_func(name, GINT_TO_POINTER(formats[i].format),
+                             test_random_3d);
+    }
+
+    return g_test_run();
+}
@@ -0,0 +1,161 @@
+/*
+ * Test nv2a texture swizzling routines
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "hw/xbox/nv2a/swizzle.h"
+
+/* Reference implementation: scatter the bits of every coordinate into its
+ * mask one texel at a time. This is what the optimized routines replaced.
+ */
+static void ref_generate_swizzle_masks(unsigned int width,
+                                       unsigned int height,
+                                       unsigned int depth,
+                                       uint32_t *mask_x,
+                                       uint32_t *mask_y,
+                                       uint32_t *mask_z)
+{
+    uint32_t x = 0, y = 0, z = 0;
+    uint32_t bit = 1;
+    uint32_t mask_bit = 1;
+    bool done;
+    do {
+        done = true;
+        if (bit < width) { x |= mask_bit; mask_bit <<= 1; done = false; }
+        if (bit < height) { y |= mask_bit; mask_bit <<= 1; done = false; }
+        if (bit < depth) { z |= mask_bit; mask_bit <<= 1; done = false; }
+        bit <<= 1;
+    } while (!done);
+    *mask_x = x;
+    *mask_y = y;
+    *mask_z = z;
+}
+
+static uint32_t ref_fill_pattern(uint32_t pattern, uint32_t value)
+{
+    uint32_t result = 0;
+    uint32_t bit = 1;
+    while (value) {
+        if (pattern & bit) {
+            result |= value & 1 ? bit : 0;
+            value >>= 1;
+        }
+        bit <<= 1;
+    }
+    return result;
+}
+
+static void ref_swizzle(const uint8_t *linear, uint8_t *swizzled,
+                        unsigned int width, unsigned int height,
+                        unsigned int depth, unsigned int row_pitch,
+                        unsigned int slice_pitch, unsigned int bpp,
+                        bool unswizzle)
+{
+    uint32_t mask_x, mask_y, mask_z;
+    ref_generate_swizzle_masks(width, height, depth,
+                               &mask_x, &mask_y, &mask_z);
+
+    for (unsigned int z = 0; z < depth; z++) {
+        for (unsigned int y = 0; y < height; y++) {
+            for (unsigned int x = 0; x < width; x++) {
+                size_t lin = z * slice_pitch + y * row_pitch + x * bpp;
+                size_t sw = bpp * (ref_fill_pattern(mask_x, x) |
+                                   ref_fill_pattern(mask_y, y) |
+                                   ref_fill_pattern(mask_z, z));
+                if (unswizzle) {
+                    memcpy((uint8_t *)linear + lin, swizzled + sw, bpp);
+                } else {
+                    memcpy(swizzled + sw, linear + lin, bpp);
+                }
+            }
+        }
+    }
+}
+
+static void check_box(unsigned int width, unsigned int height,
+                      unsigned int depth, unsigned int bpp,
+                      unsigned int row_padding)
+{
+    unsigned int row_pitch = width * bpp + row_padding;
+    unsigned int slice_pitch = row_pitch * height;
+    size_t swizzled_size = (size_t)width * height * depth * bpp;
+    size_t linear_size = (size_t)slice_pitch * depth;
+
+    uint8_t *swizzled = g_malloc(swizzled_size);
+    uint8_t *expected_linear = g_malloc0(linear_size);
+    uint8_t *actual_linear = g_malloc0(linear_size);
+    uint8_t *expected_swizzled = g_malloc0(swizzled_size);
+    uint8_t *actual_swizzled = g_malloc0(swizzled_size);
+
+    for (size_t i = 0; i < swizzled_size; i++) {
+        swizzled[i] = g_test_rand_int();
+    }
+
+    ref_swizzle(expected_linear, swizzled, width, height, depth,
+                row_pitch, slice_pitch, bpp, true);
+    unswizzle_box(swizzled, width, height, depth, actual_linear,
+                  row_pitch, slice_pitch, bpp);
+    g_assert_cmpmem(expected_linear, linear_size, actual_linear, linear_size);
+
+    ref_swizzle(expected_linear, expected_swizzled, width, height, depth,
+                row_pitch, slice_pitch, bpp, false);
+    swizzle_box(expected_linear, width, height, depth, actual_swizzled,
+                row_pitch, slice_pitch, bpp);
+    g_assert_cmpmem(expected_swizzled, swizzled_size,
+                    actual_swizzled, swizzled_size);
+    g_assert_cmpmem(swizzled, swizzled_size, actual_swizzled, swizzled_size);
+
+    g_free(swizzled);
+    g_free(expected_linear);
+    g_free(actual_linear);
+    g_free(expected_swizzled);
+    g_free(actual_swizzled);
+}
+
+static void test_swizzle_rect(const void *opaque)
+{
+    unsigned int bpp = GPOINTER_TO_UINT(opaque);
+
+    for (unsigned int lw = 0; lw <= 9; lw++) {
+        for (unsigned int lh = 0; lh <= 9; lh++) {
+            check_box(1 << lw, 1 << lh, 1, bpp, 0);
+            check_box(1 << lw, 1 << lh, 1, bpp, 12);
+        }
+    }
+}
+
+static void test_swizzle_box(const void *opaque)
+{
+    unsigned int bpp = GPOINTER_TO_UINT(opaque);
+
+    for (unsigned int lw = 0; lw <= 6; lw++) {
+        for (unsigned int lh = 0; lh <= 6; lh++) {
+            for (unsigned int ld = 0; ld <= 5; ld++) {
+                check_box(1 << lw, 1 << lh, 1 << ld, bpp, 0);
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static const unsigned int bpps[] = { 1, 2, 4 };
+    char name[64];
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (int i = 0; i < ARRAY_SIZE(bpps); i++) {
+        snprintf(name, sizeof(name), "/nv2a/swizzle/rect/bpp-%u", bpps[i]);
+        g_test_add_data_func(name, GUINT_TO_POINTER(bpps[i]),
+                             test_swizzle_rect);
+        snprintf(name, sizeof(name), "/nv2a/swizzle/box/bpp-%u", bpps[i]);
+        g_test_add_data_func(name, GUINT_TO_POINTER(bpps[i]),
+                             test_swizzle_box);
+    }
+
+    return g_test_run();
+}
@@ -78,6 +78,33 @@ void ActionScreenshot(void)
 	g_screenshot_pending = true;
 }
 
+void ActionCapturePushBuffer(void)
+{
+    const unsigned int num_frames = 60;
+    char fname[128];
+
+    time_t t = time(NULL);
+    struct tm *tmp = localtime(&t);
+    if (tmp) {
+        strftime(fname, sizeof(fname), "xemu-%Y-%m-%d-%H-%M-%S.nv2a", tmp);
+    } else {
+        strcpy(fname, "xemu.nv2a");
+    }
+
+    const char *output_dir = g_config.general.screenshot_dir;
+    if (!strlen(output_dir)) {
+        output_dir = ".";
+    }
+    char *path = g_strdup_printf("%s/%s", output_dir, fname);
+    if (nv2a_capture_start(path, num_frames)) {
+        char *msg = g_strdup_printf("Capturing %u frames to %s", num_frames,
+                                    fname);
+        xemu_queue_notification(msg);
+        g_free(msg);
+    }
+    g_free(path);
+}
+
 void ActionActivateBoundSnapshot(int slot, bool save)
 {
     assert(slot < 4 && slot >= 0);
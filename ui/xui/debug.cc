@@ -16,6 +16,8 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
+#include <algorithm>
+#include <vector>
 #include "debug.hh"
 #include "common.hh"
 #include "misc.hh"
@@ -226,6 +228,89 @@ struct ScrollingBuffer {
     }
 };
 
+// Icicle graph of the last timed frame, scopes below the scope they ran in
+static void DrawTimingFlame()
+{
+    const NV2AProfileFrame *f = &g_nv2a_profile.frames[g_nv2a_profile.last];
+    if (f->frame_ns <= 0) {
+        ImGui::TextDisabled("No frame timed yet");
+        return;
+    }
+
+    ImGui::Text("Frame: %.2f ms", f->frame_ns / 1e6);
+
+    ImDrawList *draw_list = ImGui::GetWindowDrawList();
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    float width = ImGui::GetContentRegionAvail().x;
+    float row_height = ImGui::GetTextLineHeightWithSpacing();
+    float text_pad = ImGui::GetStyle().FramePadding.x;
+
+    // Nodes always come after their parent, so one pass lays them out
+    float x[NV2A_PROF_MAX_NODES], next_x[NV2A_PROF_MAX_NODES + 1];
+    int depth[NV2A_PROF_MAX_NODES];
+    int max_depth = 0;
+    next_x[0] = 0;
+    for (unsigned int i = 0; i < f->num_nodes; i++) {
+        const NV2AProfileNode *n = &f->nodes[i];
+        float w = width * n->time_ns / f->frame_ns;
+        x[i] = next_x[n->parent + 1];
+        next_x[n->parent + 1] += w;
+        next_x[i + 1] = x[i];
+        depth[i] = n->parent < 0 ? 0 : depth[n->parent] + 1;
+        max_depth = std::max(max_depth, depth[i]);
+
+        ImVec2 a(origin.x + x[i], origin.y + depth[i] * row_height);
+        ImVec2 b(a.x + w, a.y + row_height - 1);
+        if (b.x - a.x < 1) {
+            continue;
+        }
+        ImVec4 color = ImPlot::GetColormapColor(n->scope);
+        draw_list->AddRectFilled(a, b, ImGui::GetColorU32(color));
+
+        const char *name = nv2a_profile_get_scope_name(n->scope);
+        draw_list->PushClipRect(a, b, true);
+        draw_list->AddText(ImVec2(a.x + text_pad, a.y),
+                           IM_COL32_WHITE, name);
+        draw_list->PopClipRect();
+
+        if (ImGui::IsMouseHoveringRect(a, b)) {
+            ImGui::SetTooltip("%s\n%u calls, %.1f us (%.1f%% of frame)",
+                              name, n->calls, n->time_ns / 1e3,
+                              100.0 * n->time_ns / f->frame_ns);
+        }
+    }
+    ImGui::Dummy(ImVec2(width, (max_depth + 1) * row_height));
+
+    std::vector<int> methods;
+    for (int i = 0; i < NV2A_PROF_NUM_METHODS; i++) {
+        if (f->methods[i].calls) {
+            methods.push_back(i);
+        }
+    }
+    std::sort(methods.begin(), methods.end(), [f](int a, int b) {
+        return f->methods[a].time_ns > f->methods[b].time_ns;
+    });
+    methods.resize(std::min<size_t>(methods.size(), 10));
+
+    ImGuiTableFlags flags = ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders;
+    if (ImGui::BeginTable("nv2a_methods_tbl", 3, flags)) {
+        ImGui::TableSetupColumn("Method");
+        ImGui::TableSetupColumn("Calls");
+        ImGui::TableSetupColumn("Time (us)");
+        ImGui::TableHeadersRow();
+        for (int i : methods) {
+            ImGui::TableNextRow();
+            ImGui::TableSetColumnIndex(0);
+            ImGui::TextUnformatted(nv2a_profile_get_method_name(i));
+            ImGui::TableSetColumnIndex(1);
+            ImGui::Text("%u", f->methods[i].calls);
+            ImGui::TableSetColumnIndex(2);
+            ImGui::Text("%.1f", f->methods[i].time_ns / 1e3);
+        }
+        ImGui::EndTable();
+    }
+}
+
 DebugVideoWindow::DebugVideoWindow()
 {
     m_is_open = false;
@@ -306,6 +391,14 @@ void DebugVideoWindow::Draw()
         }
         ImPlot::PopStyleColor();
 
+        if (ImGui::TreeNode("Timing")) {
+            ImGui::Checkbox("Time PGRAPH scopes", &g_nv2a_profile.enabled);
+            if (g_nv2a_profile.enabled) {
+                DrawTimingFlame();
+            }
+            ImGui::TreePop();
+        }
+
         ImGui::SetNextItemOpen(g_config.display.debug.video.advanced_tree_state,
                                ImGuiCond_Once);
         g_config.display.debug.video.advanced_tree_state =
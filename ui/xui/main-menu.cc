@@ -65,6 +65,18 @@ void MainMenuGeneralView::Draw()
 
     Toggle("Cache shaders to disk", &g_config.perf.cache_shaders,
            "Reduce stutter in games by caching previously generated shaders");
+    Toggle("Upload compressed textures", &g_config.perf.compressed_textures,
+           "Let the GPU decode DXT textures instead of decoding them on the CPU");
+    ChevronCombo("Shader compilation", &g_config.perf.shader_compilation,
+                 "Synchronous (Default)\0"
+                 "Background, wait briefly\0"
+                 "Background, skip draws\0"
+                 "Background, draw with fallback\0",
+                 "Compile new shaders in the background to reduce stutter, at "
+                 "the cost of some draws being missing or wrong until ready");
+    Toggle("Merge draws", &g_config.perf.draw_merging,
+           "Submit consecutive draws without state changes between them "
+           "together");
 
     SectionTitle("Miscellaneous");
     Toggle("Skip startup animation", &g_config.general.skip_boot_anim,
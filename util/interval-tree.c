@@ -0,0 +1,186 @@
+/*
+ * Interval tree over closed [start, last] ranges
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/interval-tree.h"
+
+/* Nodes sharing a start are told apart by address, so every key is unique */
+static inline bool node_less(const IntervalTreeNode *a,
+                             const IntervalTreeNode *b)
+{
+    return a->start < b->start ||
+           (a->start == b->start && (uintptr_t)a < (uintptr_t)b);
+}
+
+static inline int node_height(const IntervalTreeNode *n)
+{
+    return n ? n->height : 0;
+}
+
+static void node_update(IntervalTreeNode *n)
+{
+    n->height = 1 + MAX(node_height(n->left), node_height(n->right));
+    n->subtree_last = n->last;
+    if (n->left) {
+        n->subtree_last = MAX(n->subtree_last, n->left->subtree_last);
+    }
+    if (n->right) {
+        n->subtree_last = MAX(n->subtree_last, n->right->subtree_last);
+    }
+}
+
+static IntervalTreeNode *rotate_right(IntervalTreeNode *n)
+{
+    IntervalTreeNode *l = n->left;
+
+    n->left = l->right;
+    l->right = n;
+    node_update(n);
+    node_update(l);
+    return l;
+}
+
+static IntervalTreeNode *rotate_left(IntervalTreeNode *n)
+{
+    IntervalTreeNode *r = n->right;
+
+    n->right = r->left;
+    r->left = n;
+    node_update(n);
+    node_update(r);
+    return r;
+}
+
+static IntervalTreeNode *rebalance(IntervalTreeNode *n)
+{
+    int balance = node_height(n->left) - node_height(n->right);
+
+    if (balance > 1) {
+        if (node_height(n->left->left) < node_height(n->left->right)) {
+            n->left = rotate_left(n->left);
+        }
+        return rotate_right(n);
+    }
+    if (balance < -1) {
+        if (node_height(n->right->right) < node_height(n->right->left)) {
+            n->right = rotate_right(n->right);
+        }
+        return rotate_left(n);
+    }
+
+    node_update(n);
+    return n;
+}
+
+static IntervalTreeNode *subtree_insert(IntervalTreeNode *n,
+                                        IntervalTreeNode *node)
+{
+    if (!n) {
+        return node;
+    }
+    if (node_less(node, n)) {
+        n->left = subtree_insert(n->left, node);
+    } else {
+        n->right = subtree_insert(n->right, node);
+    }
+    return rebalance(n);
+}
+
+static IntervalTreeNode *subtree_remove_min(IntervalTreeNode *n,
+                                            IntervalTreeNode **min)
+{
+    if (!n->left) {
+        *min = n;
+        return n->right;
+    }
+    n->left = subtree_remove_min(n->left, min);
+    return rebalance(n);
+}
+
+static IntervalTreeNode *subtree_remove(IntervalTreeNode *n,
+                                        IntervalTreeNode *node)
+{
+    assert(n);
+
+    if (n == node) {
+        IntervalTreeNode *min;
+
+        if (!n->right) {
+            return n->left;
+        }
+        IntervalTreeNode *right = subtree_remove_min(n->right, &min);
+        min->left = n->left;
+        min->right = right;
+        return rebalance(min);
+    }
+
+    if (node_less(node, n)) {
+        n->left = subtree_remove(n->left, node);
+    } else {
+        n->right = subtree_remove(n->right, node);
+    }
+    return rebalance(n);
+}
+
+void interval_tree_insert(IntervalTreeNode *node, IntervalTreeRoot *root)
+{
+    assert(node->start <= node->last);
+
+    node->left = node->right = NULL;
+    node_update(node);
+    root->node = subtree_insert(root->node, node);
+}
+
+void interval_tree_remove(IntervalTreeNode *node, IntervalTreeRoot *root)
+{
+    root->node = subtree_remove(root->node, node);
+}
+
+/*
+ * Returns the lowest node in the subtree at @n that overlaps [start, last],
+ * skipping every node up to and including @after when it is set.
+ */
+static IntervalTreeNode *subtree_first(IntervalTreeNode *n,
+                                       uint64_t start, uint64_t last,
+                                       const IntervalTreeNode *after)
+{
+    while (n && n->subtree_last >= start) {
+        if (after && !node_less(after, n)) {
+            /* n and everything left of it were already returned */
+            n = n->right;
+            continue;
+        }
+
+        IntervalTreeNode *found = subtree_first(n->left, start, last, after);
+        if (found) {
+            return found;
+        }
+        if (n->start > last) {
+            /* Neither can anything right of it overlap */
+            return NULL;
+        }
+        if (n->last >= start) {
+            return n;
+        }
+        n = n->right;
+    }
+
+    return NULL;
+}
+
+IntervalTreeNode *interval_tree_iter_first(IntervalTreeRoot *root,
+                                           uint64_t start, uint64_t last)
+{
+    return subtree_first(root->node, start, last, NULL);
+}
+
+IntervalTreeNode *interval_tree_iter_next(IntervalTreeRoot *root,
+                                          IntervalTreeNode *node,
+                                          uint64_t start, uint64_t last)
+{
+    return subtree_first(root->node, start, last, node);
+}